@@ -0,0 +1,14 @@
+# list traversal: builds a list of a million integers, walks it with
+# length (in C) a hundred times, and writes the bytes still live; compare
+# a default build against one with -DNL_TAGGED_CELLS
+(load 'src/core.nl)
+(defq range (N Acc)
+  (or (and (= N 0) Acc)
+      (range (- N 1) (pair N Acc))))
+(setq L (range 1000000 ()))
+(defq walk (K)
+  (or (= K 0)
+      (and (length L) (walk (- K 1)))))
+(walk 100)
+(write (gc))
+(newline)
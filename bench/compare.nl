@@ -0,0 +1,17 @@
+# structural comparison: compares two equal 5000 item lists and two
+# equal trees of 4095 pairs with = and <, two hundred times each
+(load 'src/core.nl)
+(defq range (N Acc)
+  (if (= N 0) Acc (range (- N 1) (pair N Acc))))
+(defq tree (D)
+  (if (= D 0) (list D 'leaf) (pair (tree (- D 1)) (tree (- D 1)))))
+(setq A (range 5000 ()))
+(setq B (range 5000 ()))
+(setq TA (tree 11))
+(setq TB (tree 11))
+(defq loop (K Acc)
+  (if (= K 0)
+      Acc
+      (loop (- K 1) (+ Acc (if (= A B) 1 0) (if (< A B) 1 0) (if (= TA TB) 1 0) (if (< TA TB) 1 0)))))
+(write (loop 200 0))
+(newline)
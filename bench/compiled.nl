@@ -0,0 +1,2 @@
+# bench/control.nl with its lambdas compiled to C by nlc (built by ./build.sh bench)
+(load 'bin/bench-control-native.nl)
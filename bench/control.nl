@@ -0,0 +1,21 @@
+# special forms: fib with if and with cond, where every call makes a
+# branch; a while loop summing to a million
+(load 'src/core.nl)
+(defq fib (N)
+  (if (< N 2) N (+ (fib (- N 1)) (fib (- N 2)))))
+(write (fib 25))
+(newline)
+(defq fib2 (N)
+  (cond ((< N 2) N)
+        (t2 (+ (fib2 (- N 1)) (fib2 (- N 2))))))
+(setq t2 1)
+(write (fib2 25))
+(newline)
+(defq total (N)
+  (setq Total 0)
+  (while (> N 0)
+    (setq Total (+ Total N))
+    (setq N (- N 1)))
+  Total)
+(write (total 1000000))
+(newline)
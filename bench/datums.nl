@@ -0,0 +1,11 @@
+# streaming reader: reads the 100000 records of bin/bench-reader.nl (see
+# reader.nl) one at a time with for-each-datum, three times, without
+# evaluating them; peak RSS should not depend on the size of the file
+(load 'src/core.nl)
+(setq Count 0)
+(defq count (D) (setq Count (+ Count 1)))
+(for-each-datum count 'bin/bench-reader.nl)
+(for-each-datum count 'bin/bench-reader.nl)
+(for-each-datum count 'bin/bench-reader.nl)
+(write Count)
+(newline)
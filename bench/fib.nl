@@ -0,0 +1,7 @@
+# recursive arithmetic: (fib 30) makes about 2.7 million calls
+(load 'src/core.nl)
+(defq fib (N)
+  (or (and (< N 2) N)
+      (+ (fib (- N 1)) (fib (- N 2)))))
+(write (fib 30))
+(newline)
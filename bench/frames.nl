@@ -0,0 +1,15 @@
+# call frames: a loop through lets and a fexpr, each of which binds
+# fresh names for the length of one call
+(load 'src/core.nl)
+(defq twice Args (+ (eval (head Args)) (eval (head Args))))
+(defq step (N)
+  (let ((A (+ N 1)) (B (twice N)))
+    (let ((C (- B A)))
+      (+ C 1))))
+(defq run (N Total)
+  (while (> N 0)
+    (setq Total (+ Total (step N)))
+    (setq N (- N 1)))
+  Total)
+(write (run 300000 0))
+(newline)
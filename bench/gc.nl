@@ -0,0 +1,15 @@
+# collector: keeps 20000 short lists alive, then churns through 5000
+# steps which build a 1000 item list every hundredth step, and writes
+# the pause times
+(load 'src/core.nl)
+(defq range (N Acc) (if (= N 0) Acc (range (- N 1) (pair N Acc))))
+(defq churn (K Keep)
+ (if (= K 0) Keep
+  (churn (- K 1) (if (= 0 (- K (* 100 (/ K 100)))) (range 1000 ()) Keep))))
+(setq Kept ())
+(defq grow (K) (or (= K 0) (and (setq Kept (pair (range 100 ()) Kept)) (grow (- K 1)))))
+(grow 20000)
+(write (fold + 0 (churn 5000 ())))
+(newline)
+(write (gc-stats))
+(newline)
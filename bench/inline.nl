@@ -0,0 +1,14 @@
+# definition-time optimizing: a loop through small helpers with
+# constant arguments, which inline and fold away
+(load 'src/core.nl)
+(defq square (X) (* X X))
+(defq limit () (* 1000 1000))
+(defq step (N) (+ N (- (square 3) 8)))
+(defq count-up ()
+  (setq N 0 Total 0)
+  (while (< N (limit))
+    (setq Total (+ Total (square 2)))
+    (setq N (step N)))
+  Total)
+(write (count-up))
+(newline)
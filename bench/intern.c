@@ -0,0 +1,40 @@
+#include "nl.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+static double nl_bench_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+/**
+ * Intern n distinct symbols, then look each of them up again,
+ * reporting throughput for both passes
+ */
+static void nl_bench_intern(char prefix, size_t n) {
+  char *names = malloc(n * 16), *interned;
+  size_t *lengths = malloc(n * sizeof(*lengths)), i;
+  double start, insert, lookup;
+  for (i = 0; i < n; ++i)
+    lengths[i] = sprintf(names + i * 16, "%c%zu", prefix, i);
+  start = nl_bench_now();
+  for (i = 0; i < n; ++i)
+    nl_intern_bytes(names + i * 16, lengths[i]);
+  insert = nl_bench_now() - start;
+  start = nl_bench_now();
+  for (i = 0; i < n; ++i) {
+    interned = nl_intern_bytes(names + i * 16, lengths[i]);
+    if (interned[0] != prefix) abort();
+  }
+  lookup = nl_bench_now() - start;
+  printf("intern %8zu distinct: insert %7.2f Msym/s, lookup %7.2f Msym/s\n",
+         n, n / insert / 1e6, n / lookup / 1e6);
+  free(names);
+  free(lengths);
+}
+int main() {
+  nl_bench_intern('a', 10000);
+  nl_bench_intern('b', 100000);
+  nl_bench_intern('c', 1000000);
+  return 0;
+}
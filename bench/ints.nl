@@ -0,0 +1,18 @@
+# packed integer arrays: sums, dots and scans a million items with the
+# vector kernels, next to the same sum folded over a list
+(load 'src/core.nl)
+(defq range (N Acc)
+  (or (and (= N 0) Acc)
+      (range (- N 1) (pair N Acc))))
+(setq L (range 1000000 ()))
+(setq A (list->ints L))
+(setq B (ints< A 500000))
+(write (fold + 0 L))
+(newline)
+(defq repeat (N Acc)
+  (or (and (= N 0) Acc)
+      (repeat (- N 1) (+ (ints-sum A) (ints-dot A B) (ints-max A) (ints-min A) Acc))))
+(write (repeat 500 0))
+(newline)
+(write (ints-max (ints-prefix-sum (ints-mul (ints-add A 1) B))))
+(newline)
@@ -0,0 +1,13 @@
+# list functions: maps, filters and folds over a 200000 item list ten
+# times, allocating a new list at each step
+(load 'src/core.nl)
+(defq range (N Acc)
+  (if (= N 0) Acc (range (- N 1) (pair N Acc))))
+(setq L (range 200000 ()))
+(defq even? (X) (= 0 (- X (* 2 (/ X 2)))))
+(defq pass (K Acc)
+  (if (= K 0)
+      Acc
+      (pass (- K 1) (+ Acc (fold + 0 (filter even? (map '((X) (* X 3)) L)))))))
+(write (pass 10 0))
+(newline)
@@ -0,0 +1,15 @@
+# parallel map: computes the 22nd fibonacci number once for each of 64
+# items, first with map and then with pmap, which splits the items
+# between a worker process per core
+(load 'src/core.nl)
+(defq range (N Acc)
+  (or (and (= N 0) Acc)
+      (range (- N 1) (pair N Acc))))
+(defq fib (N)
+  (if (< N 2) N (+ (fib (- N 1)) (fib (- N 2)))))
+(setq L (range 64 ()))
+(defq work (X) (+ X (fib 22)))
+(write (fold + 0 (map work L)))
+(newline)
+(write (fold + 0 (pmap work L)))
+(newline)
@@ -0,0 +1,15 @@
+# printer throughput: writes a binary tree of 16383 pairs, holding
+# symbols, integers and vectors, fifty times with write and fifty
+# times with print
+(load 'src/core.nl)
+(defq tree (D)
+  (if (= D 0)
+      (list 'leaf D (list->vector (list D 'x)))
+      (pair (tree (- D 1)) (tree (- D 1)))))
+(setq T (tree 12))
+(defq loop (K F)
+  (F T)
+  (newline)
+  (if (= K 1) () (loop (- K 1) F)))
+(loop 50 write)
+(loop 50 print)
@@ -0,0 +1,9 @@
+# reader throughput: loads bin/bench-reader.nl three times; build.sh
+# bench writes it first, with 100000 quoted lists of symbols, integers
+# and vectors (about 12MB), so nearly all the time goes to reading
+(load 'src/core.nl)
+(load 'bin/bench-reader.nl)
+(load 'bin/bench-reader.nl)
+(load 'bin/bench-reader.nl)
+(write Last)
+(newline)
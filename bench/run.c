@@ -0,0 +1,150 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#define NL_BENCH_MAX_REPS 1000
+#define NL_BENCH_NAME_MAX 64
+/**
+ * What one benchmark came to over all of its repetitions. Times are
+ * in milliseconds; rss is the largest peak resident size of any run
+ */
+struct nl_bench_result {
+  char name[NL_BENCH_NAME_MAX];
+  double median, p95, cpu;
+  long rss;
+};
+static double nl_bench_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+static int nl_bench_compare(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+/**
+ * Run the interpreter once with the script as its standard input,
+ * discarding its output. The REPL exits with 0 at the end of its input,
+ * so any other status (an error) or a signal fails
+ */
+static int nl_bench_once(const char *nl, const char *script, double *wall, double *cpu, long *rss) {
+  struct rusage usage;
+  double start = nl_bench_now();
+  int status, in, out;
+  pid_t pid;
+  if ((pid = fork()) < 0) return 1;
+  if (!pid) {
+    in = open(script, O_RDONLY);
+    out = open("/dev/null", O_WRONLY);
+    if (in < 0 || out < 0) _exit(127);
+    dup2(in, STDIN_FILENO);
+    dup2(out, STDOUT_FILENO);
+    dup2(out, STDERR_FILENO);
+    execl(nl, nl, (char *)NULL);
+    _exit(127);
+  }
+  if (wait4(pid, &status, 0, &usage) < 0) return 1;
+  *wall = nl_bench_now() - start;
+  *cpu = usage.ru_utime.tv_sec * 1e3 + usage.ru_utime.tv_usec / 1e3
+    + usage.ru_stime.tv_sec * 1e3 + usage.ru_stime.tv_usec / 1e3;
+  *rss = usage.ru_maxrss;
+  return !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+}
+/**
+ * Run one script reps times. The p95 is the nearest-rank percentile, so
+ * with fewer than twenty repetitions it is the slowest run
+ */
+static int nl_bench_run(const char *nl, const char *script, int reps, struct nl_bench_result *r) {
+  double wall[NL_BENCH_MAX_REPS], cpu[NL_BENCH_MAX_REPS];
+  const char *base = strrchr(script, '/');
+  long rss;
+  int i;
+  base = base ? base + 1 : script;
+  snprintf(r->name, sizeof(r->name), "%.*s", (int)strcspn(base, "."), base);
+  r->rss = 0;
+  for (i = 0; i < reps; ++i) {
+    if (nl_bench_once(nl, script, &wall[i], &cpu[i], &rss)) return 1;
+    if (rss > r->rss) r->rss = rss;
+  }
+  qsort(wall, reps, sizeof(*wall), nl_bench_compare);
+  qsort(cpu, reps, sizeof(*cpu), nl_bench_compare);
+  r->median = reps % 2 ? wall[reps / 2] : (wall[reps / 2 - 1] + wall[reps / 2]) / 2;
+  r->cpu = reps % 2 ? cpu[reps / 2] : (cpu[reps / 2 - 1] + cpu[reps / 2]) / 2;
+  r->p95 = wall[(reps * 95 + 99) / 100 - 1];
+  return 0;
+}
+/**
+ * Find the latest median recorded for the benchmark under a label other
+ * than this run's, to compare against. Lines are tab-separated: label,
+ * benchmark, repetitions, median, p95 and cpu time, and peak rss
+ */
+static int nl_bench_baseline(FILE *in, const char *label, const char *name, double *median) {
+  char line[512], l[256], n[NL_BENCH_NAME_MAX];
+  double m;
+  int found = 0;
+  rewind(in);
+  while (fgets(line, sizeof(line), in)) {
+    if (sscanf(line, "%255[^\t]\t%63[^\t]\t%*d\t%lf", l, n, &m) != 3) continue;
+    if (strcmp(l, label) && !strcmp(n, name)) {
+      *median = m;
+      found = 1;
+    }
+  }
+  return found;
+}
+static void nl_bench_usage() {
+  fputs("usage: bench-run [-n REPS] [-l LABEL] [-o RESULTS] NL SCRIPT...\n", stderr);
+  exit(2);
+}
+int main(int argc, char **argv) {
+  struct nl_bench_result r;
+  const char *label = "current", *results = NULL;
+  FILE *out = NULL;
+  double before;
+  int reps = 5, failed = 0, opt, i;
+  while ((opt = getopt(argc, argv, "n:l:o:")) != -1) {
+    switch (opt) {
+    case 'n':
+      reps = atoi(optarg);
+      if (reps < 1 || reps > NL_BENCH_MAX_REPS) nl_bench_usage();
+      break;
+    case 'l':
+      label = optarg;
+      break;
+    case 'o':
+      results = optarg;
+      break;
+    default:
+      nl_bench_usage();
+    }
+  }
+  if (argc - optind < 2) nl_bench_usage();
+  if (results && !(out = fopen(results, "a+"))) {
+    perror(results);
+    return 2;
+  }
+  printf("%-12s %10s %10s %10s %10s %8s\n", "bench", "median ms", "p95 ms", "cpu ms", "rss KB", "change");
+  for (i = optind + 1; i < argc; ++i) {
+    if (nl_bench_run(argv[optind], argv[i], reps, &r)) {
+      printf("%-12s failed\n", r.name);
+      failed = 1;
+      continue;
+    }
+    printf("%-12s %10.1f %10.1f %10.1f %10ld", r.name, r.median, r.p95, r.cpu, r.rss);
+    if (out && nl_bench_baseline(out, label, r.name, &before) && before > 0)
+      printf(" %+7.1f%%", (r.median - before) / before * 100);
+    putchar('\n');
+    fflush(stdout);
+    if (out) {
+      fseek(out, 0, SEEK_END);
+      fprintf(out, "%s\t%s\t%d\t%.1f\t%.1f\t%.1f\t%ld\n", label, r.name, reps, r.median, r.p95, r.cpu, r.rss);
+      fflush(out);
+    }
+  }
+  if (out) fclose(out);
+  return failed;
+}
@@ -0,0 +1,14 @@
+# deep dynamic scopes: recurses 2000 calls deep, each binding four
+# parameters, then reads variables bound all the way up the chain a
+# thousand times at the bottom before unwinding; repeated 50 times
+(load 'src/core.nl)
+(defq probe (K Acc)
+  (if (= K 0) Acc (probe (- K 1) (+ Acc A B C D))))
+(defq nest (D A B C)
+  (if (= D 0)
+      (probe 1000 0)
+      (+ 1 (nest (- D 1) (+ A 1) B C))))
+(defq run (K Acc)
+  (if (= K 0) Acc (run (- K 1) (+ Acc (nest 2000 0 1 2)))))
+(write (run 50 0))
+(newline)
@@ -0,0 +1,14 @@
+# lazy sequences: the same filter, map and fold over a million items
+# three times, fused into one pass over the list with seq-filter and
+# seq-map, so no intermediate lists are built
+(load 'src/core.nl)
+(defq range (N Acc)
+  (or (and (= N 0) Acc)
+      (range (- N 1) (pair N Acc))))
+(setq L (range 1000000 ()))
+(defq sq (X) (* X X))
+(defq odd (X) (= (- X (* (/ X 2) 2)) 1))
+(write (fold + 0 (seq-map sq (seq-filter odd L))))
+(write (fold + 0 (seq-map sq (seq-filter odd L))))
+(write (fold + 0 (seq-map sq (seq-filter odd L))))
+(newline)
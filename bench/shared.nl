@@ -0,0 +1,13 @@
+# hash-consed reading: keeps all 100000 records of bin/bench-shared.nl
+# live, read with read-shared; every record repeats the same tag lists
+# and key pairs, which are then held once
+(load 'src/core.nl)
+(defq read-all (Port)
+  (setq All nil)
+  (while (setq Record (read-shared Port))
+    (setq All (pair Record All)))
+  All)
+(setq Port (open-input 'bin/bench-shared.nl))
+(write (length (read-all Port)))
+(newline)
+(close-input Port)
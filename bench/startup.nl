@@ -0,0 +1,2 @@
+# startup: loads the core functions and does nothing else
+(load 'src/core.nl)
@@ -0,0 +1,23 @@
+# keyed lookup: builds a 20000 entry association list and a table with
+# the same keys, then looks up 2000 keys in each; the association list
+# is scanned with = on every lookup, the table hashes the key once
+(load 'src/core.nl)
+(defq entries (N Acc)
+  (or (and (= N 0) Acc)
+      (entries (- N 1) (pair (pair (list 'route N) N) Acc))))
+(setq A (entries 20000 ()))
+(setq T (make-table A))
+(defq assoc (Key List)
+  (and List
+       (or (and (= Key (head (head List))) (tail (head List)))
+           (assoc Key (tail List)))))
+(defq sum-alist (I Acc)
+  (or (and (= I 20000) Acc)
+      (sum-alist (+ I 10) (+ Acc (assoc (list 'route I) A)))))
+(defq sum-table (I Acc)
+  (or (and (= I 20000) Acc)
+      (sum-table (+ I 10) (+ Acc (table-get T (list 'route I))))))
+(write (sum-alist 10 0))
+(newline)
+(write (sum-table 10 0))
+(newline)
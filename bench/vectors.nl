@@ -0,0 +1,22 @@
+# indexed access: sums a 2000 item table by index, once through a list
+# walked with nth and once through a vector with vector-ref; the list
+# version is quadratic, the vector version linear
+(load 'src/core.nl)
+(defq range (N Acc)
+  (or (and (= N 0) Acc)
+      (range (- N 1) (pair N Acc))))
+(setq L (range 2000 ()))
+(setq V (list->vector L))
+(defq nth (I List)
+  (or (and (= I 0) (head List))
+      (nth (- I 1) (tail List))))
+(defq sum-list (I Acc)
+  (or (and (= I 2000) Acc)
+      (sum-list (+ I 1) (+ Acc (nth I L)))))
+(defq sum-vector (I Acc)
+  (or (and (= I 2000) Acc)
+      (sum-vector (+ I 1) (+ Acc (vector-ref V I)))))
+(write (sum-list 0 0))
+(newline)
+(write (sum-vector 0 0))
+(newline)
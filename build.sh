@@ -1,4 +1,41 @@
 #!/bin/sh
 set -e
 mkdir -p bin
-gcc -lgc -ldl -Wall src/nl.c src/main.c -o bin/nl
+SRC="src/nl.c src/core.c src/intern.c src/vm.c src/image.c src/gc.c src/table.c src/parallel.c src/profile.c src/ints.c src/port.c src/seq.c src/optimize.c src/share.c"
+case "$1" in
+  bench)
+    gcc -O2 -rdynamic -pthread -ldl -Wall -Isrc bench/intern.c $SRC -o bin/bench-intern
+    bin/bench-intern
+    gcc -O2 -Wall bench/run.c -o bin/bench-run
+    gcc -O2 -rdynamic -pthread -ldl -Wall $SRC src/main.c -o bin/nl-bench
+    gcc -O2 -rdynamic -pthread -ldl -Wall $SRC src/nlc.c -o bin/nlc
+    # bench/compiled.nl runs bench/control.nl compiled ahead of time
+    bin/nlc -o bin/bench-control-native bench/control.nl
+    [ -f bin/bench-reader.nl ] || awk 'BEGIN {
+      for (i = 0; i < 100000; ++i)
+        printf "(setq Last (quote (record-%d %d (alpha beta gamma %d) #(%d delta-%d (epsilon . %d)) (zeta (eta (theta %d))))))\n", i, i, i * 3, i % 1000, i % 100, i * 3, i % 7
+    }' > bin/bench-reader.nl
+    [ -f bin/bench-shared.nl ] || awk 'BEGIN {
+      for (i = 0; i < 100000; ++i)
+        printf "(record %d (tags alpha beta gamma) ((color . red) (size . %d)) (owner (name admin) (group staff)) (acl (read all) (write staff) (admin root)))\n", i % 100, i % 10
+    }' > bin/bench-shared.nl
+    # Results are appended to bin/bench-results.tsv, labelled with the commit
+    bin/bench-run -n "${2:-5}" -l "$(git rev-parse --short HEAD 2>/dev/null || echo unknown)" \
+      -o bin/bench-results.tsv bin/nl-bench bench/*.nl
+    ;;
+  test)
+    gcc -rdynamic -pthread -ldl -Wall $SRC src/main.c -o bin/nl
+    gcc -DNL_TAGGED_CELLS -rdynamic -pthread -ldl -Wall $SRC src/main.c -o bin/nl-tagged
+    gcc -rdynamic -pthread -ldl -Wall $SRC src/nlc.c -o bin/nlc
+    sh test/run.sh bin/nl bin/nl-tagged
+    ;;
+  nlc)
+    gcc -rdynamic -pthread -ldl -Wall $SRC src/nlc.c -o bin/nlc
+    ;;
+  tagged)
+    gcc -DNL_TAGGED_CELLS -rdynamic -pthread -ldl -Wall $SRC src/main.c -o bin/nl-tagged
+    ;;
+  *)
+    gcc -rdynamic -pthread -ldl -Wall $SRC src/main.c -o bin/nl
+    ;;
+esac
@@ -1,52 +1,77 @@
+#include "nl.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
 NL_BUILTIN(is_nil) {
-  if (nl_evalq(scope, cell.type == NL_PAIR ? NL_HEAD(cell) : cell, result)) return 1;
-  if (result->type == NL_NIL)
+  if (nl_evalq(scope, NL_IS_PAIR(cell) ? NL_HEAD(cell) : cell, result)) return 1;
+  if (NL_TYPE(*result) == NL_NIL)
     *result = t;
   else
     *result = nil;
   return 0;
 }
 NL_BUILTIN(is_integer) {
-  if (nl_evalq(scope, cell.type == NL_PAIR ? NL_HEAD(cell) : cell, result)) return 1;
-  if (result->type == NL_INTEGER)
+  if (nl_evalq(scope, NL_IS_PAIR(cell) ? NL_HEAD(cell) : cell, result)) return 1;
+  if (NL_TYPE(*result) == NL_INTEGER)
     *result = t;
   else
     *result = nil;
   return 0;
 }
 NL_BUILTIN(is_pair) {
-  if (nl_evalq(scope, cell.type == NL_PAIR ? NL_HEAD(cell) : cell, result)) return 1;
-  if (result->type == NL_PAIR)
+  if (nl_evalq(scope, NL_IS_PAIR(cell) ? NL_HEAD(cell) : cell, result)) return 1;
+  if (NL_IS_PAIR(*result))
     *result = t;
   else
     *result = nil;
   return 0;
 }
 NL_BUILTIN(is_symbol) {
-  if (nl_evalq(scope, cell.type == NL_PAIR ? NL_HEAD(cell) : cell, result)) return 1;
-  if (result->type == NL_SYMBOL)
+  if (nl_evalq(scope, NL_IS_PAIR(cell) ? NL_HEAD(cell) : cell, result)) return 1;
+  if (NL_TYPE(*result) == NL_SYMBOL)
     *result = t;
   else
     *result = nil;
   return 0;
 }
-int nl_cell_equal(struct nl_cell a, struct nl_cell b) {
-  if (a.type != b.type) return 0;
-  switch (a.type) {
-  case NL_NIL: return 1;
-  case NL_INTEGER: return a.value.as_integer == b.value.as_integer;
-  case NL_SYMBOL: return a.value.as_symbol == b.value.as_symbol;
-  case NL_PAIR: return nl_cell_equal(NL_HEAD(a), NL_HEAD(b))
-      && nl_cell_equal(NL_TAIL(a), NL_TAIL(b));
-  default: return 0;
-  }
+NL_BUILTIN(is_vector) {
+  if (nl_evalq(scope, NL_IS_PAIR(cell) ? NL_HEAD(cell) : cell, result)) return 1;
+  if (NL_TYPE(*result) == NL_VECTOR)
+    *result = t;
+  else
+    *result = nil;
+  return 0;
+}
+NL_BUILTIN(is_table) {
+  if (nl_evalq(scope, NL_IS_PAIR(cell) ? NL_HEAD(cell) : cell, result)) return 1;
+  if (NL_TYPE(*result) == NL_TABLE)
+    *result = t;
+  else
+    *result = nil;
+  return 0;
+}
+NL_BUILTIN(is_ints) {
+  if (nl_evalq(scope, NL_IS_PAIR(cell) ? NL_HEAD(cell) : cell, result)) return 1;
+  if (NL_TYPE(*result) == NL_INTS)
+    *result = t;
+  else
+    *result = nil;
+  return 0;
+}
+NL_BUILTIN(is_seq) {
+  if (nl_evalq(scope, NL_IS_PAIR(cell) ? NL_HEAD(cell) : cell, result)) return 1;
+  if (NL_TYPE(*result) == NL_SEQ)
+    *result = t;
+  else
+    *result = nil;
+  return 0;
 }
 NL_BUILTIN(apply) {
-  if (cell.type != NL_PAIR) {
+  if (!NL_IS_PAIR(cell)) {
     scope->last_err = "illegal apply call: non-pair args";
     return 1;
   }
-  if (NL_TAIL(cell).type != NL_PAIR) {
+  if (!NL_IS_PAIR(NL_TAIL(cell))) {
     scope->last_err = "illegal apply call: non-pair args tail";
     return 1;
   }
@@ -56,134 +81,168 @@ NL_BUILTIN(apply) {
 }
 NL_BUILTIN(eval) {
   struct nl_cell *tail, form;
-  if (cell.type != NL_PAIR) {
+  if (!NL_IS_PAIR(cell)) {
     scope->last_err = "illegal eval: non-pair args";
     return 1;
   }
   NL_FOREACH(&cell, tail) {
     if (nl_evalq(scope, NL_HEAD_AT(tail), &form)) return 1;
+    if (!NL_IS_PAIR(NL_TAIL_AT(tail))) {
+      *result = form;
+      return NL_TAILCALL;
+    }
     if (nl_evalq(scope, form, result)) return 1;
   }
   return 0;
 }
 NL_BUILTIN(foreach) {
-  struct nl_cell fun, list, *a, call;
-  if (cell.type != NL_PAIR || NL_TAIL(cell).type != NL_PAIR) {
+  struct nl_cell fun, list, *a, value;
+  struct nl_seq_iter it;
+  int err;
+  if (!NL_IS_PAIR(cell) || !NL_IS_PAIR(NL_TAIL(cell))) {
     scope->last_err = "illegal foreach: expected at least two args";
     return 1;
   }
   if (nl_evalq(scope, NL_HEAD(cell), &fun)) return 1;
   if (nl_evalq(scope, NL_HEAD(NL_TAIL(cell)), &list)) return 1;
-  if (list.type == NL_NIL) {
+  if (NL_TYPE(list) == NL_NIL) {
     *result = nil;
     return 0;
   }
-  if (list.type != NL_PAIR) {
+  if (NL_TYPE(list) == NL_SEQ) {
+    *result = nil;
+    if (nl_seq_begin(scope, &it, list)) return 1;
+    while (!(err = nl_seq_next(scope, &it, &value)))
+      if ((err = nl_invoke_values(scope, fun, 1, &value, result))) break;
+    nl_seq_end(&it);
+    return err == EOF ? 0 : err;
+  }
+  if (!NL_IS_PAIR(list)) {
     scope->last_err = "illegal foreach: expected a pair";
     return 1;
   }
   NL_FOREACH(&list, a) {
-    call = nl_cell_as_pair(nl_cell_as_pair(quote, fun), nl_cell_as_pair(nl_cell_as_pair(quote, NL_HEAD_AT(a)), nil));
-    if (nl_evalq(scope, call, result)) return 1;
+    if (nl_invoke_values(scope, fun, 1, &NL_HEAD_AT(a), result)) return 1;
   }
   return 0;
 }
 NL_BUILTIN(map) {
-  struct nl_cell fun, list, *item, call;
-  if (cell.type != NL_PAIR) {
+  struct nl_cell fun, list, *item, value;
+  int64_t i;
+  if (!NL_IS_PAIR(cell)) {
     scope->last_err = "illegal map: non-pair args";
     return 1;
   }
-  if (NL_TAIL(cell).type != NL_PAIR) {
+  if (!NL_IS_PAIR(NL_TAIL(cell))) {
     scope->last_err = "illegal map: expected at least two args in list";
     return 1;
   }
   if (nl_evalq(scope, NL_HEAD(cell), &fun)) return 1;
   if (nl_evalq(scope, NL_HEAD(NL_TAIL(cell)), &list)) return 1;
-  if (list.type == NL_NIL) {
+  if (NL_TYPE(list) == NL_NIL) {
     *result = list;
     return 0;
   }
-  if (list.type != NL_PAIR) {
+  if (NL_TYPE(list) == NL_VECTOR) {
+    // The new vector may be promoted while fun runs, so store through the barrier
+    *result = nl_cell_as_vector(NL_VECTOR_OF(list)->length);
+    for (i = 0; i < NL_VECTOR_OF(list)->length; ++i) {
+      if (nl_invoke_values(scope, fun, 1, &NL_VECTOR_OF(list)->items[i], &value)) return 1;
+      nl_gc_write(&NL_VECTOR_OF(*result)->items[i], value);
+    }
+    return 0;
+  }
+  if (!NL_IS_PAIR(list)) {
     scope->last_err = "illegal map: second argument should be a pair";
     return 1;
   }
   *result = nl_cell_as_pair(nil, nil);
   NL_FOREACH(&list, item) {
-    call = nl_cell_as_pair(nl_cell_as_pair(quote, fun), nl_cell_as_pair(nl_cell_as_pair(quote, NL_HEAD_AT(item)), nil));
-    if (nl_evalq(scope, call, result->value.as_pair)) return 1;
-    switch (NL_TAIL_AT(item).type) {
+    if (nl_invoke_values(scope, fun, 1, &NL_HEAD_AT(item), NL_PAIR_OF(*result))) return 1;
+    switch (NL_TYPE(NL_TAIL_AT(item))) {
     case NL_NIL:
       break;
     case NL_PAIR:
-      NL_TAIL_AT(result) = nl_cell_as_pair(nil, nil);
+      nl_gc_write(&NL_TAIL_AT(result), nl_cell_as_pair(nil, nil));
       result = NL_NEXT_AT(result);
       break;
     default:
-      call = nl_cell_as_pair(nl_cell_as_pair(quote, fun), nl_cell_as_pair(nl_cell_as_pair(quote, NL_TAIL_AT(item)), nil));
-      return nl_evalq(scope, call, NL_NEXT_AT(result));
+      return nl_invoke_values(scope, fun, 1, &NL_TAIL_AT(item), NL_NEXT_AT(result));
     }
   }
   return 0;
 }
 NL_BUILTIN(mappair) {
-  struct nl_cell fun, list, *item, call;
-  if (cell.type != NL_PAIR) {
+  struct nl_cell fun, list, *item;
+  if (!NL_IS_PAIR(cell)) {
     scope->last_err = "illegal map: non-pair args";
     return 1;
   }
-  if (NL_TAIL(cell).type != NL_PAIR) {
+  if (!NL_IS_PAIR(NL_TAIL(cell))) {
     scope->last_err = "illegal map: expected at least two args in list";
     return 1;
   }
   if (nl_evalq(scope, NL_HEAD(cell), &fun)) return 1;
   if (nl_evalq(scope, NL_HEAD(NL_TAIL(cell)), &list)) return 1;
-  if (list.type == NL_NIL) {
+  if (NL_TYPE(list) == NL_NIL) {
     *result = list;
     return 0;
   }
-  if (list.type != NL_PAIR) {
+  if (!NL_IS_PAIR(list)) {
     scope->last_err = "illegal map: second argument should be a pair";
     return 1;
   }
   *result = nl_cell_as_pair(nil, nil);
   NL_FOREACH(&list, item) {
-    call = nl_cell_as_pair(nl_cell_as_pair(quote, fun), nl_cell_as_pair(nl_cell_as_pair(quote, *item), nil));
-    if (nl_evalq(scope, call, result->value.as_pair)) return 1;
-    if (NL_TAIL_AT(item).type == NL_PAIR) {
-      NL_TAIL_AT(result) = nl_cell_as_pair(nil, nil);
+    if (nl_invoke_values(scope, fun, 1, item, NL_PAIR_OF(*result))) return 1;
+    if (NL_IS_PAIR(NL_TAIL_AT(item))) {
+      nl_gc_write(&NL_TAIL_AT(result), nl_cell_as_pair(nil, nil));
       result = NL_NEXT_AT(result);
     }
   }
   return 0;
 }
 NL_BUILTIN(filter) {
-  struct nl_cell fun, list, *item, call;
-  if (cell.type != NL_PAIR) {
+  struct nl_cell fun, list, *item;
+  int64_t i;
+  char *keep;
+  if (!NL_IS_PAIR(cell)) {
     scope->last_err = "illegal filter: non-pair args";
     return 1;
   }
-  if (NL_TAIL(cell).type != NL_PAIR) {
+  if (!NL_IS_PAIR(NL_TAIL(cell))) {
     scope->last_err = "illegal filter: expected at least two args in list";
     return 1;
   }
   if (nl_evalq(scope, NL_HEAD(cell), &fun)) return 1;
   if (nl_evalq(scope, NL_HEAD(NL_TAIL(cell)), &list)) return 1;
-  if (list.type == NL_NIL) {
+  if (NL_TYPE(list) == NL_NIL) {
     *result = list;
     return 0;
   }
-  if (list.type != NL_PAIR) {
+  if (NL_TYPE(list) == NL_VECTOR) {
+    keep = malloc(NL_VECTOR_OF(list)->length + 1);
+    for (i = 0; i < NL_VECTOR_OF(list)->length; ++i) {
+      if (nl_invoke_values(scope, fun, 1, &NL_VECTOR_OF(list)->items[i], result)) {
+        free(keep);
+        return 1;
+      }
+      keep[i] = NL_TYPE(*result) != NL_NIL;
+    }
+    *result = nl_vector_keep(NL_VECTOR_OF(list)->items, NL_VECTOR_OF(list)->length, keep);
+    free(keep);
+    return 0;
+  }
+  if (!NL_IS_PAIR(list)) {
     scope->last_err = "illegal filter: second argument should be a pair";
     return 1;
   }
   *result = nl_cell_as_pair(nil, nil);
   NL_FOREACH(&list, item) {
-    call = nl_cell_as_pair(nl_cell_as_pair(quote, fun), nl_cell_as_pair(nl_cell_as_pair(quote, NL_HEAD_AT(item)), nil));
-    if (nl_evalq(scope, call, result->value.as_pair)) return 1;
-    if (NL_HEAD_AT(result).type != NL_NIL) {
+    if (nl_invoke_values(scope, fun, 1, &NL_HEAD_AT(item), NL_PAIR_OF(*result))) return 1;
+    if (NL_TYPE(NL_HEAD_AT(result)) != NL_NIL) {
       NL_HEAD_AT(result) = NL_HEAD_AT(item);
-      NL_TAIL_AT(result) = nl_cell_as_pair(nil, nil);
+      nl_gc_write(&NL_TAIL_AT(result), nl_cell_as_pair(nil, nil));
       result = NL_NEXT_AT(result);
     }
   }
@@ -191,38 +250,59 @@ NL_BUILTIN(filter) {
   return 0;
 }
 NL_BUILTIN(fold) {
-  struct nl_cell fun, list, *item, call;
-  if (cell.type != NL_PAIR) {
+  struct nl_cell fun, list, *item, args[2];
+  struct nl_seq_iter it;
+  int64_t i;
+  int err;
+  if (!NL_IS_PAIR(cell)) {
     scope->last_err = "illegal fold: non-pair args";
     return 1;
   }
-  if (NL_TAIL(cell).type != NL_PAIR) {
+  if (!NL_IS_PAIR(NL_TAIL(cell))) {
     scope->last_err = "illegal fold: expected at least three args in list";
     return 1;
   }
-  if (NL_TAIL(NL_TAIL(cell)).type != NL_PAIR) {
+  if (!NL_IS_PAIR(NL_TAIL(NL_TAIL(cell)))) {
     scope->last_err = "illegal fold: expected at least three args in list";
     return 1;
   }
   if (nl_evalq(scope, NL_HEAD(cell), &fun)) return 1;
   if (nl_evalq(scope, NL_HEAD(NL_TAIL(cell)), result)) return 1;
   if (nl_evalq(scope, NL_HEAD(NL_TAIL(NL_TAIL(cell))), &list)) return 1;
-  if (list.type == NL_NIL) {
+  if (NL_TYPE(list) == NL_NIL) {
     return 0;
   }
-  if (list.type != NL_PAIR) {
+  if (NL_TYPE(list) == NL_VECTOR) {
+    for (i = 0; i < NL_VECTOR_OF(list)->length; ++i) {
+      args[0] = NL_VECTOR_OF(list)->items[i];
+      args[1] = *result;
+      if (nl_invoke_values(scope, fun, 2, args, result)) return 1;
+    }
+    return 0;
+  }
+  if (NL_TYPE(list) == NL_SEQ) {
+    if (nl_seq_begin(scope, &it, list)) return 1;
+    while (!(err = nl_seq_next(scope, &it, &args[0]))) {
+      args[1] = *result;
+      if ((err = nl_invoke_values(scope, fun, 2, args, result))) break;
+    }
+    nl_seq_end(&it);
+    return err == EOF ? 0 : err;
+  }
+  if (!NL_IS_PAIR(list)) {
     scope->last_err = "illegal fold: third argument should be a pair";
     return 1;
   }
   NL_FOREACH(&list, item) {
-    call = nl_cell_as_pair(nl_cell_as_pair(quote, fun), nl_cell_as_pair(nl_cell_as_pair(quote, NL_HEAD_AT(item)), nl_cell_as_pair(nl_cell_as_pair(quote, *result), nil)));
-    if (nl_evalq(scope, call, result)) return 1;
+    args[0] = NL_HEAD_AT(item);
+    args[1] = *result;
+    if (nl_invoke_values(scope, fun, 2, args, result)) return 1;
   }
   return 0;
 }
 NL_BUILTIN(unfold) {
-  struct nl_cell seed, pair_f, continue_f, next_seed_f, call, v;
-  if (cell.type != NL_PAIR) {
+  struct nl_cell seed, pair_f, continue_f, next_seed_f, args[2], v;
+  if (!NL_IS_PAIR(cell)) {
     scope->last_err = "illegal unfold: non-pair args";
     return 1;
   }
@@ -237,19 +317,18 @@ NL_BUILTIN(unfold) {
       || nl_evalq(scope, NL_HEAD(NL_TAIL(NL_TAIL(NL_TAIL(NL_TAIL(cell))))), &next_seed_f))
     return 1;
   for (;;) {
-    call = nl_cell_as_pair(nl_cell_as_pair(quote, continue_f), nl_cell_as_pair(nl_cell_as_pair(quote, seed), nil));
-    if (nl_evalq(scope, call, &v)) return 1;
-    if (v.type == NL_NIL) break;
-    call = nl_cell_as_pair(nl_cell_as_pair(quote, pair_f), nl_cell_as_pair(nl_cell_as_pair(quote, seed), nl_cell_as_pair(nl_cell_as_pair(quote, *result), nil)));
-    if (nl_evalq(scope, call, result)) return 1;
-    call = nl_cell_as_pair(nl_cell_as_pair(quote, next_seed_f), nl_cell_as_pair(nl_cell_as_pair(quote, seed), nil));
-    if (nl_evalq(scope, call, &seed)) return 1;
+    if (nl_invoke_values(scope, continue_f, 1, &seed, &v)) return 1;
+    if (NL_TYPE(v) == NL_NIL) break;
+    args[0] = seed;
+    args[1] = *result;
+    if (nl_invoke_values(scope, pair_f, 2, args, result)) return 1;
+    if (nl_invoke_values(scope, next_seed_f, 1, &seed, &seed)) return 1;
   }
   return 0;
 }
 NL_BUILTIN(equal) {
   struct nl_cell *tail, last, val;
-  if (cell.type != NL_PAIR) {
+  if (!NL_IS_PAIR(cell)) {
     *result = t;
     return 0;
   }
@@ -264,11 +343,21 @@ NL_BUILTIN(equal) {
   *result = t;
   return 0;
 }
+NL_BUILTIN(hash) {
+  if (!NL_IS_PAIR(cell)) {
+    scope->last_err = "illegal hash: expected 1 arg";
+    return 1;
+  }
+  if (nl_evalq(scope, NL_HEAD(cell), result)) return 1;
+  // Tagged integers have 63 bits, so 62 keep the hash the same and positive
+  *result = nl_cell_as_int(nl_cell_hash(*result) >> 2);
+  return 0;
+}
 NL_BUILTIN(length) {
   int64_t n = 0;
   struct nl_cell *a;
-  if (nl_evalq(scope, cell.type == NL_PAIR ? NL_HEAD(cell) : cell, result)) return 1;
-  switch (result->type) {
+  if (nl_evalq(scope, NL_IS_PAIR(cell) ? NL_HEAD(cell) : cell, result)) return 1;
+  switch (NL_TYPE(*result)) {
   case NL_NIL:
     n = 0;
     break;
@@ -276,12 +365,12 @@ NL_BUILTIN(length) {
     n = 1;
     break;
   case NL_SYMBOL:
-    n = strlen(result->value.as_symbol);
+    n = strlen(NL_SYM(*result));
     break;
   case NL_PAIR:
     NL_FOREACH(result, a) {
       n += 1;
-      switch (NL_TAIL_AT(a).type) {
+      switch (NL_TYPE(NL_TAIL_AT(a))) {
       case NL_INTEGER:
       case NL_SYMBOL:
         n += 1;
@@ -290,6 +379,18 @@ NL_BUILTIN(length) {
       }
     }
     break;
+  case NL_VECTOR:
+    n = NL_VECTOR_OF(*result)->length;
+    break;
+  case NL_TABLE:
+    n = nl_table_count(NL_TABLE_OF(*result));
+    break;
+  case NL_INTS:
+    n = NL_INTS_OF(*result)->length;
+    break;
+  case NL_SEQ:
+    scope->last_err = "illegal length: a sequence has no length until it is consumed";
+    return 1;
   default:
     scope->last_err = "unknown cell type";
     return 1;
@@ -299,7 +400,7 @@ NL_BUILTIN(length) {
 }
 NL_BUILTIN(lt) {
   struct nl_cell *p, a, b;
-  if (cell.type != NL_PAIR) {
+  if (!NL_IS_PAIR(cell)) {
     *result = nil;
     return 0;
   }
@@ -317,7 +418,7 @@ NL_BUILTIN(lt) {
 }
 NL_BUILTIN(gt) {
   struct nl_cell *p, a, b;
-  if (cell.type != NL_PAIR) {
+  if (!NL_IS_PAIR(cell)) {
     *result = nil;
     return 0;
   }
@@ -335,7 +436,7 @@ NL_BUILTIN(gt) {
 }
 NL_BUILTIN(lte) {
   struct nl_cell *p, a, b;
-  if (cell.type != NL_PAIR) {
+  if (!NL_IS_PAIR(cell)) {
     *result = nil;
     return 0;
   }
@@ -353,7 +454,7 @@ NL_BUILTIN(lte) {
 }
 NL_BUILTIN(gte) {
   struct nl_cell *p, a, b;
-  if (cell.type != NL_PAIR) {
+  if (!NL_IS_PAIR(cell)) {
     *result = nil;
     return 0;
   }
@@ -370,238 +471,289 @@ NL_BUILTIN(gte) {
   return 0;
 }
 NL_BUILTIN(not) {
-  if (nl_evalq(scope, cell.type == NL_PAIR ? NL_HEAD(cell) : cell, result)) return 1;
-  if (result->type == NL_NIL)
+  if (nl_evalq(scope, NL_IS_PAIR(cell) ? NL_HEAD(cell) : cell, result)) return 1;
+  if (NL_TYPE(*result) == NL_NIL)
     *result = t;
   else
     *result = nil;
   return 0;
 }
 NL_BUILTIN(head) {
-  if (cell.type != NL_PAIR) {
+  if (!NL_IS_PAIR(cell)) {
     scope->last_err = "invalid head: non-pair args";
     return 1;
   }
-  if (NL_TAIL(cell).type != NL_NIL) {
+  if (NL_TYPE(NL_TAIL(cell)) != NL_NIL) {
     scope->last_err = "invalid head: too many args";
     return 1;
   }
   if (nl_evalq(scope, NL_HEAD(cell), result)) return 1;
-  if (result->type == NL_PAIR) *result = NL_HEAD_AT(result);
+  if (NL_IS_PAIR(*result)) *result = NL_HEAD_AT(result);
   return 0;
 }
 NL_BUILTIN(tail) {
-  if (cell.type != NL_PAIR) {
+  if (!NL_IS_PAIR(cell)) {
     scope->last_err = "invalid tail: non-pair args";
     return 1;
   }
-  if (NL_TAIL(cell).type != NL_NIL) {
+  if (NL_TYPE(NL_TAIL(cell)) != NL_NIL) {
     scope->last_err = "invalid tail: too many args";
     return 1;
   }
   if (nl_evalq(scope, NL_HEAD(cell), result)) return 1;
-  if (result->type == NL_PAIR)
+  if (NL_IS_PAIR(*result))
     *result = NL_TAIL_AT(result);
   else
     *result = nil;
   return 0;
 }
 NL_BUILTIN(pair) {
-  if (cell.type != NL_PAIR) {
+  if (!NL_IS_PAIR(cell)) {
     scope->last_err = "illegal pair: non-pair args";
     return 1;
   }
   *result = nl_cell_as_pair(nil, nil);
-  if (nl_evalq(scope, NL_HEAD(cell), result->value.as_pair)) return 1;
-  if (NL_TAIL(cell).type == NL_PAIR) {
+  if (nl_evalq(scope, NL_HEAD(cell), NL_PAIR_OF(*result))) return 1;
+  if (NL_IS_PAIR(NL_TAIL(cell))) {
     if (nl_evalq(scope, NL_HEAD(NL_TAIL(cell)), NL_NEXT_AT(result))) return 1;
   } else if (nl_evalq(scope, NL_TAIL(cell), NL_NEXT_AT(result))) return 1;
   return 0;
 }
 NL_BUILTIN(list) {
   struct nl_cell *in_tail, *out_tail = result;
-  if (cell.type == NL_NIL) {
+  if (NL_TYPE(cell) == NL_NIL) {
     *result = nil;
     return 0;
   }
   *result = nl_cell_as_pair(nil, nil);
   NL_FOREACH(&cell, in_tail) {
-    if (nl_evalq(scope, NL_HEAD_AT(in_tail), out_tail->value.as_pair)) return 1;
-    if (NL_TAIL_AT(in_tail).type != NL_PAIR) {
+    if (nl_evalq(scope, NL_HEAD_AT(in_tail), NL_PAIR_OF(*out_tail))) return 1;
+    if (!NL_IS_PAIR(NL_TAIL_AT(in_tail))) {
       return nl_evalq(scope, NL_TAIL_AT(in_tail), NL_NEXT_AT(out_tail));
     }
-    NL_TAIL_AT(out_tail) = nl_cell_as_pair(nil, nil);
+    nl_gc_write(&NL_TAIL_AT(out_tail), nl_cell_as_pair(nil, nil));
     out_tail = NL_NEXT_AT(out_tail);
   }
   return 0;
 }
 NL_BUILTIN(add) {
   struct nl_cell *tail, val;
-  if (cell.type == NL_NIL) {
+  if (NL_TYPE(cell) == NL_NIL) {
     *result = nl_cell_as_int(0);
     return 0;
   }
-  if (cell.type != NL_PAIR) {
+  if (!NL_IS_PAIR(cell)) {
     scope->last_err = "illegal add: non-pair args";
     return 1;
   }
   if (nl_evalq(scope, NL_HEAD(cell), result)) return 1;
-  if (result->type != NL_INTEGER) {
+  if (NL_TYPE(*result) != NL_INTEGER) {
     scope->last_err = "illegal add: non-integer arg";
     return 1;
   }
   NL_FOREACH(NL_NEXT(cell), tail) {
     if (nl_evalq(scope, NL_HEAD_AT(tail), &val)) return 1;
-    if (val.type != NL_INTEGER) {
+    if (NL_TYPE(val) != NL_INTEGER) {
       scope->last_err = "illegal add: non-integer arg";
       return 1;
     }
-    result->value.as_integer += val.value.as_integer;
+    *result = nl_cell_as_int(NL_INT(*result) + NL_INT(val));
   }
   return 0;
 }
 NL_BUILTIN(sub) {
   struct nl_cell *tail, val;
-  if (cell.type == NL_NIL) {
+  if (NL_TYPE(cell) == NL_NIL) {
     *result = nl_cell_as_int(0);
     return 0;
   }
-  if (cell.type != NL_PAIR) {
+  if (!NL_IS_PAIR(cell)) {
     scope->last_err = "illegal sub: non-pair args";
     return 1;
   }
-  if (NL_TAIL(cell).type == NL_NIL) {
-    *result = nl_cell_as_int(-NL_HEAD(cell).value.as_integer);
+  if (NL_TYPE(NL_TAIL(cell)) == NL_NIL) {
+    *result = nl_cell_as_int(-NL_INT(NL_HEAD(cell)));
     return 0;
   }
   if (nl_evalq(scope, NL_HEAD(cell), result)) return 1;
-  if (result->type != NL_INTEGER) {
+  if (NL_TYPE(*result) != NL_INTEGER) {
     scope->last_err = "illegal sub: non-integer arg";
     return 1;
   }
   NL_FOREACH(NL_NEXT(cell), tail) {
     if (nl_evalq(scope, NL_HEAD_AT(tail), &val)) return 1;
-    if (val.type != NL_INTEGER) {
+    if (NL_TYPE(val) != NL_INTEGER) {
       scope->last_err = "illegal sub: non-integer arg";
       return 1;
     }
-    result->value.as_integer -= val.value.as_integer;
+    *result = nl_cell_as_int(NL_INT(*result) - NL_INT(val));
   }
   return 0;
 }
 NL_BUILTIN(mul) {
   struct nl_cell *tail, val;
   int64_t sum = 1;
-  if (cell.type == NL_NIL) {
+  if (NL_TYPE(cell) == NL_NIL) {
     *result = nl_cell_as_int(1);
     return 0;
   }
-  if (cell.type != NL_PAIR) {
+  if (!NL_IS_PAIR(cell)) {
     scope->last_err = "illegal mul: non-pair args";
     return 1;
   }
   NL_FOREACH(&cell, tail) {
     if (nl_evalq(scope, NL_HEAD_AT(tail), &val)) return 1;
-    if (val.type != NL_INTEGER) {
+    if (NL_TYPE(val) != NL_INTEGER) {
       scope->last_err = "illegal mul: non-integer arg";
       return 1;
     }
-    sum *= val.value.as_integer;
+    sum *= NL_INT(val);
   }
   *result = nl_cell_as_int(sum);
   return 0;
 }
 NL_BUILTIN(div) {
   struct nl_cell *tail, val;
-  if (cell.type == NL_NIL) {
+  if (NL_TYPE(cell) == NL_NIL) {
     *result = nl_cell_as_int(1);
     return 0;
   }
-  if (cell.type != NL_PAIR) {
+  if (!NL_IS_PAIR(cell)) {
     scope->last_err = "illegal div: non-pair args";
     return 1;
   }
   if (nl_evalq(scope, NL_HEAD(cell), result)) return 1;
-  if (NL_TAIL(cell).type == NL_NIL) {
-    result->value.as_integer = 1 / result->value.as_integer;
+  if (NL_TYPE(NL_TAIL(cell)) == NL_NIL) {
+    *result = nl_cell_as_int(1 / NL_INT(*result));
     return 0;
   }
   NL_FOREACH(NL_NEXT(cell), tail) {
     if (nl_evalq(scope, NL_HEAD_AT(tail), &val)) return 1;
-    if (val.type != NL_INTEGER) {
+    if (NL_TYPE(val) != NL_INTEGER) {
       scope->last_err = "illegal div: non-integer arg";
       return 1;
     }
-    result->value.as_integer /= val.value.as_integer;
+    *result = nl_cell_as_int(NL_INT(*result) / NL_INT(val));
   }
   return 0;
 }
-NL_BUILTIN(printq) {
-  struct nl_cell s_out;
-  FILE *out = stdout;
-  if (!nl_evalq(scope, nl_out, &s_out)
-      && s_out.type == NL_INTEGER)
-    out = (FILE *)s_out.value.as_integer;
-  switch (cell.type) {
+static void nl_table_list_entry(struct nl_cell key, struct nl_cell value, void *data) {
+  struct nl_cell *list = data;
+  *list = nl_cell_as_pair(nl_cell_as_pair(key, value), *list);
+}
+/**
+ * List the entries of a table as (key . value) pairs
+ */
+static struct nl_cell nl_table_list(struct nl_table *table) {
+  struct nl_cell list = nil;
+  nl_table_foreach(table, nl_table_list_entry, &list);
+  return list;
+}
+/**
+ * Write an int array as #ints(...)
+ */
+static void nl_write_ints(struct nl_port *out, struct nl_ints *ints) {
+  int64_t i;
+  nl_port_write(out, "#ints(", 6);
+  for (i = 0; i < ints->length; ++i) {
+    if (i) nl_port_putc(out, ' ');
+    nl_port_write_int(out, ints->items[i]);
+  }
+  nl_port_putc(out, ')');
+}
+/**
+ * Print a value for people to read, to the port the caller looked up
+ */
+static int nl_print_to(struct nl_scope *scope, struct nl_port *out, struct nl_cell cell) {
+  int64_t i;
+  switch (NL_TYPE(cell)) {
   case NL_NIL:
-    fprintf(out, "nil");
-    *result = cell;
+    nl_port_write(out, "nil", 3);
     return 0;
   case NL_INTEGER:
-    fprintf(out, "%li", cell.value.as_integer);
-    *result = cell;
+    nl_port_write_int(out, NL_INT(cell));
     return 0;
   case NL_PAIR:
-    if (nl_printq(scope, NL_HEAD(cell), result)) return 1;
-    if (NL_TAIL(cell).type == NL_NIL) return 0;
-    fprintf(out, NL_TAIL(cell).type == NL_PAIR ? " " : ", ");
-    return nl_printq(scope, NL_TAIL(cell), result);
+    for (;;) {
+      if (nl_print_to(scope, out, NL_HEAD(cell))) return 1;
+      cell = NL_TAIL(cell);
+      if (NL_TYPE(cell) == NL_NIL) return 0;
+      if (!NL_IS_PAIR(cell)) break;
+      nl_port_putc(out, ' ');
+    }
+    nl_port_write(out, ", ", 2);
+    return nl_print_to(scope, out, cell);
   case NL_SYMBOL:
-    fprintf(out, "%s", cell.value.as_symbol);
-    *result = cell;
+    nl_port_write(out, NL_SYM(cell), NL_SYMBOL_OF(NL_SYM(cell))->length);
+    return 0;
+  case NL_VECTOR:
+    nl_port_write(out, "#(", 2);
+    for (i = 0; i < NL_VECTOR_OF(cell)->length; ++i) {
+      if (i) nl_port_putc(out, ' ');
+      if (nl_print_to(scope, out, NL_VECTOR_OF(cell)->items[i])) return 1;
+    }
+    nl_port_putc(out, ')');
+    return 0;
+  case NL_TABLE:
+    nl_port_write(out, "#table(", 7);
+    if (nl_print_to(scope, out, nl_table_list(NL_TABLE_OF(cell)))) return 1;
+    nl_port_putc(out, ')');
+    return 0;
+  case NL_SEQ:
+    nl_port_write(out, "#seq(", 5);
+    if (nl_print_to(scope, out, nl_cell_of_pair(NL_SEQ_OF(cell)))) return 1;
+    nl_port_putc(out, ')');
+    return 0;
+  case NL_INTS:
+    nl_write_ints(out, NL_INTS_OF(cell));
     return 0;
   default:
     scope->last_err = "unknown cell type";
     return 1;
   }
 }
+NL_BUILTIN(printq) {
+  struct nl_port *out = nl_port_out(scope);
+  if (!out || nl_print_to(scope, out, cell)) return 1;
+  *result = cell;
+  return 0;
+}
 NL_BUILTIN(print) {
-  struct nl_cell val, *tail, s_out;
-  FILE *out = stdout;
-  if (!nl_evalq(scope, nl_out, &s_out)
-      && s_out.type == NL_INTEGER)
-    out = (FILE *)s_out.value.as_integer;
-  if (cell.type != NL_PAIR)
+  struct nl_port *out = nl_port_out(scope);
+  struct nl_cell *tail;
+  if (!out) return 1;
+  if (!NL_IS_PAIR(cell))
     return nl_evalq(scope, cell, result) || nl_printq(scope, cell, result);
   NL_FOREACH(&cell, tail) {
-    if (nl_evalq(scope, NL_HEAD_AT(tail), &val)) return 1;
-    if (nl_printq(scope, val, result)) return 1;
-    if (NL_TAIL_AT(tail).type == NL_PAIR) fputc(' ', out);
+    if (nl_evalq(scope, NL_HEAD_AT(tail), result)) return 1;
+    if (nl_print_to(scope, out, *result)) return 1;
+    if (NL_IS_PAIR(NL_TAIL_AT(tail))) nl_port_putc(out, ' ');
   }
-  if (tail->type != NL_NIL) {
-    fprintf(out, ", ");
-    nl_print(scope, *tail, result);
+  if (NL_TYPE(*tail) != NL_NIL) {
+    nl_port_write(out, ", ", 2);
+    return nl_print(scope, *tail, result);
   }
   return 0;
 }
 NL_BUILTIN(defq) {
   struct nl_cell name, body;
   *result = nil;
-  if (cell.type != NL_PAIR) {
+  if (!NL_IS_PAIR(cell)) {
     scope->last_err = "illegal defq: non-pair args";
     return 1;
   }
   name = NL_HEAD(cell);
-  if (name.type != NL_SYMBOL) {
+  if (NL_TYPE(name) != NL_SYMBOL) {
     scope->last_err = "illegal defq: non-symbol name";
     return 1;
   }
   body = NL_TAIL(cell);
-  if (body.type != NL_PAIR) {
+  if (!NL_IS_PAIR(body)) {
     scope->last_err = "illegal defq: non-pair body";
     return 1;
   }
-  nl_scope_put(scope, name.value.as_symbol, body);
+  if (nl_optimize_lambda(scope, NL_SYM(name), body, &body)) return 1;
+  nl_scope_put(scope, NL_SYM(name), body);
   return 0;
 }
 NL_BUILTIN(setq) {
@@ -609,23 +761,23 @@ NL_BUILTIN(setq) {
 }
 NL_BUILTIN(set) {
   struct nl_cell *tail, var;
-  if (cell.type != NL_PAIR) {
+  if (!NL_IS_PAIR(cell)) {
     scope->last_err = "illegal set call: non-pair args";
     return 1;
   }
-  for (tail = &cell; tail->type == NL_PAIR; tail = NL_NEXT(NL_TAIL_AT(tail))) {
+  for (tail = &cell; NL_IS_PAIR(*tail); tail = NL_NEXT(NL_TAIL_AT(tail))) {
     if (nl_evalq(scope, NL_HEAD_AT(tail), &var)) return 1;
-    if (var.type != NL_SYMBOL) {
+    if (NL_TYPE(var) != NL_SYMBOL) {
       scope->last_err = "illegal set call: non-symbol var";
       return 1;
     }
-    if (NL_TAIL_AT(tail).type != NL_PAIR) {
+    if (!NL_IS_PAIR(NL_TAIL_AT(tail))) {
       if (nl_evalq(scope, NL_TAIL_AT(tail), result)) return 1;
-      nl_scope_put(scope, var.value.as_symbol, *result);
+      nl_scope_put(scope, NL_SYM(var), *result);
       return 0;
     }
     if (nl_evalq(scope, NL_HEAD(NL_TAIL_AT(tail)), result)) return 1;
-    nl_scope_put(scope, var.value.as_symbol, *result);
+    nl_scope_put(scope, NL_SYM(var), *result);
   }
   return 0;
 }
@@ -638,11 +790,16 @@ NL_BUILTIN(set_head) {
   if (nl_evalq(scope, NL_HEAD(cell), &pair)
       || nl_evalq(scope, NL_HEAD(NL_TAIL(cell)), &new_head))
     return 1;
-  if (pair.type != NL_PAIR) {
+  if (!NL_IS_PAIR(pair)) {
     scope->last_err = "illegal set-head: cannot set head of non-pair";
     return 1;
   }
-  NL_HEAD(pair) = new_head;
+  if (nl_share_has(pair)) {
+    scope->last_err = "illegal set-head: cannot change a pair read in shared mode";
+    return 1;
+  }
+  nl_gc_write(&NL_HEAD(pair), new_head);
+  nl_vm_invalidate();
   return 0;
 }
 NL_BUILTIN(set_tail) {
@@ -654,14 +811,484 @@ NL_BUILTIN(set_tail) {
   if (nl_evalq(scope, NL_HEAD(cell), &pair)
       || nl_evalq(scope, NL_HEAD(NL_TAIL(cell)), &new_tail))
     return 1;
-  if (pair.type != NL_PAIR) {
+  if (!NL_IS_PAIR(pair)) {
     scope->last_err = "illegal set-tail: cannot set tail of non-pair";
     return 1;
   }
-  NL_TAIL(pair) = new_tail;
+  if (nl_share_has(pair)) {
+    scope->last_err = "illegal set-tail: cannot change a pair read in shared mode";
+    return 1;
+  }
+  nl_gc_write(&NL_TAIL(pair), new_tail);
+  nl_vm_invalidate();
   return 0;
 }
-void nl_write_symbol(FILE *out, const char *sym) {
+/**
+ * Evaluate the first argument, which should be a table
+ */
+static int nl_table_arg(struct nl_scope *scope, struct nl_cell cell, struct nl_cell *table, char *err) {
+  if (nl_evalq(scope, NL_IS_PAIR(cell) ? NL_HEAD(cell) : cell, table)) return 1;
+  if (NL_TYPE(*table) != NL_TABLE) {
+    scope->last_err = err;
+    return 1;
+  }
+  return 0;
+}
+NL_BUILTIN(make_table) {
+  struct nl_cell list = nil;
+  if (NL_IS_PAIR(cell) && nl_evalq(scope, NL_HEAD(cell), &list)) return 1;
+  if (nl_table_from_list(list, result)) {
+    scope->last_err = "illegal make-table: expected a list of pairs";
+    return 1;
+  }
+  return 0;
+}
+NL_BUILTIN(tableget) {
+  struct nl_cell table, key;
+  int64_t n = nl_list_length(cell);
+  if (n != 2 && n != 3) {
+    scope->last_err = "illegal table-get: expected 2 or 3 args";
+    return 1;
+  }
+  if (nl_table_arg(scope, cell, &table, "illegal table-get: expected a table")
+      || nl_evalq(scope, NL_HEAD(NL_TAIL(cell)), &key))
+    return 1;
+  if (nl_table_get(NL_TABLE_OF(table), key, result)) return 0;
+  if (n == 2) {
+    *result = nil;
+    return 0;
+  }
+  return nl_evalq(scope, NL_HEAD(NL_TAIL(NL_TAIL(cell))), result);
+}
+NL_BUILTIN(tableput) {
+  struct nl_cell table, key;
+  if (3 != nl_list_length(cell)) {
+    scope->last_err = "illegal table-put: expected 3 args";
+    return 1;
+  }
+  if (nl_table_arg(scope, cell, &table, "illegal table-put: expected a table")
+      || nl_evalq(scope, NL_HEAD(NL_TAIL(cell)), &key)
+      || nl_evalq(scope, NL_HEAD(NL_TAIL(NL_TAIL(cell))), result))
+    return 1;
+  nl_table_put(NL_TABLE_OF(table), key, *result);
+  return 0;
+}
+NL_BUILTIN(tableremove) {
+  struct nl_cell table, key;
+  if (2 != nl_list_length(cell)) {
+    scope->last_err = "illegal table-remove: expected 2 args";
+    return 1;
+  }
+  if (nl_table_arg(scope, cell, &table, "illegal table-remove: expected a table")
+      || nl_evalq(scope, NL_HEAD(NL_TAIL(cell)), &key))
+    return 1;
+  *result = nl_table_remove(NL_TABLE_OF(table), key) ? t : nil;
+  return 0;
+}
+NL_BUILTIN(tablecount) {
+  if (nl_table_arg(scope, cell, result, "illegal table-count: expected a table")) return 1;
+  *result = nl_cell_as_int(nl_table_count(NL_TABLE_OF(*result)));
+  return 0;
+}
+NL_BUILTIN(tablelist) {
+  if (nl_table_arg(scope, cell, result, "illegal table->list: expected a table")) return 1;
+  *result = nl_table_list(NL_TABLE_OF(*result));
+  return 0;
+}
+NL_BUILTIN(tableforeach) {
+  struct nl_cell fun, table, list, *entry;
+  if (!NL_IS_PAIR(cell) || !NL_IS_PAIR(NL_TAIL(cell))) {
+    scope->last_err = "illegal table-for-each: expected at least two args";
+    return 1;
+  }
+  if (nl_evalq(scope, NL_HEAD(cell), &fun)
+      || nl_table_arg(scope, NL_TAIL(cell), &table, "illegal table-for-each: expected a table"))
+    return 1;
+  // Take the entries first, so that fun may change the table
+  list = nl_table_list(NL_TABLE_OF(table));
+  *result = nil;
+  NL_FOREACH(&list, entry) {
+    if (nl_invoke_values(scope, fun, 2, NL_PAIR_OF(NL_HEAD_AT(entry)), result)) return 1;
+  }
+  return 0;
+}
+NL_BUILTIN(make_vector) {
+  struct nl_cell length, fill = nil;
+  int64_t i;
+  if (!NL_IS_PAIR(cell)) {
+    scope->last_err = "illegal make-vector: non-pair args";
+    return 1;
+  }
+  if (nl_evalq(scope, NL_HEAD(cell), &length)) return 1;
+  if (NL_IS_PAIR(NL_TAIL(cell)) && nl_evalq(scope, NL_HEAD(NL_TAIL(cell)), &fill)) return 1;
+  if (NL_TYPE(length) != NL_INTEGER || NL_INT(length) < 0) {
+    scope->last_err = "illegal make-vector: length should be a non-negative integer";
+    return 1;
+  }
+  *result = nl_cell_as_vector(NL_INT(length));
+  for (i = 0; i < NL_INT(length); ++i)
+    NL_VECTOR_OF(*result)->items[i] = fill;
+  return 0;
+}
+/**
+ * Evaluate the vector and index arguments of vector-ref and vector-set
+ */
+static int nl_vector_index(struct nl_scope *scope, struct nl_cell cell, struct nl_cell *vector, int64_t *index, char *err) {
+  struct nl_cell i;
+  if (nl_evalq(scope, NL_HEAD(cell), vector)
+      || nl_evalq(scope, NL_HEAD(NL_TAIL(cell)), &i))
+    return 1;
+  if (NL_TYPE(*vector) != NL_VECTOR || NL_TYPE(i) != NL_INTEGER
+      || NL_INT(i) < 0 || NL_INT(i) >= NL_VECTOR_OF(*vector)->length) {
+    scope->last_err = err;
+    return 1;
+  }
+  *index = NL_INT(i);
+  return 0;
+}
+NL_BUILTIN(vector_ref) {
+  struct nl_cell vector;
+  int64_t i;
+  if (2 != nl_list_length(cell)) {
+    scope->last_err = "illegal vector-ref: expected 2 args";
+    return 1;
+  }
+  if (nl_vector_index(scope, cell, &vector, &i, "illegal vector-ref: index out of range")) return 1;
+  *result = NL_VECTOR_OF(vector)->items[i];
+  return 0;
+}
+NL_BUILTIN(vector_set) {
+  struct nl_cell vector;
+  int64_t i;
+  if (3 != nl_list_length(cell)) {
+    scope->last_err = "illegal vector-set: expected 3 args";
+    return 1;
+  }
+  if (nl_vector_index(scope, cell, &vector, &i, "illegal vector-set: index out of range")
+      || nl_evalq(scope, NL_HEAD(NL_TAIL(NL_TAIL(cell))), result))
+    return 1;
+  nl_gc_write(&NL_VECTOR_OF(vector)->items[i], *result);
+  return 0;
+}
+NL_BUILTIN(vector_length) {
+  if (nl_evalq(scope, NL_IS_PAIR(cell) ? NL_HEAD(cell) : cell, result)) return 1;
+  if (NL_TYPE(*result) != NL_VECTOR) {
+    scope->last_err = "illegal vector-length: expected a vector";
+    return 1;
+  }
+  *result = nl_cell_as_int(NL_VECTOR_OF(*result)->length);
+  return 0;
+}
+NL_BUILTIN(list_to_vector) {
+  struct nl_cell list;
+  if (nl_evalq(scope, NL_IS_PAIR(cell) ? NL_HEAD(cell) : cell, &list)) return 1;
+  if (nl_vector_from_list(list, result)) {
+    scope->last_err = "illegal list->vector: expected a list";
+    return 1;
+  }
+  return 0;
+}
+NL_BUILTIN(vector_to_list) {
+  struct nl_cell vector;
+  int64_t i;
+  if (nl_evalq(scope, NL_IS_PAIR(cell) ? NL_HEAD(cell) : cell, &vector)) return 1;
+  if (NL_TYPE(vector) != NL_VECTOR) {
+    scope->last_err = "illegal vector->list: expected a vector";
+    return 1;
+  }
+  *result = nil;
+  for (i = NL_VECTOR_OF(vector)->length; i-- > 0;)
+    *result = nl_cell_as_pair(NL_VECTOR_OF(vector)->items[i], *result);
+  return 0;
+}
+/**
+ * Evaluate the first argument, which should be an int array
+ */
+static int nl_ints_arg(struct nl_scope *scope, struct nl_cell cell, struct nl_cell *ints, char *err) {
+  if (nl_evalq(scope, NL_IS_PAIR(cell) ? NL_HEAD(cell) : cell, ints)) return 1;
+  if (NL_TYPE(*ints) != NL_INTS) {
+    scope->last_err = err;
+    return 1;
+  }
+  return 0;
+}
+NL_BUILTIN(make_ints) {
+  struct nl_cell length, fill = nl_cell_as_int(0);
+  int64_t i;
+  if (!NL_IS_PAIR(cell)) {
+    scope->last_err = "illegal make-ints: non-pair args";
+    return 1;
+  }
+  if (nl_evalq(scope, NL_HEAD(cell), &length)) return 1;
+  if (NL_IS_PAIR(NL_TAIL(cell)) && nl_evalq(scope, NL_HEAD(NL_TAIL(cell)), &fill)) return 1;
+  if (NL_TYPE(length) != NL_INTEGER || NL_INT(length) < 0 || NL_TYPE(fill) != NL_INTEGER) {
+    scope->last_err = "illegal make-ints: expected a non-negative length and an integer";
+    return 1;
+  }
+  *result = nl_cell_as_ints(NL_INT(length));
+  if (NL_INT(fill))
+    for (i = 0; i < NL_INT(length); ++i)
+      NL_INTS_OF(*result)->items[i] = NL_INT(fill);
+  return 0;
+}
+/**
+ * Evaluate the int array and index arguments of ints-ref and ints-set
+ */
+static int nl_ints_index(struct nl_scope *scope, struct nl_cell cell, struct nl_cell *ints, int64_t *index, char *err) {
+  struct nl_cell i;
+  if (nl_evalq(scope, NL_HEAD(cell), ints)
+      || nl_evalq(scope, NL_HEAD(NL_TAIL(cell)), &i))
+    return 1;
+  if (NL_TYPE(*ints) != NL_INTS || NL_TYPE(i) != NL_INTEGER
+      || NL_INT(i) < 0 || NL_INT(i) >= NL_INTS_OF(*ints)->length) {
+    scope->last_err = err;
+    return 1;
+  }
+  *index = NL_INT(i);
+  return 0;
+}
+NL_BUILTIN(intsref) {
+  struct nl_cell ints;
+  int64_t i;
+  if (2 != nl_list_length(cell)) {
+    scope->last_err = "illegal ints-ref: expected 2 args";
+    return 1;
+  }
+  if (nl_ints_index(scope, cell, &ints, &i, "illegal ints-ref: index out of range")) return 1;
+  *result = nl_cell_as_int(NL_INTS_OF(ints)->items[i]);
+  return 0;
+}
+NL_BUILTIN(intsset) {
+  struct nl_cell ints;
+  int64_t i;
+  if (3 != nl_list_length(cell)) {
+    scope->last_err = "illegal ints-set: expected 3 args";
+    return 1;
+  }
+  if (nl_ints_index(scope, cell, &ints, &i, "illegal ints-set: index out of range")
+      || nl_evalq(scope, NL_HEAD(NL_TAIL(NL_TAIL(cell))), result))
+    return 1;
+  if (NL_TYPE(*result) != NL_INTEGER) {
+    scope->last_err = "illegal ints-set: expected an integer";
+    return 1;
+  }
+  NL_INTS_OF(ints)->items[i] = NL_INT(*result);
+  return 0;
+}
+NL_BUILTIN(intslength) {
+  if (nl_ints_arg(scope, cell, result, "illegal ints-length: expected an int array")) return 1;
+  *result = nl_cell_as_int(NL_INTS_OF(*result)->length);
+  return 0;
+}
+NL_BUILTIN(list_to_ints) {
+  struct nl_cell list;
+  if (nl_evalq(scope, NL_IS_PAIR(cell) ? NL_HEAD(cell) : cell, &list)) return 1;
+  if (nl_ints_from_list(list, result)) {
+    scope->last_err = "illegal list->ints: expected a list of integers";
+    return 1;
+  }
+  return 0;
+}
+NL_BUILTIN(intslist) {
+  struct nl_cell ints;
+  int64_t i;
+  if (nl_ints_arg(scope, cell, &ints, "illegal ints->list: expected an int array")) return 1;
+  *result = nil;
+  for (i = NL_INTS_OF(ints)->length; i-- > 0;)
+    *result = nl_cell_as_pair(nl_cell_as_int(NL_INTS_OF(ints)->items[i]), *result);
+  return 0;
+}
+/**
+ * Evaluate the two arguments of an elementwise builtin: an int array,
+ * then either an int array of the same length or, if scalar_ok, an integer
+ */
+static int nl_ints_args(struct nl_scope *scope, struct nl_cell cell, struct nl_cell *a, struct nl_cell *b,
+                        int scalar_ok, char *err) {
+  if (2 != nl_list_length(cell)) {
+    scope->last_err = err;
+    return 1;
+  }
+  if (nl_evalq(scope, NL_HEAD(cell), a)
+      || nl_evalq(scope, NL_HEAD(NL_TAIL(cell)), b))
+    return 1;
+  if (NL_TYPE(*a) != NL_INTS
+      || (NL_TYPE(*b) == NL_INTS ? NL_INTS_OF(*b)->length != NL_INTS_OF(*a)->length
+          : !scalar_ok || NL_TYPE(*b) != NL_INTEGER)) {
+    scope->last_err = err;
+    return 1;
+  }
+  return 0;
+}
+static int nl_ints_elementwise(struct nl_scope *scope, struct nl_cell cell, struct nl_cell *result,
+                               enum nl_ints_op op, char *err) {
+  struct nl_cell a, b;
+  if (nl_ints_args(scope, cell, &a, &b, 1, err)) return 1;
+  *result = nl_cell_as_ints(NL_INTS_OF(a)->length);
+  if (NL_TYPE(b) == NL_INTS)
+    nl_ints_map(op, NL_INTS_OF(*result)->items, NL_INTS_OF(a)->items, NL_INTS_OF(b)->items, 0, NL_INTS_OF(a)->length);
+  else
+    nl_ints_map(op, NL_INTS_OF(*result)->items, NL_INTS_OF(a)->items, NULL, NL_INT(b), NL_INTS_OF(a)->length);
+  return 0;
+}
+NL_BUILTIN(intsadd) {
+  return nl_ints_elementwise(scope, cell, result, NL_INTS_ADD,
+                             "illegal ints-add: expected an int array, then an int array of the same length or an integer");
+}
+NL_BUILTIN(intssub) {
+  return nl_ints_elementwise(scope, cell, result, NL_INTS_SUB,
+                             "illegal ints-sub: expected an int array, then an int array of the same length or an integer");
+}
+NL_BUILTIN(intsmul) {
+  return nl_ints_elementwise(scope, cell, result, NL_INTS_MUL,
+                             "illegal ints-mul: expected an int array, then an int array of the same length or an integer");
+}
+NL_BUILTIN(intseq) {
+  return nl_ints_elementwise(scope, cell, result, NL_INTS_EQ,
+                             "illegal ints=: expected an int array, then an int array of the same length or an integer");
+}
+NL_BUILTIN(intslt) {
+  return nl_ints_elementwise(scope, cell, result, NL_INTS_LT,
+                             "illegal ints<: expected an int array, then an int array of the same length or an integer");
+}
+NL_BUILTIN(intsgt) {
+  return nl_ints_elementwise(scope, cell, result, NL_INTS_GT,
+                             "illegal ints>: expected an int array, then an int array of the same length or an integer");
+}
+NL_BUILTIN(intssum) {
+  if (nl_ints_arg(scope, cell, result, "illegal ints-sum: expected an int array")) return 1;
+  *result = nl_cell_as_int(nl_ints_sum(NL_INTS_OF(*result)->items, NL_INTS_OF(*result)->length));
+  return 0;
+}
+NL_BUILTIN(intsmin) {
+  if (nl_ints_arg(scope, cell, result, "illegal ints-min: expected a non-empty int array")) return 1;
+  if (!NL_INTS_OF(*result)->length) {
+    scope->last_err = "illegal ints-min: expected a non-empty int array";
+    return 1;
+  }
+  *result = nl_cell_as_int(nl_ints_min(NL_INTS_OF(*result)->items, NL_INTS_OF(*result)->length));
+  return 0;
+}
+NL_BUILTIN(intsmax) {
+  if (nl_ints_arg(scope, cell, result, "illegal ints-max: expected a non-empty int array")) return 1;
+  if (!NL_INTS_OF(*result)->length) {
+    scope->last_err = "illegal ints-max: expected a non-empty int array";
+    return 1;
+  }
+  *result = nl_cell_as_int(nl_ints_max(NL_INTS_OF(*result)->items, NL_INTS_OF(*result)->length));
+  return 0;
+}
+NL_BUILTIN(intsdot) {
+  struct nl_cell a, b;
+  if (nl_ints_args(scope, cell, &a, &b, 0, "illegal ints-dot: expected two int arrays of the same length")) return 1;
+  *result = nl_cell_as_int(nl_ints_dot(NL_INTS_OF(a)->items, NL_INTS_OF(b)->items, NL_INTS_OF(a)->length));
+  return 0;
+}
+NL_BUILTIN(intsprefixsum) {
+  struct nl_cell ints;
+  if (nl_ints_arg(scope, cell, &ints, "illegal ints-prefix-sum: expected an int array")) return 1;
+  *result = nl_cell_as_ints(NL_INTS_OF(ints)->length);
+  nl_ints_prefix_sum(NL_INTS_OF(*result)->items, NL_INTS_OF(ints)->items, NL_INTS_OF(ints)->length);
+  return 0;
+}
+/**
+ * Evaluate the argument as a sequence, making one of a list, vector, int
+ * array or input port
+ */
+static int nl_seq_arg(struct nl_scope *scope, struct nl_cell arg, struct nl_cell *seq, char *err) {
+  if (nl_evalq(scope, arg, seq)) return 1;
+  if (nl_seq_of(*seq, seq)) {
+    scope->last_err = err;
+    return 1;
+  }
+  return 0;
+}
+NL_BUILTIN(seq) {
+  return nl_seq_arg(scope, NL_IS_PAIR(cell) ? NL_HEAD(cell) : cell, result,
+                    "illegal seq: expected a list, vector, int array or input port");
+}
+NL_BUILTIN(seqrange) {
+  struct nl_cell start, end = nil, step = nl_cell_as_int(1);
+  if (!NL_IS_PAIR(cell)) {
+    scope->last_err = "illegal seq-range: expected a start";
+    return 1;
+  }
+  if (nl_evalq(scope, NL_HEAD(cell), &start)) return 1;
+  if (NL_IS_PAIR(NL_TAIL(cell))) {
+    if (nl_evalq(scope, NL_HEAD(NL_TAIL(cell)), &end)) return 1;
+    if (NL_IS_PAIR(NL_TAIL(NL_TAIL(cell))) && nl_evalq(scope, NL_HEAD(NL_TAIL(NL_TAIL(cell))), &step)) return 1;
+  }
+  if (NL_TYPE(start) != NL_INTEGER || (NL_TYPE(end) != NL_INTEGER && NL_TYPE(end) != NL_NIL)
+      || NL_TYPE(step) != NL_INTEGER || NL_INT(step) == 0) {
+    scope->last_err = "illegal seq-range: expected integers, and a step other than 0";
+    return 1;
+  }
+  *result = nl_seq_make(NL_SEQ_RANGE, nl_cell_as_pair(start, nl_cell_as_pair(end, nl_cell_as_pair(step, nil))));
+  return 0;
+}
+NL_BUILTIN(sequnfold) {
+  struct nl_cell seed, more, next;
+  if (nl_list_length(cell) != 3) {
+    scope->last_err = "illegal seq-unfold: expected exactly three args";
+    return 1;
+  }
+  if (nl_evalq(scope, NL_HEAD(cell), &seed)
+      || nl_evalq(scope, NL_HEAD(NL_TAIL(cell)), &more)
+      || nl_evalq(scope, NL_HEAD(NL_TAIL(NL_TAIL(cell))), &next))
+    return 1;
+  *result = nl_seq_make(NL_SEQ_UNFOLD, nl_cell_as_pair(seed, nl_cell_as_pair(more, nl_cell_as_pair(next, nil))));
+  return 0;
+}
+/**
+ * Add a stage to the sequence given as the second argument, with the
+ * first argument, which is a count for take and drop
+ */
+static int nl_seq_stage(struct nl_scope *scope, struct nl_cell cell, struct nl_cell *result,
+                        enum nl_seq_kind kind, char *err) {
+  struct nl_cell arg, seq;
+  if (!NL_IS_PAIR(cell) || !NL_IS_PAIR(NL_TAIL(cell))) {
+    scope->last_err = err;
+    return 1;
+  }
+  if (nl_evalq(scope, NL_HEAD(cell), &arg)) return 1;
+  if ((kind == NL_SEQ_TAKE || kind == NL_SEQ_DROP) && NL_TYPE(arg) != NL_INTEGER) {
+    scope->last_err = err;
+    return 1;
+  }
+  if (nl_seq_arg(scope, NL_HEAD(NL_TAIL(cell)), &seq, err)) return 1;
+  *result = nl_seq_add(seq, kind, arg);
+  return 0;
+}
+NL_BUILTIN(seqmap) {
+  return nl_seq_stage(scope, cell, result, NL_SEQ_MAP, "illegal seq-map: expected a function and a sequence");
+}
+NL_BUILTIN(seqfilter) {
+  return nl_seq_stage(scope, cell, result, NL_SEQ_FILTER, "illegal seq-filter: expected a function and a sequence");
+}
+NL_BUILTIN(seqtake) {
+  return nl_seq_stage(scope, cell, result, NL_SEQ_TAKE, "illegal seq-take: expected a count and a sequence");
+}
+NL_BUILTIN(seqdrop) {
+  return nl_seq_stage(scope, cell, result, NL_SEQ_DROP, "illegal seq-drop: expected a count and a sequence");
+}
+NL_BUILTIN(seqlist) {
+  struct nl_cell seq, value, *tail = result;
+  struct nl_seq_iter it;
+  int err;
+  if (nl_seq_arg(scope, NL_IS_PAIR(cell) ? NL_HEAD(cell) : cell, &seq, "illegal seq->list: expected a sequence")) return 1;
+  if (nl_seq_begin(scope, &it, seq)) return 1;
+  *result = nil;
+  while (!(err = nl_seq_next(scope, &it, &value))) {
+    // The list may be promoted while the stages run, so store through the barrier
+    if (tail == result)
+      *tail = nl_cell_as_pair(value, nil);
+    else
+      nl_gc_write(tail, nl_cell_as_pair(value, nil));
+    tail = NL_NEXT_AT(tail);
+  }
+  nl_seq_end(&it);
+  return err == EOF ? 0 : err;
+}
+void nl_write_symbol(struct nl_port *out, const char *sym) {
   const char *s = sym;
   switch (*sym) {
   case '.':
@@ -678,69 +1305,84 @@ void nl_write_symbol(FILE *out, const char *sym) {
     if (isspace(*s) || *s == '(' || *s == ')')
       goto quoted;
   }
-  fprintf(out, "%s", sym);
+  nl_port_write(out, sym, s - sym);
   return;
  quoted:
-  fprintf(out, "\"%.*s", (int)(s - sym), sym);
-  fputc(*s, out);
-  for (sym = ++s; *s != '\0'; ++s) {
+  nl_port_putc(out, '"');
+  for (s = sym; *s != '\0'; ++s) {
     if (*s == '\\' || *s == '"') {
-      fprintf(out, "%.*s\\%c", (int)(s - sym), sym, *s);
-      sym = s+1;
+      nl_port_write(out, sym, s - sym);
+      nl_port_putc(out, '\\');
+      sym = s;
     }
   }
-  fprintf(out, "%s\"", sym);
+  nl_port_write(out, sym, s - sym);
+  nl_port_putc(out, '"');
 }
-NL_BUILTIN(writeq) {
-  struct nl_cell *tail, s_out;
-  FILE *out = stdout;
-  if (!nl_evalq(scope, nl_out, &s_out)
-      && s_out.type == NL_INTEGER)
-    out = (FILE *)s_out.value.as_integer;
-  switch (cell.type) {
+/**
+ * Write a value so that it can be read back, to the port the caller
+ * looked up
+ */
+int nl_write_to(struct nl_scope *scope, struct nl_port *out, struct nl_cell cell) {
+  struct nl_cell list;
+  int64_t i;
+  switch (NL_TYPE(cell)) {
   case NL_NIL:
-    fprintf(out, "nil");
-    *result = cell;
+    nl_port_write(out, "nil", 3);
     return 0;
   case NL_INTEGER:
-    fprintf(out, "%li", cell.value.as_integer);
-    *result = cell;
+    nl_port_write_int(out, NL_INT(cell));
     return 0;
   case NL_SYMBOL:
-    nl_write_symbol(out, cell.value.as_symbol);
-    *result = cell;
+    nl_write_symbol(out, NL_SYM(cell));
     return 0;
+  case NL_VECTOR:
+    nl_port_write(out, "#(", 2);
+    for (i = 0; i < NL_VECTOR_OF(cell)->length; ++i) {
+      if (i) nl_port_putc(out, ' ');
+      if (nl_write_to(scope, out, NL_VECTOR_OF(cell)->items[i])) return 1;
+    }
+    nl_port_putc(out, ')');
+    return 0;
+  case NL_TABLE:
+    nl_port_write(out, "#table", 6);
+    list = nl_table_list(NL_TABLE_OF(cell));
+    if (NL_TYPE(list) == NL_NIL)
+      nl_port_write(out, "()", 2);
+    else if (nl_write_to(scope, out, list))
+      return 1;
+    return 0;
+  case NL_INTS:
+    nl_write_ints(out, NL_INTS_OF(cell));
+    return 0;
+  case NL_SEQ:
+    nl_port_write(out, "#seq", 4);
+    return nl_write_to(scope, out, nl_cell_of_pair(NL_SEQ_OF(cell)));
   case NL_PAIR:
-    fputc('(', out);
-    if (nl_writeq(scope, NL_HEAD(cell), result)) return 1;
-    tail = NL_NEXT(cell);
+    nl_port_putc(out, '(');
     for (;;) {
-      switch (tail->type) {
-      case NL_NIL:
-        fputc(')', out);
-        *result = cell;
-        return 0;
-      case NL_PAIR:
-        fputc(' ', out);
-        if (nl_writeq(scope, NL_HEAD_AT(tail), result)) return 1;
-        tail = NL_NEXT_AT(tail);
-        break;
-      case NL_INTEGER:
-        fprintf(out, " . %li)", tail->value.as_integer);
-        return 0;
-      case NL_SYMBOL:
-        fprintf(out, " . ");
-        nl_write_symbol(out, tail->value.as_symbol);
-        return 0;
-      }
+      if (nl_write_to(scope, out, NL_HEAD(cell))) return 1;
+      cell = NL_TAIL(cell);
+      if (!NL_IS_PAIR(cell)) break;
+      nl_port_putc(out, ' ');
+    }
+    if (NL_TYPE(cell) != NL_NIL) {
+      nl_port_write(out, " . ", 3);
+      if (nl_write_to(scope, out, cell)) return 1;
     }
+    nl_port_putc(out, ')');
+    return 0;
   }
-  *result = cell;
   scope->last_err = "unhandled type";
   return 1;
 }
+NL_BUILTIN(writeq) {
+  struct nl_port *out = nl_port_out(scope);
+  *result = cell;
+  return !out || nl_write_to(scope, out, cell);
+}
 NL_BUILTIN(write) {
-  if (cell.type != NL_PAIR) {
+  if (!NL_IS_PAIR(cell)) {
     scope->last_err = "illegal write call: non-pair args";
     return 1;
   }
@@ -749,64 +1391,89 @@ NL_BUILTIN(write) {
 }
 NL_BUILTIN(and) {
   struct nl_cell *tail;
-  if (cell.type != NL_PAIR) {
+  if (!NL_IS_PAIR(cell)) {
     scope->last_err = "illegal and: non-pair args";
     return 1;
   }
   NL_FOREACH(&cell, tail) {
+    if (!NL_IS_PAIR(NL_TAIL_AT(tail))) {
+      *result = NL_HEAD_AT(tail);
+      return NL_TAILCALL;
+    }
     if (nl_evalq(scope, NL_HEAD_AT(tail), result)) return 1;
-    if (result->type == NL_NIL) return 0;
+    if (NL_TYPE(*result) == NL_NIL) return 0;
   }
   return 0;
 }
 NL_BUILTIN(or) {
   struct nl_cell *tail;
-  if (cell.type != NL_PAIR) {
+  if (!NL_IS_PAIR(cell)) {
     scope->last_err = "illegal or: non-pair args";
     return 1;
   }
   NL_FOREACH(&cell, tail) {
+    if (!NL_IS_PAIR(NL_TAIL_AT(tail))) {
+      *result = NL_HEAD_AT(tail);
+      return NL_TAILCALL;
+    }
     if (nl_evalq(scope, NL_HEAD_AT(tail), result)) return 1;
-    if (result->type != NL_NIL) return 0;
+    if (NL_TYPE(*result) != NL_NIL) return 0;
   }
   return 0;
 }
-NL_BUILTIN(write_bytes) {
-  struct nl_cell *a, s_out;
-  FILE *out = stdout;
-  if (!nl_evalq(scope, nl_out, &s_out)
-      && s_out.type == NL_INTEGER)
-    out = (FILE *)s_out.value.as_integer;
-  switch (cell.type) {
-  case NL_INTEGER:
-    fputc((char)cell.value.as_integer, out);
+/**
+ * Write the bytes of a value: an integer is one byte, a symbol is its
+ * name, and a list or an int array is each of its items in turn
+ */
+static int nl_write_bytes_to(struct nl_scope *scope, struct nl_port *out, struct nl_cell cell) {
+  struct nl_cell *a;
+  int64_t i;
+  switch (NL_TYPE(cell)) {
   case NL_NIL:
-    *result = cell;
+    return 0;
+  case NL_INTEGER:
+    nl_port_putc(out, NL_INT(cell));
     return 0;
   case NL_SYMBOL:
-    return nl_evalq(scope, cell, result)
-      || nl_write_bytes(scope, *result, result);
+    nl_port_write(out, NL_SYM(cell), NL_SYMBOL_OF(NL_SYM(cell))->length);
+    return 0;
+  case NL_INTS:
+    for (i = 0; i < NL_INTS_OF(cell)->length; ++i)
+      nl_port_putc(out, NL_INTS_OF(cell)->items[i]);
+    return 0;
   case NL_PAIR:
     NL_FOREACH(&cell, a) {
-      if (nl_evalq(scope, NL_HEAD_AT(a), result)) return 1;
-      if (nl_write_bytes(scope, *result, result)) return 1;
+      if (nl_write_bytes_to(scope, out, NL_HEAD_AT(a))) return 1;
     }
-    return nl_write_bytes(scope, *a, result);
+    return nl_write_bytes_to(scope, out, *a);
+  default:
+    scope->last_err = "illegal write-bytes: expected integers, symbols, int arrays or lists of them";
+    return 1;
   }
-  scope->last_err = "unknown cell type";
-  return 1;
+}
+NL_BUILTIN(write_bytes) {
+  struct nl_port *out = nl_port_out(scope);
+  struct nl_cell *a;
+  *result = nil;
+  if (!out) return 1;
+  NL_FOREACH(&cell, a) {
+    if (nl_evalq(scope, NL_HEAD_AT(a), result)
+        || nl_write_bytes_to(scope, out, *result))
+      return 1;
+  }
+  return 0;
 }
 NL_BUILTIN(exit) {
   struct nl_cell exit_code;
-  if (cell.type == NL_NIL) exit(0);
-  if (cell.type != NL_PAIR) {
+  if (NL_TYPE(cell) == NL_NIL) exit(0);
+  if (!NL_IS_PAIR(cell)) {
     scope->last_err = "invalid exit: expected pair args";
     exit(1);
   }
   if (nl_evalq(scope, NL_HEAD(cell), &exit_code)) return 1;
-  switch (exit_code.type) {
+  switch (NL_TYPE(exit_code)) {
   case NL_NIL: exit(0);
-  case NL_INTEGER: exit(exit_code.value.as_integer);
+  case NL_INTEGER: exit(NL_INT(exit_code));
   default:
     scope->last_err = "invalid exit: expected integer exit code";
     exit(1);
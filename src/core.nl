@@ -16,10 +16,32 @@
   (nl_filter . filter)
   (nl_fold . fold)
   (nl_foreach . for-each)
+  (nl_hash . hash)
   (nl_head . head)
+  (nl_intsadd . ints-add)
+  (nl_intsdot . ints-dot)
+  (nl_intseq . ints=)
+  (nl_intsgt . ints>)
+  (nl_intslength . ints-length)
+  (nl_intslist . ints->list)
+  (nl_intslt . ints<)
+  (nl_intsmax . ints-max)
+  (nl_intsmin . ints-min)
+  (nl_intsmul . ints-mul)
+  (nl_intsprefixsum . ints-prefix-sum)
+  (nl_intsref . ints-ref)
+  (nl_intsset . ints-set)
+  (nl_intssub . ints-sub)
+  (nl_intssum . ints-sum)
   (nl_is_integer . integer?)
+  (nl_is_ints . ints?)
   (nl_length . length)
   (nl_list . list)
+  (nl_list_to_ints . list->ints)
+  (nl_list_to_vector . list->vector)
+  (nl_make_ints . make-ints)
+  (nl_make_table . make-table)
+  (nl_make_vector . make-vector)
   (nl_map . map)
   (nl_mappair . map-pair)
   (nl_is_nil . nil?)
@@ -28,23 +50,38 @@
   (nl_pair . pair)
   (nl_is_pair . pair?)
   (nl_print . print)
+  (nl_seq . seq)
+  (nl_is_seq . seq?)
+  (nl_seqdrop . seq-drop)
+  (nl_seqfilter . seq-filter)
+  (nl_seqlist . seq->list)
+  (nl_seqmap . seq-map)
+  (nl_seqrange . seq-range)
+  (nl_seqtake . seq-take)
+  (nl_sequnfold . seq-unfold)
   (nl_set . set)
   (nl_set_head . set-head)
   (nl_set_tail . set-tail)
   (nl_setq . setq)
   (nl_is_symbol . symbol?)
+  (nl_tablelist . table->list)
+  (nl_tablecount . table-count)
+  (nl_tableforeach . table-for-each)
+  (nl_tableget . table-get)
+  (nl_tableput . table-put)
+  (nl_tableremove . table-remove)
+  (nl_is_table . table?)
   (nl_tail . tail)
   (nl_unfold . unfold)
+  (nl_vector_to_list . vector->list)
+  (nl_vector_length . vector-length)
+  (nl_vector_ref . vector-ref)
+  (nl_vector_set . vector-set)
+  (nl_is_vector . vector?)
   (nl_write . write)
   (nl_write_bytes . write-bytes))
 (defq newline ()
   (write-bytes 10))
-(defq if IfThenElse
-  ('((@ Result)
-     (and @ (setq Result (eval (head (tail IfThenElse)))))
-     (or @ (setq Result (eval (head (tail (tail IfThenElse))))))
-     Result)
-   (eval (head IfThenElse))))
 (defq max Items
   (fold '((A B) (if (> A B) A B)) () (map eval Items)))
 (defq min Items
@@ -0,0 +1,601 @@
+#define _GNU_SOURCE
+#include "nl.h"
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#define NL_GC_SLOT_SIZE (2 * sizeof(struct nl_cell))
+#define NL_GC_BLOCK_SLOTS 2048
+#define NL_GC_BLOCK_SIZE (NL_GC_SLOT_SIZE * NL_GC_BLOCK_SLOTS)
+#define NL_GC_BITMAP_WORDS (NL_GC_BLOCK_SLOTS / 64)
+#define NL_GC_COMMIT_BLOCKS 16
+#define NL_GC_RESERVE ((size_t)1 << 36)
+#define NL_GC_RESERVE_MIN ((size_t)1 << 28)
+#define NL_GC_NURSERY_SLOTS (128 * 1024)
+#define NL_GC_MAJOR_MIN_SLOTS (1024 * 1024)
+#define NL_GC_REMEMBERED_MAX (64 * 1024)
+#define NL_GC_VERIFY_NURSERY_SLOTS 256
+_Static_assert(sizeof(struct nl_vector) <= NL_GC_SLOT_SIZE, "a vector header must fit a slot");
+_Static_assert(sizeof(struct nl_table) <= NL_GC_SLOT_SIZE, "a table header must fit a slot");
+_Static_assert(sizeof(struct nl_ints) <= NL_GC_SLOT_SIZE, "an int array header must fit a slot");
+/**
+ * The heap is one reserved range of address space, committed a few blocks
+ * at a time. Each block holds objects of a single kind: pairs (which a
+ * sequence is, under another type), or vector, table and int array
+ * headers, each of which takes one slot.
+ *
+ * The items of a vector or an int array and the entries of a table are
+ * malloc'd, and freed when the header is found to be dead. Headers are cleared as they
+ * are freed, so a header slot which owns memory is always an object which
+ * was alive at some point
+ */
+enum nl_gc_kind {
+  NL_GC_FREE,
+  NL_GC_PAIRS,
+  NL_GC_VECTORS,
+  NL_GC_TABLES,
+  NL_GC_INTS,
+};
+/**
+ * Slots which have survived a collection are old; the rest are either
+ * young (allocated since the last collection) or free. Old slots are
+ * never moved, and are only traced again by a major collection
+ */
+struct nl_gc_block {
+  uint64_t old[NL_GC_BITMAP_WORDS], mark[NL_GC_BITMAP_WORDS];
+  int kind, full, marked;
+};
+/**
+ * Slots of each kind are bump-allocated from runs of free slots
+ */
+struct nl_gc_space {
+  char *next, *limit;
+  size_t block, slot, size;
+  int kind;
+};
+/**
+ * A growable stack of words, for the mark stack and remembered sets
+ */
+struct nl_gc_stack {
+  uintptr_t *items;
+  size_t count, capacity;
+};
+struct nl_gc_roots {
+  struct nl_cell *cells;
+  size_t count;
+  struct nl_gc_roots *next;
+};
+struct nl_gc_pauses {
+  uint64_t *ns;
+  size_t count, capacity;
+};
+static char *nl_gc_lo, *nl_gc_hi, *nl_gc_end, *nl_gc_stack_top;
+static struct nl_gc_block *nl_gc_blocks;
+static size_t nl_gc_nblocks;
+static struct nl_gc_space nl_gc_pairs = { NULL, NULL, 0, 0, 1, NL_GC_PAIRS };
+static struct nl_gc_space nl_gc_vectors = { NULL, NULL, 0, 0, 1, NL_GC_VECTORS };
+static struct nl_gc_space nl_gc_tables = { NULL, NULL, 0, 0, 1, NL_GC_TABLES };
+static struct nl_gc_space nl_gc_ints = { NULL, NULL, 0, 0, 1, NL_GC_INTS };
+static uint64_t nl_gc_allocations_total;
+static size_t nl_gc_allocated, nl_gc_old_slots, nl_gc_major_threshold = NL_GC_MAJOR_MIN_SLOTS;
+static size_t nl_gc_old_buffers, nl_gc_nursery_slots = NL_GC_NURSERY_SLOTS;
+static int nl_gc_major, nl_gc_verifying;
+/**
+ * remembered holds cells which may point to young objects from outside
+ * the young generation; rescan holds slots which were found on the C
+ * stack, and so may have been written through a C pointer since.
+ * young_owners holds the vectors, tables and int arrays allocated since the last
+ * collection, and retired holds memory to free once it is over
+ */
+static struct nl_gc_stack nl_gc_mark_stack, nl_gc_marked_blocks, nl_gc_young_owners;
+static struct nl_gc_stack nl_gc_remembered, nl_gc_rescan, nl_gc_next_rescan, nl_gc_retired;
+static struct nl_gc_roots *nl_gc_roots;
+static struct nl_gc_pauses nl_gc_minor_pauses, nl_gc_major_pauses;
+static void nl_gc_push(struct nl_gc_stack *stack, uintptr_t item) {
+  if (stack->count == stack->capacity) {
+    stack->capacity = stack->capacity ? stack->capacity * 2 : 1024;
+    stack->items = realloc(stack->items, stack->capacity * sizeof(*stack->items));
+  }
+  stack->items[stack->count++] = item;
+}
+void nl_gc_init() {
+  pthread_attr_t attr;
+  size_t size = NL_GC_RESERVE;
+  void *addr;
+  char *verify;
+  if (nl_gc_lo) return;
+  while ((nl_gc_lo = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0)) == MAP_FAILED) {
+    if ((size /= 2) < NL_GC_RESERVE_MIN) {
+      fputs("nl: cannot reserve heap\n", stderr);
+      abort();
+    }
+  }
+  nl_gc_hi = nl_gc_lo;
+  nl_gc_end = nl_gc_lo + size;
+  pthread_getattr_np(pthread_self(), &attr);
+  pthread_attr_getstack(&attr, &addr, &size);
+  pthread_attr_destroy(&attr);
+  nl_gc_stack_top = (char *)addr + size;
+  // Collect far more often, checking the barrier each time
+  if ((verify = getenv("NL_GC_VERIFY"))) {
+    nl_gc_verifying = 1;
+    nl_gc_nursery_slots = strtol(verify, NULL, 10) > 0 ? strtol(verify, NULL, 10) : NL_GC_VERIFY_NURSERY_SLOTS;
+  }
+}
+/**
+ * Commit some more blocks at the end of the heap
+ */
+static void nl_gc_grow() {
+  size_t n = NL_GC_COMMIT_BLOCKS;
+  if (nl_gc_hi + n * NL_GC_BLOCK_SIZE > nl_gc_end
+      || mprotect(nl_gc_hi, n * NL_GC_BLOCK_SIZE, PROT_READ | PROT_WRITE)) {
+    fputs("nl: out of memory\n", stderr);
+    abort();
+  }
+  nl_gc_blocks = realloc(nl_gc_blocks, (nl_gc_nblocks + n) * sizeof(*nl_gc_blocks));
+  memset(nl_gc_blocks + nl_gc_nblocks, 0, n * sizeof(*nl_gc_blocks));
+  nl_gc_nblocks += n;
+  nl_gc_hi += n * NL_GC_BLOCK_SIZE;
+}
+/**
+ * Find the next run of free slots for the given space, collecting first
+ * if enough has been allocated since the last collection
+ */
+static void nl_gc_refill(struct nl_gc_space *space) {
+  struct nl_gc_block *b;
+  size_t start, end;
+  if (nl_gc_allocated >= nl_gc_nursery_slots || nl_gc_remembered.count >= NL_GC_REMEMBERED_MAX)
+    nl_gc_collect(0);
+  for (;; ++space->block, space->slot = 0) {
+    if (space->block == nl_gc_nblocks) nl_gc_grow();
+    b = &nl_gc_blocks[space->block];
+    if (b->kind == NL_GC_FREE) b->kind = space->kind;
+    if (b->kind != space->kind || b->full) continue;
+    for (start = space->slot; start < NL_GC_BLOCK_SLOTS
+           && b->old[start / 64] & (1ULL << start % 64); ++start);
+    for (end = start; end < NL_GC_BLOCK_SLOTS
+           && !(b->old[end / 64] & (1ULL << end % 64)); ++end);
+    if (start == end) continue;
+    if (end - start > nl_gc_nursery_slots) end = start + nl_gc_nursery_slots;
+    space->slot = end;
+    space->next = nl_gc_lo + (space->block * NL_GC_BLOCK_SLOTS + start) * NL_GC_SLOT_SIZE;
+    space->limit = space->next + (end - start) * NL_GC_SLOT_SIZE;
+    // The block may have held pairs before, which would look like items
+    if (space->kind == NL_GC_VECTORS || space->kind == NL_GC_TABLES || space->kind == NL_GC_INTS)
+      memset(space->next, 0, space->limit - space->next);
+    nl_gc_allocated += end - start;
+    return;
+  }
+}
+static inline void *nl_gc_alloc(struct nl_gc_space *space) {
+  void *p;
+  if (space->next == space->limit) nl_gc_refill(space);
+  p = space->next;
+  space->next += space->size * NL_GC_SLOT_SIZE;
+  ++nl_gc_allocations_total;
+  return p;
+}
+uint64_t nl_gc_allocations() {
+  return nl_gc_allocations_total;
+}
+struct nl_cell *nl_gc_alloc_pair() {
+  return nl_gc_alloc(&nl_gc_pairs);
+}
+struct nl_vector *nl_gc_alloc_vector(int64_t length) {
+  struct nl_vector *vector;
+  nl_gc_allocated += length * sizeof(struct nl_cell) / NL_GC_SLOT_SIZE;
+  vector = nl_gc_alloc(&nl_gc_vectors);
+  vector->length = length;
+  vector->items = calloc(length ? length : 1, sizeof(struct nl_cell));
+  nl_gc_push(&nl_gc_young_owners, (uintptr_t)vector);
+  return vector;
+}
+struct nl_table *nl_gc_alloc_table() {
+  struct nl_table *table = nl_gc_alloc(&nl_gc_tables);
+  nl_gc_push(&nl_gc_young_owners, (uintptr_t)table);
+  return table;
+}
+struct nl_ints *nl_gc_alloc_ints(int64_t length) {
+  struct nl_ints *ints;
+  nl_gc_allocated += length * sizeof(int64_t) / NL_GC_SLOT_SIZE;
+  ints = nl_gc_alloc(&nl_gc_ints);
+  ints->length = length;
+  ints->items = calloc(length ? length : 1, sizeof(int64_t));
+  nl_gc_push(&nl_gc_young_owners, (uintptr_t)ints);
+  return ints;
+}
+void nl_gc_free_later(void *p) {
+  nl_gc_push(&nl_gc_retired, (uintptr_t)p);
+}
+/**
+ * Whether the given address is inside a slot allocated since the last
+ * collection. Addresses outside the heap are never young
+ */
+static inline int nl_gc_is_young(void *p) {
+  size_t slot;
+  if ((char *)p < nl_gc_lo || (char *)p >= nl_gc_hi) return 0;
+  slot = ((char *)p - nl_gc_lo) / NL_GC_SLOT_SIZE;
+  return !(nl_gc_blocks[slot / NL_GC_BLOCK_SLOTS].old[slot % NL_GC_BLOCK_SLOTS / 64]
+           & (1ULL << slot % 64));
+}
+/**
+ * The collected object a cell refers to, if any
+ */
+static inline void *nl_gc_object_of(struct nl_cell value) {
+  return NL_IS_PAIR(value) ? (void *)NL_PAIR_OF(value)
+    : NL_TYPE(value) == NL_SEQ ? (void *)NL_SEQ_OF(value)
+    : NL_TYPE(value) == NL_VECTOR ? (void *)NL_VECTOR_OF(value)
+    : NL_TYPE(value) == NL_TABLE ? (void *)NL_TABLE_OF(value)
+    : NL_TYPE(value) == NL_INTS ? (void *)NL_INTS_OF(value) : NULL;
+}
+void nl_gc_write(struct nl_cell *slot, struct nl_cell value) {
+  void *p = nl_gc_object_of(value);
+  *slot = value;
+  if (p && nl_gc_is_young(p) && !nl_gc_is_young(slot)) {
+    nl_gc_push(&nl_gc_remembered, (uintptr_t)slot);
+    // Collect at the next allocation, rather than let the set grow
+    if (nl_gc_remembered.count >= NL_GC_REMEMBERED_MAX)
+      nl_gc_pairs.limit = nl_gc_pairs.next, nl_gc_vectors.limit = nl_gc_vectors.next,
+        nl_gc_tables.limit = nl_gc_tables.next, nl_gc_ints.limit = nl_gc_ints.next;
+  }
+}
+void nl_gc_add_roots(struct nl_cell *cells, size_t count) {
+  struct nl_gc_roots *roots = malloc(sizeof(*roots));
+  roots->cells = cells;
+  roots->count = count;
+  roots->next = nl_gc_roots;
+  nl_gc_roots = roots;
+}
+int nl_gc_is_live(void *p) {
+  struct nl_gc_block *b;
+  size_t slot;
+  uint64_t bit;
+  if ((char *)p < nl_gc_lo || (char *)p >= nl_gc_hi) return 1;
+  slot = ((char *)p - nl_gc_lo) / NL_GC_SLOT_SIZE;
+  b = &nl_gc_blocks[slot / NL_GC_BLOCK_SLOTS];
+  bit = 1ULL << slot % 64;
+  if (b->mark[slot % NL_GC_BLOCK_SLOTS / 64] & bit) return 1;
+  return !nl_gc_major && (b->old[slot % NL_GC_BLOCK_SLOTS / 64] & bit);
+}
+/**
+ * Mark the object containing the given address, if it is in a block of
+ * the given kind, and queue it to have its fields traced. A minor
+ * collection stops at old objects, unless they are being forced (found
+ * on the stack)
+ */
+static void nl_gc_mark(void *p, int kind, int force) {
+  struct nl_gc_block *b;
+  size_t slot, i;
+  uint64_t bit;
+  if ((char *)p < nl_gc_lo || (char *)p >= nl_gc_hi) return;
+  slot = ((char *)p - nl_gc_lo) / NL_GC_SLOT_SIZE;
+  b = &nl_gc_blocks[slot / NL_GC_BLOCK_SLOTS];
+  if (b->kind == NL_GC_FREE || (kind && b->kind != kind)) return;
+  i = slot % NL_GC_BLOCK_SLOTS / 64;
+  bit = 1ULL << slot % 64;
+  if (b->mark[i] & bit) return;
+  if (!nl_gc_major && !force && (b->old[i] & bit)) return;
+  b->mark[i] |= bit;
+  if (!b->marked) {
+    b->marked = 1;
+    nl_gc_push(&nl_gc_marked_blocks, slot / NL_GC_BLOCK_SLOTS);
+  }
+  nl_gc_push(&nl_gc_mark_stack, slot);
+}
+void nl_gc_mark_cell(struct nl_cell cell) {
+  if (NL_IS_PAIR(cell)) nl_gc_mark(NL_PAIR_OF(cell), NL_GC_PAIRS, 0);
+  else if (NL_TYPE(cell) == NL_SEQ) nl_gc_mark(NL_SEQ_OF(cell), NL_GC_PAIRS, 0);
+  else if (NL_TYPE(cell) == NL_VECTOR) nl_gc_mark(NL_VECTOR_OF(cell), NL_GC_VECTORS, 0);
+  else if (NL_TYPE(cell) == NL_TABLE) nl_gc_mark(NL_TABLE_OF(cell), NL_GC_TABLES, 0);
+  else if (NL_TYPE(cell) == NL_INTS) nl_gc_mark(NL_INTS_OF(cell), NL_GC_INTS, 0);
+}
+static void nl_gc_trace(size_t slot) {
+  struct nl_cell *pair = (struct nl_cell *)(nl_gc_lo + slot * NL_GC_SLOT_SIZE);
+  struct nl_vector *vector = (struct nl_vector *)pair;
+  int64_t i;
+  switch (nl_gc_blocks[slot / NL_GC_BLOCK_SLOTS].kind) {
+  case NL_GC_PAIRS:
+    nl_gc_mark_cell(pair[0]);
+    nl_gc_mark_cell(pair[1]);
+    break;
+  case NL_GC_VECTORS:
+    // A stale slot found on the stack may have been freed already
+    if (!vector->items) break;
+    for (i = 0; i < vector->length; ++i)
+      nl_gc_mark_cell(vector->items[i]);
+    break;
+  case NL_GC_TABLES:
+    nl_table_mark((struct nl_table *)pair);
+    break;
+  }
+}
+static void nl_gc_drain() {
+  while (nl_gc_mark_stack.count)
+    nl_gc_trace(nl_gc_mark_stack.items[--nl_gc_mark_stack.count]);
+}
+/**
+ * Any word on the C stack (or in a register) which points into a slot
+ * keeps it alive. Those slots are traced even if they are old, and again
+ * by the next collection, since C code may be writing into them through
+ * the pointer without a barrier
+ */
+static void __attribute__((noinline, no_sanitize_address)) nl_gc_scan_stack() {
+  jmp_buf regs;
+  uintptr_t *p, slot;
+  int kind;
+  __builtin_unwind_init();
+  setjmp(regs);
+  for (p = (uintptr_t *)((uintptr_t)&regs & ~(uintptr_t)7); p < (uintptr_t *)nl_gc_stack_top; ++p) {
+    if ((char *)*p < nl_gc_lo || (char *)*p >= nl_gc_hi) continue;
+    slot = ((char *)*p - nl_gc_lo) / NL_GC_SLOT_SIZE;
+    kind = nl_gc_blocks[slot / NL_GC_BLOCK_SLOTS].kind;
+    if (kind == NL_GC_FREE) continue;
+    nl_gc_push(&nl_gc_next_rescan, slot);
+    nl_gc_mark((void *)*p, 0, 1);
+  }
+}
+static int nl_gc_compare_words(const void *a, const void *b) {
+  uintptr_t x = *(const uintptr_t *)a, y = *(const uintptr_t *)b;
+  return x < y ? -1 : x > y;
+}
+static int nl_gc_contains(struct nl_gc_stack *sorted, uintptr_t item) {
+  return bsearch(&item, sorted->items, sorted->count, sizeof(*sorted->items), nl_gc_compare_words) != NULL;
+}
+/**
+ * Abort if a cell outside the young generation refers to a young object
+ * without having been remembered
+ */
+static void nl_gc_verify_cell(struct nl_cell *cell, void *data) {
+  void *p = nl_gc_object_of(*cell);
+  if (p && nl_gc_is_young(p) && !nl_gc_contains(&nl_gc_remembered, (uintptr_t)cell)) {
+    fprintf(stderr, "nl: %s at %p refers to young %p, but was stored without nl_gc_write\n",
+            (const char *)data, (void *)cell, p);
+    abort();
+  }
+}
+static void nl_gc_verify_symbol(char *sym, void *data) {
+  nl_gc_verify_cell(&NL_SYMBOL_OF(sym)->value, "the value of a symbol");
+}
+/**
+ * With NL_GC_VERIFY set, check before each minor collection what the
+ * barrier is there to keep true: every reference to a young object from
+ * an old one, a symbol or a root was remembered, unless the old object
+ * was found on the C stack, and so is traced again anyway. A store made
+ * without nl_gc_write is caught by the first collection after it, which
+ * comes soon, since the nursery shrinks to NL_GC_VERIFY slots (or 256)
+ */
+static void nl_gc_verify() {
+  struct nl_gc_block *b;
+  struct nl_gc_roots *roots;
+  struct nl_cell *cells;
+  struct nl_vector *vector;
+  size_t i, slot;
+  qsort(nl_gc_remembered.items, nl_gc_remembered.count, sizeof(uintptr_t), nl_gc_compare_words);
+  qsort(nl_gc_rescan.items, nl_gc_rescan.count, sizeof(uintptr_t), nl_gc_compare_words);
+  qsort(nl_gc_next_rescan.items, nl_gc_next_rescan.count, sizeof(uintptr_t), nl_gc_compare_words);
+  for (slot = 0; slot < nl_gc_nblocks * NL_GC_BLOCK_SLOTS; ++slot) {
+    b = &nl_gc_blocks[slot / NL_GC_BLOCK_SLOTS];
+    if (!(b->old[slot % NL_GC_BLOCK_SLOTS / 64] & (1ULL << slot % 64))
+        || nl_gc_contains(&nl_gc_rescan, slot) || nl_gc_contains(&nl_gc_next_rescan, slot))
+      continue;
+    cells = (struct nl_cell *)(nl_gc_lo + slot * NL_GC_SLOT_SIZE);
+    vector = (struct nl_vector *)cells;
+    if (b->kind == NL_GC_PAIRS) {
+      nl_gc_verify_cell(&cells[0], "a pair");
+      nl_gc_verify_cell(&cells[1], "a pair");
+    } else if (b->kind == NL_GC_VECTORS && vector->items) {
+      for (i = 0; i < (size_t)vector->length; ++i)
+        nl_gc_verify_cell(&vector->items[i], "a vector item");
+    } else if (b->kind == NL_GC_TABLES) {
+      nl_table_cells((struct nl_table *)cells, nl_gc_verify_cell, "a table entry");
+    }
+  }
+  nl_intern_foreach(nl_gc_verify_symbol, NULL);
+  for (roots = nl_gc_roots; roots; roots = roots->next)
+    for (i = 0; i < roots->count; ++i)
+      nl_gc_verify_cell(&roots->cells[i], "a root");
+}
+static void nl_gc_mark_symbol(char *sym, void *data) {
+  nl_gc_mark_cell(NL_SYMBOL_OF(sym)->value);
+}
+static void nl_gc_record(struct nl_gc_pauses *pauses, uint64_t ns) {
+  if (pauses->count == pauses->capacity) {
+    pauses->capacity = pauses->capacity ? pauses->capacity * 2 : 64;
+    pauses->ns = realloc(pauses->ns, pauses->capacity * sizeof(*pauses->ns));
+  }
+  pauses->ns[pauses->count++] = ns;
+}
+static uint64_t nl_gc_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+/**
+ * Bytes held by old objects, including the items of old vectors and int
+ * arrays, and the entries of old tables (as of the collection which found them)
+ */
+static size_t nl_gc_old_bytes() {
+  return nl_gc_old_slots * NL_GC_SLOT_SIZE + nl_gc_old_buffers;
+}
+/**
+ * Free the memory owned by the vector, table or int array in the given
+ * slot, if it did not survive
+ */
+static void nl_gc_sweep_owner(size_t slot) {
+  void *p = nl_gc_lo + slot * NL_GC_SLOT_SIZE;
+  struct nl_vector *vector = p;
+  struct nl_table *table = p;
+  struct nl_ints *ints = p;
+  struct nl_gc_block *b = &nl_gc_blocks[slot / NL_GC_BLOCK_SLOTS];
+  uint64_t bit = 1ULL << slot % 64;
+  int live = (b->mark[slot % NL_GC_BLOCK_SLOTS / 64] & bit) != 0;
+  if (!live && !nl_gc_major && (b->old[slot % NL_GC_BLOCK_SLOTS / 64] & bit)) return;
+  if (b->kind == NL_GC_VECTORS && vector->items) {
+    if (live) {
+      nl_gc_old_buffers += vector->length * sizeof(struct nl_cell);
+    } else {
+      free(vector->items);
+      vector->items = NULL;
+    }
+  } else if (b->kind == NL_GC_TABLES) {
+    if (live)
+      nl_gc_old_buffers += nl_table_bytes(table);
+    else
+      nl_table_free(table);
+  } else if (b->kind == NL_GC_INTS && ints->items) {
+    if (live) {
+      nl_gc_old_buffers += ints->length * sizeof(int64_t);
+    } else {
+      free(ints->items);
+      ints->items = NULL;
+    }
+  }
+}
+/**
+ * Free the memory owned by vectors, tables and int arrays which did not
+ * survive. A minor collection only has to look at those allocated since
+ * the last one
+ */
+static void nl_gc_sweep_owners() {
+  size_t i, slot;
+  if (nl_gc_major) {
+    nl_gc_old_buffers = 0;
+    for (i = 0; i < nl_gc_nblocks; ++i) {
+      if (nl_gc_blocks[i].kind != NL_GC_VECTORS && nl_gc_blocks[i].kind != NL_GC_TABLES
+          && nl_gc_blocks[i].kind != NL_GC_INTS) continue;
+      for (slot = i * NL_GC_BLOCK_SLOTS; slot < (i + 1) * NL_GC_BLOCK_SLOTS; ++slot)
+        nl_gc_sweep_owner(slot);
+    }
+  } else {
+    for (i = 0; i < nl_gc_young_owners.count; ++i)
+      nl_gc_sweep_owner(((char *)nl_gc_young_owners.items[i] - nl_gc_lo) / NL_GC_SLOT_SIZE);
+  }
+  nl_gc_young_owners.count = 0;
+  for (i = 0; i < nl_gc_retired.count; ++i)
+    free((void *)nl_gc_retired.items[i]);
+  nl_gc_retired.count = 0;
+}
+void nl_gc_collect(int major) {
+  struct nl_gc_block *b;
+  struct nl_gc_roots *roots;
+  struct nl_gc_stack swap;
+  uint64_t start = nl_gc_now(), promoted = 0;
+  size_t i, j;
+  int full;
+  nl_gc_major = major;
+  nl_gc_next_rescan.count = 0;
+  nl_gc_scan_stack();
+  if (nl_gc_verifying && !major) nl_gc_verify();
+  nl_vm_roots();
+  nl_scope_roots();
+  nl_profile_roots();
+  if (major) {
+    nl_intern_foreach(nl_gc_mark_symbol, NULL);
+    for (roots = nl_gc_roots; roots; roots = roots->next)
+      for (i = 0; i < roots->count; ++i)
+        nl_gc_mark_cell(roots->cells[i]);
+  } else {
+    for (i = 0; i < nl_gc_remembered.count; ++i)
+      nl_gc_mark_cell(*(struct nl_cell *)nl_gc_remembered.items[i]);
+    for (i = 0; i < nl_gc_rescan.count; ++i)
+      nl_gc_trace(nl_gc_rescan.items[i]);
+  }
+  nl_gc_drain();
+  nl_vm_sweep();
+  nl_share_sweep(major);
+  nl_gc_sweep_owners();
+  // Marked slots become old; anything young and unmarked is now free
+  if (major) {
+    nl_gc_old_slots = 0;
+    for (i = 0; i < nl_gc_nblocks; ++i) {
+      b = &nl_gc_blocks[i];
+      for (j = 0, full = 1; j < NL_GC_BITMAP_WORDS; ++j) {
+        b->old[j] = b->mark[j];
+        b->mark[j] = 0;
+        nl_gc_old_slots += __builtin_popcountll(b->old[j]);
+        full &= b->old[j] == ~0ULL;
+      }
+      b->full = full;
+      b->marked = 0;
+      for (j = 0; j < NL_GC_BITMAP_WORDS && !b->old[j]; ++j);
+      if (j == NL_GC_BITMAP_WORDS) b->kind = NL_GC_FREE;
+    }
+    nl_gc_major_threshold = 2 * nl_gc_old_bytes() / NL_GC_SLOT_SIZE;
+    if (nl_gc_major_threshold < NL_GC_MAJOR_MIN_SLOTS)
+      nl_gc_major_threshold = NL_GC_MAJOR_MIN_SLOTS;
+  } else {
+    for (i = 0; i < nl_gc_marked_blocks.count; ++i) {
+      b = &nl_gc_blocks[nl_gc_marked_blocks.items[i]];
+      for (j = 0, full = 1; j < NL_GC_BITMAP_WORDS; ++j) {
+        promoted += __builtin_popcountll(b->mark[j] & ~b->old[j]);
+        b->old[j] |= b->mark[j];
+        b->mark[j] = 0;
+        full &= b->old[j] == ~0ULL;
+      }
+      b->full = full;
+      b->marked = 0;
+    }
+    nl_gc_old_slots += promoted;
+  }
+  nl_gc_marked_blocks.count = 0;
+  nl_gc_remembered.count = 0;
+  swap = nl_gc_rescan;
+  nl_gc_rescan = nl_gc_next_rescan;
+  nl_gc_next_rescan = swap;
+  nl_gc_pairs.next = nl_gc_pairs.limit = NULL;
+  nl_gc_pairs.block = nl_gc_pairs.slot = 0;
+  nl_gc_vectors.next = nl_gc_vectors.limit = NULL;
+  nl_gc_vectors.block = nl_gc_vectors.slot = 0;
+  nl_gc_tables.next = nl_gc_tables.limit = NULL;
+  nl_gc_tables.block = nl_gc_tables.slot = 0;
+  nl_gc_ints.next = nl_gc_ints.limit = NULL;
+  nl_gc_ints.block = nl_gc_ints.slot = 0;
+  nl_gc_allocated = 0;
+  nl_gc_record(major ? &nl_gc_major_pauses : &nl_gc_minor_pauses, nl_gc_now() - start);
+  if (!major && nl_gc_old_bytes() / NL_GC_SLOT_SIZE > nl_gc_major_threshold)
+    nl_gc_collect(1);
+}
+static int nl_gc_compare_ns(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+/**
+ * Summarize pauses as (name count total max p99), in microseconds
+ */
+static struct nl_cell nl_gc_summary(const char *name, struct nl_gc_pauses *pauses) {
+  uint64_t total = 0, max = 0, p99 = 0, *sorted;
+  size_t i;
+  for (i = 0; i < pauses->count; ++i) {
+    total += pauses->ns[i];
+    if (pauses->ns[i] > max) max = pauses->ns[i];
+  }
+  if (pauses->count) {
+    sorted = malloc(pauses->count * sizeof(*sorted));
+    memcpy(sorted, pauses->ns, pauses->count * sizeof(*sorted));
+    qsort(sorted, pauses->count, sizeof(*sorted), nl_gc_compare_ns);
+    p99 = sorted[(pauses->count * 99 + 99) / 100 - 1];
+    free(sorted);
+  }
+  return nl_cell_as_pair(nl_cell_as_symbol(nl_intern_bytes(name, strlen(name))),
+         nl_cell_as_pair(nl_cell_as_int(pauses->count),
+         nl_cell_as_pair(nl_cell_as_int(total / 1000),
+         nl_cell_as_pair(nl_cell_as_int(max / 1000),
+         nl_cell_as_pair(nl_cell_as_int(p99 / 1000), nl_cell_as_nil())))));
+}
+NL_BUILTIN(gc) {
+  nl_gc_collect(1);
+  *result = nl_cell_as_int(nl_gc_old_bytes());
+  return 0;
+}
+NL_BUILTIN(gcstats) {
+  struct nl_cell heap = nl_cell_as_pair(nl_cell_as_symbol(nl_intern_bytes("heap", 4)),
+                        nl_cell_as_pair(nl_cell_as_int(nl_gc_hi - nl_gc_lo),
+                        nl_cell_as_pair(nl_cell_as_int(nl_gc_old_bytes()),
+                                        nl_cell_as_nil())));
+  struct nl_cell minor = nl_gc_summary("minor", &nl_gc_minor_pauses);
+  struct nl_cell major = nl_gc_summary("major", &nl_gc_major_pauses);
+  *result = nl_cell_as_pair(minor, nl_cell_as_pair(major, nl_cell_as_pair(heap, nl_cell_as_nil())));
+  return 0;
+}
@@ -0,0 +1,576 @@
+#include "nl.h"
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define NL_IMAGE_MAGIC "nlimage5"
+#define NL_IMAGE_NONE UINT64_MAX
+/**
+ * Image-only cell types, for integers which are really pointers, and
+ * have to be resolved again when the image is loaded
+ */
+#define NL_IMAGE_NATIVE (NL_SEQ + 1)
+#define NL_IMAGE_STREAM (NL_SEQ + 2)
+/**
+ * In an image, every cell but an integer is a type and an index
+ */
+#ifdef NL_TAGGED_CELLS
+#define NL_IMAGE_TYPE(cell) (NL_TYPE(cell) == NL_INTEGER ? NL_INTEGER : (int)((cell).bits >> 1 & 15))
+#define NL_IMAGE_INDEX(cell) ((uint64_t)(cell).bits >> 5)
+static struct nl_cell nl_image_ref(int type, uint64_t index) {
+  struct nl_cell c;
+  c.bits = index << 5 | type << 1;
+  return c;
+}
+#else
+#define NL_IMAGE_TYPE(cell) ((int)(cell).type)
+#define NL_IMAGE_INDEX(cell) ((uint64_t)(cell).value.as_integer)
+static struct nl_cell nl_image_ref(int type, uint64_t index) {
+  struct nl_cell c;
+  c.type = type;
+  c.value.as_integer = index;
+  return c;
+}
+#endif
+/**
+ * An image is this header, followed by the pairs, the symbols, the
+ * native functions, the vectors and tables and their items, and the
+ * bytes of the names. The pairs are laid out exactly as live pairs are,
+ * but with indexes in place of pointers, so they can be relocated in
+ * place once the image is mapped. Vectors are copied into the heap
+ * instead, and tables are filled again from their keys and values. The
+ * items of an int array are stored as they are, one to a cell
+ */
+struct nl_image_header {
+  char magic[8];
+  uint64_t cell_size, npairs, nsymbols, nnatives, nvectors, nitems, nbytes;
+};
+struct nl_image_symbol {
+  uint64_t name, length;
+  struct nl_cell value;
+};
+struct nl_image_native {
+  uint64_t name, library;
+};
+struct nl_image_vector {
+  uint64_t type, item, length;
+};
+/**
+ * Open-addressing map from pointers to indexes, using linear probing
+ */
+struct nl_image_map {
+  void **keys;
+  uint64_t *values;
+  size_t count, capacity;
+};
+struct nl_image_writer {
+  struct nl_image_map symbol_index, pair_index, native_index, vector_index;
+  struct nl_cell *pairs, **pending, *items;
+  struct nl_image_symbol *symbols;
+  struct nl_image_native *natives;
+  struct nl_cell *pending_vectors;
+  struct nl_image_vector *vectors;
+  char *bytes;
+  size_t npairs, nsymbols, nnatives, nvectors, nitems, nbytes;
+  size_t pairs_capacity, symbols_capacity, natives_capacity, vectors_capacity, items_capacity, bytes_capacity;
+};
+static size_t nl_image_slot(struct nl_image_map *map, void *key) {
+  size_t i = ((uintptr_t)key >> 3) * 11400714819323198485ULL >> 32;
+  for (i &= map->capacity - 1;
+       map->keys[i] && map->keys[i] != key;
+       i = (i + 1) & (map->capacity - 1));
+  return i;
+}
+static int nl_image_map_get(struct nl_image_map *map, void *key, uint64_t *value) {
+  size_t i;
+  if (!map->capacity) return 0;
+  i = nl_image_slot(map, key);
+  if (!map->keys[i]) return 0;
+  *value = map->values[i];
+  return 1;
+}
+static void nl_image_map_put(struct nl_image_map *map, void *key, uint64_t value) {
+  struct nl_image_map old = *map;
+  size_t i;
+  if (2 * (map->count + 1) > map->capacity) {
+    map->capacity = old.capacity ? old.capacity * 2 : 1024;
+    map->keys = calloc(map->capacity, sizeof(*map->keys));
+    map->values = malloc(map->capacity * sizeof(*map->values));
+    for (i = 0; i < old.capacity; ++i)
+      if (old.keys[i]) {
+        size_t j = nl_image_slot(map, old.keys[i]);
+        map->keys[j] = old.keys[i];
+        map->values[j] = old.values[i];
+      }
+    free(old.keys);
+    free(old.values);
+  }
+  i = nl_image_slot(map, key);
+  if (!map->keys[i]) ++map->count;
+  map->keys[i] = key;
+  map->values[i] = value;
+}
+static void nl_image_map_free(struct nl_image_map *map) {
+  free(map->keys);
+  free(map->values);
+}
+/**
+ * Make room for one more item in the given array, doubling as needed
+ */
+static void *nl_image_reserve(void *items, size_t *capacity, size_t count, size_t size) {
+  if (count < *capacity) return items;
+  *capacity = *capacity ? *capacity * 2 : 256;
+  return realloc(items, *capacity * size);
+}
+static uint64_t nl_image_bytes(struct nl_image_writer *w, const char *bytes, size_t length) {
+  uint64_t offset = w->nbytes;
+  while (w->nbytes + length + 1 > w->bytes_capacity)
+    w->bytes = nl_image_reserve(w->bytes, &w->bytes_capacity, w->bytes_capacity, 1);
+  memcpy(w->bytes + w->nbytes, bytes, length);
+  w->bytes[w->nbytes + length] = 0;
+  w->nbytes += length + 1;
+  return offset;
+}
+static void nl_image_add_symbol(char *sym, void *data) {
+  struct nl_image_writer *w = data;
+  struct nl_image_symbol *s;
+  w->symbols = nl_image_reserve(w->symbols, &w->symbols_capacity, w->nsymbols, sizeof(*w->symbols));
+  s = &w->symbols[w->nsymbols];
+  s->length = NL_SYMBOL_OF(sym)->length;
+  s->name = nl_image_bytes(w, sym, s->length);
+  s->value = NL_SYMBOL_OF(sym)->value;
+  nl_image_map_put(&w->symbol_index, sym, w->nsymbols++);
+}
+static uint64_t nl_image_add_native(struct nl_image_writer *w, nl_native_func func) {
+  struct nl_image_native *n;
+  char *name = nl_native_name(func), *library = nl_native_library(func);
+  uint64_t i;
+  if (nl_image_map_get(&w->native_index, (void *)func, &i)) return i;
+  w->natives = nl_image_reserve(w->natives, &w->natives_capacity, w->nnatives, sizeof(*w->natives));
+  n = &w->natives[w->nnatives];
+  n->name = nl_image_bytes(w, name, strlen(name));
+  n->library = library ? nl_image_bytes(w, library, strlen(library)) : NL_IMAGE_NONE;
+  nl_image_map_put(&w->native_index, (void *)func, w->nnatives);
+  return w->nnatives++;
+}
+/**
+ * Encode a cell for the image. Pairs are numbered as they are first
+ * seen, and queued to be encoded in turn
+ */
+static struct nl_cell nl_image_encode(struct nl_image_writer *w, struct nl_cell cell) {
+  uint64_t i = 0;
+  void *p;
+  switch (NL_TYPE(cell)) {
+  case NL_NIL:
+    break;
+  case NL_INTEGER:
+    if ((FILE *)NL_INT(cell) == stdin
+        || (struct nl_port *)NL_INT(cell) == &nl_stdout_port
+        || (struct nl_port *)NL_INT(cell) == &nl_stderr_port) {
+      return nl_image_ref(NL_IMAGE_STREAM, (FILE *)NL_INT(cell) == stdin ? 0
+                          : (struct nl_port *)NL_INT(cell) == &nl_stdout_port ? 1 : 2);
+    } else if (nl_native_name((nl_native_func)NL_INT(cell))) {
+      return nl_image_ref(NL_IMAGE_NATIVE, nl_image_add_native(w, (nl_native_func)NL_INT(cell)));
+    }
+    return cell;
+  case NL_SYMBOL:
+    nl_image_map_get(&w->symbol_index, NL_SYM(cell), &i);
+    break;
+  case NL_PAIR:
+  case NL_SEQ:
+    // A sequence is saved as the pair it points at, under its own type
+    p = NL_IS_PAIR(cell) ? NL_PAIR_OF(cell) : NL_SEQ_OF(cell);
+    if (!nl_image_map_get(&w->pair_index, p, &i)) {
+      i = w->npairs;
+      w->pending = nl_image_reserve(w->pending, &w->pairs_capacity, w->npairs, sizeof(*w->pending));
+      w->pending[w->npairs++] = p;
+      nl_image_map_put(&w->pair_index, p, i);
+    }
+    break;
+  case NL_VECTOR:
+  case NL_TABLE:
+  case NL_INTS:
+    p = NL_TYPE(cell) == NL_VECTOR ? (void *)NL_VECTOR_OF(cell)
+      : NL_TYPE(cell) == NL_TABLE ? (void *)NL_TABLE_OF(cell) : (void *)NL_INTS_OF(cell);
+    if (!nl_image_map_get(&w->vector_index, p, &i)) {
+      i = w->nvectors;
+      w->pending_vectors = nl_image_reserve(w->pending_vectors, &w->vectors_capacity, w->nvectors, sizeof(*w->pending_vectors));
+      w->pending_vectors[w->nvectors++] = cell;
+      nl_image_map_put(&w->vector_index, p, i);
+    }
+    break;
+  }
+  return nl_image_ref(NL_TYPE(cell), i);
+}
+static void nl_image_add_item(struct nl_image_writer *w, struct nl_cell cell) {
+  struct nl_cell item = nl_image_encode(w, cell);
+  w->items = nl_image_reserve(w->items, &w->items_capacity, w->nitems, sizeof(*w->items));
+  w->items[w->nitems++] = item;
+}
+static void nl_image_add_raw(struct nl_image_writer *w, int64_t value) {
+  w->items = nl_image_reserve(w->items, &w->items_capacity, w->nitems, sizeof(*w->items));
+  memset(&w->items[w->nitems], 0, sizeof(*w->items));
+  memcpy(&w->items[w->nitems++], &value, sizeof(value));
+}
+static void nl_image_add_entry(struct nl_cell key, struct nl_cell value, void *data) {
+  nl_image_add_item(data, key);
+  nl_image_add_item(data, value);
+}
+NL_BUILTIN(dumpimage) {
+  struct nl_image_writer w;
+  struct nl_image_header header;
+  struct nl_scope *s;
+  struct nl_scope_symbols *saved;
+  struct nl_cell path, pending;
+  uint64_t i, j;
+  int64_t k;
+  size_t allocated, vectors_allocated;
+  FILE *out;
+  int err;
+  if (!NL_IS_PAIR(cell)) {
+    scope->last_err = "illegal dump-image: expected pathname";
+    return 1;
+  }
+  if (nl_evalq(scope, NL_HEAD(cell), &path)) return 1;
+  if (NL_TYPE(path) != NL_SYMBOL) {
+    scope->last_err = "illegal dump-image: expected pathname";
+    return 1;
+  }
+  memset(&w, 0, sizeof(w));
+  nl_intern_foreach(nl_image_add_symbol, &w);
+  // Save the global values, rather than those bound by enclosing calls
+  for (s = scope; s != NULL; s = s->parent_scope)
+    for (saved = s->symbols; saved != NULL; saved = saved->next)
+      if (nl_image_map_get(&w.symbol_index, saved->name, &i))
+        w.symbols[i].value = saved->value;
+  for (i = 0; i < w.nsymbols; ++i)
+    w.symbols[i].value = nl_image_encode(&w, w.symbols[i].value);
+  for (i = 0, j = 0, allocated = 0, vectors_allocated = 0; i < w.npairs || j < w.nvectors;) {
+    if (i < w.npairs) {
+      struct nl_cell head = nl_image_encode(&w, w.pending[i][0]);
+      struct nl_cell tail = nl_image_encode(&w, w.pending[i][1]);
+      if (allocated < w.pairs_capacity) {
+        allocated = w.pairs_capacity;
+        w.pairs = realloc(w.pairs, 2 * allocated * sizeof(*w.pairs));
+      }
+      w.pairs[2 * i] = head;
+      w.pairs[2 * i + 1] = tail;
+      ++i;
+      continue;
+    }
+    pending = w.pending_vectors[j];
+    if (vectors_allocated < w.vectors_capacity) {
+      vectors_allocated = w.vectors_capacity;
+      w.vectors = realloc(w.vectors, vectors_allocated * sizeof(*w.vectors));
+    }
+    w.vectors[j].type = NL_TYPE(pending);
+    w.vectors[j].item = w.nitems;
+    if (NL_TYPE(pending) == NL_VECTOR) {
+      for (k = 0; k < NL_VECTOR_OF(pending)->length; ++k)
+        nl_image_add_item(&w, NL_VECTOR_OF(pending)->items[k]);
+    } else if (NL_TYPE(pending) == NL_INTS) {
+      for (k = 0; k < NL_INTS_OF(pending)->length; ++k)
+        nl_image_add_raw(&w, NL_INTS_OF(pending)->items[k]);
+    } else {
+      nl_table_foreach(NL_TABLE_OF(pending), nl_image_add_entry, &w);
+    }
+    w.vectors[j].length = w.nitems - w.vectors[j].item;
+    ++j;
+  }
+  memcpy(header.magic, NL_IMAGE_MAGIC, sizeof(header.magic));
+  header.cell_size = sizeof(struct nl_cell);
+  header.npairs = w.npairs;
+  header.nsymbols = w.nsymbols;
+  header.nnatives = w.nnatives;
+  header.nvectors = w.nvectors;
+  header.nitems = w.nitems;
+  header.nbytes = w.nbytes;
+  err = !(out = fopen(NL_SYM(path), "wb"))
+    || fwrite(&header, sizeof(header), 1, out) != 1
+    || fwrite(w.pairs, sizeof(*w.pairs), 2 * w.npairs, out) != 2 * w.npairs
+    || fwrite(w.symbols, sizeof(*w.symbols), w.nsymbols, out) != w.nsymbols
+    || fwrite(w.natives, sizeof(*w.natives), w.nnatives, out) != w.nnatives
+    || fwrite(w.vectors, sizeof(*w.vectors), w.nvectors, out) != w.nvectors
+    || fwrite(w.items, sizeof(*w.items), w.nitems, out) != w.nitems
+    || fwrite(w.bytes, 1, w.nbytes, out) != w.nbytes;
+  if (out && fclose(out)) err = 1;
+  nl_image_map_free(&w.symbol_index);
+  nl_image_map_free(&w.pair_index);
+  nl_image_map_free(&w.native_index);
+  nl_image_map_free(&w.vector_index);
+  free(w.pairs);
+  free(w.pending);
+  free(w.symbols);
+  free(w.natives);
+  free(w.pending_vectors);
+  free(w.vectors);
+  free(w.items);
+  free(w.bytes);
+  if (err) {
+    scope->last_err = "dump-image: cannot write image";
+    return 1;
+  }
+  *result = path;
+  return 0;
+}
+/**
+ * Turn an encoded cell back into a live one. Returns non-zero if the
+ * cell refers to something outside the image
+ */
+static int nl_image_decode(struct nl_cell *cell, struct nl_image_header *header, struct nl_cell *pairs, char **symbols, nl_native_func *natives, struct nl_cell *vectors) {
+  uint64_t i = NL_IMAGE_INDEX(*cell);
+  switch (NL_IMAGE_TYPE(*cell)) {
+  case NL_NIL:
+    *cell = nl_cell_as_nil();
+    return 0;
+  case NL_INTEGER:
+    return 0;
+  case NL_SYMBOL:
+    if (i >= header->nsymbols) return 1;
+    *cell = nl_cell_as_symbol(symbols[i]);
+    return 0;
+  case NL_PAIR:
+    if (i >= header->npairs) return 1;
+    *cell = nl_cell_of_pair(pairs + 2 * i);
+    return 0;
+  case NL_SEQ:
+    if (i >= header->npairs) return 1;
+    *cell = nl_cell_of_seq(pairs + 2 * i);
+    return 0;
+  case NL_VECTOR:
+  case NL_TABLE:
+  case NL_INTS:
+    if (i >= header->nvectors || NL_TYPE(vectors[i]) != NL_IMAGE_TYPE(*cell)) return 1;
+    *cell = vectors[i];
+    return 0;
+  case NL_IMAGE_NATIVE:
+    if (i >= header->nnatives) return 1;
+    *cell = nl_cell_as_int((int64_t)natives[i]);
+    return 0;
+  case NL_IMAGE_STREAM:
+    if (i > 2) return 1;
+    *cell = nl_cell_as_int(i == 0 ? (int64_t)stdin
+                           : (int64_t)(i == 1 ? &nl_stdout_port : &nl_stderr_port));
+    return 0;
+  default:
+    return 1;
+  }
+}
+/**
+ * Whether an encoded cell refers only to things inside the image
+ */
+static int nl_image_valid(struct nl_cell cell, struct nl_image_header *header, struct nl_image_vector *vectors) {
+  uint64_t i = NL_IMAGE_INDEX(cell);
+  switch (NL_IMAGE_TYPE(cell)) {
+  case NL_NIL:
+  case NL_INTEGER:
+    return 1;
+  case NL_SYMBOL:
+    return i < header->nsymbols;
+  case NL_PAIR:
+  case NL_SEQ:
+    return i < header->npairs;
+  case NL_VECTOR:
+  case NL_TABLE:
+  case NL_INTS:
+    return i < header->nvectors && vectors[i].type == (uint64_t)NL_IMAGE_TYPE(cell);
+  case NL_IMAGE_NATIVE:
+    return i < header->nnatives;
+  case NL_IMAGE_STREAM:
+    return i <= 2;
+  default:
+    return 0;
+  }
+}
+/**
+ * Take count items of the given size from what is left of the file,
+ * returning zero if there are not that many
+ */
+static int nl_image_take(uint64_t *left, uint64_t count, uint64_t size) {
+  if (count > *left / size) return 0;
+  *left -= count * size;
+  return 1;
+}
+/**
+ * Whether a name in the image lies within its bytes, ending in a null
+ */
+static int nl_image_name(struct nl_image_header *header, const char *bytes, uint64_t offset) {
+  return offset < header->nbytes && memchr(bytes + offset, 0, header->nbytes - offset);
+}
+/**
+ * Check the counts in the header against the size of the file, and every
+ * offset and index against the counts, before any of them is followed,
+ * so that a truncated or corrupt image is refused before it changes
+ * anything
+ */
+static int nl_image_check(struct nl_image_header *header, uint64_t size) {
+  struct nl_image_symbol *symbols;
+  struct nl_image_native *natives;
+  struct nl_image_vector *vectors;
+  struct nl_cell *pairs, *items;
+  uint64_t i, k, left = size - sizeof(*header);
+  char *bytes;
+  if (!nl_image_take(&left, header->npairs, 2 * sizeof(struct nl_cell))
+      || !nl_image_take(&left, header->nsymbols, sizeof(struct nl_image_symbol))
+      || !nl_image_take(&left, header->nnatives, sizeof(struct nl_image_native))
+      || !nl_image_take(&left, header->nvectors, sizeof(struct nl_image_vector))
+      || !nl_image_take(&left, header->nitems, sizeof(struct nl_cell))
+      || left != header->nbytes)
+    return 1;
+  pairs = (struct nl_cell *)(header + 1);
+  symbols = (struct nl_image_symbol *)(pairs + 2 * header->npairs);
+  natives = (struct nl_image_native *)(symbols + header->nsymbols);
+  vectors = (struct nl_image_vector *)(natives + header->nnatives);
+  items = (struct nl_cell *)(vectors + header->nvectors);
+  bytes = (char *)(items + header->nitems);
+  for (i = 0; i < 2 * header->npairs; ++i)
+    if (!nl_image_valid(pairs[i], header, vectors)) return 1;
+  for (i = 0; i < header->nsymbols; ++i)
+    if (symbols[i].name > header->nbytes || symbols[i].length > header->nbytes - symbols[i].name
+        || !nl_image_valid(symbols[i].value, header, vectors))
+      return 1;
+  for (i = 0; i < header->nnatives; ++i)
+    if (!nl_image_name(header, bytes, natives[i].name)
+        || (natives[i].library != NL_IMAGE_NONE && !nl_image_name(header, bytes, natives[i].library)))
+      return 1;
+  for (i = 0; i < header->nvectors; ++i) {
+    if (vectors[i].item > header->nitems || vectors[i].length > header->nitems - vectors[i].item
+        || (vectors[i].type != NL_VECTOR && vectors[i].type != NL_INTS
+            && (vectors[i].type != NL_TABLE || vectors[i].length % 2)))
+      return 1;
+    // The items of an int array are raw integers
+    if (vectors[i].type == NL_INTS) continue;
+    for (k = 0; k < vectors[i].length; ++k)
+      if (!nl_image_valid(items[vectors[i].item + k], header, vectors)) return 1;
+  }
+  return 0;
+}
+int nl_image_load(struct nl_scope *scope, const char *path) {
+  struct nl_image_header *header;
+  struct nl_image_symbol *symbols;
+  struct nl_image_native *natives;
+  struct nl_image_vector *vectors;
+  struct nl_cell *pairs, *items, key, value, holder;
+  struct nl_vector *vector;
+  struct stat st;
+  nl_native_func *funcs = NULL, f;
+  char **names = NULL, *bytes;
+  void *map, *lib;
+  uint64_t i;
+  int64_t k;
+  int fd;
+  if ((fd = open(path, O_RDONLY)) < 0) {
+    scope->last_err = "cannot open image";
+    return 1;
+  }
+  if (fstat(fd, &st) || (size_t)st.st_size < sizeof(*header)
+      || (map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+    close(fd);
+    scope->last_err = "cannot map image";
+    return 1;
+  }
+  close(fd);
+  header = map;
+  if (memcmp(header->magic, NL_IMAGE_MAGIC, sizeof(header->magic))
+      || header->cell_size != sizeof(struct nl_cell)) {
+    scope->last_err = "not an image, or dumped by a different build";
+    goto fail;
+  }
+  if (nl_image_check(header, st.st_size)) {
+    scope->last_err = "corrupt image";
+    goto fail;
+  }
+  pairs = (struct nl_cell *)(header + 1);
+  symbols = (struct nl_image_symbol *)(pairs + 2 * header->npairs);
+  natives = (struct nl_image_native *)(symbols + header->nsymbols);
+  vectors = (struct nl_image_vector *)(natives + header->nnatives);
+  items = (struct nl_cell *)(vectors + header->nvectors);
+  bytes = (char *)(items + header->nitems);
+  names = malloc(header->nsymbols * sizeof(*names) + 1);
+  funcs = malloc(header->nnatives * sizeof(*funcs) + 1);
+  for (i = 0; i < header->nsymbols; ++i)
+    names[i] = nl_intern_bytes(bytes + symbols[i].name, symbols[i].length);
+  for (i = 0; i < header->nnatives; ++i) {
+    if (natives[i].library == NL_IMAGE_NONE) {
+      f = nl_native_lookup(bytes + natives[i].name);
+    } else {
+      lib = nl_native_open(bytes + natives[i].library);
+      f = lib ? (nl_native_func)dlsym(lib, bytes + natives[i].name) : NULL;
+      if (f) {
+        nl_native_register(bytes + natives[i].name, f);
+        nl_native_set_library(f, bytes + natives[i].library);
+      }
+    }
+    if (!f) {
+      scope->last_err = "cannot find a native function used by the image";
+      goto fail;
+    }
+    funcs[i] = f;
+  }
+  // Allocating may collect, so the vectors and tables are kept in a vector of their own
+  holder = nl_cell_as_vector(header->nvectors);
+  for (i = 0; i < header->nvectors; ++i) {
+    nl_gc_write(&NL_VECTOR_OF(holder)->items[i], vectors[i].type == NL_VECTOR
+                ? nl_cell_as_vector(vectors[i].length)
+                : vectors[i].type == NL_INTS ? nl_cell_as_ints(vectors[i].length) : nl_cell_as_table());
+  }
+  // Nothing else allocates, but young vectors may be stored into pairs outside the heap
+  for (i = 0; i < 2 * header->npairs; ++i) {
+    value = pairs[i];
+    if (nl_image_decode(&value, header, pairs, names, funcs, NL_VECTOR_OF(holder)->items)) {
+      scope->last_err = "corrupt image";
+      goto fail;
+    }
+    nl_gc_write(&pairs[i], value);
+  }
+  for (i = 0; i < header->nvectors; ++i) {
+    if (vectors[i].type == NL_INTS)
+      for (k = 0; k < (int64_t)vectors[i].length; ++k)
+        memcpy(&NL_INTS_OF(NL_VECTOR_OF(holder)->items[i])->items[k], &items[vectors[i].item + k], sizeof(int64_t));
+    if (vectors[i].type != NL_VECTOR) continue;
+    vector = NL_VECTOR_OF(NL_VECTOR_OF(holder)->items[i]);
+    for (k = 0; k < vector->length; ++k) {
+      value = items[vectors[i].item + k];
+      if (nl_image_decode(&value, header, pairs, names, funcs, NL_VECTOR_OF(holder)->items)) {
+        scope->last_err = "corrupt image";
+        goto fail;
+      }
+      nl_gc_write(&vector->items[k], value);
+    }
+  }
+  // Keys are hashed by content, so tables are filled once everything else is in place
+  for (i = 0; i < header->nvectors; ++i) {
+    if (vectors[i].type != NL_TABLE) continue;
+    for (k = 0; k < (int64_t)vectors[i].length; k += 2) {
+      key = items[vectors[i].item + k];
+      value = items[vectors[i].item + k + 1];
+      if (nl_image_decode(&key, header, pairs, names, funcs, NL_VECTOR_OF(holder)->items)
+          || nl_image_decode(&value, header, pairs, names, funcs, NL_VECTOR_OF(holder)->items)) {
+        scope->last_err = "corrupt image";
+        goto fail;
+      }
+      nl_table_put(NL_TABLE_OF(NL_VECTOR_OF(holder)->items[i]), key, value);
+    }
+  }
+  for (i = 0; i < header->nsymbols; ++i) {
+    value = symbols[i].value;
+    if (nl_image_decode(&value, header, pairs, names, funcs, NL_VECTOR_OF(holder)->items)) {
+      scope->last_err = "corrupt image";
+      goto fail;
+    }
+    nl_scope_put(scope, names[i], value);
+  }
+  // The mapping is never released: its pairs are now part of the heap
+  if (header->npairs)
+    nl_gc_add_roots(pairs, 2 * header->npairs);
+  free(names);
+  free(funcs);
+  return 0;
+ fail:
+  free(names);
+  free(funcs);
+  munmap(map, st.st_size);
+  return 1;
+}
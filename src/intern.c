@@ -0,0 +1,92 @@
+#include "nl.h"
+#include <stdlib.h>
+#include <string.h>
+#define NL_ARENA_BLOCK_SIZE (64 * 1024)
+#define NL_SYMBOL_TABLE_MIN 1024
+struct nl_arena_block {
+  struct nl_arena_block *next;
+  size_t used, size;
+  char data[];
+};
+/**
+ * Arena blocks are never freed. Symbols hold their current values, which
+ * the collector finds through nl_intern_foreach
+ */
+static struct nl_arena_block *nl_symbol_arena;
+/**
+ * Open-addressing hash table of interned symbols, using linear probing.
+ * The capacity is always a power of two, and at most half full
+ */
+static struct nl_symbol **nl_symbol_table;
+static size_t nl_symbol_count, nl_symbol_capacity;
+uint64_t nl_hash_bytes(const char *bytes, size_t length) {
+  uint64_t hash = 14695981039346656037ULL;
+  while (length--) {
+    hash ^= (unsigned char)*bytes++;
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+static struct nl_symbol *nl_symbol_alloc(const char *bytes, size_t length, uint64_t hash) {
+  struct nl_arena_block *block = nl_symbol_arena;
+  struct nl_symbol *sym;
+  size_t size = (sizeof(*sym) + length + 1 + 7) & ~(size_t)7;
+  if (!block || block->size - block->used < size) {
+    block = malloc(sizeof(*block) + (size > NL_ARENA_BLOCK_SIZE ? size : NL_ARENA_BLOCK_SIZE));
+    block->next = nl_symbol_arena;
+    block->used = 0;
+    block->size = size > NL_ARENA_BLOCK_SIZE ? size : NL_ARENA_BLOCK_SIZE;
+    nl_symbol_arena = block;
+  }
+  sym = (struct nl_symbol *)(block->data + block->used);
+  block->used += size;
+  sym->hash = hash;
+  sym->length = length;
+  sym->value = nl_cell_as_nil();
+  memcpy(sym->name, bytes, length);
+  sym->name[length] = '\0';
+  return sym;
+}
+static void nl_symbol_table_grow() {
+  struct nl_symbol **old = nl_symbol_table;
+  size_t i, j, old_capacity = nl_symbol_capacity;
+  nl_symbol_capacity = old_capacity ? old_capacity * 2 : NL_SYMBOL_TABLE_MIN;
+  nl_symbol_table = calloc(nl_symbol_capacity, sizeof(*nl_symbol_table));
+  for (i = 0; i < old_capacity; ++i) {
+    if (!old[i]) continue;
+    for (j = old[i]->hash & (nl_symbol_capacity - 1);
+         nl_symbol_table[j];
+         j = (j + 1) & (nl_symbol_capacity - 1));
+    nl_symbol_table[j] = old[i];
+  }
+  free(old);
+}
+char *nl_intern_bytes(const char *bytes, size_t length) {
+  uint64_t hash = nl_hash_bytes(bytes, length);
+  struct nl_symbol *sym;
+  size_t i;
+  if (2 * (nl_symbol_count + 1) > nl_symbol_capacity)
+    nl_symbol_table_grow();
+  for (i = hash & (nl_symbol_capacity - 1);
+       (sym = nl_symbol_table[i]) != NULL;
+       i = (i + 1) & (nl_symbol_capacity - 1)) {
+    if (sym->hash == hash && sym->length == length
+        && 0 == memcmp(sym->name, bytes, length))
+      return sym->name;
+  }
+  sym = nl_symbol_alloc(bytes, length, hash);
+  nl_symbol_table[i] = sym;
+  ++nl_symbol_count;
+  return sym->name;
+}
+char *nl_intern(char *sym) {
+  char *interned = nl_intern_bytes(sym, strlen(sym));
+  free(sym);
+  return interned;
+}
+void nl_intern_foreach(void (*fn)(char *, void *), void *data) {
+  size_t i;
+  for (i = 0; i < nl_symbol_capacity; ++i)
+    if (nl_symbol_table[i])
+      fn(nl_symbol_table[i]->name, data);
+}
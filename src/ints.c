@@ -0,0 +1,86 @@
+#include "nl.h"
+#include <stdlib.h>
+#include <string.h>
+/**
+ * The kernels for one instruction set. The same source is compiled for
+ * each set by ints_kernels.h, using GCC vector types whose width matches
+ * the set's registers
+ */
+struct nl_ints_kernel_set {
+  const char *name;
+  void (*map)(enum nl_ints_op, int64_t *, const int64_t *, const int64_t *, int64_t, int64_t);
+  int64_t (*sum)(const int64_t *, int64_t);
+  int64_t (*dot)(const int64_t *, const int64_t *, int64_t);
+  int64_t (*min)(const int64_t *, int64_t);
+  int64_t (*max)(const int64_t *, int64_t);
+  void (*prefix_sum)(int64_t *, const int64_t *, int64_t);
+};
+#define NL_INTS_PASTE(name, isa) nl_ints_##name##_##isa
+#define NL_INTS_EXPAND(name, isa) NL_INTS_PASTE(name, isa)
+#define NL_INTS_NAME(name) NL_INTS_EXPAND(name, NL_INTS_ISA)
+#if defined(__x86_64__) || defined(__i386__)
+#define NL_INTS_X86
+#define NL_INTS_ISA avx2
+#define NL_INTS_LABEL "avx2"
+#define NL_INTS_LANES 4
+#define NL_INTS_TARGET __attribute__((target("avx2")))
+#include "ints_kernels.h"
+#undef NL_INTS_ISA
+#undef NL_INTS_LABEL
+#undef NL_INTS_LANES
+#undef NL_INTS_TARGET
+#define NL_INTS_ISA sse42
+#define NL_INTS_LABEL "sse4.2"
+#define NL_INTS_LANES 2
+#define NL_INTS_TARGET __attribute__((target("sse4.2")))
+#include "ints_kernels.h"
+#undef NL_INTS_ISA
+#undef NL_INTS_LABEL
+#undef NL_INTS_LANES
+#undef NL_INTS_TARGET
+#endif
+#define NL_INTS_ISA scalar
+#define NL_INTS_LABEL "scalar"
+#define NL_INTS_LANES 1
+#define NL_INTS_TARGET
+#include "ints_kernels.h"
+static const struct nl_ints_kernel_set *nl_ints_set;
+/**
+ * Pick the widest set the CPU supports, or the one named by
+ * NL_INTS_KERNELS if it is supported. The scalar set always is
+ */
+static const struct nl_ints_kernel_set *nl_ints_choose() {
+  const char *want = getenv("NL_INTS_KERNELS");
+#ifdef NL_INTS_X86
+  __builtin_cpu_init();
+  if ((!want || !strcmp(want, nl_ints_set_avx2.name)) && __builtin_cpu_supports("avx2"))
+    return nl_ints_set = &nl_ints_set_avx2;
+  if ((!want || !strcmp(want, nl_ints_set_sse42.name)) && __builtin_cpu_supports("sse4.2"))
+    return nl_ints_set = &nl_ints_set_sse42;
+#endif
+  return nl_ints_set = &nl_ints_set_scalar;
+}
+static inline const struct nl_ints_kernel_set *nl_ints_kernel_set() {
+  return nl_ints_set ? nl_ints_set : nl_ints_choose();
+}
+void nl_ints_map(enum nl_ints_op op, int64_t *out, const int64_t *a, const int64_t *b, int64_t scalar, int64_t length) {
+  nl_ints_kernel_set()->map(op, out, a, b, scalar, length);
+}
+int64_t nl_ints_sum(const int64_t *a, int64_t length) {
+  return nl_ints_kernel_set()->sum(a, length);
+}
+int64_t nl_ints_dot(const int64_t *a, const int64_t *b, int64_t length) {
+  return nl_ints_kernel_set()->dot(a, b, length);
+}
+int64_t nl_ints_min(const int64_t *a, int64_t length) {
+  return nl_ints_kernel_set()->min(a, length);
+}
+int64_t nl_ints_max(const int64_t *a, int64_t length) {
+  return nl_ints_kernel_set()->max(a, length);
+}
+void nl_ints_prefix_sum(int64_t *out, const int64_t *a, int64_t length) {
+  nl_ints_kernel_set()->prefix_sum(out, a, length);
+}
+const char *nl_ints_kernels() {
+  return nl_ints_kernel_set()->name;
+}
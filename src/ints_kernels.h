@@ -0,0 +1,128 @@
+/**
+ * The int array kernels, included by ints.c once for each instruction
+ * set, with NL_INTS_ISA naming it, NL_INTS_LANES items to a vector and
+ * NL_INTS_TARGET enabling it for the functions below. Vectors are loaded
+ * and stored unaligned; arithmetic is done unsigned so that it wraps
+ */
+typedef uint64_t NL_INTS_NAME(u) __attribute__((vector_size(NL_INTS_LANES * 8), aligned(8), may_alias));
+typedef int64_t NL_INTS_NAME(s) __attribute__((vector_size(NL_INTS_LANES * 8), aligned(8), may_alias));
+#define U NL_INTS_NAME(u)
+#define S NL_INTS_NAME(s)
+#define L NL_INTS_LANES
+/**
+ * One pass over the items, then the items left over after the last
+ * whole vector. x and y are the operands, as vectors and then as items
+ */
+#define NL_INTS_MAP_LOOP(load_y, item_y, vector, item) { \
+    for (i = 0; i + L <= length; i += L) { \
+      x = *(const U *)(a + i); \
+      y = load_y; \
+      *(U *)(out + i) = vector; \
+    } \
+    for (; i < length; ++i) { \
+      uint64_t x = a[i], y = item_y; \
+      out[i] = item; \
+    } \
+  }
+#define NL_INTS_MAP(vector, item) \
+  if (b) NL_INTS_MAP_LOOP(*(const U *)(b + i), b[i], vector, item) \
+  else NL_INTS_MAP_LOOP(broadcast, (uint64_t)scalar, vector, item)
+NL_INTS_TARGET static void NL_INTS_NAME(map)(enum nl_ints_op op, int64_t *out, const int64_t *a,
+                                             const int64_t *b, int64_t scalar, int64_t length) {
+  U x, y, broadcast = (U){0} + (uint64_t)scalar;
+  int64_t i;
+  switch (op) {
+  case NL_INTS_ADD: NL_INTS_MAP(x + y, x + y); break;
+  case NL_INTS_SUB: NL_INTS_MAP(x - y, x - y); break;
+  case NL_INTS_MUL: NL_INTS_MAP(x * y, x * y); break;
+  case NL_INTS_EQ: NL_INTS_MAP((U)-(x == y), x == y); break;
+  case NL_INTS_LT: NL_INTS_MAP((U)-((S)x < (S)y), (int64_t)x < (int64_t)y); break;
+  case NL_INTS_GT: NL_INTS_MAP((U)-((S)x > (S)y), (int64_t)x > (int64_t)y); break;
+  }
+}
+#undef NL_INTS_MAP
+#undef NL_INTS_MAP_LOOP
+NL_INTS_TARGET static int64_t NL_INTS_NAME(sum)(const int64_t *a, int64_t length) {
+  U total = {0};
+  uint64_t result = 0;
+  int64_t i;
+  int k;
+  for (i = 0; i + L <= length; i += L)
+    total += *(const U *)(a + i);
+  for (k = 0; k < L; ++k) result += total[k];
+  for (; i < length; ++i) result += a[i];
+  return result;
+}
+NL_INTS_TARGET static int64_t NL_INTS_NAME(dot)(const int64_t *a, const int64_t *b, int64_t length) {
+  U total = {0};
+  uint64_t result = 0;
+  int64_t i;
+  int k;
+  for (i = 0; i + L <= length; i += L)
+    total += *(const U *)(a + i) * *(const U *)(b + i);
+  for (k = 0; k < L; ++k) result += total[k];
+  for (; i < length; ++i) result += (uint64_t)a[i] * b[i];
+  return result;
+}
+/**
+ * The running best of each lane is kept by masking, since there is no
+ * 64-bit min or max instruction before AVX-512
+ */
+#define NL_INTS_BEST(name, better) \
+  NL_INTS_TARGET static int64_t NL_INTS_NAME(name)(const int64_t *a, int64_t length) { \
+    S best, x, m; \
+    int64_t result = a[0], i = 1; \
+    int k; \
+    if (length >= L) { \
+      best = *(const S *)a; \
+      for (i = L; i + L <= length; i += L) { \
+        x = *(const S *)(a + i); \
+        m = x better best; \
+        best = (x & m) | (best & ~m); \
+      } \
+      for (k = 0; k < L; ++k) \
+        if (best[k] better result) result = best[k]; \
+    } \
+    for (; i < length; ++i) \
+      if (a[i] better result) result = a[i]; \
+    return result; \
+  }
+NL_INTS_BEST(min, <)
+NL_INTS_BEST(max, >)
+#undef NL_INTS_BEST
+/**
+ * Each vector is summed in place by adding itself shifted along by one
+ * lane, then by two, and then the total so far is added to every lane
+ */
+NL_INTS_TARGET static void NL_INTS_NAME(prefix_sum)(int64_t *out, const int64_t *a, int64_t length) {
+  U x, carry = {0};
+  uint64_t total;
+  int64_t i;
+  for (i = 0; i + L <= length; i += L) {
+    x = *(const U *)(a + i);
+#if NL_INTS_LANES == 4
+    x += __builtin_shuffle(x, (U){0}, (U){4, 0, 1, 2});
+    x += __builtin_shuffle(x, (U){0}, (U){4, 5, 0, 1});
+#elif NL_INTS_LANES == 2
+    x += __builtin_shuffle(x, (U){0}, (U){2, 0});
+#endif
+    x += carry;
+    *(U *)(out + i) = x;
+    carry = (U){0} + x[L - 1];
+  }
+  total = carry[0];
+  for (; i < length; ++i)
+    out[i] = total += a[i];
+}
+static const struct nl_ints_kernel_set NL_INTS_NAME(set) = {
+  NL_INTS_LABEL,
+  NL_INTS_NAME(map),
+  NL_INTS_NAME(sum),
+  NL_INTS_NAME(dot),
+  NL_INTS_NAME(min),
+  NL_INTS_NAME(max),
+  NL_INTS_NAME(prefix_sum),
+};
+#undef U
+#undef S
+#undef L
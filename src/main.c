@@ -1,8 +1,33 @@
 #include "nl.h"
-int main() {
+#include <stdlib.h>
+#include <string.h>
+static void report_profile() {
+  nl_profile_stop();
+  nl_profile_report(&nl_stderr_port);
+}
+int main(int argc, char **argv) {
   struct nl_scope scope;
+  char *image = NULL;
+  int i;
   nl_globals_init();
   nl_scope_init(&scope);
   nl_scope_define_builtins(&scope);
+  for (i = 1; i < argc; ++i) {
+    if (0 == strcmp(argv[i], "--image") && i + 1 < argc) {
+      image = argv[++i];
+    } else if (0 == strcmp(argv[i], "--profile")) {
+      // Reported on the way out, even if the program calls exit
+      atexit(report_profile);
+      nl_profile_start();
+    } else if (0 == strcmp(argv[i], "--no-optimize")) {
+      nl_optimizing = 0;
+    } else if (0 == strcmp(argv[i], "--optimize-report")) {
+      nl_optimize_reporting = 1;
+    }
+  }
+  if (image && nl_image_load(&scope, image)) {
+    fprintf(stderr, "ERROR image: %s\n", scope.last_err);
+    return 1;
+  }
   return nl_run_repl(isatty(STDIN_FILENO), &scope);
 }
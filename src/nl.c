@@ -4,8 +4,53 @@
 #include <string.h>
 #include <wchar.h>
 #include <dlfcn.h>
-#include <gc.h>
-static struct nl_cell nil, t, quote, unquote, nl_in, nl_out, nl_err;
+#include <sys/mman.h>
+#include <sys/stat.h>
+struct nl_cell nil, t, nl_out;
+const int NL_CELL_LAYOUT = 1;
+static struct nl_cell quote, unquote, nl_in, nl_err;
+#ifdef NL_TAGGED_CELLS
+struct nl_cell nl_cell_as_nil() {
+  struct nl_cell c;
+  c.bits = 0;
+  return c;
+}
+struct nl_cell nl_cell_as_int(int64_t value) {
+  struct nl_cell c;
+  c.bits = (uintptr_t)value << 1 | 1;
+  return c;
+}
+struct nl_cell nl_cell_of_pair(struct nl_cell *pair) {
+  struct nl_cell c;
+  c.bits = (uintptr_t)pair;
+  return c;
+}
+struct nl_cell nl_cell_of_seq(struct nl_cell *pair) {
+  struct nl_cell c;
+  c.bits = (uintptr_t)pair | 12;
+  return c;
+}
+struct nl_cell nl_cell_as_symbol(char *interned_symbol) {
+  struct nl_cell c;
+  c.bits = (uintptr_t)interned_symbol | 2;
+  return c;
+}
+struct nl_cell nl_cell_as_vector(int64_t length) {
+  struct nl_cell c;
+  c.bits = (uintptr_t)nl_gc_alloc_vector(length) | 6;
+  return c;
+}
+struct nl_cell nl_cell_as_table() {
+  struct nl_cell c;
+  c.bits = (uintptr_t)nl_gc_alloc_table() | 4;
+  return c;
+}
+struct nl_cell nl_cell_as_ints(int64_t length) {
+  struct nl_cell c;
+  c.bits = (uintptr_t)nl_gc_alloc_ints(length) | 14;
+  return c;
+}
+#else
 struct nl_cell nl_cell_as_nil() {
   struct nl_cell c;
   c.type = NL_NIL;
@@ -17,12 +62,16 @@ struct nl_cell nl_cell_as_int(int64_t value) {
   c.value.as_integer = value;
   return c;
 }
-struct nl_cell nl_cell_as_pair(struct nl_cell head, struct nl_cell tail) {
+struct nl_cell nl_cell_of_pair(struct nl_cell *pair) {
   struct nl_cell c;
   c.type = NL_PAIR;
-  c.value.as_pair = GC_malloc(sizeof(head) + sizeof(tail));
-  NL_HEAD(c) = head;
-  NL_TAIL(c) = tail;
+  c.value.as_pair = pair;
+  return c;
+}
+struct nl_cell nl_cell_of_seq(struct nl_cell *pair) {
+  struct nl_cell c;
+  c.type = NL_SEQ;
+  c.value.as_seq = pair;
   return c;
 }
 struct nl_cell nl_cell_as_symbol(char *interned_symbol) {
@@ -31,118 +80,309 @@ struct nl_cell nl_cell_as_symbol(char *interned_symbol) {
   c.value.as_symbol = interned_symbol;
   return c;
 }
+struct nl_cell nl_cell_as_vector(int64_t length) {
+  struct nl_cell c;
+  c.type = NL_VECTOR;
+  c.value.as_vector = nl_gc_alloc_vector(length);
+  return c;
+}
+struct nl_cell nl_cell_as_table() {
+  struct nl_cell c;
+  c.type = NL_TABLE;
+  c.value.as_table = nl_gc_alloc_table();
+  return c;
+}
+struct nl_cell nl_cell_as_ints(int64_t length) {
+  struct nl_cell c;
+  c.type = NL_INTS;
+  c.value.as_ints = nl_gc_alloc_ints(length);
+  return c;
+}
+#endif
+struct nl_cell nl_cell_as_pair(struct nl_cell head, struct nl_cell tail) {
+  struct nl_cell c = nl_cell_of_pair(nl_gc_alloc_pair());
+  NL_HEAD(c) = head;
+  NL_TAIL(c) = tail;
+  return c;
+}
+int nl_vector_from_list(struct nl_cell list, struct nl_cell *result) {
+  struct nl_cell *p, *items;
+  int64_t i = 0;
+  NL_FOREACH(&list, p);
+  if (NL_TYPE(*p) != NL_NIL) return 1;
+  *result = nl_cell_as_vector(nl_list_length(list));
+  items = NL_VECTOR_OF(*result)->items;
+  NL_FOREACH(&list, p) items[i++] = NL_HEAD_AT(p);
+  return 0;
+}
+int nl_ints_from_list(struct nl_cell list, struct nl_cell *result) {
+  struct nl_cell *p;
+  int64_t i = 0;
+  NL_FOREACH(&list, p) {
+    if (NL_TYPE(NL_HEAD_AT(p)) != NL_INTEGER) return 1;
+  }
+  if (NL_TYPE(*p) != NL_NIL) return 1;
+  *result = nl_cell_as_ints(nl_list_length(list));
+  NL_FOREACH(&list, p) NL_INTS_OF(*result)->items[i++] = NL_INT(NL_HEAD_AT(p));
+  return 0;
+}
+int nl_table_from_list(struct nl_cell list, struct nl_cell *result) {
+  struct nl_cell *entry;
+  *result = nl_cell_as_table();
+  NL_FOREACH(&list, entry) {
+    if (!NL_IS_PAIR(NL_HEAD_AT(entry))) return 1;
+    nl_table_put(NL_TABLE_OF(*result), NL_HEAD(NL_HEAD_AT(entry)), NL_TAIL(NL_HEAD_AT(entry)));
+  }
+  return 0;
+}
+struct nl_cell nl_vector_keep(struct nl_cell *items, int64_t n, const char *keep) {
+  struct nl_cell result, *out;
+  int64_t i, kept;
+  for (i = kept = 0; i < n; ++i) kept += keep[i] != 0;
+  // Nothing allocates between here and the copy, so the new vector stays
+  // young, and its items can be stored without nl_gc_write
+  result = nl_cell_as_vector(kept);
+  out = NL_VECTOR_OF(result)->items;
+  for (i = 0; i < n; ++i)
+    if (keep[i]) *out++ = items[i];
+  return result;
+}
 int64_t nl_list_length(struct nl_cell l) {
   int64_t len = 0;
   struct nl_cell *p;
-  if (l.type == NL_PAIR) {
+  if (NL_IS_PAIR(l)) {
     NL_FOREACH(&l, p) {
       ++len;
     }
-    if (p->type != NL_NIL) ++len;
+    if (NL_TYPE(*p) != NL_NIL) ++len;
   }
   return len;
 }
+/**
+ * The values shadowed by nl_scope_bind are saved in an arena of blocks,
+ * used as a stack: scopes are unwound in the reverse order they were
+ * initialized, so each one releases its bindings by putting the top back
+ * where it found it, and calls allocate nothing from the heap. Blocks
+ * are kept once made, and never move, so bindings can point at each other
+ */
+#define NL_BINDING_BLOCK 1024
+struct nl_binding_block {
+  struct nl_binding_block *prev, *next;
+  struct nl_scope_symbols items[NL_BINDING_BLOCK];
+};
+static struct nl_binding_block *nl_binding_block;
+static struct nl_scope_symbols *nl_binding_top;
+static struct nl_scope_symbols *nl_binding_alloc() {
+  struct nl_binding_block *b;
+  if (!nl_binding_block || nl_binding_top == nl_binding_block->items + NL_BINDING_BLOCK) {
+    if (!nl_binding_block || !nl_binding_block->next) {
+      b = malloc(sizeof(*b));
+      b->prev = nl_binding_block;
+      b->next = NULL;
+      if (nl_binding_block) nl_binding_block->next = b;
+    } else {
+      b = nl_binding_block->next;
+    }
+    nl_binding_block = b;
+    nl_binding_top = b->items;
+  }
+  return nl_binding_top++;
+}
+void nl_scope_roots() {
+  struct nl_binding_block *b;
+  struct nl_scope_symbols *s, *end;
+  for (b = nl_binding_block; b; b = b->prev) {
+    end = b == nl_binding_block ? nl_binding_top : b->items + NL_BINDING_BLOCK;
+    for (s = b->items; s < end; ++s)
+      nl_gc_mark_cell(s->value);
+  }
+}
 void nl_scope_init(struct nl_scope *scope) {
   scope->last_err = NULL;
   scope->parent_scope = NULL;
-  scope->symbols = GC_malloc(sizeof(*scope->symbols));
-  scope->symbols->name = nil.value.as_symbol;
-  scope->symbols->value.type = NL_NIL;
-  scope->symbols->next = NULL;
+  scope->symbols = NULL;
+  scope->frame = nl_binding_top;
+}
+#define NL_READER_CHUNK 65536
+void nl_reader_init(struct nl_reader *r, FILE *in) {
+  r->in = in;
+  r->buf = NULL;
+  r->pos = r->end = r->size = 0;
+  r->mapped = r->owned = r->shared = 0;
+  r->interactive = in && isatty(fileno(in));
 }
-int nl_skip_whitespace(FILE *in) {
+int nl_reader_open(struct nl_reader *r, const char *path) {
+  struct stat st;
+  FILE *in;
+  void *map;
+  if (!(in = fopen(path, "r"))) return 1;
+  if (!fstat(fileno(in), &st) && S_ISREG(st.st_mode) && st.st_size > 0) {
+    // Private and writable, so strings can be unescaped in place
+    map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(in), 0);
+    if (map != MAP_FAILED) {
+      fclose(in);
+      nl_reader_init(r, NULL);
+      r->buf = map;
+      r->end = r->size = st.st_size;
+      r->mapped = 1;
+      return 0;
+    }
+  }
+  nl_reader_init(r, in);
+  r->owned = 1;
+  return 0;
+}
+void nl_reader_close(struct nl_reader *r) {
+  if (r->mapped)
+    munmap(r->buf, r->size);
+  else
+    free(r->buf);
+  if (r->owned)
+    fclose(r->in);
+  nl_reader_init(r, NULL);
+}
+/**
+ * Read more input into the buffer. Bytes before the read position are
+ * discarded, except for the last byte read (so it can be put back) and
+ * anything from the given mark onwards, if any. Returns zero at the end
+ * of the input
+ */
+static size_t nl_reader_fill(struct nl_reader *r, size_t *mark) {
+  size_t keep = mark ? *mark : r->pos ? r->pos - 1 : 0, n;
+  if (!r->in) return 0;
+  if (keep) memmove(r->buf, r->buf + keep, r->end - keep);
+  r->end -= keep;
+  r->pos -= keep;
+  if (mark) *mark = 0;
+  if (r->size - r->end < NL_READER_CHUNK / 2) {
+    r->size = r->size ? r->size * 2 : NL_READER_CHUNK;
+    r->buf = realloc(r->buf, r->size);
+  }
+  if (r->interactive) {
+    // A line at a time, so the REPL doesn't block on input it hasn't asked for
+    if (!fgets(r->buf + r->end, r->size - r->end, r->in)) return 0;
+    n = strlen(r->buf + r->end);
+  } else {
+    n = fread(r->buf + r->end, 1, r->size - r->end, r->in);
+  }
+  r->end += n;
+  return n;
+}
+static inline int nl_reader_getc(struct nl_reader *r) {
+  if (r->pos == r->end && !nl_reader_fill(r, NULL)) return EOF;
+  return (unsigned char)r->buf[r->pos++];
+}
+static inline void nl_reader_ungetc(struct nl_reader *r, int ch) {
+  if (ch != EOF) --r->pos;
+}
+int nl_skip_whitespace(struct nl_reader *in) {
   int ch;
   do {
-    ch = fgetc(in);
+    ch = nl_reader_getc(in);
   } while (isspace(ch));
   return ch;
 }
-struct nl_interned_symbols {
-  char *sym;
-  struct nl_interned_symbols *next;
-};
-static struct nl_interned_symbols *nl_interned_symbols;
-char *nl_intern(char *sym) {
-  if (!nl_interned_symbols) {
-    nl_interned_symbols = malloc(sizeof(*nl_interned_symbols));
-    nl_interned_symbols->sym = sym;
-    nl_interned_symbols->next = NULL;
-    return sym;
-  }
-  struct nl_interned_symbols *s;
-  for (s = nl_interned_symbols; s != NULL; s = s->next) {
-    if (0 == strcmp(sym, s->sym)) {
-      free(sym);
-      return s->sym;
-    }
-    if (s->next == NULL) {
-      s->next = malloc(sizeof(*s->next));
-      s->next->sym = sym;
-      s->next->next = NULL;
-      return sym;
-    }
-  }
-  return NULL;
-}
-int nl_read(struct nl_scope *scope, FILE *s_in, struct nl_cell *result) {
+int nl_read(struct nl_scope *scope, struct nl_reader *s_in, struct nl_cell *result) {
   struct nl_cell head, *tail;
-  int ch, sign = 1, used = 0, allocated = 16;
-  char *buf;
+  int ch, err, sign = 1;
+  int64_t digits;
+  size_t start, used = 0;
+  char tag[8];
  start:
   ch = nl_skip_whitespace(s_in);
   if (ch == EOF) {
     return EOF;
   } else if (ch == '#') {
-    do { ch = fgetc(s_in); }
-    while (ch != '\n');
-    goto start;
+    // A vector is written as #(...), and an int array, a table or a
+    // sequence as #ints, #table or #seq and a list; any other # starts a
+    // comment, but one that looks like an unknown literal is an error
+    for (start = 0; start < sizeof(tag) - 1 && isalpha(ch = nl_reader_getc(s_in)); ++start)
+      tag[start] = ch;
+    tag[start] = 0;
+    if (ch != '(') {
+      while (ch != '\n' && ch != EOF)
+        ch = nl_reader_getc(s_in);
+      goto start;
+    }
+    nl_reader_ungetc(s_in, ch);
+    if (!start) {
+      if (nl_read(scope, s_in, &head)) return 1;
+      if (nl_vector_from_list(head, result)) {
+        scope->last_err = "illegal vector";
+        return 1;
+      }
+    } else if (!strcmp(tag, "ints")) {
+      if (nl_read(scope, s_in, &head)) return 1;
+      if (nl_ints_from_list(head, result)) {
+        scope->last_err = "illegal int array";
+        return 1;
+      }
+    } else if (!strcmp(tag, "table")) {
+      if (nl_read(scope, s_in, &head)) return 1;
+      if (nl_table_from_list(head, result)) {
+        scope->last_err = "illegal table";
+        return 1;
+      }
+    } else if (!strcmp(tag, "seq")) {
+      // The list of a sequence's source and stages
+      if (nl_read(scope, s_in, &head)) return 1;
+      if (!NL_IS_PAIR(head) || !NL_IS_PAIR(NL_HEAD(head))) {
+        scope->last_err = "illegal sequence";
+        return 1;
+      }
+      *result = nl_cell_of_seq(NL_PAIR_OF(head));
+    } else {
+      scope->last_err = "illegal literal: unknown # prefix";
+      return 1;
+    }
+    return 0;
   } else if (ch == '-') {
-    int peek = fgetc(s_in);
+    int peek = nl_reader_getc(s_in);
     if (isdigit(peek)) {
       sign = -1;
       ch = peek;
       goto NL_READ_DIGIT;
     }
-    ungetc(peek, s_in);
+    nl_reader_ungetc(s_in, peek);
     goto NL_READ_SYMBOL;
   } else if (isdigit(ch)) {
   NL_READ_DIGIT:
-    *result = nl_cell_as_int(ch - '0');
-    while (isdigit(ch = fgetc(s_in))) {
-      result->value.as_integer *= 10;
-      result->value.as_integer += ch - '0';
-    }
-    result->value.as_integer *= sign;
-    ungetc(ch, s_in);
+    digits = ch - '0';
+    while (isdigit(ch = nl_reader_getc(s_in)))
+      digits = digits * 10 + ch - '0';
+    *result = nl_cell_as_int(digits * sign);
+    nl_reader_ungetc(s_in, ch);
     return 0;
   } else if ('"' == ch) {
-    buf = malloc(sizeof(char) * allocated);
-    for (ch = fgetc(s_in); ch != '"'; ch = fgetc(s_in)) {
-      if (ch == '\\')
-        buf[used++] = fgetc(s_in);
-      else
-        buf[used++] = ch;
-      if (used == allocated) {
-        allocated *= 2;
-        buf = realloc(buf, sizeof(char) * allocated);
+    // Unescape in place: the string never grows, so writes trail reads
+    for (start = s_in->pos;;) {
+      if (s_in->pos == s_in->end && !nl_reader_fill(s_in, &start)) break;
+      ch = s_in->buf[s_in->pos++];
+      if (ch == '"') break;
+      if (ch == '\\') {
+        if (s_in->pos == s_in->end && !nl_reader_fill(s_in, &start)) break;
+        ch = s_in->buf[s_in->pos++];
       }
+      s_in->buf[start + used++] = ch;
     }
-    buf[used] = '\0';
-    buf = realloc(buf, sizeof(char) * used);
-    if (used == 0) {
-      free(buf);
-      *result = nil;
-    } else {
-      *result = nl_cell_as_symbol(nl_intern(buf));
+    if (ch != '"') {
+      scope->last_err = "illegal string: missing closing quote";
+      return 1;
     }
+    if (used == 0)
+      *result = nil;
+    else
+      *result = nl_cell_as_symbol(nl_intern_bytes(s_in->buf + start, used));
     return 0;
   } else if ('\'' == ch) {
     if (nl_read(scope, s_in, &head)) return 1;
     *result = nl_cell_as_pair(quote, head);
+    if (s_in->shared) *result = nl_share_pair(*result);
     return 0;
   } else if (',' == ch) {
     if (nl_read(scope, s_in, &head)) return 1;
     *result = nl_cell_as_pair(unquote, head);
+    if (s_in->shared) *result = nl_share_pair(*result);
     return 0;
   } else if ('(' == ch) {
     ch = nl_skip_whitespace(s_in);
@@ -150,158 +390,312 @@ int nl_read(struct nl_scope *scope, FILE *s_in, struct nl_cell *result) {
       *result = nil;
       return 0;
     }
-    ungetc(ch, s_in);
-    if (nl_read(scope, s_in, &head)) return 1;
+    nl_reader_ungetc(s_in, ch);
+    if ((err = nl_read(scope, s_in, &head))) goto NL_READ_LIST_END;
     *result = nl_cell_as_pair(head, nil);
     tail = NL_NEXT_AT(result);
     for (;;) {
       ch = nl_skip_whitespace(s_in);
-      if (ch == ')') return 0;
+      if (ch == ')') break;
+      if ((err = ch) == EOF) goto NL_READ_LIST_END;
       if (ch == '.') {
         if (nl_read(scope, s_in, tail)) return 1;
         if (nl_skip_whitespace(s_in) != ')') {
           scope->last_err = "illegal list";
           return 1;
         }
-        return 0;
+        break;
       }
-      ungetc(ch, s_in);
-      if (nl_read(scope, s_in, &head)) return 1;
+      nl_reader_ungetc(s_in, ch);
+      if ((err = nl_read(scope, s_in, &head))) goto NL_READ_LIST_END;
       *tail = nl_cell_as_pair(head, nil);
       tail = NL_NEXT_AT(tail);
     }
+    // The items are shared already, so the list can be shared from its end
+    if (s_in->shared) *result = nl_share_list(*result);
+    return 0;
+  NL_READ_LIST_END:
+    // The end of the input inside a list is an error, not the end of the input
+    if (err == EOF) scope->last_err = "illegal list: missing closing parenthesis";
+    return 1;
   } else {
   NL_READ_SYMBOL:
-    buf = malloc(sizeof(char) * allocated);
-    for (; !isspace(ch) && ch != '(' && ch != ')'; ch = fgetc(s_in)) {
-      buf[used++] = ch;
-      if (used == allocated) {
-        allocated *= 2;
-        buf = realloc(buf, sizeof(char) * allocated);
-      }
+    // The token is interned straight out of the buffer
+    for (start = s_in->pos - 1;;) {
+      if (s_in->pos == s_in->end && !nl_reader_fill(s_in, &start)) break;
+      ch = s_in->buf[s_in->pos];
+      if (isspace(ch) || ch == '(' || ch == ')') break;
+      ++s_in->pos;
     }
-    ungetc(ch, s_in);
-    buf[used] = '\0';
-    buf = realloc(buf, sizeof(char) * used);
-    *result = nl_cell_as_symbol(nl_intern(buf));
+    *result = nl_cell_as_symbol(nl_intern_bytes(s_in->buf + start, s_in->pos - start));
     return 0;
   }
 }
 void nl_scope_put(struct nl_scope *scope, char *name, struct nl_cell value) {
+  nl_gc_write(&NL_SYMBOL_OF(name)->value, value);
+}
+void nl_scope_get(struct nl_scope *scope, char *name, struct nl_cell *result) {
+  *result = NL_SYMBOL_OF(name)->value;
+}
+void nl_scope_bind(struct nl_scope *scope, char *name, struct nl_cell value) {
   struct nl_scope_symbols *s;
-  for (; scope != NULL; scope = scope->parent_scope) {
-    for (s = scope->symbols; s != NULL; s = s->next) {
-      if (name == s->name) {
-        s->value = value;
-        return;
-      }
-      if (!s->next && !scope->parent_scope) {
-        s->next = GC_malloc(sizeof(*s->next));
-        s->next->name = name;
-        s->next->value = value;
-        return;
-      }
+  for (s = scope->symbols; s != NULL; s = s->next) {
+    if (s->name == name) {
+      nl_gc_write(&NL_SYMBOL_OF(name)->value, value);
+      return;
     }
   }
+  s = nl_binding_alloc();
+  s->name = name;
+  s->value = NL_SYMBOL_OF(name)->value;
+  s->next = scope->symbols;
+  scope->symbols = s;
+  nl_gc_write(&NL_SYMBOL_OF(name)->value, value);
 }
-void nl_scope_get(struct nl_scope *scope, char *name, struct nl_cell *result) {
+void nl_scope_unwind(struct nl_scope *scope) {
   struct nl_scope_symbols *s;
-  for (; scope != NULL; scope = scope->parent_scope) {
-    for (s = scope->symbols; s != NULL; s = s->next)
-      if (name == s->name) {
-        *result = s->value;
-        return;
-      }
-  }
-  *result = nil;
+  for (s = scope->symbols; s != NULL; s = s->next)
+    nl_gc_write(&NL_SYMBOL_OF(s->name)->value, s->value);
+  scope->symbols = NULL;
+  if (!nl_binding_block) return;
+  // Back to the block the scope started in, or the first if it started before any
+  while (nl_binding_block->prev && !(scope->frame >= nl_binding_block->items
+                                     && scope->frame <= nl_binding_block->items + NL_BINDING_BLOCK))
+    nl_binding_block = nl_binding_block->prev;
+  nl_binding_top = scope->frame ? scope->frame : nl_binding_block->items;
 }
 int nl_setqe(struct nl_scope *target_scope, struct nl_scope *eval_scope, struct nl_cell args, struct nl_cell *result) {
   struct nl_cell *tail;
-  if (args.type != NL_PAIR) {
+  if (!NL_IS_PAIR(args)) {
     target_scope->last_err = "illegal setq call: non-pair args";
     return 1;
   }
-  for (tail = &args; tail->type == NL_PAIR; tail = NL_NEXT(NL_TAIL_AT(tail))) {
-    if (NL_HEAD_AT(tail).type != NL_SYMBOL) {
+  for (tail = &args; NL_IS_PAIR(*tail); tail = NL_NEXT(NL_TAIL_AT(tail))) {
+    if (NL_TYPE(NL_HEAD_AT(tail)) != NL_SYMBOL) {
       target_scope->last_err = "illegal setq call: non-symbol var";
       return 1;
     }
-    if (NL_TAIL_AT(tail).type != NL_PAIR) {
+    if (!NL_IS_PAIR(NL_TAIL_AT(tail))) {
       if (nl_evalq(eval_scope, NL_TAIL_AT(tail), result)) return 1;
-      nl_scope_put(target_scope, NL_HEAD_AT(tail).value.as_symbol, *result);
+      nl_scope_put(target_scope, NL_SYM(NL_HEAD_AT(tail)), *result);
       return 0;
     }
     if (nl_evalq(eval_scope, NL_HEAD(NL_TAIL_AT(tail)), result)) return 1;
-    nl_scope_put(target_scope, NL_HEAD_AT(tail).value.as_symbol, *result);
+    nl_scope_put(target_scope, NL_SYM(NL_HEAD_AT(tail)), *result);
+  }
+  return 0;
+}
+int nl_eval_args(struct nl_scope *scope, struct nl_cell args, int64_t n, struct nl_cell *values) {
+  struct nl_cell *a = &args, rest = nil;
+  int64_t i;
+  for (i = 0; i < n; ++i) {
+    if (NL_IS_PAIR(*a)) {
+      if (nl_evalq(scope, NL_HEAD_AT(a), &values[i])) return 1;
+      a = NL_NEXT_AT(a);
+    } else if (NL_TYPE(*a) == NL_NIL) {
+      values[i] = *a;
+    } else {
+      if (nl_evalq(scope, *a, &values[i])) return 1;
+      a = &rest;
+    }
+  }
+  return 0;
+}
+/**
+ * Evaluate the arguments to a lambda in the calling scope, then bind
+ * them to the lambda's parameters in the call scope. All arguments are
+ * evaluated before any parameter is bound, so that argument expressions
+ * never see the new bindings
+ */
+static int nl_bind_params(struct nl_scope *scope, struct nl_scope *call_scope, struct nl_cell params, struct nl_cell args) {
+  struct nl_cell values[nl_list_length(params) + 1], *p;
+  int64_t i = 0;
+  NL_FOREACH(&params, p) {
+    if (NL_TYPE(NL_HEAD_AT(p)) != NL_SYMBOL) {
+      scope->last_err = "illegal call: non-symbol parameter in lambda";
+      return 1;
+    }
+    ++i;
+  }
+  if (nl_eval_args(scope, args, i, values)) return 1;
+  i = 0;
+  NL_FOREACH(&params, p) {
+    nl_scope_bind(call_scope, NL_SYM(NL_HEAD_AT(p)), values[i++]);
   }
   return 0;
 }
 NL_BUILTIN(call) {
-  struct nl_cell *p, *a, v, head;
-  struct nl_scope call_scope;
-  if (cell.type != NL_PAIR) {
+  struct nl_cell head;
+  if (!NL_IS_PAIR(cell)) {
     scope->last_err = "illegal call: non-pair args";
     return 1;
   }
   if (nl_evalq(scope, NL_HEAD(cell), &head)) return 1;
+  // Quoted forms are the commonest call of all, and need no call scope
+  if (NL_TYPE(head) == NL_INTEGER && (nl_native_func)NL_INT(head) == nl_quote) {
+    *result = NL_TAIL(cell);
+    return 0;
+  }
+  return nl_invoke(scope, head, NL_TAIL(cell), result);
+}
+/**
+ * Record a call made by nl_invoke, which ends the call it recorded before
+ * when it loops around for a tail call
+ */
+static inline void nl_invoke_profile(int *profiled, struct nl_cell head) {
+  if (*profiled) nl_profile_leave();
+  if ((*profiled = nl_profiling)) nl_profile_enter(head);
+}
+/**
+ * Calls run as a loop: the last form of a lambda body, and any form a
+ * native function hands back with NL_TAILCALL, is evaluated by jumping
+ * back to the top rather than recursing. Tail-called lambdas bind their
+ * parameters in the same call scope, so that a tail-recursive loop runs
+ * in constant stack while still seeing the bindings of its callers
+ */
+int nl_invoke(struct nl_scope *scope, struct nl_cell head, struct nl_cell args, struct nl_cell *result) {
+  struct nl_cell *p, cell;
+  struct nl_scope call_scope, *eval_scope = scope;
+  struct nl_code *code;
+  int err = 0, profiled = 0, chain = 0;
+  nl_scope_init(&call_scope);
+  call_scope.parent_scope = scope;
  retry:
-  switch (head.type) {
+  switch (NL_TYPE(head)) {
   case NL_SYMBOL:
-    nl_scope_get(scope, head.value.as_symbol, &head);
+    if (++chain > NL_CHAIN_MAX) {
+      eval_scope->last_err = "illegal call: too many symbols bound to symbols";
+      err = 1;
+      goto done;
+    }
+    nl_scope_get(eval_scope, NL_SYM(head), &head);
     goto retry;
   case NL_INTEGER:
-    return ((nl_native_func)head.value.as_integer)(scope, NL_TAIL(cell), result);
+    if (profiled || nl_profiling) nl_invoke_profile(&profiled, head);
+    err = ((nl_native_func)NL_INT(head))(eval_scope, args, result);
+    if (err != NL_TAILCALL) goto done;
+    err = 0;
+    cell = *result;
+    goto eval;
   case NL_NIL:
-    scope->last_err = "illegal call: cannot invoke nil";
-    return 1;
-  default:
+    eval_scope->last_err = "illegal call: cannot invoke nil";
+    err = 1;
+    goto done;
+  case NL_PAIR:
     break;
+  default:
+    eval_scope->last_err = "illegal call: cannot invoke a vector, table, int array or sequence";
+    err = 1;
+    goto done;
   }
-  nl_scope_init(&call_scope);
-  switch (NL_HEAD(head).type) {
+  switch (NL_TYPE(NL_HEAD(head))) {
   case NL_SYMBOL:
-    nl_scope_put(&call_scope, NL_HEAD(head).value.as_symbol, NL_TAIL(cell));
+    nl_scope_bind(&call_scope, NL_SYM(NL_HEAD(head)), args);
     break;
   case NL_PAIR:
-    a = &NL_TAIL(cell);
-    NL_FOREACH(&NL_HEAD(head), p) {
-      if (NL_HEAD_AT(p).type != NL_SYMBOL) {
-        scope->last_err = "illegal call: non-symbol parameter in lambda";
-        return 1;
-      }
-      if (a->type == NL_PAIR) {
-        if (nl_evalq(scope, NL_HEAD_AT(a), &v)) return 1;
-        nl_scope_put(&call_scope, NL_HEAD_AT(p).value.as_symbol, v);
-        a = NL_NEXT_AT(a);
-      } else if (a->type == NL_NIL) {
-        nl_scope_put(&call_scope, NL_HEAD_AT(p).value.as_symbol, *a);
-      } else {
-        if (nl_evalq(scope, *a, &v)) return 1;
-        nl_scope_put(&call_scope, NL_HEAD_AT(p).value.as_symbol, v);
-        a->type = NL_NIL;
-      }
-    }
+    if ((err = nl_bind_params(eval_scope, &call_scope, NL_HEAD(head), args))) goto done;
     break;
   case NL_NIL:
     break;
   default:
-    scope->last_err = "illegal call: illegal parameter list in lambda";
-    return 1;
+    eval_scope->last_err = "illegal call: illegal parameter list in lambda";
+    err = 1;
+    goto done;
   }
-  call_scope.parent_scope = scope;
+  if (profiled || nl_profiling) nl_invoke_profile(&profiled, head);
+  eval_scope = &call_scope;
+  if ((code = nl_vm_compile(head)) != NULL) {
+    err = nl_vm_exec(eval_scope, code, result);
+    if (err != NL_TAILCALL) goto done;
+    err = 0;
+    cell = *result;
+    goto eval;
+  }
+  if (!NL_IS_PAIR(NL_TAIL(head))) goto done;
   NL_FOREACH(&NL_TAIL(head), p) {
-    if (nl_evalq(&call_scope, NL_HEAD_AT(p), result)) return 1;
+    if (!NL_IS_PAIR(NL_TAIL_AT(p))) break;
+    if ((err = nl_evalq(eval_scope, NL_HEAD_AT(p), result))) goto done;
+  }
+  cell = NL_HEAD_AT(p);
+ eval:
+  switch (NL_TYPE(cell)) {
+  case NL_PAIR:
+    if ((err = nl_evalq(eval_scope, NL_HEAD(cell), &head))) goto done;
+    args = NL_TAIL(cell);
+    chain = 0;
+    goto retry;
+  case NL_SYMBOL:
+    nl_scope_get(eval_scope, NL_SYM(cell), result);
+    break;
+  default:
+    *result = cell;
+    break;
+  }
+ done:
+  if (profiled) nl_profile_leave();
+  // Errors in the body are reported on the call scope; pass them up
+  if (err && call_scope.last_err) scope->last_err = call_scope.last_err;
+  nl_scope_unwind(&call_scope);
+  return err;
+}
+/**
+ * Build the argument list ((quote . a) (quote . b) ...) in the given cells,
+ * which should have room for four cells per argument, or on the heap if
+ * no cells are given
+ */
+static struct nl_cell nl_quote_values(int64_t argc, struct nl_cell *argv, struct nl_cell *cells) {
+  struct nl_cell args = nil;
+  while (argc--) {
+    if (!cells) {
+      args = nl_cell_as_pair(nl_cell_as_pair(quote, argv[argc]), args);
+      continue;
+    }
+    cells[0] = quote;
+    cells[1] = argv[argc];
+    cells[2] = nl_cell_of_pair(cells);
+    cells[3] = args;
+    args = nl_cell_of_pair(cells + 2);
+    cells += 4;
+  }
+  return args;
+}
+int nl_invoke_values(struct nl_scope *scope, struct nl_cell fun, int64_t argc, struct nl_cell *argv, struct nl_cell *result) {
+  struct nl_cell cells[4 * argc + 1];
+  struct nl_code *code;
+  int chain = 0;
+ retry:
+  switch (NL_TYPE(fun)) {
+  case NL_SYMBOL:
+    if (++chain > NL_CHAIN_MAX) {
+      scope->last_err = "illegal call: too many symbols bound to symbols";
+      return 1;
+    }
+    nl_scope_get(scope, NL_SYM(fun), &fun);
+    goto retry;
+  case NL_INTEGER:
+    if ((nl_native_func)NL_INT(fun) == nl_quote)
+      return nl_invoke(scope, fun, nl_quote_values(argc, argv, NULL), result);
+    return nl_invoke(scope, fun, nl_quote_values(argc, argv, cells), result);
+  case NL_PAIR:
+    if ((code = nl_vm_compile(fun)) != NULL)
+      return nl_vm_call(scope, code, argc, argv, result);
+    /* fall through */
+  default:
+    return nl_invoke(scope, fun, nl_quote_values(argc, argv, NULL), result);
   }
-  return 0;
 }
 NL_BUILTIN(evalq) {
-  switch (cell.type) {
+  switch (NL_TYPE(cell)) {
   case NL_NIL:
   case NL_INTEGER:
+  case NL_VECTOR:
+  case NL_TABLE:
+  case NL_INTS:
+  case NL_SEQ:
     *result = cell;
     return 0;
   case NL_SYMBOL:
-    nl_scope_get(scope, cell.value.as_symbol, result);
+    nl_scope_get(scope, NL_SYM(cell), result);
     return 0;
   case NL_PAIR:
     return nl_call(scope, cell, result);
@@ -310,142 +704,528 @@ NL_BUILTIN(evalq) {
     return 1;
   }
 }
+/**
+ * nl_compare and nl_cell_equal keep the lists and vectors they are part
+ * way through on a stack of their own, so that deep nesting cannot
+ * overflow the C stack. A frame walking a list holds the rest of each
+ * list, and one walking a vector the index of the next item
+ */
+struct nl_walk_frame {
+  struct nl_cell a, b;
+  int64_t k;
+};
+struct nl_walk {
+  struct nl_walk_frame *frames, small[32];
+  int64_t count, capacity;
+};
+static void nl_walk_init(struct nl_walk *w) {
+  w->frames = w->small;
+  w->count = 0;
+  w->capacity = sizeof(w->small) / sizeof(*w->small);
+}
+static void nl_walk_push(struct nl_walk *w, struct nl_cell a, struct nl_cell b, int64_t k) {
+  if (w->count == w->capacity) {
+    w->capacity *= 2;
+    if (w->frames == w->small) {
+      w->frames = malloc(w->capacity * sizeof(*w->frames));
+      memcpy(w->frames, w->small, sizeof(w->small));
+    } else {
+      w->frames = realloc(w->frames, w->capacity * sizeof(*w->frames));
+    }
+  }
+  w->frames[w->count].a = a;
+  w->frames[w->count].b = b;
+  w->frames[w->count++].k = k;
+}
+static void nl_walk_end(struct nl_walk *w) {
+  if (w->frames != w->small) free(w->frames);
+}
 int nl_compare(struct nl_cell a, struct nl_cell b) {
-  struct nl_cell *i, *j;
-  int item_result;
-  int64_t a_len, b_len;
-  if (a.type == b.type)
-    switch (a.type) {
-    case NL_NIL: return 0;
-    case NL_SYMBOL: return strcmp(a.value.as_symbol, b.value.as_symbol);
-    case NL_INTEGER:
-      if (a.value.as_integer == b.value.as_integer) return 0;
-      if (a.value.as_integer < b.value.as_integer) return -1;
-      return 1;
-    case NL_PAIR:
-      a_len = nl_list_length(a);
-      b_len = nl_list_length(b);
-      if (a_len == b_len) {
-        for (i = &a, j = &b; i->type == NL_PAIR && j->type == NL_PAIR; i = NL_NEXT_AT(i), j = NL_NEXT_AT(j)) {
-          item_result = nl_compare(NL_HEAD_AT(i), NL_HEAD_AT(j));
-          if (item_result) return item_result;
-        }
-        return nl_compare(*i, *j);
+  struct nl_walk w;
+  struct nl_walk_frame *f;
+  struct nl_ints *ia, *ib;
+  int64_t k;
+  int result;
+  nl_walk_init(&w);
+ compare:
+  if (NL_SAME(a, b)) {
+    result = 0;
+    goto done;
+  }
+  // Types are ranked in the order they are declared
+  if (NL_TYPE(a) != NL_TYPE(b)) {
+    result = NL_TYPE(a) < NL_TYPE(b) ? -1 : 1;
+    goto done;
+  }
+  switch (NL_TYPE(a)) {
+  case NL_PAIR:
+    nl_walk_push(&w, a, b, -1);
+    goto next;
+  case NL_VECTOR:
+    if (NL_VECTOR_OF(a)->length != NL_VECTOR_OF(b)->length) {
+      result = NL_VECTOR_OF(a)->length < NL_VECTOR_OF(b)->length ? -1 : 1;
+      goto done;
+    }
+    nl_walk_push(&w, a, b, 0);
+    goto next;
+  case NL_SYMBOL:
+    result = strcmp(NL_SYM(a), NL_SYM(b));
+    goto done;
+  case NL_INTEGER:
+    result = NL_INT(a) == NL_INT(b) ? 0 : NL_INT(a) < NL_INT(b) ? -1 : 1;
+    goto done;
+  case NL_TABLE:
+    result = NL_TABLE_OF(a) == NL_TABLE_OF(b) ? 0 : NL_TABLE_OF(a) < NL_TABLE_OF(b) ? -1 : 1;
+    goto done;
+  case NL_SEQ:
+    result = NL_SEQ_OF(a) == NL_SEQ_OF(b) ? 0 : NL_SEQ_OF(a) < NL_SEQ_OF(b) ? -1 : 1;
+    goto done;
+  case NL_INTS:
+    ia = NL_INTS_OF(a);
+    ib = NL_INTS_OF(b);
+    result = 0;
+    if (ia->length != ib->length) {
+      result = ia->length < ib->length ? -1 : 1;
+      goto done;
+    }
+    for (k = 0; k < ia->length && !result; ++k)
+      if (ia->items[k] != ib->items[k]) result = ia->items[k] < ib->items[k] ? -1 : 1;
+    goto done;
+  default:
+    result = 0;
+    goto done;
+  }
+ next:
+  f = &w.frames[w.count - 1];
+  if (f->k < 0) {
+    if (NL_IS_PAIR(f->a) && NL_IS_PAIR(f->b)) {
+      a = NL_HEAD(f->a);
+      b = NL_HEAD(f->b);
+      f->a = NL_TAIL(f->a);
+      f->b = NL_TAIL(f->b);
+      goto compare;
+    }
+    // Whichever list ran out first is the shorter; otherwise their tails decide
+    a = f->a;
+    b = f->b;
+    --w.count;
+    if (NL_IS_PAIR(a) != NL_IS_PAIR(b)) {
+      result = NL_IS_PAIR(a) ? 1 : -1;
+      goto done;
+    }
+    goto compare;
+  }
+  if (f->k < NL_VECTOR_OF(f->a)->length) {
+    a = NL_VECTOR_OF(f->a)->items[f->k];
+    b = NL_VECTOR_OF(f->b)->items[f->k++];
+    goto compare;
+  }
+  --w.count;
+  result = 0;
+ done:
+  if (w.count && !result) goto next;
+  // The lists still being walked are only ordered by their items if
+  // they are the same length, so each must still be walked to the end
+  while (w.count) {
+    f = &w.frames[--w.count];
+    if (f->k >= 0) continue;
+    while (NL_IS_PAIR(f->a) && NL_IS_PAIR(f->b)) {
+      f->a = NL_TAIL(f->a);
+      f->b = NL_TAIL(f->b);
+    }
+    if (NL_IS_PAIR(f->a) != NL_IS_PAIR(f->b)) result = NL_IS_PAIR(f->a) ? 1 : -1;
+  }
+  nl_walk_end(&w);
+  return result;
+}
+int nl_cell_equal(struct nl_cell a, struct nl_cell b) {
+  struct nl_walk w;
+  struct nl_walk_frame *f;
+  int equal = 1;
+  nl_walk_init(&w);
+  for (;;) {
+    // Down the heads, leaving the tails for later
+    while (NL_IS_PAIR(a) && NL_IS_PAIR(b) && !NL_SAME(a, b)) {
+      nl_walk_push(&w, NL_TAIL(a), NL_TAIL(b), -1);
+      a = NL_HEAD(a);
+      b = NL_HEAD(b);
+    }
+    if (NL_SAME(a, b)) {
+      // Nothing to compare
+    } else if (NL_TYPE(a) != NL_TYPE(b)) {
+      equal = 0;
+    } else {
+      switch (NL_TYPE(a)) {
+      case NL_NIL: break;
+      case NL_INTEGER: equal = NL_INT(a) == NL_INT(b); break;
+      case NL_SYMBOL: equal = NL_SYM(a) == NL_SYM(b); break;
+      case NL_VECTOR:
+        equal = NL_VECTOR_OF(a)->length == NL_VECTOR_OF(b)->length;
+        if (equal) nl_walk_push(&w, a, b, 0);
+        break;
+      case NL_TABLE: equal = NL_TABLE_OF(a) == NL_TABLE_OF(b); break;
+      case NL_SEQ: equal = NL_SEQ_OF(a) == NL_SEQ_OF(b); break;
+      case NL_INTS:
+        equal = NL_INTS_OF(a)->length == NL_INTS_OF(b)->length
+          && !memcmp(NL_INTS_OF(a)->items, NL_INTS_OF(b)->items, NL_INTS_OF(a)->length * sizeof(int64_t));
+        break;
+      default: equal = 0;
       }
-      if (a_len < b_len) return -1;
-      return 1;
     }
-  if (a.type == NL_NIL) return -1;
-  if (b.type == NL_NIL) return 1;
-  if (a.type == NL_INTEGER) return -1;
-  if (b.type == NL_INTEGER) return 1;
-  if (a.type == NL_SYMBOL) return -1;
-  if (b.type == NL_SYMBOL) return 1;
-  if (a.type == NL_PAIR) return -1;
-  return 1;
+    if (!equal) break;
+    // The next cells to compare come from the latest frame not yet done
+    while (w.count && (f = &w.frames[w.count - 1])->k >= 0 && f->k >= NL_VECTOR_OF(f->a)->length)
+      --w.count;
+    if (!w.count) break;
+    if (f->k < 0) {
+      a = f->a;
+      b = f->b;
+      --w.count;
+    } else {
+      a = NL_VECTOR_OF(f->a)->items[f->k];
+      b = NL_VECTOR_OF(f->b)->items[f->k++];
+    }
+  }
+  nl_walk_end(&w);
+  return equal;
+}
+/**
+ * Native functions are recorded by address along with their C names,
+ * so that the compiler can recognize well-known builtins, and along
+ * with the library they came from, so that images can find them again
+ */
+struct nl_native_entry {
+  nl_native_func func;
+  char *name, *library;
+};
+static struct nl_native_entry *nl_natives;
+static size_t nl_natives_count, nl_natives_capacity;
+static size_t nl_native_slot(struct nl_native_entry *table, size_t capacity, nl_native_func func) {
+  size_t i = ((uintptr_t)func >> 4) * 11400714819323198485ULL >> 32;
+  for (i &= capacity - 1; table[i].func && table[i].func != func; i = (i + 1) & (capacity - 1));
+  return i;
+}
+struct nl_cell nl_native_register(const char *name, nl_native_func func) {
+  struct nl_native_entry *old = nl_natives;
+  size_t i, old_capacity = nl_natives_capacity;
+  if (2 * (nl_natives_count + 1) > nl_natives_capacity) {
+    nl_natives_capacity = old_capacity ? old_capacity * 2 : 64;
+    nl_natives = calloc(nl_natives_capacity, sizeof(*nl_natives));
+    for (i = 0; i < old_capacity; ++i)
+      if (old[i].func)
+        nl_natives[nl_native_slot(nl_natives, nl_natives_capacity, old[i].func)] = old[i];
+    free(old);
+  }
+  i = nl_native_slot(nl_natives, nl_natives_capacity, func);
+  if (!nl_natives[i].func) ++nl_natives_count;
+  nl_natives[i].func = func;
+  nl_natives[i].name = nl_intern_bytes(name, strlen(name));
+  return nl_cell_as_int((int64_t)func);
+}
+char *nl_native_name(nl_native_func func) {
+  if (!nl_natives) return NULL;
+  return nl_natives[nl_native_slot(nl_natives, nl_natives_capacity, func)].name;
+}
+void nl_native_set_library(nl_native_func func, const char *library) {
+  size_t i = nl_native_slot(nl_natives, nl_natives_capacity, func);
+  if (nl_natives[i].func)
+    nl_natives[i].library = nl_intern_bytes(library, strlen(library));
+}
+char *nl_native_library(nl_native_func func) {
+  if (!nl_natives) return NULL;
+  return nl_natives[nl_native_slot(nl_natives, nl_natives_capacity, func)].library;
+}
+void *nl_native_open(const char *library) {
+  void *lib = dlopen(library, RTLD_LAZY);
+  // The core functions are linked into the interpreter rather than built
+  // as a library of their own, so only their library falls back on the
+  // program itself; any other name has to open, or nothing is bound
+  if (!lib && !strcmp(library, NL_CORE_LIBRARY)) lib = dlopen(NULL, RTLD_LAZY);
+  return lib;
+}
+nl_native_func nl_native_lookup(const char *name) {
+  size_t i;
+  for (i = 0; i < nl_natives_capacity; ++i)
+    if (nl_natives[i].func && !nl_natives[i].library
+        && !strcmp(nl_natives[i].name, name))
+      return nl_natives[i].func;
+  return NULL;
 }
 void nl_scope_define_builtins(struct nl_scope *scope) {
-  nl_scope_put(scope, nl_in.value.as_symbol, nl_cell_as_int((int64_t)stdin));
-  nl_scope_put(scope, nl_out.value.as_symbol, nl_cell_as_int((int64_t)stdout));
-  nl_scope_put(scope, nl_err.value.as_symbol, nl_cell_as_int((int64_t)stderr));
+  nl_scope_put(scope, NL_SYM(nl_in), nl_cell_as_int((int64_t)stdin));
+  nl_scope_put(scope, NL_SYM(nl_out), nl_cell_as_int((int64_t)&nl_stdout_port));
+  nl_scope_put(scope, NL_SYM(nl_err), nl_cell_as_int((int64_t)&nl_stderr_port));
   NL_DEF_BUILTIN("load", load);
   NL_DEF_BUILTIN("load-native", loadnative);
+  NL_DEF_BUILTIN("dump-image", dumpimage);
+  NL_DEF_BUILTIN("gc", gc);
+  NL_DEF_BUILTIN("gc-stats", gcstats);
+  NL_DEF_BUILTIN("flush", flush);
+  NL_DEF_BUILTIN("port-buffer", portbuffer);
+  NL_DEF_BUILTIN("open-input", openinput);
+  NL_DEF_BUILTIN("close-input", closeinput);
+  NL_DEF_BUILTIN("read", readport);
+  NL_DEF_BUILTIN("read-shared", readshared);
+  NL_DEF_BUILTIN("for-each-datum", foreachdatum);
+  NL_DEF_BUILTIN("pmap", pmap);
+  NL_DEF_BUILTIN("pfilter", pfilter);
+  NL_DEF_BUILTIN("pfor-each", pforeach);
+  NL_DEF_BUILTIN("profile-start", profilestart);
+  NL_DEF_BUILTIN("profile-stop", profilestop);
+  NL_DEF_BUILTIN("profile-report", profilereport);
+  NL_DEF_BUILTIN("optimize", optimize);
+  // Only the optimizer's guards hold it, so it is registered but not bound
+  nl_native_register("nl_guard", nl_guard);
   NL_DEF_BUILTIN("quote", quote);
+  NL_DEF_BUILTIN("progn", progn);
+  NL_DEF_BUILTIN("if", if);
+  NL_DEF_BUILTIN("cond", cond);
+  NL_DEF_BUILTIN("while", while);
+  NL_DEF_BUILTIN("let", let);
 }
 NL_BUILTIN(quote) {
   *result = cell;
   return 0;
 }
+/**
+ * The special forms. Each is given its arguments unevaluated, and hands
+ * back the form in tail position (if any) to be evaluated by its caller
+ */
+NL_BUILTIN(progn) {
+  struct nl_cell *p;
+  *result = nil;
+  NL_FOREACH(&cell, p) {
+    if (!NL_IS_PAIR(NL_TAIL_AT(p))) {
+      *result = NL_HEAD_AT(p);
+      return NL_TAILCALL;
+    }
+    if (nl_evalq(scope, NL_HEAD_AT(p), result)) return 1;
+  }
+  return 0;
+}
+NL_BUILTIN(if) {
+  struct nl_cell forms;
+  // Missing forms are nil, as they were when if was a lambda in core.nl
+  *result = nil;
+  if (!NL_IS_PAIR(cell)) return 0;
+  if (nl_evalq(scope, NL_HEAD(cell), result)) return 1;
+  forms = NL_TAIL(cell);
+  if (NL_TYPE(*result) == NL_NIL && NL_IS_PAIR(forms)) forms = NL_TAIL(forms);
+  *result = nil;
+  if (!NL_IS_PAIR(forms)) return 0;
+  *result = NL_HEAD(forms);
+  return NL_TAILCALL;
+}
+NL_BUILTIN(cond) {
+  struct nl_cell *clause;
+  NL_FOREACH(&cell, clause) {
+    if (!NL_IS_PAIR(NL_HEAD_AT(clause))) {
+      scope->last_err = "illegal cond: expected a list for each clause";
+      return 1;
+    }
+    if (nl_evalq(scope, NL_HEAD(NL_HEAD_AT(clause)), result)) return 1;
+    // A clause with only a test gives the value of the test
+    if (NL_TYPE(*result) != NL_NIL)
+      return NL_IS_PAIR(NL_TAIL(NL_HEAD_AT(clause))) ? nl_progn(scope, NL_TAIL(NL_HEAD_AT(clause)), result) : 0;
+  }
+  *result = nil;
+  return 0;
+}
+NL_BUILTIN(while) {
+  struct nl_cell test, *p;
+  if (!NL_IS_PAIR(cell)) {
+    scope->last_err = "illegal while: expected a test";
+    return 1;
+  }
+  for (;;) {
+    if (nl_evalq(scope, NL_HEAD(cell), &test)) return 1;
+    if (NL_TYPE(test) == NL_NIL) break;
+    NL_FOREACH(&NL_TAIL(cell), p) {
+      if (nl_evalq(scope, NL_HEAD_AT(p), result)) return 1;
+    }
+  }
+  *result = nil;
+  return 0;
+}
+/**
+ * (let ((Name Value) ...) Form ...) evaluates every value, then binds them
+ * in a scope of its own for the forms, as a call to a lambda would
+ */
+NL_BUILTIN(let) {
+  struct nl_cell *b, *p;
+  struct nl_cell values[NL_IS_PAIR(cell) ? nl_list_length(NL_HEAD(cell)) + 1 : 1];
+  struct nl_scope let_scope;
+  int64_t i = 0;
+  int err = 0;
+  if (!NL_IS_PAIR(cell)) {
+    scope->last_err = "illegal let: expected a list of bindings";
+    return 1;
+  }
+  NL_FOREACH(&NL_HEAD(cell), b) {
+    if (NL_TYPE(NL_HEAD_AT(b)) == NL_SYMBOL) {
+      values[i++] = nil;
+      continue;
+    }
+    if (!NL_IS_PAIR(NL_HEAD_AT(b)) || NL_TYPE(NL_HEAD(NL_HEAD_AT(b))) != NL_SYMBOL) {
+      scope->last_err = "illegal let: expected a symbol or (symbol value) for each binding";
+      return 1;
+    }
+    values[i] = nil;
+    if (NL_IS_PAIR(NL_TAIL(NL_HEAD_AT(b))) && nl_evalq(scope, NL_HEAD(NL_TAIL(NL_HEAD_AT(b))), &values[i])) return 1;
+    ++i;
+  }
+  nl_scope_init(&let_scope);
+  let_scope.parent_scope = scope;
+  i = 0;
+  NL_FOREACH(&NL_HEAD(cell), b) {
+    nl_scope_bind(&let_scope, NL_SYM(NL_TYPE(NL_HEAD_AT(b)) == NL_SYMBOL ? NL_HEAD_AT(b) : NL_HEAD(NL_HEAD_AT(b))), values[i++]);
+  }
+  *result = nil;
+  NL_FOREACH(&NL_TAIL(cell), p) {
+    if ((err = nl_evalq(&let_scope, NL_HEAD_AT(p), result))) break;
+  }
+  if (err && let_scope.last_err) scope->last_err = let_scope.last_err;
+  nl_scope_unwind(&let_scope);
+  return err;
+}
 NL_BUILTIN(load) {
   struct nl_cell last_read, c_in;
-  FILE *in;
-  if (cell.type != NL_PAIR) {
+  struct nl_reader in;
+  int err;
+  if (!NL_IS_PAIR(cell)) {
     scope->last_err = "illegal load";
     return 1;
   }
   if (nl_evalq(scope, NL_HEAD(cell), &c_in)) return 1;
-  if (c_in.type != NL_SYMBOL) {
+  if (NL_TYPE(c_in) != NL_SYMBOL) {
     scope->last_err = "illegal load: expected pathname";
     return 1;
   }
-  in = fopen(c_in.value.as_symbol, "r");
-  if (!in) in = stdin;
-  for (;;) {
-    if (nl_read(scope, in, &last_read) == EOF) break;
-    if (nl_evalq(scope, last_read, result)) return 1;
+  if (nl_reader_open(&in, NL_SYM(c_in)))
+    nl_reader_init(&in, stdin);
+  // (load Path Shared) hash-conses everything read, code included
+  if (NL_IS_PAIR(NL_TAIL(cell))) {
+    if ((err = nl_evalq(scope, NL_HEAD(NL_TAIL(cell)), &last_read))) {
+      nl_reader_close(&in);
+      return err;
+    }
+    in.shared = NL_TYPE(last_read) != NL_NIL;
   }
-  return 0;
+  while (!(err = nl_read(scope, &in, &last_read))) {
+    if ((err = nl_evalq(scope, last_read, result))) break;
+  }
+  nl_reader_close(&in);
+  return err == EOF ? 0 : err;
 }
 NL_BUILTIN(loadnative) {
   void *lib, *f;
   struct nl_cell name, *n;
-  if (cell.type != NL_PAIR) {
+  if (!NL_IS_PAIR(cell)) {
     scope->last_err = "illegal load-native: need a list";
     return 1;
   }
   if (nl_evalq(scope, NL_HEAD(cell), &name)) return 1;
-  if (name.type != NL_SYMBOL) {
+  if (NL_TYPE(name) != NL_SYMBOL) {
     scope->last_err = "illegal load-native: first arg should be a symbol";
     return 1;
   }
-  lib = dlopen(name.value.as_symbol, RTLD_LAZY);
+  lib = nl_native_open(NL_SYM(name));
   if (!lib) {
     *result = nil;
     return 0;
   }
   NL_FOREACH(&NL_TAIL(cell), n) {
-    if (NL_HEAD_AT(n).type != NL_PAIR
-        || NL_HEAD(NL_HEAD_AT(n)).type != NL_SYMBOL
-        || NL_TAIL(NL_HEAD_AT(n)).type != NL_SYMBOL) {
+    if (!NL_IS_PAIR(NL_HEAD_AT(n))
+        || NL_TYPE(NL_HEAD(NL_HEAD_AT(n))) != NL_SYMBOL
+        || NL_TYPE(NL_TAIL(NL_HEAD_AT(n))) != NL_SYMBOL) {
       scope->last_err = "illegal load-native: expected pair of symbols";
       return 1;
     }
-    f = dlsym(lib, NL_HEAD(NL_HEAD_AT(n)).value.as_symbol);
+    f = dlsym(lib, NL_SYM(NL_HEAD(NL_HEAD_AT(n))));
     if (!f) {
       *result = nil;
       return 0;
     }
-    nl_scope_put(scope, NL_TAIL(NL_HEAD_AT(n)).value.as_symbol, nl_cell_as_int((int64_t)f));
+    nl_scope_put(scope, NL_SYM(NL_TAIL(NL_HEAD_AT(n))),
+                 nl_native_register(NL_SYM(NL_HEAD(NL_HEAD_AT(n))), (nl_native_func)f));
+    nl_native_set_library((nl_native_func)f, NL_SYM(name));
   }
   *result = t;
   return 0;
 }
+int nl_native_constants(const char *text, struct nl_cell *cells, size_t count) {
+  struct nl_reader in;
+  struct nl_scope scope;
+  struct nl_cell list, *c;
+  size_t i = 0;
+  nl_scope_init(&scope);
+  nl_reader_init(&in, NULL);
+  // Strings are unescaped in place, so the reader needs its own copy
+  in.buf = strdup(text);
+  in.end = in.size = strlen(text);
+  if (nl_read(&scope, &in, &list) != 0) {
+    free(in.buf);
+    return 1;
+  }
+  free(in.buf);
+  NL_FOREACH(&list, c) {
+    if (i == count) break;
+    nl_gc_write(&cells[i++], NL_HEAD_AT(c));
+  }
+  nl_gc_add_roots(cells, count);
+  return i != count;
+}
 int nl_run_repl(int interactive, struct nl_scope *scope) {
   struct nl_cell last_read, last_eval, c_in, c_out, c_err;
-  FILE *s_in = stdin, *s_out = stdout, *s_err = stderr;
+  struct nl_reader reader;
+  int err;
+  struct nl_port *s_out = &nl_stdout_port, *s_err = &nl_stderr_port;
+  FILE *s_in = stdin;
+  nl_reader_init(&reader, s_in);
   for (;;) {
+    // Anything but a port is ignored, rather than used as a pointer
     if (!nl_evalq(scope, nl_in, &c_in)
-        && c_in.type == NL_INTEGER)
-      s_in = (FILE *)c_in.value.as_integer;
-    if (!nl_evalq(scope, nl_out, &c_out)
-        && c_out.type == NL_INTEGER)
-      s_out = (FILE *)c_out.value.as_integer;
-    if (!nl_evalq(scope, nl_err, &c_err)
-        && c_err.type == NL_INTEGER)
-      s_err = (FILE *)c_err.value.as_integer;
-    if (interactive)
-      fprintf(s_out, "\n> ");
-    if (nl_read(scope, s_in, &last_read)) {
+        && NL_TYPE(c_in) == NL_INTEGER && (FILE *)NL_INT(c_in) == stdin)
+      s_in = stdin;
+    if (s_in != reader.in) {
+      free(reader.buf);
+      nl_reader_init(&reader, s_in);
+    }
+    if (!nl_evalq(scope, nl_out, &c_out) && nl_port_of(c_out))
+      s_out = nl_port_of(c_out);
+    if (!nl_evalq(scope, nl_err, &c_err) && nl_port_of(c_err))
+      s_err = nl_port_of(c_err);
+    if (interactive) {
+      nl_port_write(s_out, "\n> ", 3);
+      nl_port_flush(s_out);
+    }
+    if ((err = nl_read(scope, &reader, &last_read))) {
+      // Whatever was printed comes before the error
+      nl_port_flush(s_out);
+      if (err == EOF) return 0;
       if (scope->last_err)
-        fprintf(s_err, "ERROR read: %s\n", scope->last_err);
+        nl_port_printf(s_err, "ERROR read: %s\n", scope->last_err);
       else
-        fputs("ERROR read\n", s_err);
+        nl_port_write(s_err, "ERROR read\n", 11);
       return 1;
     }
     if (nl_evalq(scope, last_read, &last_eval)) {
+      nl_port_flush(s_out);
       if (scope->last_err)
-        fprintf(s_err, "ERROR eval: %s\n", scope->last_err);
+        nl_port_printf(s_err, "ERROR eval: %s\n", scope->last_err);
       else
-        fputs("ERROR eval\n", s_err);
+        nl_port_write(s_err, "ERROR eval\n", 11);
       return 2;
     }
     if (interactive) {
-      fputs("; ", s_out);
+      nl_port_write(s_out, "; ", 2);
       nl_writeq(scope, last_eval, &last_read);
     }
   }
 }
 void nl_globals_init() {
+  nl_gc_init();
+  nl_port_init();
   nil = nl_cell_as_nil();
   t = nl_cell_as_symbol(nl_intern(strdup("t")));
   quote = nl_cell_as_symbol(nl_intern(strdup("quote")));
@@ -1,25 +1,83 @@
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <unistd.h>
-#define NL_HEAD(cell) cell.value.as_pair[0]
-#define NL_TAIL(cell) cell.value.as_pair[1]
-#define NL_NEXT(cell) (cell.value.as_pair+1)
-#define NL_HEAD_AT(ref) ref->value.as_pair[0]
-#define NL_TAIL_AT(ref) ref->value.as_pair[1]
-#define NL_NEXT_AT(ref) (ref->value.as_pair+1)
-#define NL_FOREACH(start, a) for (a = start; a->type == NL_PAIR; a = NL_NEXT_AT(a))
+#define NL_HEAD(cell) NL_PAIR_OF(cell)[0]
+#define NL_TAIL(cell) NL_PAIR_OF(cell)[1]
+#define NL_NEXT(cell) (NL_PAIR_OF(cell)+1)
+#define NL_HEAD_AT(ref) NL_PAIR_OF(*(ref))[0]
+#define NL_TAIL_AT(ref) NL_PAIR_OF(*(ref))[1]
+#define NL_NEXT_AT(ref) (NL_PAIR_OF(*(ref))+1)
+#define NL_FOREACH(start, a) for (a = start; NL_IS_PAIR(*a); a = NL_NEXT_AT(a))
 #define NL_BUILTIN(name) int nl_ ## name(struct nl_scope *scope, struct nl_cell cell, struct nl_cell *result)
-#define NL_DEF_BUILTIN(sym, name) nl_scope_put(scope, nl_intern(strdup(sym)), nl_cell_as_int((int64_t)nl_ ## name))
+#define NL_SYMBOL_OF(sym) ((struct nl_symbol *)((sym) - offsetof(struct nl_symbol, name)))
+#define NL_DEF_BUILTIN(sym, name) nl_scope_put(scope, nl_intern(strdup(sym)), nl_native_register("nl_" #name, nl_ ## name))
+enum nl_type {
+  NL_NIL,
+  NL_INTEGER,
+  NL_SYMBOL,
+  NL_PAIR,
+  NL_VECTOR,
+  NL_TABLE,
+  NL_INTS,
+  NL_SEQ,
+};
+/**
+ * A vector is a header allocated by the collector, holding a separately
+ * allocated, fixed-length array of cells
+ */
+struct nl_vector {
+  int64_t length;
+  struct nl_cell *items;
+};
+/**
+ * A hash table is a header allocated by the collector, holding a
+ * separately allocated block of entries. While the table grows, entries
+ * are moved over from the previous block a few at a time, on each change
+ */
+struct nl_table {
+  struct nl_table_entries *entries, *old;
+};
+/**
+ * An int array is a header allocated by the collector, holding a
+ * separately allocated, fixed-length array of packed 64-bit integers
+ */
+struct nl_ints {
+  int64_t length;
+  int64_t *items;
+};
+#ifdef NL_TAGGED_CELLS
+/**
+ * The cell is the smallest block of data in nl. Built with
+ * NL_TAGGED_CELLS, a cell is a single word: integers are shifted left
+ * with the low bit set, symbols are pointers with the second bit set,
+ * vectors are pointers with the second and third bits set, int arrays
+ * with the fourth as well (headers are 16-byte aligned), tables are
+ * pointers with the third bit set, sequences are pointers to a pair with
+ * the third and fourth, pairs are plain pointers, and nil is zero.
+ * Integers only have 63 bits
+ */
+struct nl_cell {
+  uintptr_t bits;
+};
+#define NL_TYPE(cell) ((cell).bits & 1 ? NL_INTEGER \
+                       : (cell).bits & 2 ? ((cell).bits & 4 ? ((cell).bits & 8 ? NL_INTS : NL_VECTOR) : NL_SYMBOL) \
+                       : (cell).bits & 4 ? ((cell).bits & 8 ? NL_SEQ : NL_TABLE) : (cell).bits ? NL_PAIR : NL_NIL)
+#define NL_IS_PAIR(cell) (!((cell).bits & 7) && (cell).bits)
+#define NL_INT(cell) ((int64_t)(cell).bits >> 1)
+#define NL_SYM(cell) ((char *)((cell).bits & ~(uintptr_t)2))
+#define NL_PAIR_OF(cell) ((struct nl_cell *)(cell).bits)
+#define NL_VECTOR_OF(cell) ((struct nl_vector *)((cell).bits & ~(uintptr_t)6))
+#define NL_TABLE_OF(cell) ((struct nl_table *)((cell).bits & ~(uintptr_t)4))
+#define NL_INTS_OF(cell) ((struct nl_ints *)((cell).bits & ~(uintptr_t)14))
+#define NL_SEQ_OF(cell) ((struct nl_cell *)((cell).bits & ~(uintptr_t)12))
+#define NL_SAME(a, b) ((a).bits == (b).bits)
+#else
 /**
  * The cell is the smallest block of data in nl
  */
 struct nl_cell {
-  enum {
-        NL_NIL,
-        NL_INTEGER,
-        NL_SYMBOL,
-        NL_PAIR,
-  } type;
+  enum nl_type type;
   union {
     int64_t as_integer;
     char *as_symbol;
@@ -27,10 +85,54 @@ struct nl_cell {
      * Should be a pointer to exactly 2 cells
      */
     struct nl_cell *as_pair;
+    struct nl_vector *as_vector;
+    struct nl_table *as_table;
+    struct nl_ints *as_ints;
+    /**
+     * The pair holding a sequence's source and stages
+     */
+    struct nl_cell *as_seq;
   } value;
 };
+#define NL_TYPE(cell) ((cell).type)
+#define NL_IS_PAIR(cell) ((cell).type == NL_PAIR)
+#define NL_INT(cell) ((cell).value.as_integer)
+#define NL_SYM(cell) ((cell).value.as_symbol)
+#define NL_PAIR_OF(cell) ((cell).value.as_pair)
+#define NL_VECTOR_OF(cell) ((cell).value.as_vector)
+#define NL_TABLE_OF(cell) ((cell).value.as_table)
+#define NL_INTS_OF(cell) ((cell).value.as_ints)
+#define NL_SEQ_OF(cell) ((cell).value.as_seq)
+/**
+ * Whether two cells are the very same value, which is only a shortcut:
+ * equal cells need not be the same
+ */
+#define NL_SAME(a, b) ((a).type == (b).type && (a).value.as_integer == (b).value.as_integer)
+#endif
+/**
+ * Defined only by interpreters built with the same cell layout, so that
+ * a native library compiled for the other layout fails to load
+ */
+#ifdef NL_TAGGED_CELLS
+#define NL_CELL_LAYOUT nl_cells_tagged
+#else
+#define NL_CELL_LAYOUT nl_cells_boxed
+#endif
+extern const int NL_CELL_LAYOUT;
 /**
- * Linked list of names (which should be interned) and values
+ * Interned symbols are packed one after another into arena blocks,
+ * each name preceded by its hash, its length, and its current value.
+ * Use NL_SYMBOL_OF to get from an interned name to its symbol
+ */
+struct nl_symbol {
+  uint64_t hash;
+  size_t length;
+  struct nl_cell value;
+  char name[];
+};
+/**
+ * Linked list of names (which should be interned) and the values
+ * they had before being bound in a scope
  */
 struct nl_scope_symbols {
   char *name;
@@ -38,24 +140,114 @@ struct nl_scope_symbols {
   struct nl_scope_symbols *next;
 };
 /**
- * Scopes hold a symbol list, and optionally have a parent scope
+ * Scopes hold a list of the bindings they have shadowed, and optionally
+ * have a parent scope. Since scope is dynamic, the current value of every
+ * symbol lives in the symbol itself; a scope only needs to remember the
+ * values it replaced, so that they can be restored when it is unwound
  */
 struct nl_scope {
   // TODO move this inside the symbol list, like nl_in, and make it a stack
   char *last_err;
   struct nl_scope_symbols *symbols;
   struct nl_scope *parent_scope;
+  /**
+   * The top of the binding arena when the scope was initialized, which
+   * it is reset to when the scope is unwound
+   */
+  struct nl_scope_symbols *frame;
+};
+/**
+ * The reader's input. Tokens are scanned and interned in place, straight
+ * out of the buffer, which holds either a whole file mapped into memory
+ * or the latest block read from a stream
+ */
+struct nl_reader {
+  /**
+   * The stream to refill from, or NULL if the buffer holds all the input
+   */
+  FILE *in;
+  char *buf;
+  size_t pos, end, size;
+  int mapped, interactive, owned;
+  /**
+   * Set to hash-cons the pairs read, so that equal lists read while it
+   * is set are the very same pairs
+   */
+  int shared;
+};
+/**
+ * An output port collects bytes in a buffer on their way to a file
+ * descriptor. *Out and *Err hold ports, as integers. A port with no
+ * capacity writes straight through, and a line port (a terminal) is
+ * flushed after every newline
+ */
+struct nl_port {
+  int fd, line, failed;
+  char *buf;
+  size_t length, capacity;
 };
 /**
  * Native functions accept a scope (for variable lookup) and a cell (which
  * is the tail of the call pair). They should leave the result value in the
  * result pointer, and return non-zero on error.
+ *
+ * Instead of evaluating a form in tail position themselves, native functions
+ * may leave that form in the result pointer and return NL_TAILCALL; the
+ * form is then evaluated by the caller, in the same scope
+ */
+#define NL_TAILCALL -1
+/**
+ * How many symbols bound to symbols a call follows from its head before
+ * giving up, so that a cycle such as (setq a 'a)(a) is an error, not a hang
+ */
+#define NL_CHAIN_MAX 64
+/**
+ * Bytecode compiled from the body of a lambda
+ */
+struct nl_code;
+/**
+ * nil and t, and the symbol *Out, which names the port the printing
+ * functions write to. Set up by nl_globals_init
  */
+extern struct nl_cell nil, t, nl_out;
+/**
+ * The ports of standard output, buffered, and standard error, which is
+ * not. Both are flushed when the program exits
+ */
+extern struct nl_port nl_stdout_port, nl_stderr_port;
+/**
+ * Write a value to the port so that it can be read back, as write does
+ */
+int nl_write_to(struct nl_scope *, struct nl_port *, struct nl_cell);
 typedef int (*nl_native_func)(struct nl_scope *, struct nl_cell, struct nl_cell *result);
 NL_BUILTIN(evalq);
+NL_BUILTIN(writeq);
 NL_BUILTIN(quote);
+NL_BUILTIN(progn);
+NL_BUILTIN(if);
+NL_BUILTIN(cond);
+NL_BUILTIN(while);
+NL_BUILTIN(let);
 NL_BUILTIN(load);
 NL_BUILTIN(loadnative);
+NL_BUILTIN(dumpimage);
+NL_BUILTIN(gc);
+NL_BUILTIN(gcstats);
+NL_BUILTIN(pmap);
+NL_BUILTIN(pfilter);
+NL_BUILTIN(pforeach);
+NL_BUILTIN(profilestart);
+NL_BUILTIN(profilestop);
+NL_BUILTIN(profilereport);
+NL_BUILTIN(flush);
+NL_BUILTIN(portbuffer);
+NL_BUILTIN(openinput);
+NL_BUILTIN(closeinput);
+NL_BUILTIN(readport);
+NL_BUILTIN(readshared);
+NL_BUILTIN(foreachdatum);
+NL_BUILTIN(optimize);
+NL_BUILTIN(guard);
 struct nl_cell nl_cell_as_nil();
 struct nl_cell nl_cell_as_int(int64_t);
 /**
@@ -63,6 +255,31 @@ struct nl_cell nl_cell_as_int(int64_t);
  * This function allocates memory, and may call the garbage-collector
  */
 struct nl_cell nl_cell_as_pair(struct nl_cell, struct nl_cell);
+/**
+ * Create a cell pointing to the given two cells, which must be a pair
+ * allocated by the collector, or live on the C stack
+ */
+struct nl_cell nl_cell_of_pair(struct nl_cell *);
+/**
+ * Create a sequence cell from the given pair allocated by the collector,
+ * whose head is the sequence's source and whose tail lists its stages
+ */
+struct nl_cell nl_cell_of_seq(struct nl_cell *);
+/**
+ * Create a new vector of the given length, with every item nil.
+ * This function allocates memory, and may call the garbage-collector
+ */
+struct nl_cell nl_cell_as_vector(int64_t);
+/**
+ * Create a new, empty hash table.
+ * This function allocates memory, and may call the garbage-collector
+ */
+struct nl_cell nl_cell_as_table();
+/**
+ * Create a new int array of the given length, with every item zero.
+ * This function allocates memory, and may call the garbage-collector
+ */
+struct nl_cell nl_cell_as_ints(int64_t);
 /**
  * Create a new cell pointing to the given symbol.
  * The symbol should already be interned
@@ -73,25 +290,188 @@ struct nl_cell nl_cell_as_symbol(char *);
  * 0 if they are equal, or 1 if the first cell is larger.
  *
  * Values of the same type are compared normally: integers are compared
- * numerically, symbols are compared case-sensitively, and pairs are
- * compared first by their length and then element-wise
+ * numerically, symbols are compared case-sensitively, and pairs and
+ * vectors are compared first by their length and then element-wise
  *
  * Values of different types are ranked in the order: nil, integers,
- * symbols, pairs; from smallest to largest
+ * symbols, pairs, vectors, tables, int arrays; from smallest to largest.
+ * Tables are only equal to themselves, and are otherwise ordered by
+ * address. Int arrays are compared like vectors
+ *
+ * Lists are measured in the same walk that compares their items, which
+ * never recurses on the C stack, and values which are the very same
+ * cell are equal without being looked into
  */
 int nl_compare(struct nl_cell, struct nl_cell);
+/**
+ * Return non-zero if the two cells are structurally equal. Like
+ * nl_compare, this never recurses on the C stack
+ */
+int nl_cell_equal(struct nl_cell, struct nl_cell);
 int64_t nl_list_length(struct nl_cell);
 /**
- * Intern the given symbol, possibly freeing the memory it points to
- * if the same symbol has been interned before. Returns the interned
- * symbol
+ * Create a new vector holding the items of the given list, storing it
+ * into the given cell location. Returns non-zero if the list is improper
+ */
+int nl_vector_from_list(struct nl_cell, struct nl_cell *);
+/**
+ * Create a new int array holding the items of the given list, storing it
+ * into the given cell location. Returns non-zero if the list is improper
+ * or holds anything but integers
+ */
+int nl_ints_from_list(struct nl_cell, struct nl_cell *);
+/**
+ * Create a new table from the given list of (Key . Value) pairs, storing
+ * it into the given cell location. Returns non-zero if an item is not a pair
+ */
+int nl_table_from_list(struct nl_cell, struct nl_cell *);
+/**
+ * Create a new vector holding those of the n given items whose flag in
+ * keep is non-zero, in order.
+ * This function allocates memory, and may call the garbage-collector
+ */
+struct nl_cell nl_vector_keep(struct nl_cell *, int64_t, const char *);
+/**
+ * Hash a cell structurally, so that cells which are nl_cell_equal have
+ * the same hash. Tables hash by identity
+ */
+uint64_t nl_cell_hash(struct nl_cell);
+/**
+ * Look up the given key in the table, storing its value into the given
+ * cell location. Returns zero if the key is not in the table
+ */
+int nl_table_get(struct nl_table *, struct nl_cell, struct nl_cell *);
+/**
+ * Bind the given key to the given value in the table
+ */
+void nl_table_put(struct nl_table *, struct nl_cell, struct nl_cell);
+/**
+ * Remove the given key from the table. Returns zero if it was not there
+ */
+int nl_table_remove(struct nl_table *, struct nl_cell);
+int64_t nl_table_count(struct nl_table *);
+/**
+ * Call the given function on every key and value in the table. The
+ * table must not be changed until it returns
+ */
+void nl_table_foreach(struct nl_table *, void (*)(struct nl_cell, struct nl_cell, void *), void *);
+/**
+ * Mark every key and value in the table, from the collector
+ */
+void nl_table_mark(struct nl_table *);
+/**
+ * Call the given function on the address of every key and value in the
+ * table, for the collector's checks
+ */
+void nl_table_cells(struct nl_table *, void (*)(struct nl_cell *, void *), void *);
+/**
+ * Free the entries of a table which did not survive a collection
+ */
+void nl_table_free(struct nl_table *);
+/**
+ * Bytes of entries held by the table, for the collector's accounting
+ */
+size_t nl_table_bytes(struct nl_table *);
+/**
+ * Intern the given symbol, which should be heap-allocated, freeing the
+ * memory it points to. Returns the interned symbol
  */
 char *nl_intern(char *);
 /**
- * Read the next value from the given file, storing it into the given cell location.
- * Returns non-zero on error.
+ * Call the given function on every interned symbol
+ */
+void nl_intern_foreach(void (*)(char *, void *), void *);
+/**
+ * Intern the given bytes, which need not be null-terminated. The bytes
+ * are copied into symbol storage if they have not been interned before.
+ * Returns the interned symbol
+ */
+char *nl_intern_bytes(const char *, size_t);
+/**
+ * Hash the given bytes, as done for interned symbols
+ */
+uint64_t nl_hash_bytes(const char *, size_t);
+/**
+ * Read the next value from the given reader, storing it into the given cell location.
+ * Returns non-zero on error, or EOF at the end of the input.
  */
-int nl_read(struct nl_scope *, FILE *, struct nl_cell *);
+int nl_read(struct nl_scope *, struct nl_reader *, struct nl_cell *);
+/**
+ * Initialize a reader over the given stream, which is read in large
+ * blocks (or a line at a time, for a terminal)
+ */
+void nl_reader_init(struct nl_reader *, FILE *);
+/**
+ * Initialize a reader over the file at the given path, mapping it into
+ * memory if possible. Returns non-zero if the file cannot be opened
+ */
+int nl_reader_open(struct nl_reader *, const char *);
+/**
+ * Release the reader's buffer, and close its file if it was opened
+ * by nl_reader_open
+ */
+void nl_reader_close(struct nl_reader *);
+/**
+ * Return the pair to use for the given one, whose head and tail should
+ * already be shared: either an earlier pair with the same head and tail,
+ * or this one, which is found by later calls for as long as it lives
+ */
+struct nl_cell nl_share_pair(struct nl_cell);
+/**
+ * Share each pair of the given list from the end back, with
+ * nl_share_pair, returning the list's shared first pair. The list's
+ * pairs are reused when nothing equal is shared yet
+ */
+struct nl_cell nl_share_list(struct nl_cell);
+/**
+ * Whether the given pair was read in shared mode, and so must not change
+ */
+int nl_share_has(struct nl_cell pair);
+/**
+ * Forget the shared pairs which did not survive the collection in
+ * progress. Called by the collector
+ */
+void nl_share_sweep(int major);
+/**
+ * Set up the standard ports. Called by nl_globals_init
+ */
+void nl_port_init();
+/**
+ * Append bytes to the port. Anything too big for the room left in the
+ * buffer is written at once, along with what was buffered, in one call
+ */
+void nl_port_write(struct nl_port *, const void *, size_t);
+void nl_port_putc(struct nl_port *, int);
+void nl_port_write_int(struct nl_port *, int64_t);
+void nl_port_printf(struct nl_port *, const char *, ...) __attribute__((format(printf, 2, 3)));
+/**
+ * Write out whatever the port has buffered. Returns non-zero if any
+ * write to the port has failed
+ */
+int nl_port_flush(struct nl_port *);
+void nl_port_flush_all();
+/**
+ * Flush the port, then buffer up to the given number of bytes from now on
+ */
+void nl_port_set_buffer(struct nl_port *, size_t);
+/**
+ * The output port held by a cell, or NULL if the cell is not a port; and
+ * the port *Out holds in the given scope, which is standard output while
+ * *Out is nil. If *Out holds anything else, nl_port_out sets the scope's
+ * error and returns NULL
+ */
+struct nl_port *nl_port_of(struct nl_cell);
+struct nl_port *nl_port_out(struct nl_scope *);
+/**
+ * The input port held by a cell, as returned by open-input, or NULL if
+ * the cell is not an open input port
+ */
+struct nl_input_port *nl_input_port_of(struct nl_cell);
+/**
+ * Read the next datum from an input port. Returns non-zero on error, or
+ * EOF at the end of the input
+ */
+int nl_input_port_read(struct nl_scope *, struct nl_input_port *, struct nl_cell *);
 /**
  * Initialize a scope struct. This should be called before using
  * a scope in any other way
@@ -107,6 +487,344 @@ void nl_scope_put(struct nl_scope *, char *, struct nl_cell);
  * Get the value for the given symbol in the given scope, storing it in the given cell location
  */
 void nl_scope_get(struct nl_scope *, char *, struct nl_cell *);
+/**
+ * Bind the given value to the given symbol, which should be interned,
+ * in the given scope, shadowing any previous binding until the scope
+ * is unwound. Binding a symbol twice in the same scope replaces the
+ * first binding. Only the innermost scope not yet unwound may bind
+ */
+void nl_scope_bind(struct nl_scope *, char *, struct nl_cell);
+/**
+ * Restore the values of every symbol bound in the given scope, and
+ * release the bindings it saved. This must be called once the scope is
+ * no longer in use, before any scope initialized earlier is unwound
+ */
+void nl_scope_unwind(struct nl_scope *);
+/**
+ * Mark the values saved by the bindings of every scope not yet unwound,
+ * so that the collector keeps them alive
+ */
+void nl_scope_roots();
+/**
+ * Evaluate each value in the given list of symbols and values in
+ * eval_scope, and set the symbol to it in target_scope, as setq does
+ */
+int nl_setqe(struct nl_scope *target_scope, struct nl_scope *eval_scope, struct nl_cell, struct nl_cell *);
+/**
+ * Call the given function, which should already be evaluated, with the
+ * given argument list, which is not evaluated. The function may be a
+ * native function, a lambda, or a symbol naming either
+ */
+int nl_invoke(struct nl_scope *, struct nl_cell, struct nl_cell, struct nl_cell *);
+/**
+ * Call the given function, which should already be evaluated, with the
+ * given number of arguments, which are also already evaluated.
+ *
+ * This is equivalent to evaluating a call form with each value quoted,
+ * but does not allocate for lambdas or native functions. Native functions
+ * called this way receive an argument list which lives on the C stack,
+ * and must not keep references to it after they return
+ */
+int nl_invoke_values(struct nl_scope *, struct nl_cell, int64_t, struct nl_cell *, struct nl_cell *);
+/**
+ * Evaluate the argument list of a call into values for the given number
+ * of parameters, as a lambda does: missing arguments are nil, and extra
+ * ones are never evaluated
+ */
+int nl_eval_args(struct nl_scope *, struct nl_cell, int64_t, struct nl_cell *);
+/**
+ * Record the C name of a native function, returning a cell that holds
+ * the function. Natives must be registered to be recognized by the compiler
+ */
+struct nl_cell nl_native_register(const char *, nl_native_func);
+/**
+ * Get the C name a native function was registered with, or NULL
+ */
+char *nl_native_name(nl_native_func);
+/**
+ * Record the path of the library a registered native function was
+ * loaded from with load-native
+ */
+void nl_native_set_library(nl_native_func, const char *);
+/**
+ * Get the library a native function was loaded from, or NULL if it
+ * is built into the interpreter
+ */
+char *nl_native_library(nl_native_func);
+/**
+ * Find a registered native function built into the interpreter by its
+ * C name, or NULL
+ */
+nl_native_func nl_native_lookup(const char *);
+/**
+ * The library core.nl loads the core functions from
+ */
+#define NL_CORE_LIBRARY "core.o"
+/**
+ * Open the library native functions are loaded from for load-native, or
+ * return NULL if it cannot be opened. NL_CORE_LIBRARY opens the
+ * interpreter itself, which the core functions are linked into
+ */
+void *nl_native_open(const char *);
+/**
+ * Read the list of constants a compiled module was built with from its
+ * written form into the given cells, which become roots. Returns non-zero
+ * unless there were exactly that many. Called by modules built with nlc
+ * as they are loaded
+ */
+int nl_native_constants(const char *, struct nl_cell *, size_t);
+/**
+ * Restore the global bindings saved by dump-image from the given file.
+ * The image's cells are used in place, straight out of the mapped file.
+ * Returns non-zero on error
+ */
+int nl_image_load(struct nl_scope *, const char *);
+/**
+ * Get the compiled code for the given lambda, compiling it on first use.
+ * Returns NULL if the lambda cannot be compiled, as for lambdas which take
+ * their argument list unevaluated
+ */
+struct nl_code *nl_vm_compile(struct nl_cell);
+/**
+ * Run compiled code in the given scope, which should already have the
+ * lambda's parameters bound. May return NL_TAILCALL, like a native function
+ */
+int nl_vm_exec(struct nl_scope *, struct nl_code *, struct nl_cell *);
+/**
+ * Call compiled code in a new child of the given scope, binding the given
+ * evaluated arguments to the lambda's parameters
+ */
+int nl_vm_call(struct nl_scope *, struct nl_code *, int64_t, struct nl_cell *, struct nl_cell *);
+/**
+ * Discard all compiled code. This must be called whenever a pair is
+ * modified in place, since the pair may be part of a compiled lambda
+ */
+void nl_vm_invalidate();
+/**
+ * Mark the lambdas of compiled code which is currently running, so that
+ * the collector keeps them alive
+ */
+void nl_vm_roots();
+/**
+ * Free compiled code whose lambda did not survive the collection in
+ * progress, along with stale code which is no longer running
+ */
+void nl_vm_sweep();
+/**
+ * Set while the profiler is sampling. Calls are recorded with
+ * nl_profile_enter and nl_profile_leave only while it is set, but each
+ * call which was entered must still be left after it is cleared
+ */
+extern int nl_profiling;
+/**
+ * Record a call to the given lambda or native function
+ */
+void nl_profile_enter(struct nl_cell);
+/**
+ * Record the return from the latest call recorded by nl_profile_enter
+ */
+void nl_profile_leave();
+/**
+ * Record a tail call, which takes the place of the latest call recorded
+ */
+void nl_profile_replace(struct nl_cell);
+/**
+ * Mark the functions the profiler has measured, so that they keep their
+ * identity until the report
+ */
+void nl_profile_roots();
+/**
+ * Start sampling calls every millisecond of CPU time, forgetting anything
+ * measured before
+ */
+void nl_profile_start();
+/**
+ * Stop sampling, keeping what was measured for nl_profile_report
+ */
+void nl_profile_stop();
+/**
+ * Print the calls, time and allocations measured for each function
+ */
+void nl_profile_report(struct nl_port *);
+/**
+ * Set while lambdas are optimized as defq binds them, which is the
+ * default. While nl_optimize_reporting is set as well, each rewrite is
+ * written to standard error
+ */
+extern int nl_optimizing, nl_optimize_reporting;
+/**
+ * Store an optimized copy of a lambda about to be bound to the given
+ * name: constant calls to arithmetic and comparisons folded, small
+ * functions inlined, and forms whose values go unused and which do
+ * nothing else dropped. Inlined and folded calls are guarded on their
+ * symbols still being bound as they were. The lambda itself is never
+ * changed
+ */
+int nl_optimize_lambda(struct nl_scope *, char *name, struct nl_cell lambda, struct nl_cell *result);
+/**
+ * Whether the form is a guard left by the optimizer: nl_guard itself at
+ * its head, which no symbol is bound to, then a symbol, what it must
+ * still be bound to, the rewritten form and the form as written
+ */
+int nl_is_guard(struct nl_cell);
+/**
+ * The elementwise operations of nl_ints_map. Comparisons give 1 where
+ * they hold and 0 elsewhere; arithmetic wraps around
+ */
+enum nl_ints_op {
+  NL_INTS_ADD,
+  NL_INTS_SUB,
+  NL_INTS_MUL,
+  NL_INTS_EQ,
+  NL_INTS_LT,
+  NL_INTS_GT,
+};
+/**
+ * Apply the operation to each pair of items of a and b, or to each item
+ * of a and the integer scalar if b is NULL, storing into out. The kernels
+ * use the widest vector instructions the CPU supports, chosen on first use
+ */
+void nl_ints_map(enum nl_ints_op, int64_t *out, const int64_t *a, const int64_t *b, int64_t scalar, int64_t length);
+int64_t nl_ints_sum(const int64_t *, int64_t length);
+int64_t nl_ints_dot(const int64_t *, const int64_t *, int64_t length);
+/**
+ * The smallest or largest item; the length must not be zero
+ */
+int64_t nl_ints_min(const int64_t *, int64_t length);
+int64_t nl_ints_max(const int64_t *, int64_t length);
+/**
+ * Store the running total of a into out, which may be a
+ */
+void nl_ints_prefix_sum(int64_t *out, const int64_t *a, int64_t length);
+/**
+ * The name of the kernels in use: avx2, sse4.2 or scalar. Setting
+ * NL_INTS_KERNELS in the environment picks a supported set by name
+ */
+const char *nl_ints_kernels();
+/**
+ * A lazy sequence is a cell of its own type, pointing at a pair of its
+ * source and the list of stages each item goes through in order, as in
+ * ((range 0 10 1) (map . F) (take . 3)). Building one never touches the
+ * items: they are pulled from the source one at a time, and through
+ * every stage, by whatever consumes the sequence
+ */
+enum nl_seq_kind {
+  NL_SEQ_LIST,
+  NL_SEQ_VECTOR,
+  NL_SEQ_RANGE,
+  NL_SEQ_UNFOLD,
+  NL_SEQ_PORT,
+  NL_SEQ_MAP,
+  NL_SEQ_FILTER,
+  NL_SEQ_TAKE,
+  NL_SEQ_DROP,
+};
+struct nl_seq_stage {
+  enum nl_seq_kind kind;
+  struct nl_cell arg;
+  int64_t count;
+};
+/**
+ * The state of one pass over a sequence, which keeps the sequence itself
+ * alive. items is what is left of a list, or the vector, or the seed
+ */
+struct nl_seq_iter {
+  struct nl_cell seq, items, more, next;
+  enum nl_seq_kind source;
+  int64_t index, end, step;
+  int bounded, started, done;
+  struct nl_input_port *port;
+  struct nl_seq_stage *stages;
+  int64_t stage_count;
+};
+/**
+ * A sequence with the given source, whose arguments follow the kind
+ */
+struct nl_cell nl_seq_make(enum nl_seq_kind, struct nl_cell);
+/**
+ * A copy of the sequence with one more stage at the end
+ */
+struct nl_cell nl_seq_add(struct nl_cell, enum nl_seq_kind, struct nl_cell);
+/**
+ * The given list, vector, int array or input port as a sequence, or the
+ * sequence itself. Returns non-zero for anything else
+ */
+int nl_seq_of(struct nl_cell, struct nl_cell *);
+/**
+ * Start a pass over the sequence. Returns non-zero, with an error in the
+ * scope, if it is malformed or its port has been closed
+ */
+int nl_seq_begin(struct nl_scope *, struct nl_seq_iter *, struct nl_cell);
+/**
+ * Store the next item that makes it through every stage. Returns
+ * non-zero on error, or EOF once there are no more
+ */
+int nl_seq_next(struct nl_scope *, struct nl_seq_iter *, struct nl_cell *);
+void nl_seq_end(struct nl_seq_iter *);
+/**
+ * Set up the collected heap. Called by nl_globals_init
+ */
+void nl_gc_init();
+/**
+ * Allocate the two cells of a new pair. May collect first
+ */
+struct nl_cell *nl_gc_alloc_pair();
+/**
+ * Allocate a vector header and its items, which are all nil. May collect
+ * first. The items are freed along with the header
+ */
+struct nl_vector *nl_gc_alloc_vector(int64_t);
+/**
+ * Allocate a table header, without any entries. May collect first.
+ * The entries are freed along with the header
+ */
+struct nl_table *nl_gc_alloc_table();
+/**
+ * Allocate an int array header and its items, which are all zero. May
+ * collect first. The items are freed along with the header
+ */
+struct nl_ints *nl_gc_alloc_ints(int64_t);
+/**
+ * Free a block of memory outside the heap once the next collection is
+ * over, since cells inside it may still be in the remembered set
+ */
+void nl_gc_free_later(void *);
+/**
+ * Store a value into a cell which may be older than the value, such as
+ * a symbol's value or the head or tail of an existing pair. Every such
+ * store must go through here, so that minor collections can find young
+ * pairs referred to from outside the young generation.
+ *
+ * Pairs being built by C code which still holds a pointer to them on the
+ * stack may be written directly
+ */
+void nl_gc_write(struct nl_cell *, struct nl_cell);
+/**
+ * Register cells outside the heap and off the C stack which may hold
+ * pairs, so that they are traced by major collections. Stores into them
+ * must still go through nl_gc_write
+ */
+void nl_gc_add_roots(struct nl_cell *, size_t);
+/**
+ * Mark the given cell as live, from a collector callback such as
+ * nl_vm_roots
+ */
+void nl_gc_mark_cell(struct nl_cell);
+/**
+ * Whether the given pair survives the collection in progress, from a
+ * collector callback such as nl_vm_sweep
+ */
+int nl_gc_is_live(void *);
+/**
+ * How many pairs, vectors, tables and int arrays have been
+ * allocated since the program started
+ */
+uint64_t nl_gc_allocations();
+/**
+ * Collect garbage now. A minor collection only traces pairs allocated
+ * since the last collection; a major one traces the whole heap
+ */
+void nl_gc_collect(int major);
 /**
  * Initialize the root scope by binding native core functions.
  * This should be called once for the root scope of the program,
@@ -119,7 +837,8 @@ void nl_scope_define_builtins(struct nl_scope *);
  * Read each datum from the file bound at *In in the given scope, evaluating
  * each datum until end-of-file
  *
- * Optionally run interactively
+ * Optionally run interactively. Returns 0 at the end of the input, 1 on
+ * a read error, and 2 on an evaluation error
  *
  * TODO move prompt symbols into scope
  */
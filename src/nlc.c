@@ -0,0 +1,888 @@
+#include "nl.h"
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+/**
+ * nlc compiles the defq lambdas of a .nl file ahead of time. Each becomes
+ * a C function with the NL_BUILTIN signature, built by the system compiler
+ * into a shared object, and a loader is written which binds them with
+ * load-native in place of their defq forms. Everything else in the file
+ * is copied into the loader as it is.
+ *
+ * Compiled code makes the choices the bytecode compiler makes: a call to
+ * a well-known native function is inlined behind a guard that its symbol
+ * is still bound to that native, and anything else is left to the
+ * interpreter. Calls between functions of the same file are direct C
+ * calls behind the same kind of guard, and a function calling itself in
+ * tail position loops, rebinding its parameters in its call scope
+ */
+struct nlc_function {
+  char *name, *cname;
+  /**
+   * The number of parameters, or -1 for a lambda which takes its
+   * argument list unevaluated
+   */
+  int64_t nparams;
+  /**
+   * Set unless another defq in the file binds the same name, in which
+   * case calls to it are left to the interpreter
+   */
+  int unique, rebinds;
+  char *code;
+  size_t code_size;
+  int temps, lets;
+};
+/**
+ * A top-level form, and where its text starts and ends in the file
+ */
+struct nlc_form {
+  size_t start, end;
+  struct nlc_function *function;
+};
+struct nlc {
+  FILE *out;
+  struct nlc_function *functions, *function;
+  size_t nfunctions;
+  struct nlc_form *forms;
+  size_t nforms;
+  /**
+   * Lists of everything read or built, and of the constants compiled
+   * code refers to (last first); both are found on the stack
+   */
+  struct nl_cell keep, constants;
+  int nconstants;
+  char **symbols, **natives;
+  int nsymbols, nnatives;
+  int depth, temps, lets, labels;
+  /**
+   * Set once a call between functions of the file is compiled, which
+   * needs nlc_direct written out
+   */
+  int direct;
+  char at[32], fail[32];
+  int *failed;
+};
+static void nlc_line(struct nlc *c, const char *format, ...) __attribute__((format(printf, 2, 3)));
+static void nlc_line(struct nlc *c, const char *format, ...) {
+  va_list args;
+  fprintf(c->out, "%*s", 2 * c->depth, "");
+  va_start(args, format);
+  vfprintf(c->out, format, args);
+  va_end(args);
+  fputc('\n', c->out);
+}
+static void nlc_label(struct nlc *c, const char *format, int n) {
+  fputc(' ', c->out);
+  fprintf(c->out, format, n);
+  fputs(":\n", c->out);
+}
+static char *nlc_jump_fail(struct nlc *c) {
+  *c->failed = 1;
+  return c->fail;
+}
+static int nlc_symbol(struct nlc *c, char *sym) {
+  int i;
+  for (i = 0; i < c->nsymbols; ++i)
+    if (c->symbols[i] == sym) return i;
+  c->symbols = realloc(c->symbols, (c->nsymbols + 1) * sizeof(*c->symbols));
+  c->symbols[c->nsymbols] = sym;
+  return c->nsymbols++;
+}
+static void nlc_native(struct nlc *c, char *name) {
+  int i;
+  for (i = 0; i < c->nnatives; ++i)
+    if (!strcmp(c->natives[i], name)) return;
+  c->natives = realloc(c->natives, (c->nnatives + 1) * sizeof(*c->natives));
+  c->natives[c->nnatives++] = name;
+}
+/**
+ * The form with each of the optimizer's guards replaced by the call it
+ * guards: nl_guard at a guard's head would be written as an address,
+ * which means nothing to the process reading the constants back
+ */
+static struct nl_cell nlc_unguard(struct nl_cell form) {
+  struct nl_cell head, tail;
+  if (!NL_IS_PAIR(form)) return form;
+  if (nl_is_guard(form)) return nlc_unguard(NL_HEAD(NL_TAIL(NL_TAIL(NL_TAIL(NL_TAIL(form))))));
+  head = nlc_unguard(NL_HEAD(form));
+  tail = nlc_unguard(NL_TAIL(form));
+  if (NL_SAME(head, NL_HEAD(form)) && NL_SAME(tail, NL_TAIL(form))) return form;
+  return nl_cell_as_pair(head, tail);
+}
+static int nlc_constant(struct nlc *c, struct nl_cell cell) {
+  c->constants = nl_cell_as_pair(nlc_unguard(cell), c->constants);
+  return c->nconstants++;
+}
+static struct nlc_function *nlc_function(struct nlc *c, char *name) {
+  size_t i;
+  for (i = 0; i < c->nfunctions; ++i)
+    if (c->functions[i].name == name) return &c->functions[i];
+  return NULL;
+}
+static int64_t nlc_argc(struct nl_cell args) {
+  struct nl_cell *a;
+  int64_t n = 0;
+  NL_FOREACH(&args, a) ++n;
+  return NL_TYPE(*a) == NL_NIL ? n : -1;
+}
+static void nlc_form(struct nlc *, struct nl_cell, int, int);
+/**
+ * Compile a value which evaluates to itself
+ */
+static void nlc_value(struct nlc *c, struct nl_cell cell, int k) {
+  if (NL_TYPE(cell) == NL_NIL)
+    nlc_line(c, "v[%d] = nil;", k);
+  else if (NL_TYPE(cell) == NL_INTEGER && NL_INT(cell) == INT64_MIN)
+    nlc_line(c, "v[%d] = nl_cell_as_int(INT64_MIN);", k);
+  else if (NL_TYPE(cell) == NL_INTEGER)
+    nlc_line(c, "v[%d] = nl_cell_as_int(%lldLL);", k, (long long)NL_INT(cell));
+  else
+    nlc_line(c, "v[%d] = nlc_consts[%d];", k, nlc_constant(c, cell));
+}
+/**
+ * Leave the form to the interpreter
+ */
+static void nlc_eval(struct nlc *c, struct nl_cell form, int k) {
+  nlc_line(c, "if (nl_evalq(&%s, nlc_consts[%d], &v[%d])) goto %s;", c->at, nlc_constant(c, form), k, nlc_jump_fail(c));
+}
+static void nlc_check_int(struct nlc *c, struct nl_cell form, int k, const char *msg) {
+  if (NL_TYPE(form) == NL_INTEGER) return;
+  nlc_line(c, "if (NL_TYPE(v[%d]) != NL_INTEGER) {", k);
+  nlc_line(c, "  %s.last_err = \"%s\";", c->at, msg);
+  nlc_line(c, "  goto %s;", nlc_jump_fail(c));
+  nlc_line(c, "}");
+}
+/**
+ * Compile a body of forms, leaving the value of the last one, or the end
+ * of the list if there are none
+ */
+static void nlc_body(struct nlc *c, struct nl_cell forms, int k, int tail) {
+  struct nl_cell *f;
+  if (!NL_IS_PAIR(forms)) {
+    nlc_value(c, forms, k);
+    return;
+  }
+  NL_FOREACH(&forms, f)
+    nlc_form(c, NL_HEAD_AT(f), k, tail && !NL_IS_PAIR(NL_TAIL_AT(f)));
+}
+/**
+ * Whether a call to the given native function can be compiled inline,
+ * which depends only on its shape
+ */
+static int nlc_inlines(struct nl_cell form, const char *name, int64_t argc) {
+  static const char *unary[] = {
+    "nl_not", "nl_is_nil", "nl_is_integer", "nl_is_symbol", "nl_is_pair", "nl_head", "nl_tail", "nl_eval",
+  }, *binary[] = {
+    "nl_lt", "nl_lte", "nl_gt", "nl_gte", "nl_equal", "nl_pair",
+  };
+  struct nl_cell *a, *b;
+  size_t i;
+  if (!strcmp(name, "nl_quote")) return 1;
+  if (argc < 0) return 0;
+  for (i = 0; i < sizeof(unary) / sizeof(*unary); ++i)
+    if (!strcmp(name, unary[i])) return argc == 1;
+  for (i = 0; i < sizeof(binary) / sizeof(*binary); ++i)
+    if (!strcmp(name, binary[i])) return argc == 2;
+  if (!strcmp(name, "nl_and") || !strcmp(name, "nl_or") || !strcmp(name, "nl_while")) return argc > 0;
+  if (!strcmp(name, "nl_add") || !strcmp(name, "nl_mul") || !strcmp(name, "nl_progn")) return 1;
+  if (!strcmp(name, "nl_sub") || !strcmp(name, "nl_div")) return argc != 1;
+  if (!strcmp(name, "nl_setq")) return argc == 2 && NL_TYPE(NL_HEAD(NL_TAIL(form))) == NL_SYMBOL;
+  if (!strcmp(name, "nl_if")) return argc == 2 || argc == 3;
+  if (!strcmp(name, "nl_guard")) return argc == 4 && NL_TYPE(NL_HEAD(NL_TAIL(form))) == NL_SYMBOL;
+  if (!strcmp(name, "nl_cond")) {
+    if (argc == 0) return 0;
+    NL_FOREACH(&NL_TAIL(form), a)
+      if (!NL_IS_PAIR(NL_HEAD_AT(a)) || nlc_argc(NL_HEAD_AT(a)) < 0) return 0;
+    return 1;
+  }
+  if (!strcmp(name, "nl_let")) {
+    if (argc == 0 || nlc_argc(NL_HEAD(NL_TAIL(form))) < 0) return 0;
+    NL_FOREACH(&NL_HEAD(NL_TAIL(form)), b) {
+      if (NL_TYPE(NL_HEAD_AT(b)) == NL_SYMBOL) continue;
+      if (!NL_IS_PAIR(NL_HEAD_AT(b)) || NL_TYPE(NL_HEAD(NL_HEAD_AT(b))) != NL_SYMBOL) return 0;
+    }
+    return 1;
+  }
+  return 0;
+}
+/**
+ * Compile let, binding its values in a scope of its own. Its body is
+ * never in tail position, since the scope is unwound after it
+ */
+static void nlc_let(struct nlc *c, struct nl_cell form, int k) {
+  struct nl_cell *b, *p, binding;
+  int base = c->temps, id = c->lets++, i = 0, failed = 0, *outer_failed = c->failed;
+  char at[32], fail[32];
+  NL_FOREACH(&NL_HEAD(NL_TAIL(form)), b) ++c->temps;
+  NL_FOREACH(&NL_HEAD(NL_TAIL(form)), b) {
+    binding = NL_HEAD_AT(b);
+    if (NL_IS_PAIR(binding) && NL_IS_PAIR(NL_TAIL(binding)))
+      nlc_form(c, NL_HEAD(NL_TAIL(binding)), base + i++, 0);
+    else
+      nlc_line(c, "v[%d] = nil;", base + i++);
+  }
+  nlc_line(c, "nl_scope_init(&l%d);", id);
+  nlc_line(c, "l%d.parent_scope = &%s;", id, c->at);
+  i = 0;
+  NL_FOREACH(&NL_HEAD(NL_TAIL(form)), b) {
+    binding = NL_TYPE(NL_HEAD_AT(b)) == NL_SYMBOL ? NL_HEAD_AT(b) : NL_HEAD(NL_HEAD_AT(b));
+    nlc_line(c, "nl_scope_bind(&l%d, nlc_syms[%d], v[%d]);", id, nlc_symbol(c, NL_SYM(binding)), base + i++);
+  }
+  nlc_line(c, "v[%d] = nil;", k);
+  strcpy(at, c->at);
+  strcpy(fail, c->fail);
+  snprintf(c->at, sizeof(c->at), "l%d", id);
+  snprintf(c->fail, sizeof(c->fail), "let_fail%d", id);
+  c->failed = &failed;
+  NL_FOREACH(&NL_TAIL(NL_TAIL(form)), p)
+    nlc_form(c, NL_HEAD_AT(p), k, 0);
+  strcpy(c->at, at);
+  strcpy(c->fail, fail);
+  c->failed = outer_failed;
+  nlc_line(c, "nl_scope_unwind(&l%d);", id);
+  if (!failed) return;
+  // Errors in the body are reported on the let scope; pass them up
+  nlc_line(c, "goto let_end%d;", id);
+  nlc_label(c, "let_fail%d", id);
+  nlc_line(c, "if (l%d.last_err) %s.last_err = l%d.last_err;", id, c->at, id);
+  nlc_line(c, "nl_scope_unwind(&l%d);", id);
+  nlc_line(c, "goto %s;", nlc_jump_fail(c));
+  nlc_label(c, "let_end%d", id);
+}
+/**
+ * Compile a call to a native function inline, which nlc_inlines allowed
+ */
+static void nlc_inline(struct nlc *c, struct nl_cell form, const char *name, int k, int tail) {
+  static const struct {
+    const char *name, *test;
+  } tests[] = {
+    { "nl_not", "NL_TYPE(v[%d]) == NL_NIL" },
+    { "nl_is_nil", "NL_TYPE(v[%d]) == NL_NIL" },
+    { "nl_is_integer", "NL_TYPE(v[%d]) == NL_INTEGER" },
+    { "nl_is_symbol", "NL_TYPE(v[%d]) == NL_SYMBOL" },
+    { "nl_is_pair", "NL_TYPE(v[%d]) == NL_PAIR" },
+  }, compares[] = {
+    { "nl_lt", "== -1" },
+    { "nl_lte", "!= 1" },
+    { "nl_gt", "== 1" },
+    { "nl_gte", "!= -1" },
+  };
+  struct nl_cell args = NL_TAIL(form), *a, clause;
+  int64_t argc = nlc_argc(args);
+  int x, end, opened = 0;
+  size_t i;
+  if (!strcmp(name, "nl_quote")) {
+    nlc_value(c, args, k);
+    return;
+  }
+  if (!strcmp(name, "nl_progn")) {
+    nlc_body(c, args, k, tail);
+    return;
+  }
+  if (!strcmp(name, "nl_let")) {
+    nlc_let(c, form, k);
+    return;
+  }
+  if (!strcmp(name, "nl_setq")) {
+    nlc_form(c, NL_HEAD(NL_TAIL(args)), k, 0);
+    nlc_line(c, "nl_gc_write(&NL_SYMBOL_OF(nlc_syms[%d])->value, v[%d]);", nlc_symbol(c, NL_SYM(NL_HEAD(args))), k);
+    return;
+  }
+  if (!strcmp(name, "nl_if")) {
+    nlc_form(c, NL_HEAD(args), k, 0);
+    nlc_line(c, "if (NL_TYPE(v[%d]) != NL_NIL) {", k);
+    ++c->depth;
+    nlc_form(c, NL_HEAD(NL_TAIL(args)), k, tail);
+    --c->depth;
+    if (argc == 3) {
+      nlc_line(c, "} else {");
+      ++c->depth;
+      nlc_form(c, NL_HEAD(NL_TAIL(NL_TAIL(args))), k, tail);
+      --c->depth;
+    }
+    nlc_line(c, "}");
+    return;
+  }
+  if (!strcmp(name, "nl_guard")) {
+    a = NL_NEXT(args);
+    clause = NL_SYMBOL_OF(NL_SYM(NL_HEAD(args)))->value;
+    // A lambda is read back from the constants as a copy of itself, so
+    // a guard on one never passes; nor does one on a native not bound now
+    if (NL_TYPE(NL_HEAD_AT(a)) != NL_SYMBOL || NL_TYPE(clause) != NL_INTEGER
+        || !nl_native_name((nl_native_func)NL_INT(clause))
+        || strcmp(nl_native_name((nl_native_func)NL_INT(clause)), NL_SYM(NL_HEAD_AT(a)))) {
+      nlc_form(c, NL_HEAD(NL_TAIL(NL_TAIL_AT(a))), k, tail);
+      return;
+    }
+    nlc_native(c, NL_SYM(NL_HEAD_AT(a)));
+    nlc_line(c, "if (nlc_is(nlc_syms[%d], %s)) {", nlc_symbol(c, NL_SYM(NL_HEAD(args))), NL_SYM(NL_HEAD_AT(a)));
+    ++c->depth;
+    nlc_form(c, NL_HEAD(NL_TAIL_AT(a)), k, tail);
+    --c->depth;
+    nlc_line(c, "} else {");
+    ++c->depth;
+    nlc_form(c, NL_HEAD(NL_TAIL(NL_TAIL_AT(a))), k, tail);
+    --c->depth;
+    nlc_line(c, "}");
+    return;
+  }
+  if (!strcmp(name, "nl_cond")) {
+    end = c->labels++;
+    NL_FOREACH(&args, a) {
+      clause = NL_HEAD_AT(a);
+      nlc_form(c, NL_HEAD(clause), k, 0);
+      // A clause with only a test gives the value of the test
+      if (!NL_IS_PAIR(NL_TAIL(clause))) {
+        nlc_line(c, "if (NL_TYPE(v[%d]) != NL_NIL) goto cond_end%d;", k, end);
+        continue;
+      }
+      nlc_line(c, "if (NL_TYPE(v[%d]) != NL_NIL) {", k);
+      ++c->depth;
+      nlc_body(c, NL_TAIL(clause), k, tail);
+      nlc_line(c, "goto cond_end%d;", end);
+      --c->depth;
+      nlc_line(c, "}");
+    }
+    nlc_line(c, "v[%d] = nil;", k);
+    nlc_label(c, "cond_end%d", end);
+    return;
+  }
+  if (!strcmp(name, "nl_while")) {
+    // Once the test fails, its nil is the value of the loop
+    nlc_line(c, "for (;;) {");
+    ++c->depth;
+    nlc_form(c, NL_HEAD(args), k, 0);
+    nlc_line(c, "if (NL_TYPE(v[%d]) == NL_NIL) break;", k);
+    NL_FOREACH(&NL_TAIL(args), a)
+      nlc_form(c, NL_HEAD_AT(a), k, 0);
+    --c->depth;
+    nlc_line(c, "}");
+    return;
+  }
+  if (!strcmp(name, "nl_and") || !strcmp(name, "nl_or")) {
+    NL_FOREACH(&args, a) {
+      nlc_form(c, NL_HEAD_AT(a), k, tail && !NL_IS_PAIR(NL_TAIL_AT(a)));
+      if (!NL_IS_PAIR(NL_TAIL_AT(a))) break;
+      nlc_line(c, "if (NL_TYPE(v[%d]) %s NL_NIL) {", k, name[3] == 'a' ? "!=" : "==");
+      ++c->depth;
+      ++opened;
+    }
+    while (opened--) {
+      --c->depth;
+      nlc_line(c, "}");
+    }
+    return;
+  }
+  if (!strcmp(name, "nl_add") || !strcmp(name, "nl_sub") || !strcmp(name, "nl_mul") || !strcmp(name, "nl_div")) {
+    const char *op = name[3] == 'a' ? "+" : name[3] == 's' ? "-" : name[3] == 'm' ? "*" : "/";
+    const char *msg = name[3] == 'a' ? "illegal add: non-integer arg" : name[3] == 's' ? "illegal sub: non-integer arg"
+      : name[3] == 'm' ? "illegal mul: non-integer arg" : "illegal div: non-integer arg";
+    if (argc == 0 || name[3] == 'm') {
+      nlc_line(c, "v[%d] = nl_cell_as_int(%d);", k, name[3] == 'a' || name[3] == 's' ? 0 : 1);
+      if (argc == 0) return;
+    }
+    if (name[3] != 'm') {
+      nlc_form(c, NL_HEAD(args), k, 0);
+      // As with the native, the first thing divided is not checked
+      if (name[3] != 'd') nlc_check_int(c, NL_HEAD(args), k, msg);
+      args = NL_TAIL(args);
+    }
+    NL_FOREACH(&args, a) {
+      x = c->temps++;
+      nlc_form(c, NL_HEAD_AT(a), x, 0);
+      nlc_check_int(c, NL_HEAD_AT(a), x, msg);
+      nlc_line(c, "v[%d] = nl_cell_as_int(NL_INT(v[%d]) %s NL_INT(v[%d]));", k, k, op, x);
+    }
+    return;
+  }
+  nlc_form(c, NL_HEAD(args), k, 0);
+  if (argc == 1) {
+    for (i = 0; i < sizeof(tests) / sizeof(*tests); ++i) {
+      if (strcmp(name, tests[i].name)) continue;
+      fprintf(c->out, "%*sv[%d] = ", 2 * c->depth, "", k);
+      fprintf(c->out, tests[i].test, k);
+      fputs(" ? t : nil;\n", c->out);
+      return;
+    }
+    if (!strcmp(name, "nl_head"))
+      nlc_line(c, "if (NL_IS_PAIR(v[%d])) v[%d] = NL_HEAD(v[%d]);", k, k, k);
+    else if (!strcmp(name, "nl_tail"))
+      nlc_line(c, "v[%d] = NL_IS_PAIR(v[%d]) ? NL_TAIL(v[%d]) : nil;", k, k, k);
+    else
+      nlc_line(c, "if (nl_evalq(&%s, v[%d], &v[%d])) goto %s;", c->at, k, k, nlc_jump_fail(c));
+    return;
+  }
+  x = c->temps++;
+  nlc_form(c, NL_HEAD(NL_TAIL(args)), x, 0);
+  for (i = 0; i < sizeof(compares) / sizeof(*compares); ++i) {
+    if (strcmp(name, compares[i].name)) continue;
+    nlc_line(c, "v[%d] = nlc_compare(v[%d], v[%d]) %s ? t : nil;", k, k, x, compares[i].test);
+    return;
+  }
+  if (!strcmp(name, "nl_equal"))
+    nlc_line(c, "v[%d] = nl_cell_equal(v[%d], v[%d]) ? t : nil;", k, k, x);
+  else
+    nlc_line(c, "v[%d] = nl_cell_as_pair(v[%d], v[%d]);", k, k, x);
+}
+/**
+ * Compile a call to a function of the same file. Arguments are evaluated
+ * as a lambda evaluates them: only as many as it has parameters, with nil
+ * for any missing
+ */
+static void nlc_call(struct nlc *c, struct nl_cell form, struct nlc_function *f, int k, int tail) {
+  int64_t n = f->nparams < 0 ? 1 : f->nparams, i = 0;
+  int base = c->temps;
+  struct nl_cell *a;
+  c->temps += n;
+  if (f->nparams < 0) {
+    nlc_value(c, NL_TAIL(form), base);
+  } else {
+    NL_FOREACH(&NL_TAIL(form), a) {
+      if (i == n) break;
+      nlc_form(c, NL_HEAD_AT(a), base + i++, 0);
+    }
+    for (; i < n; ++i) nlc_line(c, "v[%d] = nil;", base + (int)i);
+  }
+  if (tail && f == c->function) {
+    nlc_line(c, "args = &v[%d];", base);
+    nlc_line(c, "if (nl_profiling) nl_profile_replace(nl_cell_as_int((int64_t)%s));", f->cname);
+    nlc_line(c, "goto bind;");
+    f->rebinds = 1;
+    return;
+  }
+  c->direct = 1;
+  nlc_line(c, "if (nlc_direct(&%s, %s, %s_body, &v[%d], &v[%d])) goto %s;",
+           c->at, f->cname, f->cname, base, k, nlc_jump_fail(c));
+}
+static void nlc_form(struct nlc *c, struct nl_cell form, int k, int tail) {
+  struct nlc_function *f;
+  struct nl_cell head;
+  char *name;
+  int64_t argc;
+  switch (NL_TYPE(form)) {
+  case NL_SYMBOL:
+    nlc_line(c, "v[%d] = NL_SYMBOL_OF(nlc_syms[%d])->value;", k, nlc_symbol(c, NL_SYM(form)));
+    return;
+  case NL_PAIR:
+    break;
+  default:
+    nlc_value(c, form, k);
+    return;
+  }
+  // As in the bytecode compiler, the optimizer's guards are not guarded
+  if (nl_is_guard(form) && nlc_inlines(form, "nl_guard", 4)) {
+    nlc_inline(c, form, "nl_guard", k, tail);
+    return;
+  }
+  if (NL_TYPE(NL_HEAD(form)) != NL_SYMBOL) {
+    nlc_eval(c, form, k);
+    return;
+  }
+  argc = nlc_argc(NL_TAIL(form));
+  if ((f = nlc_function(c, NL_SYM(NL_HEAD(form)))) != NULL && f->unique && (argc >= 0 || f->nparams < 0)) {
+    nlc_line(c, "if (nlc_is(nlc_syms[%d], %s)) {", nlc_symbol(c, f->name), f->cname);
+  } else {
+    f = NULL;
+    head = NL_SYMBOL_OF(NL_SYM(NL_HEAD(form)))->value;
+    if (NL_TYPE(head) != NL_INTEGER
+        || (name = nl_native_name((nl_native_func)NL_INT(head))) == NULL
+        || !nlc_inlines(form, name, argc)) {
+      nlc_eval(c, form, k);
+      return;
+    }
+    nlc_native(c, name);
+    nlc_line(c, "if (nlc_is(nlc_syms[%d], %s)) {", nlc_symbol(c, NL_SYM(NL_HEAD(form))), name);
+  }
+  ++c->depth;
+  if (f) nlc_call(c, form, f, k, tail);
+  else nlc_inline(c, form, name, k, tail);
+  --c->depth;
+  nlc_line(c, "} else {");
+  ++c->depth;
+  nlc_eval(c, form, k);
+  --c->depth;
+  nlc_line(c, "}");
+}
+/**
+ * Compile the body of a function, keeping the code for later
+ */
+static void nlc_compile(struct nlc *c, struct nlc_function *f, struct nl_cell lambda) {
+  struct nl_cell *p;
+  int failed = 0, i = 0;
+  c->out = open_memstream(&f->code, &f->code_size);
+  c->function = f;
+  c->depth = 1;
+  if (f->nparams < 0)
+    nlc_line(c, "nl_scope_bind(&call_scope, nlc_syms[%d], args[0]);", nlc_symbol(c, NL_SYM(NL_HEAD(lambda))));
+  NL_FOREACH(&NL_HEAD(lambda), p)
+    nlc_line(c, "nl_scope_bind(&call_scope, nlc_syms[%d], args[%d]);", nlc_symbol(c, NL_SYM(NL_HEAD_AT(p))), i++);
+  c->temps = 1;
+  c->lets = c->labels = 0;
+  strcpy(c->at, "call_scope");
+  strcpy(c->fail, "fail");
+  c->failed = &failed;
+  nlc_body(c, NL_TAIL(lambda), 0, 1);
+  nlc_line(c, "*result = v[0];");
+  if (failed) {
+    nlc_line(c, "goto done;");
+    fputs(" fail:\n", c->out);
+    nlc_line(c, "err = 1;");
+    fputs(" done:\n", c->out);
+  }
+  fclose(c->out);
+  f->temps = c->temps;
+  f->lets = c->lets;
+}
+/**
+ * Write a function: its body, which takes its arguments evaluated, and
+ * the native function which evaluates them
+ */
+static void nlc_write_function(FILE *out, struct nlc_function *f) {
+  int i;
+  fprintf(out, "static int %s_body(struct nl_scope *scope, struct nl_cell *args, struct nl_cell *result) {\n", f->cname);
+  fprintf(out, "  struct nl_cell v[%d];\n", f->temps);
+  fprintf(out, "  struct nl_scope call_scope");
+  for (i = 0; i < f->lets; ++i) fprintf(out, ", l%d", i);
+  fprintf(out, ";\n  int err = 0;\n");
+  fprintf(out, "  nl_scope_init(&call_scope);\n  call_scope.parent_scope = scope;\n");
+  if (f->rebinds) fprintf(out, " bind:\n");
+  fwrite(f->code, 1, f->code_size, out);
+  fprintf(out, "  if (err && call_scope.last_err) scope->last_err = call_scope.last_err;\n");
+  fprintf(out, "  nl_scope_unwind(&call_scope);\n  return err;\n}\n");
+  fprintf(out, "int %s(struct nl_scope *scope, struct nl_cell cell, struct nl_cell *result) {\n", f->cname);
+  fprintf(out, "  struct nl_cell args[%lld];\n", f->nparams > 0 ? (long long)f->nparams : 1LL);
+  if (f->nparams < 0)
+    fprintf(out, "  args[0] = cell;\n");
+  else
+    fprintf(out, "  if (nl_eval_args(scope, cell, %lld, args)) return 1;\n", (long long)f->nparams);
+  fprintf(out, "  return %s_body(scope, args, result);\n}\n", f->cname);
+}
+/**
+ * C names are nlc_ and the symbol, with anything but letters and digits
+ * escaped as _ and two hex digits, and a count if the name is reused
+ */
+static char *nlc_cname(char *name, size_t index) {
+  char *cname = malloc(4 * strlen(name) + 32), *p = cname;
+  p += sprintf(p, "nlc_");
+  for (; *name; ++name) {
+    if ((*name >= 'a' && *name <= 'z') || (*name >= 'A' && *name <= 'Z') || (*name >= '0' && *name <= '9'))
+      *p++ = *name;
+    else
+      p += sprintf(p, "_%02x", (unsigned char)*name);
+  }
+  if (index) sprintf(p, "_%zu", index);
+  else *p = 0;
+  return cname;
+}
+/**
+ * Whether the form is a defq which can be compiled: parameters which are
+ * a proper list of symbols, or a symbol, and a body which is not empty
+ */
+static int nlc_is_defq(struct nl_cell form, int64_t *nparams) {
+  struct nl_cell head, *p;
+  char *name;
+  if (!NL_IS_PAIR(form) || NL_TYPE(NL_HEAD(form)) != NL_SYMBOL) return 0;
+  head = NL_SYMBOL_OF(NL_SYM(NL_HEAD(form)))->value;
+  if (NL_TYPE(head) != NL_INTEGER || (name = nl_native_name((nl_native_func)NL_INT(head))) == NULL
+      || strcmp(name, "nl_defq")) return 0;
+  form = NL_TAIL(form);
+  if (!NL_IS_PAIR(form) || NL_TYPE(NL_HEAD(form)) != NL_SYMBOL) return 0;
+  form = NL_TAIL(form);
+  if (!NL_IS_PAIR(form) || !NL_IS_PAIR(NL_TAIL(form))) return 0;
+  if (NL_TYPE(NL_HEAD(form)) == NL_SYMBOL) {
+    *nparams = -1;
+    return 1;
+  }
+  *nparams = 0;
+  NL_FOREACH(&NL_HEAD(form), p) {
+    if (NL_TYPE(NL_HEAD_AT(p)) != NL_SYMBOL) return 0;
+    ++*nparams;
+  }
+  return NL_TYPE(*p) == NL_NIL;
+}
+static void nlc_write_string(FILE *out, const char *s, size_t length) {
+  size_t i;
+  fputs("  \"", out);
+  for (i = 0; i < length; ++i) {
+    if (i && i % 64 == 0) fputs("\"\n  \"", out);
+    if (s[i] == '"' || s[i] == '\\') fprintf(out, "\\%c", s[i]);
+    else if (s[i] >= ' ' && s[i] <= '~') fputc(s[i], out);
+    else fprintf(out, "\\%03o", (unsigned char)s[i]);
+  }
+  fputc('"', out);
+}
+/**
+ * Write the constants as they will be read back when the module is
+ * loaded, returning NULL on error
+ */
+static char *nlc_constants_text(struct nl_scope *scope, struct nlc *c, size_t *length) {
+  struct nl_cell list = nil, *p;
+  struct nl_port port = { -1, 0, 0, NULL, 0, 4096 };
+  FILE *tmp = tmpfile();
+  char *text;
+  NL_FOREACH(&c->constants, p) list = nl_cell_as_pair(NL_HEAD_AT(p), list);
+  if (!tmp) return NULL;
+  port.fd = fileno(tmp);
+  if (nl_write_to(scope, &port, list) || nl_port_flush(&port)) {
+    fclose(tmp);
+    return NULL;
+  }
+  free(port.buf);
+  *length = ftell(tmp);
+  rewind(tmp);
+  text = malloc(*length + 1);
+  text[fread(text, 1, *length, tmp)] = 0;
+  fclose(tmp);
+  return text;
+}
+static int nlc_write_c(struct nl_scope *scope, struct nlc *c, const char *source, const char *path) {
+  FILE *out = fopen(path, "w");
+  char *text;
+  size_t i, length;
+  int j;
+  if (!out) return 1;
+  if (!(text = nlc_constants_text(scope, c, &length))) {
+    fclose(out);
+    return 1;
+  }
+  fprintf(out, "/* Compiled by nlc from %s; do not edit */\n#include \"nl.h\"\n#include <stdio.h>\n", source);
+  for (j = 0; j < c->nnatives; ++j)
+    fprintf(out, "int %s(struct nl_scope *, struct nl_cell, struct nl_cell *);\n", c->natives[j]);
+  for (i = 0; i < c->nfunctions; ++i) {
+    fprintf(out, "int %s(struct nl_scope *, struct nl_cell, struct nl_cell *);\n", c->functions[i].cname);
+    fprintf(out, "static int %s_body(struct nl_scope *, struct nl_cell *, struct nl_cell *);\n", c->functions[i].cname);
+  }
+  fprintf(out, "static char *nlc_syms[%d];\n", c->nsymbols + 1);
+  fprintf(out, "static struct nl_cell nlc_consts[%d];\n", c->nconstants + 1);
+  fputs("/* Refuse to load into an interpreter with the other cell layout */\n"
+        "__attribute__((used)) static const int *nlc_layout = &NL_CELL_LAYOUT;\n", out);
+  fputs("/**\n"
+        " * Whether the symbol is still bound to the given native function\n"
+        " */\n"
+        "static inline int nlc_is(char *sym, nl_native_func f) {\n"
+        "  struct nl_cell head = NL_SYMBOL_OF(sym)->value;\n"
+        "  return NL_TYPE(head) == NL_INTEGER && NL_INT(head) == (int64_t)f;\n"
+        "}\n"
+        "static inline int nlc_compare(struct nl_cell a, struct nl_cell b) {\n"
+        "  return NL_TYPE(a) == NL_INTEGER && NL_TYPE(b) == NL_INTEGER\n"
+        "    ? (NL_INT(a) > NL_INT(b)) - (NL_INT(a) < NL_INT(b)) : nl_compare(a, b);\n"
+        "}\n", out);
+  if (c->direct)
+    fputs("/**\n"
+          " * Call a function of this module directly, recorded by the profiler\n"
+          " * as a call to its native function\n"
+          " */\n"
+          "static int nlc_direct(struct nl_scope *scope, nl_native_func f,\n"
+          "                      int (*body)(struct nl_scope *, struct nl_cell *, struct nl_cell *),\n"
+          "                      struct nl_cell *args, struct nl_cell *result) {\n"
+          "  int err;\n"
+          "  if (!nl_profiling) return body(scope, args, result);\n"
+          "  nl_profile_enter(nl_cell_as_int((int64_t)f));\n"
+          "  err = body(scope, args, result);\n"
+          "  nl_profile_leave();\n"
+          "  return err;\n"
+          "}\n", out);
+  for (i = 0; i < c->nfunctions; ++i)
+    nlc_write_function(out, &c->functions[i]);
+  fputs("__attribute__((constructor)) static void nlc_init() {\n", out);
+  for (j = 0; j < c->nsymbols; ++j) {
+    fprintf(out, "  nlc_syms[%d] = nl_intern_bytes(", j);
+    nlc_write_string(out, c->symbols[j], NL_SYMBOL_OF(c->symbols[j])->length);
+    fprintf(out, ", %zu);\n", NL_SYMBOL_OF(c->symbols[j])->length);
+  }
+  fputs("  if (nl_native_constants(\n", out);
+  nlc_write_string(out, text, length);
+  fprintf(out, ", nlc_consts, %d))\n", c->nconstants);
+  fprintf(out, "    fputs(\"ERROR load-native: bad constants in %s\\n\", stderr);\n}\n", path);
+  free(text);
+  return fclose(out) != 0;
+}
+/**
+ * Write the loader: the file as it was, but with each run of compiled
+ * defq forms replaced by a load-native of their functions, which falls
+ * back on the forms themselves if the library cannot be loaded
+ */
+static int nlc_write_loader(struct nl_scope *scope, struct nlc *c, const char *text, size_t size,
+                            const char *library, const char *path) {
+  struct nl_port port = { -1, 0, 0, NULL, 0, 4096 };
+  FILE *out = fopen(path, "w");
+  size_t i, j, end = 0;
+  if (!out) return 1;
+  port.fd = fileno(out);
+  for (i = 0; i < c->nforms; i = j) {
+    if (!c->forms[i].function) {
+      nl_port_write(&port, text + c->forms[i].start, c->forms[i].end - c->forms[i].start);
+      end = c->forms[i].end;
+      j = i + 1;
+      continue;
+    }
+    nl_port_write(&port, "\n(or (load-native '", 19);
+    nl_write_to(scope, &port, nl_cell_as_symbol(nl_intern_bytes(library, strlen(library))));
+    for (j = i; j < c->nforms && c->forms[j].function; ++j) {
+      nl_port_printf(&port, "\n      (%s . ", c->forms[j].function->cname);
+      nl_write_to(scope, &port, nl_cell_as_symbol(c->forms[j].function->name));
+      nl_port_putc(&port, ')');
+    }
+    // The text of the first form may start with a comment
+    nl_port_write(&port, ")\n    (progn\n", 13);
+    nl_port_write(&port, text + c->forms[i].start, c->forms[j - 1].end - c->forms[i].start);
+    nl_port_write(&port, "))", 2);
+    end = c->forms[j - 1].end;
+  }
+  nl_port_write(&port, text + end, size - end);
+  if (nl_port_flush(&port)) {
+    fclose(out);
+    return 1;
+  }
+  free(port.buf);
+  return fclose(out) != 0;
+}
+static char *nlc_read_file(const char *path, size_t *size) {
+  FILE *in = fopen(path, "r");
+  char *text;
+  if (!in) return NULL;
+  fseek(in, 0, SEEK_END);
+  *size = ftell(in);
+  rewind(in);
+  text = malloc(*size + 1);
+  text[fread(text, 1, *size, in)] = 0;
+  fclose(in);
+  return text;
+}
+/**
+ * A path in the repository nlc was built in, found from where nlc is,
+ * which is bin/nlc; or the path as it is, relative to the current
+ * directory, if where nlc is cannot be found
+ */
+static char *nlc_repo_path(const char *argv0, const char *path) {
+  char exe[4096], *slash, *result;
+  ssize_t n = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+  if (n > 0) {
+    exe[n] = 0;
+  } else {
+    strncpy(exe, argv0, sizeof(exe) - 1);
+    exe[sizeof(exe) - 1] = 0;
+  }
+  if (!(slash = strrchr(exe, '/'))) return strdup(path);
+  *slash = 0;
+  result = malloc(strlen(exe) + strlen(path) + 5);
+  sprintf(result, "%s/../%s", exe, path);
+  return result;
+}
+static int nlc_usage() {
+  fputs("usage: nlc [--tagged] [--no-optimize] [--core Path] [--include Dir] [-o Base] File.nl\n", stderr);
+  return 2;
+}
+int main(int argc, char **argv) {
+  struct nl_scope scope;
+  struct nl_reader in;
+  struct nl_cell form, load, lambda;
+  struct nlc c;
+  struct nlc_function *f;
+  const char *core = NULL, *include = NULL, *source = NULL, *cc = getenv("CC");
+  char *base = NULL, *path, *library, *text, *command;
+  size_t i, j, size;
+  int tagged = 0, err;
+  for (i = 1; i < (size_t)argc; ++i) {
+    if (!strcmp(argv[i], "--tagged")) tagged = 1;
+    else if (!strcmp(argv[i], "--no-optimize")) nl_optimizing = 0;
+    else if (!strcmp(argv[i], "--core") && i + 1 < (size_t)argc) core = argv[++i];
+    else if (!strcmp(argv[i], "--include") && i + 1 < (size_t)argc) include = argv[++i];
+    else if (!strcmp(argv[i], "-o") && i + 1 < (size_t)argc) base = strdup(argv[++i]);
+    else if (argv[i][0] != '-' && !source) source = argv[i];
+    else return nlc_usage();
+  }
+  if (!source) return nlc_usage();
+  if (!core) core = nlc_repo_path(argv[0], "src/core.nl");
+  if (!include) include = nlc_repo_path(argv[0], "src");
+  if (!base) {
+    // lib/foo.nl is built as lib/foo-native.c, .so and .nl
+    base = malloc(strlen(source) + 8);
+    strcpy(base, source);
+    if (strlen(base) > 3 && !strcmp(base + strlen(base) - 3, ".nl")) base[strlen(base) - 3] = 0;
+    strcat(base, "-native");
+  }
+  path = malloc(strlen(base) + 8);
+  library = malloc(strlen(base) + 8);
+  // load-native only looks for a library by path if the name has a slash
+  sprintf(library, "%s%s.so", strchr(base, '/') ? "" : "./", base);
+  nl_globals_init();
+  nl_scope_init(&scope);
+  nl_scope_define_builtins(&scope);
+  // Calls are compiled knowing what the core functions are. load reads
+  // standard input if it cannot open its file, so check first
+  if (!(text = nlc_read_file(core, &size))) {
+    fprintf(stderr, "ERROR %s: cannot read\n", core);
+    return 1;
+  }
+  free(text);
+  load = nl_cell_as_symbol(nl_intern_bytes(core, strlen(core)));
+  if (nl_invoke_values(&scope, NL_SYMBOL_OF(nl_intern_bytes("load", 4))->value, 1, &load, &load)) {
+    fprintf(stderr, "ERROR %s: %s\n", core, scope.last_err);
+    return 1;
+  }
+  if (!(text = nlc_read_file(source, &size)) || nl_reader_open(&in, source)) {
+    fprintf(stderr, "ERROR %s: cannot read\n", source);
+    return 1;
+  }
+  memset(&c, 0, sizeof(c));
+  c.keep = c.constants = nil;
+  for (;;) {
+    j = in.pos;
+    if ((err = nl_read(&scope, &in, &form)) == EOF) break;
+    if (err) {
+      fprintf(stderr, "ERROR %s: %s\n", source, scope.last_err ? scope.last_err : "read");
+      return 1;
+    }
+    c.keep = nl_cell_as_pair(form, c.keep);
+    c.forms = realloc(c.forms, (c.nforms + 1) * sizeof(*c.forms));
+    c.forms[c.nforms].start = j;
+    c.forms[c.nforms].end = in.pos;
+    c.forms[c.nforms++].function = NULL;
+  }
+  for (form = c.keep, c.keep = nil; NL_IS_PAIR(form); form = NL_TAIL(form))
+    c.keep = nl_cell_as_pair(NL_HEAD(form), c.keep);
+  // Find the functions first, so that calls to those defined later are known
+  c.functions = calloc(c.nforms + 1, sizeof(*c.functions));
+  for (i = 0, form = c.keep; i < c.nforms; ++i, form = NL_TAIL(form)) {
+    f = &c.functions[c.nfunctions];
+    if (!nlc_is_defq(NL_HEAD(form), &f->nparams)) continue;
+    f->name = NL_SYM(NL_HEAD(NL_TAIL(NL_HEAD(form))));
+    f->unique = !nlc_function(&c, f->name);
+    for (j = 0; j < c.nfunctions; ++j)
+      if (c.functions[j].name == f->name) c.functions[j].unique = 0;
+    c.forms[i].function = f;
+    ++c.nfunctions;
+  }
+  for (i = 0; i < c.nfunctions; ++i)
+    c.functions[i].cname = nlc_cname(c.functions[i].name, c.functions[i].unique ? 0 : i + 1);
+  // Optimized and bound in order, as defq would, so inlining sees the same functions
+  for (i = 0, form = c.keep; i < c.nforms; ++i, form = NL_TAIL(form)) {
+    if (!(f = c.forms[i].function)) continue;
+    if (nl_optimize_lambda(&scope, f->name, NL_TAIL(NL_TAIL(NL_HEAD(form))), &lambda)) {
+      fprintf(stderr, "ERROR %s: %s\n", source, scope.last_err);
+      return 1;
+    }
+    nl_scope_put(&scope, f->name, lambda);
+    nlc_compile(&c, f, lambda);
+  }
+  sprintf(path, "%s.c", base);
+  if (nlc_write_c(&scope, &c, source, path)) {
+    fprintf(stderr, "ERROR %s: cannot write\n", path);
+    return 1;
+  }
+  command = malloc(3 * strlen(base) + strlen(include) + 256);
+  sprintf(command, "%s -O2 -shared -fPIC -Wall%s -I'%s' -o '%s.so' '%s.c'",
+          cc ? cc : "gcc", tagged ? " -DNL_TAGGED_CELLS" : "", include, base, base);
+  if (system(command)) {
+    fprintf(stderr, "ERROR %s.c: did not compile\n", base);
+    return 1;
+  }
+  sprintf(path, "%s.nl", base);
+  if (nlc_write_loader(&scope, &c, text, size, library, path)) {
+    fprintf(stderr, "ERROR %s: cannot write\n", path);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,503 @@
+#include "nl.h"
+#include <string.h>
+#define NL_OPTIMIZE_INLINE_SIZE 24
+int nl_optimizing = 1, nl_optimize_reporting;
+/**
+ * What the optimizer knows of a native function. The arguments of ARGS
+ * natives are all evaluated, so they can be optimized in turn; FOLD
+ * natives are run when every argument is constant; PURE natives do
+ * nothing besides returning a value, and SAFE ones cannot fail either
+ */
+#define NL_OPT_ARGS 1
+#define NL_OPT_FOLD 2
+#define NL_OPT_PURE 4
+#define NL_OPT_SAFE 8
+static const struct {
+  const char *name;
+  int flags;
+} nl_optimize_natives[] = {
+  { "nl_add", NL_OPT_ARGS | NL_OPT_FOLD | NL_OPT_PURE },
+  { "nl_sub", NL_OPT_ARGS | NL_OPT_FOLD | NL_OPT_PURE },
+  { "nl_mul", NL_OPT_ARGS | NL_OPT_FOLD | NL_OPT_PURE },
+  { "nl_div", NL_OPT_ARGS | NL_OPT_FOLD | NL_OPT_PURE },
+  { "nl_lt", NL_OPT_ARGS | NL_OPT_FOLD | NL_OPT_PURE | NL_OPT_SAFE },
+  { "nl_lte", NL_OPT_ARGS | NL_OPT_FOLD | NL_OPT_PURE | NL_OPT_SAFE },
+  { "nl_gt", NL_OPT_ARGS | NL_OPT_FOLD | NL_OPT_PURE | NL_OPT_SAFE },
+  { "nl_gte", NL_OPT_ARGS | NL_OPT_FOLD | NL_OPT_PURE | NL_OPT_SAFE },
+  { "nl_equal", NL_OPT_ARGS | NL_OPT_FOLD | NL_OPT_PURE | NL_OPT_SAFE },
+  { "nl_not", NL_OPT_ARGS | NL_OPT_PURE | NL_OPT_SAFE },
+  { "nl_is_nil", NL_OPT_ARGS | NL_OPT_PURE | NL_OPT_SAFE },
+  { "nl_is_integer", NL_OPT_ARGS | NL_OPT_PURE | NL_OPT_SAFE },
+  { "nl_is_symbol", NL_OPT_ARGS | NL_OPT_PURE | NL_OPT_SAFE },
+  { "nl_is_pair", NL_OPT_ARGS | NL_OPT_PURE | NL_OPT_SAFE },
+  { "nl_head", NL_OPT_ARGS | NL_OPT_PURE },
+  { "nl_tail", NL_OPT_ARGS | NL_OPT_PURE },
+  { "nl_pair", NL_OPT_ARGS | NL_OPT_PURE },
+  { "nl_list", NL_OPT_ARGS | NL_OPT_PURE },
+  { "nl_and", NL_OPT_ARGS | NL_OPT_PURE },
+  { "nl_or", NL_OPT_ARGS | NL_OPT_PURE },
+  { "nl_if", NL_OPT_ARGS | NL_OPT_PURE },
+  { "nl_progn", NL_OPT_PURE },
+  { "nl_cond", NL_OPT_PURE },
+  { "nl_while", 0 },
+  { "nl_let", 0 },
+  { "nl_setq", 0 },
+  { "nl_eval", NL_OPT_ARGS },
+  { "nl_apply", NL_OPT_ARGS },
+  { "nl_print", NL_OPT_ARGS },
+  { "nl_write", NL_OPT_ARGS },
+  { "nl_write_bytes", NL_OPT_ARGS },
+  { "nl_map", NL_OPT_ARGS },
+  { "nl_filter", NL_OPT_ARGS },
+  { "nl_fold", NL_OPT_ARGS },
+  { "nl_foreach", NL_OPT_ARGS },
+  { "nl_length", NL_OPT_ARGS },
+};
+/**
+ * The state of one pass, over the lambda being bound to name. Inlined
+ * bodies are optimized again, with inlining off, to fold what their
+ * arguments made constant
+ */
+struct nl_optimizer {
+  struct nl_scope *scope;
+  char *name;
+  int inlining;
+};
+static struct nl_cell nl_optimize_form(struct nl_optimizer *, struct nl_cell);
+/**
+ * The C name of the native function which a call form's head symbol
+ * holds now, or NULL
+ */
+static char *nl_optimize_native(struct nl_cell form) {
+  struct nl_cell head;
+  if (!NL_IS_PAIR(form) || NL_TYPE(NL_HEAD(form)) != NL_SYMBOL) return NULL;
+  head = NL_SYMBOL_OF(NL_SYM(NL_HEAD(form)))->value;
+  return NL_TYPE(head) == NL_INTEGER ? nl_native_name((nl_native_func)NL_INT(head)) : NULL;
+}
+static int nl_optimize_flags(const char *name) {
+  size_t i;
+  for (i = 0; name && i < sizeof(nl_optimize_natives) / sizeof(*nl_optimize_natives); ++i)
+    if (!strcmp(name, nl_optimize_natives[i].name)) return nl_optimize_natives[i].flags;
+  return 0;
+}
+static int nl_optimize_is(struct nl_cell form, const char *name) {
+  char *native = nl_optimize_native(form);
+  return native && !strcmp(native, name);
+}
+static struct nl_cell nl_optimize_symbol(const char *name) {
+  return nl_cell_as_symbol(nl_intern_bytes(name, strlen(name)));
+}
+/**
+ * Whether the form always evaluates to the same value, which is stored
+ */
+static int nl_optimize_constant(struct nl_cell form, struct nl_cell *value) {
+  switch (NL_TYPE(form)) {
+  case NL_SYMBOL:
+    return 0;
+  case NL_PAIR:
+    if (!nl_optimize_is(form, "nl_quote")) return 0;
+    *value = NL_TAIL(form);
+    return 1;
+  default:
+    *value = form;
+    return 1;
+  }
+}
+/**
+ * A form which evaluates to the given value
+ */
+static struct nl_cell nl_optimize_quote(struct nl_cell value) {
+  if (NL_TYPE(value) == NL_SYMBOL || NL_IS_PAIR(value))
+    return nl_cell_as_pair(nl_optimize_symbol("quote"), value);
+  return value;
+}
+int nl_is_guard(struct nl_cell form) {
+  return NL_IS_PAIR(form) && NL_TYPE(NL_HEAD(form)) == NL_INTEGER
+    && (nl_native_func)NL_INT(NL_HEAD(form)) == nl_guard && nl_list_length(NL_TAIL(form)) == 4;
+}
+/**
+ * Guard a rewrite of a call form on the symbol still being bound to what
+ * it was when the rewrite was made: a lambda, or the C name of a native.
+ * The guard's head is nl_guard itself, so the program cannot rebind it
+ */
+static struct nl_cell nl_optimize_guard(struct nl_cell sym, struct nl_cell bound, struct nl_cell rewritten, struct nl_cell form) {
+  struct nl_cell guard = nl_cell_as_pair(rewritten, nl_cell_as_pair(form, nil));
+  return nl_cell_as_pair(nl_cell_as_int((int64_t)nl_guard), nl_cell_as_pair(sym, nl_cell_as_pair(bound, guard)));
+}
+/**
+ * Add the (Symbol . Bound) of a guard's arguments to a list of them,
+ * unless its symbol is guarded on already
+ */
+static void nl_optimize_add_guard(struct nl_cell *guards, struct nl_cell args) {
+  struct nl_cell *g;
+  NL_FOREACH(guards, g)
+    if (NL_SYM(NL_HEAD(NL_HEAD_AT(g))) == NL_SYM(NL_HEAD(args))) return;
+  *guards = nl_cell_as_pair(nl_cell_as_pair(NL_HEAD(args), NL_HEAD(NL_TAIL(args))), *guards);
+}
+/**
+ * Whether the form is constant once the guards around it pass, which
+ * are added to guards
+ */
+static int nl_optimize_guarded(struct nl_cell form, struct nl_cell *value, struct nl_cell *guards) {
+  while (nl_is_guard(form)) {
+    nl_optimize_add_guard(guards, NL_TAIL(form));
+    form = NL_HEAD(NL_TAIL(NL_TAIL(NL_TAIL(form))));
+  }
+  return nl_optimize_constant(form, value);
+}
+/**
+ * Guard a rewrite on each of the bindings it was made through
+ */
+static struct nl_cell nl_optimize_guard_all(struct nl_cell guards, struct nl_cell folded, struct nl_cell form) {
+  struct nl_cell *g;
+  NL_FOREACH(&guards, g)
+    folded = nl_optimize_guard(NL_HEAD(NL_HEAD_AT(g)), NL_TAIL(NL_HEAD_AT(g)), folded, form);
+  return folded;
+}
+/**
+ * A copy of the form to report, with guard in place of the native at
+ * each guard's head, which would otherwise be written as a number
+ */
+static struct nl_cell nl_optimize_shown(struct nl_cell form) {
+  struct nl_cell head, tail;
+  if (!NL_IS_PAIR(form)) return form;
+  head = nl_is_guard(form) ? nl_optimize_symbol("guard") : nl_optimize_shown(NL_HEAD(form));
+  tail = nl_optimize_shown(NL_TAIL(form));
+  if (NL_SAME(head, NL_HEAD(form)) && NL_SAME(tail, NL_TAIL(form))) return form;
+  return nl_cell_as_pair(head, tail);
+}
+static void nl_optimize_report(struct nl_optimizer *o, const char *what, struct nl_cell from, struct nl_cell to) {
+  if (!nl_optimize_reporting) return;
+  nl_port_printf(&nl_stderr_port, "optimize %s: %s ", o->name, what);
+  nl_write_to(o->scope, &nl_stderr_port, nl_optimize_shown(from));
+  if (strcmp(what, "dropped")) {
+    nl_port_write(&nl_stderr_port, " -> ", 4);
+    nl_write_to(o->scope, &nl_stderr_port, nl_optimize_shown(to));
+  }
+  nl_port_putc(&nl_stderr_port, '\n');
+}
+/**
+ * Whether a rewrite left the cell as it was
+ */
+static int nl_optimize_same(struct nl_cell a, struct nl_cell b) {
+  if (NL_IS_PAIR(a) || NL_IS_PAIR(b)) return NL_IS_PAIR(a) && NL_IS_PAIR(b) && NL_PAIR_OF(a) == NL_PAIR_OF(b);
+  return nl_cell_equal(a, b);
+}
+/**
+ * Optimize each form in a list, copying only as much of the list as changed
+ */
+static struct nl_cell nl_optimize_list(struct nl_optimizer *o, struct nl_cell list) {
+  struct nl_cell head, tail;
+  if (!NL_IS_PAIR(list)) return list;
+  head = nl_optimize_form(o, NL_HEAD(list));
+  tail = nl_optimize_list(o, NL_TAIL(list));
+  if (nl_optimize_same(head, NL_HEAD(list)) && nl_optimize_same(tail, NL_TAIL(list))) return list;
+  return nl_cell_as_pair(head, tail);
+}
+/**
+ * Whether evaluating the form could not fail, nor do anything but
+ * return its value
+ */
+static int nl_optimize_droppable(struct nl_cell form) {
+  struct nl_cell value, *a;
+  if (!NL_IS_PAIR(form) || nl_optimize_constant(form, &value)) return 1;
+  // A guard is as safe as both of the forms it chooses between
+  if (nl_is_guard(form))
+    return nl_optimize_droppable(NL_HEAD(NL_TAIL(NL_TAIL(NL_TAIL(form)))))
+      && nl_optimize_droppable(NL_HEAD(NL_TAIL(NL_TAIL(NL_TAIL(NL_TAIL(form))))));
+  if (!(nl_optimize_flags(nl_optimize_native(form)) & NL_OPT_SAFE)) return 0;
+  NL_FOREACH(&NL_TAIL(form), a)
+    if (!nl_optimize_droppable(NL_HEAD_AT(a))) return 0;
+  return NL_TYPE(*a) == NL_NIL;
+}
+/**
+ * Optimize a body of forms, dropping those before the last whose values
+ * go unused and which do nothing else. keep is 0 if the last form's
+ * value goes unused as well
+ */
+static struct nl_cell nl_optimize_body(struct nl_optimizer *o, struct nl_cell body, int keep) {
+  struct nl_cell head, tail;
+  int unused;
+  if (!NL_IS_PAIR(body)) return body;
+  unused = keep ? NL_IS_PAIR(NL_TAIL(body)) : NL_IS_PAIR(NL_TAIL(body)) || NL_TYPE(NL_TAIL(body)) == NL_NIL;
+  head = nl_optimize_form(o, NL_HEAD(body));
+  if (unused && nl_optimize_droppable(head)) {
+    nl_optimize_report(o, "dropped", head, nil);
+    return nl_optimize_body(o, NL_TAIL(body), keep);
+  }
+  tail = nl_optimize_body(o, NL_TAIL(body), keep);
+  if (nl_optimize_same(head, NL_HEAD(body)) && nl_optimize_same(tail, NL_TAIL(body))) return body;
+  return nl_cell_as_pair(head, tail);
+}
+/**
+ * Run a foldable native on its constant arguments, leaving the form as
+ * it is if any argument is not constant, or if the native fails
+ */
+static struct nl_cell nl_optimize_fold(struct nl_optimizer *o, struct nl_cell form, char *name) {
+  struct nl_cell value, folded, *a;
+  struct nl_cell guards = nl_cell_as_pair(nl_cell_as_pair(NL_HEAD(form), nl_optimize_symbol(name)), nil);
+  char *err = o->scope->last_err;
+  NL_FOREACH(&NL_TAIL(form), a) {
+    if (!nl_optimize_guarded(NL_HEAD_AT(a), &value, &guards)) return form;
+    // Dividing by zero would stop the program here, rather than when it runs
+    if (!strcmp(name, "nl_div") && NL_TYPE(value) == NL_INTEGER && !NL_INT(value)
+        && (a != &NL_TAIL(form) || !NL_IS_PAIR(NL_TAIL_AT(a))))
+      return form;
+  }
+  if (NL_TYPE(*a) != NL_NIL) return form;
+  value = NL_SYMBOL_OF(NL_SYM(NL_HEAD(form)))->value;
+  if (((nl_native_func)NL_INT(value))(o->scope, NL_TAIL(form), &folded)) {
+    o->scope->last_err = err;
+    return form;
+  }
+  folded = nl_optimize_guard_all(guards, nl_optimize_quote(folded), form);
+  nl_optimize_report(o, "folded", form, folded);
+  return folded;
+}
+static int nl_optimize_mentions(struct nl_cell form, char *sym) {
+  if (NL_TYPE(form) == NL_SYMBOL) return NL_SYM(form) == sym;
+  if (!NL_IS_PAIR(form)) return 0;
+  return nl_optimize_mentions(NL_HEAD(form), sym) || nl_optimize_mentions(NL_TAIL(form), sym);
+}
+static int64_t nl_optimize_size(struct nl_cell form) {
+  if (!NL_IS_PAIR(form)) return 1;
+  // Only what a guard takes when it passes is copied as it is
+  if (nl_is_guard(form))
+    return 3 + nl_optimize_size(NL_HEAD(NL_TAIL(NL_TAIL(NL_TAIL(form)))));
+  return nl_optimize_size(NL_HEAD(form)) + nl_optimize_size(NL_TAIL(form));
+}
+static int nl_optimize_is_param(struct nl_cell sym, struct nl_cell params) {
+  struct nl_cell *p;
+  NL_FOREACH(&params, p)
+    if (NL_SYM(NL_HEAD_AT(p)) == NL_SYM(sym)) return 1;
+  return 0;
+}
+/**
+ * Whether the form only calls pure natives, none of them through a
+ * parameter. A body like that gives its parameters' bindings to no
+ * other function, so nothing else can see them, as dynamic scope
+ * would otherwise allow
+ */
+static int nl_optimize_pure(struct nl_cell form, struct nl_cell params) {
+  struct nl_cell value, *a, *f;
+  if (!NL_IS_PAIR(form) || nl_optimize_constant(form, &value)) return 1;
+  // Inlining checks a guard before the body runs, making the call as
+  // written if it fails, so only what it takes when it passes matters
+  if (nl_is_guard(form)) return nl_optimize_pure(NL_HEAD(NL_TAIL(NL_TAIL(NL_TAIL(form)))), params);
+  if (NL_TYPE(NL_HEAD(form)) != NL_SYMBOL || nl_optimize_is_param(NL_HEAD(form), params)
+      || !(nl_optimize_flags(nl_optimize_native(form)) & NL_OPT_PURE))
+    return 0;
+  NL_FOREACH(&NL_TAIL(form), a) {
+    if (!nl_optimize_is(form, "nl_cond")) {
+      if (!nl_optimize_pure(NL_HEAD_AT(a), params)) return 0;
+      continue;
+    }
+    if (!NL_IS_PAIR(NL_HEAD_AT(a))) return 0;
+    NL_FOREACH(&NL_HEAD_AT(a), f)
+      if (!nl_optimize_pure(NL_HEAD_AT(f), params)) return 0;
+  }
+  return 1;
+}
+/**
+ * Replace each parameter of a pure form with its argument, and each guard
+ * with what it takes when it passes, adding the guard to guards
+ */
+static struct nl_cell nl_optimize_substitute(struct nl_cell form, struct nl_cell params, struct nl_cell *args,
+                                             struct nl_cell *guards) {
+  struct nl_cell value, *p, *a, list, *tail;
+  int64_t i = 0;
+  if (NL_TYPE(form) == NL_SYMBOL) {
+    NL_FOREACH(&params, p) {
+      if (NL_SYM(NL_HEAD_AT(p)) == NL_SYM(form)) return args[i];
+      ++i;
+    }
+    return form;
+  }
+  if (!NL_IS_PAIR(form) || nl_optimize_constant(form, &value)) return form;
+  if (nl_is_guard(form)) {
+    nl_optimize_add_guard(guards, NL_TAIL(form));
+    return nl_optimize_substitute(NL_HEAD(NL_TAIL(NL_TAIL(NL_TAIL(form)))), params, args, guards);
+  }
+  list = nl_cell_as_pair(NL_HEAD(form), nil);
+  tail = NL_NEXT_AT(&list);
+  NL_FOREACH(&NL_TAIL(form), a) {
+    value = nl_optimize_is(form, "nl_cond")
+      ? nl_optimize_substitute(nl_cell_as_pair(nil, NL_HEAD_AT(a)), params, args, guards)
+      : nl_optimize_substitute(NL_HEAD_AT(a), params, args, guards);
+    // A cond clause is substituted as the arguments of a dummy call
+    if (nl_optimize_is(form, "nl_cond")) value = NL_TAIL(value);
+    nl_gc_write(tail, nl_cell_as_pair(value, nil));
+    tail = NL_NEXT_AT(tail);
+  }
+  return list;
+}
+/**
+ * Inline a call to a small lambda which does not call itself. A lambda
+ * with parameters is only inlined if its body is pure and each argument
+ * is a constant or a symbol, so that nothing can tell the difference.
+ * The inlined body is guarded on the lambda itself, and on the guards
+ * taken out of the body of a lambda with parameters, so that the call
+ * is made as written, binding them, if any fails
+ */
+static struct nl_cell nl_optimize_inline(struct nl_optimizer *o, struct nl_cell form, struct nl_cell lambda) {
+  struct nl_cell params = NL_HEAD(lambda), body = NL_TAIL(lambda), inlined, value, guards, *p, *a, *f;
+  int64_t n = 0, i = 0;
+  char *name = NL_SYM(NL_HEAD(form));
+  if (!o->inlining || name == o->name || !NL_IS_PAIR(body)
+      || nl_optimize_mentions(body, name) || nl_optimize_size(body) > NL_OPTIMIZE_INLINE_SIZE)
+    return form;
+  NL_FOREACH(&params, p) {
+    if (NL_TYPE(NL_HEAD_AT(p)) != NL_SYMBOL) return form;
+    ++n;
+  }
+  if (NL_TYPE(*p) != NL_NIL) return form;
+  NL_FOREACH(&body, f)
+    if (n && !nl_optimize_pure(NL_HEAD_AT(f), params)) return form;
+  if (NL_TYPE(*f) != NL_NIL) return form;
+  if (NL_IS_PAIR(NL_TAIL(body))) {
+    inlined = nl_cell_as_pair(nl_optimize_symbol("progn"), body);
+    if (!nl_optimize_is(inlined, "nl_progn")) return form;
+  } else {
+    inlined = NL_HEAD(body);
+  }
+  guards = nl_cell_as_pair(nl_cell_as_pair(NL_HEAD(form), lambda), nil);
+  if (n) {
+    struct nl_cell args[n];
+    a = &NL_TAIL(form);
+    for (i = 0; i < n; ++i) {
+      args[i] = nil;
+      if (NL_TYPE(*a) == NL_NIL) continue;
+      if (!NL_IS_PAIR(*a)) return form;
+      if (NL_TYPE(NL_HEAD_AT(a)) != NL_SYMBOL && !nl_optimize_constant(NL_HEAD_AT(a), &value)) return form;
+      args[i] = NL_HEAD_AT(a);
+      a = NL_NEXT_AT(a);
+    }
+    inlined = nl_optimize_substitute(inlined, params, args, &guards);
+  }
+  o->inlining = 0;
+  inlined = nl_optimize_guard_all(guards, nl_optimize_form(o, inlined), form);
+  o->inlining = 1;
+  nl_optimize_report(o, "inlined", form, inlined);
+  return inlined;
+}
+/**
+ * Optimize the evaluated parts of a call to a native which does not
+ * simply evaluate all of its arguments
+ */
+static struct nl_cell nl_optimize_special(struct nl_optimizer *o, struct nl_cell form, char *name) {
+  struct nl_cell args = NL_TAIL(form), result = nl_cell_as_pair(NL_HEAD(form), nil), bindings, value, *a;
+  struct nl_cell *tail = NL_NEXT_AT(&result);
+  if (!strcmp(name, "nl_progn")) {
+    nl_gc_write(tail, nl_optimize_body(o, args, 1));
+  } else if (!strcmp(name, "nl_while")) {
+    if (!NL_IS_PAIR(args)) return form;
+    value = nl_optimize_form(o, NL_HEAD(args));
+    nl_gc_write(tail, nl_cell_as_pair(value, nl_optimize_body(o, NL_TAIL(args), 0)));
+  } else if (!strcmp(name, "nl_cond")) {
+    // Each clause is a list of forms, all of them evaluated
+    NL_FOREACH(&args, a) {
+      nl_gc_write(tail, nl_cell_as_pair(nl_optimize_list(o, NL_HEAD_AT(a)), nil));
+      tail = NL_NEXT_AT(tail);
+    }
+    if (NL_TYPE(*a) != NL_NIL) return form;
+  } else if (!strcmp(name, "nl_setq")) {
+    // Every other argument is a value
+    for (a = &args; NL_IS_PAIR(*a) && NL_IS_PAIR(NL_TAIL_AT(a)); a = NL_NEXT(NL_TAIL_AT(a))) {
+      value = nl_cell_as_pair(nl_optimize_form(o, NL_HEAD(NL_TAIL_AT(a))), nil);
+      nl_gc_write(tail, nl_cell_as_pair(NL_HEAD_AT(a), value));
+      tail = NL_NEXT(NL_TAIL_AT(tail));
+    }
+    if (NL_TYPE(*a) != NL_NIL) return form;
+  } else if (!strcmp(name, "nl_let")) {
+    // The value of each (Name Value) binding, then the body
+    if (!NL_IS_PAIR(args)) return form;
+    bindings = nl_cell_as_pair(nil, nil);
+    tail = NL_NEXT_AT(&bindings);
+    NL_FOREACH(&NL_HEAD(args), a) {
+      value = NL_HEAD_AT(a);
+      if (NL_IS_PAIR(value)) value = nl_cell_as_pair(NL_HEAD(value), nl_optimize_list(o, NL_TAIL(value)));
+      nl_gc_write(tail, nl_cell_as_pair(value, nil));
+      tail = NL_NEXT_AT(tail);
+    }
+    if (NL_TYPE(*a) != NL_NIL) return form;
+    value = nl_optimize_body(o, NL_TAIL(args), 1);
+    nl_gc_write(NL_NEXT_AT(&result), nl_cell_as_pair(NL_TAIL(bindings), value));
+  } else {
+    return form;
+  }
+  return result;
+}
+static struct nl_cell nl_optimize_form(struct nl_optimizer *o, struct nl_cell form) {
+  struct nl_cell value, args, guards;
+  char *name;
+  int flags;
+  if (!NL_IS_PAIR(form) || NL_TYPE(NL_HEAD(form)) != NL_SYMBOL) return form;
+  value = NL_SYMBOL_OF(NL_SYM(NL_HEAD(form)))->value;
+  if (NL_IS_PAIR(value)) {
+    // A lambda with a list of parameters evaluates its arguments; with a
+    // single symbol, it gets the forms themselves, which are left alone
+    if (NL_TYPE(NL_HEAD(value)) == NL_SYMBOL) return form;
+    if (NL_IS_PAIR(NL_HEAD(value))) {
+      args = nl_optimize_list(o, NL_TAIL(form));
+      if (!nl_optimize_same(args, NL_TAIL(form))) form = nl_cell_as_pair(NL_HEAD(form), args);
+    }
+    return nl_optimize_inline(o, form, value);
+  }
+  if (!(name = nl_optimize_native(form)) || !strcmp(name, "nl_quote")) return form;
+  if (!((flags = nl_optimize_flags(name)) & NL_OPT_ARGS))
+    return nl_optimize_special(o, form, name);
+  args = nl_optimize_list(o, NL_TAIL(form));
+  if (!nl_optimize_same(args, NL_TAIL(form))) form = nl_cell_as_pair(NL_HEAD(form), args);
+  if (flags & NL_OPT_FOLD) return nl_optimize_fold(o, form, name);
+  // An if whose test is constant is only ever one of its branches
+  guards = nl_cell_as_pair(nl_cell_as_pair(NL_HEAD(form), nl_optimize_symbol(name)), nil);
+  if (!strcmp(name, "nl_if") && NL_IS_PAIR(args) && nl_optimize_guarded(NL_HEAD(args), &value, &guards)
+      && nl_list_length(args) <= 3) {
+    args = NL_TAIL(args);
+    if (NL_TYPE(value) == NL_NIL && NL_IS_PAIR(args)) args = NL_TAIL(args);
+    value = nl_optimize_guard_all(guards, NL_IS_PAIR(args) ? NL_HEAD(args) : nil, form);
+    nl_optimize_report(o, "folded", form, value);
+    return value;
+  }
+  return form;
+}
+int nl_optimize_lambda(struct nl_scope *scope, char *name, struct nl_cell lambda, struct nl_cell *result) {
+  struct nl_optimizer o;
+  struct nl_cell body;
+  *result = lambda;
+  if (!nl_optimizing || !NL_IS_PAIR(lambda) || NL_TYPE(NL_HEAD(lambda)) == NL_SYMBOL) return 0;
+  o.scope = scope;
+  o.name = name;
+  o.inlining = 1;
+  body = nl_optimize_body(&o, NL_TAIL(lambda), 1);
+  if (!nl_optimize_same(body, NL_TAIL(lambda)))
+    *result = nl_cell_as_pair(NL_HEAD(lambda), body);
+  return 0;
+}
+NL_BUILTIN(guard) {
+  struct nl_cell args[4], value, *a;
+  char *name;
+  int i = 0, same;
+  NL_FOREACH(&cell, a) {
+    if (i == 4) break;
+    args[i++] = NL_HEAD_AT(a);
+  }
+  if (i != 4 || NL_IS_PAIR(*a) || NL_TYPE(args[0]) != NL_SYMBOL) {
+    scope->last_err = "illegal guard: expected a symbol and three forms";
+    return 1;
+  }
+  value = NL_SYMBOL_OF(NL_SYM(args[0]))->value;
+  if (NL_TYPE(args[1]) == NL_SYMBOL)
+    same = NL_TYPE(value) == NL_INTEGER && (name = nl_native_name((nl_native_func)NL_INT(value))) != NULL
+      && !strcmp(name, NL_SYM(args[1]));
+  else
+    same = NL_IS_PAIR(value) && NL_IS_PAIR(args[1]) && NL_PAIR_OF(value) == NL_PAIR_OF(args[1]);
+  *result = same ? args[2] : args[3];
+  return NL_TAILCALL;
+}
+NL_BUILTIN(optimize) {
+  if (nl_evalq(scope, NL_IS_PAIR(cell) ? NL_HEAD(cell) : cell, result)) return 1;
+  nl_optimizing = NL_TYPE(*result) != NL_NIL;
+  nl_optimize_reporting = NL_TYPE(*result) == NL_SYMBOL && !strcmp(NL_SYM(*result), "report");
+  return 0;
+}
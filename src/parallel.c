@@ -0,0 +1,434 @@
+#include "nl.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#define NL_PAR_MAX_WORKERS 256
+#define NL_PAR_CHUNKS_PER_WORKER 8
+/**
+ * Parallel builtins run their function in worker processes forked from
+ * the interpreter, rather than on a pool of threads. Every symbol holds
+ * its current value, so two threads could never run lambdas in the same
+ * heap; a forked worker gets its own copy of the heap and symbols
+ * instead, for free. The price is that nothing a worker changes reaches
+ * the parent: only what the calls return is sent back.
+ *
+ * The items are cut into chunks, which idle workers claim from a shared
+ * counter until none are left. Each worker sends back a message per
+ * chunk: its index, whether it failed, and the encoded results or the
+ * error message
+ */
+enum nl_par_mode {
+  NL_PAR_MAP,
+  NL_PAR_FILTER,
+  NL_PAR_FOREACH,
+};
+struct nl_par_shared {
+  int64_t next_chunk, failed;
+};
+struct nl_par_message {
+  int64_t chunk, failed, length;
+};
+struct nl_par_buffer {
+  char *bytes;
+  size_t length, capacity;
+};
+static void nl_par_append(struct nl_par_buffer *b, const void *bytes, size_t length) {
+  if (b->length + length > b->capacity) {
+    b->capacity = b->capacity ? b->capacity * 2 : 4096;
+    if (b->capacity < b->length + length) b->capacity = b->length + length;
+    b->bytes = realloc(b->bytes, b->capacity);
+  }
+  memcpy(b->bytes + b->length, bytes, length);
+  b->length += length;
+}
+/**
+ * Encode a value to be decoded by the parent: a tag byte, followed by an
+ * integer, a symbol's length and bytes, a vector's length and items, an
+ * int array's length and packed items, a pair's head and then its
+ * tail, or the pair a sequence points at. Returns non-zero for tables,
+ * which cannot be sent back
+ */
+static int nl_par_encode(struct nl_par_buffer *b, struct nl_cell cell) {
+  int64_t n;
+  char tag;
+  for (; NL_IS_PAIR(cell); cell = NL_TAIL(cell)) {
+    nl_par_append(b, "p", 1);
+    if (nl_par_encode(b, NL_HEAD(cell))) return 1;
+  }
+  switch (NL_TYPE(cell)) {
+  case NL_NIL:
+    nl_par_append(b, "n", 1);
+    return 0;
+  case NL_INTEGER:
+    n = NL_INT(cell);
+    tag = 'i';
+    nl_par_append(b, &tag, 1);
+    nl_par_append(b, &n, sizeof(n));
+    return 0;
+  case NL_SYMBOL:
+    n = NL_SYMBOL_OF(NL_SYM(cell))->length;
+    tag = 's';
+    nl_par_append(b, &tag, 1);
+    nl_par_append(b, &n, sizeof(n));
+    nl_par_append(b, NL_SYM(cell), n);
+    return 0;
+  case NL_VECTOR:
+    n = NL_VECTOR_OF(cell)->length;
+    tag = 'v';
+    nl_par_append(b, &tag, 1);
+    nl_par_append(b, &n, sizeof(n));
+    for (n = 0; n < NL_VECTOR_OF(cell)->length; ++n)
+      if (nl_par_encode(b, NL_VECTOR_OF(cell)->items[n])) return 1;
+    return 0;
+  case NL_INTS:
+    n = NL_INTS_OF(cell)->length;
+    tag = 'a';
+    nl_par_append(b, &tag, 1);
+    nl_par_append(b, &n, sizeof(n));
+    nl_par_append(b, NL_INTS_OF(cell)->items, n * sizeof(int64_t));
+    return 0;
+  case NL_SEQ:
+    nl_par_append(b, "q", 1);
+    return nl_par_encode(b, nl_cell_of_pair(NL_SEQ_OF(cell)));
+  default:
+    return 1;
+  }
+}
+/**
+ * Decode a value sent by a worker. Pairs are linked through the barrier,
+ * since decoding the next head may collect and promote them
+ */
+static int nl_par_decode(char **p, char *end, struct nl_cell *result) {
+  struct nl_cell first = nl_cell_as_nil(), last = first, head, next;
+  int64_t n, i;
+  char tag;
+  for (;;) {
+    if (*p >= end) return 1;
+    if (**p != 'p') break;
+    ++*p;
+    if (nl_par_decode(p, end, &head)) return 1;
+    next = nl_cell_as_pair(head, nl_cell_as_nil());
+    if (NL_TYPE(first) == NL_NIL) first = next;
+    else nl_gc_write(&NL_TAIL(last), next);
+    last = next;
+  }
+  tag = *(*p)++;
+  if (tag == 'n') {
+    next = nl_cell_as_nil();
+  } else if (tag == 'q') {
+    if (nl_par_decode(p, end, &head) || !NL_IS_PAIR(head)) return 1;
+    next = nl_cell_of_seq(NL_PAIR_OF(head));
+  } else if (tag == 'i' || tag == 's' || tag == 'v' || tag == 'a') {
+    if (end - *p < (ptrdiff_t)sizeof(n)) return 1;
+    memcpy(&n, *p, sizeof(n));
+    *p += sizeof(n);
+    if (tag == 'i') {
+      next = nl_cell_as_int(n);
+    } else if (n < 0 || end - *p < n) {
+      return 1;
+    } else if (tag == 'a') {
+      if ((end - *p) / (ptrdiff_t)sizeof(int64_t) < n) return 1;
+      next = nl_cell_as_ints(n);
+      memcpy(NL_INTS_OF(next)->items, *p, n * sizeof(int64_t));
+      *p += n * sizeof(int64_t);
+    } else if (tag == 's') {
+      next = nl_cell_as_symbol(nl_intern_bytes(*p, n));
+      *p += n;
+    } else {
+      next = nl_cell_as_vector(n);
+      for (i = 0; i < n; ++i) {
+        if (nl_par_decode(p, end, &head)) return 1;
+        nl_gc_write(&NL_VECTOR_OF(next)->items[i], head);
+      }
+    }
+  } else {
+    return 1;
+  }
+  if (NL_TYPE(first) == NL_NIL) {
+    *result = next;
+  } else {
+    nl_gc_write(&NL_TAIL(last), next);
+    *result = first;
+  }
+  return 0;
+}
+static int nl_par_write(int fd, const char *bytes, size_t length) {
+  ssize_t n;
+  while (length) {
+    if ((n = write(fd, bytes, length)) < 0) {
+      if (errno == EINTR) continue;
+      return 1;
+    }
+    bytes += n;
+    length -= n;
+  }
+  return 0;
+}
+/**
+ * Run in a worker: claim chunks until there are none left, or some
+ * worker has failed, and send back a message for each
+ */
+static void nl_par_work(struct nl_scope *scope, int fd, struct nl_par_shared *shared, enum nl_par_mode mode,
+                        struct nl_cell fun, struct nl_cell *items, int64_t count, int64_t chunk_size) {
+  struct nl_scope worker;
+  struct nl_par_buffer out = { NULL, 0, 0 };
+  struct nl_par_message message;
+  struct nl_cell r;
+  int64_t i, end;
+  const char *err;
+  nl_scope_init(&worker);
+  worker.parent_scope = scope;
+  while (!__atomic_load_n(&shared->failed, __ATOMIC_RELAXED)) {
+    message.chunk = __atomic_fetch_add(&shared->next_chunk, 1, __ATOMIC_RELAXED);
+    if (message.chunk * chunk_size >= count) break;
+    end = (message.chunk + 1) * chunk_size < count ? (message.chunk + 1) * chunk_size : count;
+    out.length = 0;
+    message.failed = 0;
+    for (i = message.chunk * chunk_size; i < end; ++i) {
+      worker.last_err = NULL;
+      if (nl_invoke_values(&worker, fun, 1, &items[i], &r)) {
+        err = worker.last_err ? worker.last_err : "parallel call failed";
+        out.length = 0;
+        nl_par_append(&out, err, strlen(err));
+        message.failed = 1;
+        break;
+      }
+      if (mode == NL_PAR_FILTER) r = NL_TYPE(r) == NL_NIL ? r : nl_cell_as_int(1);
+      if (mode == NL_PAR_FOREACH) r = nl_cell_as_nil();
+      if (nl_par_encode(&out, r)) {
+        err = "illegal parallel result: tables cannot be sent back";
+        out.length = 0;
+        nl_par_append(&out, err, strlen(err));
+        message.failed = 1;
+        break;
+      }
+    }
+    message.length = out.length;
+    if (message.failed) __atomic_store_n(&shared->failed, 1, __ATOMIC_RELAXED);
+    if (nl_par_write(fd, (char *)&message, sizeof(message))
+        || nl_par_write(fd, out.bytes, out.length))
+      break;
+  }
+  nl_scope_unwind(&worker);
+  nl_port_flush_all();
+  fflush(NULL);
+  _exit(0);
+}
+/**
+ * Read everything the workers send, until they have all closed their pipes.
+ * If the pipes cannot be polled, the workers are killed, so the caller
+ * does not wait on workers blocked writing to a pipe nobody reads, and
+ * non-zero is returned
+ */
+static int nl_par_collect(int *fds, pid_t *pids, struct nl_par_buffer *buffers, int workers) {
+  struct pollfd polls[NL_PAR_MAX_WORKERS];
+  char block[65536];
+  ssize_t n;
+  int i, open = workers;
+  for (i = 0; i < workers; ++i) {
+    polls[i].fd = fds[i];
+    polls[i].events = POLLIN;
+  }
+  while (open) {
+    if (poll(polls, workers, -1) < 0) {
+      if (errno == EINTR) continue;
+      for (i = 0; i < workers; ++i) {
+        kill(pids[i], SIGKILL);
+        if (polls[i].fd >= 0) close(polls[i].fd);
+      }
+      return 1;
+    }
+    for (i = 0; i < workers; ++i) {
+      if (polls[i].fd < 0 || !polls[i].revents) continue;
+      if ((n = read(polls[i].fd, block, sizeof(block))) > 0) {
+        nl_par_append(&buffers[i], block, n);
+      } else if (n == 0 || errno != EINTR) {
+        close(polls[i].fd);
+        polls[i].fd = -1;
+        --open;
+      }
+    }
+  }
+  return 0;
+}
+static int nl_par_workers(int64_t chunks) {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  if (n > NL_PAR_MAX_WORKERS) n = NL_PAR_MAX_WORKERS;
+  if (n > chunks) n = chunks;
+  return n < 1 ? 1 : n;
+}
+/**
+ * Apply the function to every item across the workers, storing what each
+ * call sends back in results, which should be a vector of count items
+ */
+static int nl_par_run(struct nl_scope *scope, enum nl_par_mode mode, struct nl_cell fun,
+                      struct nl_cell *items, int64_t count, struct nl_cell results) {
+  struct nl_par_buffer buffers[NL_PAR_MAX_WORKERS];
+  struct nl_par_message message;
+  struct nl_par_shared *shared;
+  struct nl_cell value;
+  int64_t chunk_size, chunks, i, j, end, first_error = -1;
+  char *p, *stop, *done;
+  const char *err = NULL;
+  int fds[NL_PAR_MAX_WORKERS], pipefd[2], workers, started = 0;
+  pid_t pids[NL_PAR_MAX_WORKERS];
+  chunk_size = count / (nl_par_workers(count) * NL_PAR_CHUNKS_PER_WORKER);
+  if (chunk_size < 1) chunk_size = 1;
+  chunks = (count + chunk_size - 1) / chunk_size;
+  workers = nl_par_workers(chunks);
+  shared = mmap(NULL, sizeof(*shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shared == MAP_FAILED) {
+    scope->last_err = "parallel: cannot share memory with workers";
+    return 1;
+  }
+  shared->next_chunk = shared->failed = 0;
+  // Anything still buffered would be written again by every worker
+  nl_port_flush_all();
+  fflush(NULL);
+  for (started = 0; started < workers; ++started) {
+    if (pipe(pipefd)) break;
+    if ((pids[started] = fork()) < 0) {
+      close(pipefd[0]);
+      close(pipefd[1]);
+      break;
+    }
+    if (pids[started] == 0) {
+      close(pipefd[0]);
+      for (i = 0; i < started; ++i) close(fds[i]);
+      nl_par_work(scope, pipefd[1], shared, mode, fun, items, count, chunk_size);
+    }
+    close(pipefd[1]);
+    fds[started] = pipefd[0];
+    memset(&buffers[started], 0, sizeof(buffers[started]));
+  }
+  if (!started) {
+    munmap(shared, sizeof(*shared));
+    scope->last_err = "parallel: cannot start workers";
+    return 1;
+  }
+  if (nl_par_collect(fds, pids, buffers, started)) err = "parallel: cannot read from workers";
+  for (i = 0; i < started; ++i)
+    while (waitpid(pids[i], NULL, 0) < 0 && errno == EINTR);
+  munmap(shared, sizeof(*shared));
+  if (err) {
+    for (i = 0; i < started; ++i) free(buffers[i].bytes);
+    scope->last_err = (char *)err;
+    return 1;
+  }
+  done = calloc(chunks, 1);
+  for (i = 0; i < started; ++i) {
+    for (p = buffers[i].bytes, stop = p + buffers[i].length; stop - p >= (ptrdiff_t)sizeof(message);) {
+      memcpy(&message, p, sizeof(message));
+      p += sizeof(message);
+      if (message.chunk < 0 || message.chunk >= chunks || message.length > stop - p) break;
+      if (message.failed) {
+        if (first_error < 0 || message.chunk < first_error) {
+          first_error = message.chunk;
+          err = nl_intern_bytes(p, message.length);
+        }
+      } else {
+        end = (message.chunk + 1) * chunk_size < count ? (message.chunk + 1) * chunk_size : count;
+        for (j = message.chunk * chunk_size; j < end; ++j) {
+          if (nl_par_decode(&p, stop, &value)) break;
+          nl_gc_write(&NL_VECTOR_OF(results)->items[j], value);
+        }
+        if (j < end) break;
+        done[message.chunk] = 1;
+      }
+      p += message.failed ? message.length : 0;
+    }
+    free(buffers[i].bytes);
+  }
+  for (i = 0; i < chunks && !err; ++i)
+    if (!done[i]) err = "parallel: a worker stopped without finishing its work";
+  free(done);
+  if (err) {
+    scope->last_err = (char *)err;
+    return 1;
+  }
+  return 0;
+}
+/**
+ * Evaluate the function and the list or vector of the parallel builtins,
+ * and gather the items into an array. Returns -1 on error
+ */
+static int64_t nl_par_args(struct nl_scope *scope, struct nl_cell cell, struct nl_cell *fun, struct nl_cell *seq,
+                           struct nl_cell **items, char *err) {
+  struct nl_cell *a;
+  int64_t n = 0;
+  if (!NL_IS_PAIR(cell) || !NL_IS_PAIR(NL_TAIL(cell))) {
+    scope->last_err = err;
+    return -1;
+  }
+  if (nl_evalq(scope, NL_HEAD(cell), fun)
+      || nl_evalq(scope, NL_HEAD(NL_TAIL(cell)), seq))
+    return -1;
+  if (NL_TYPE(*seq) == NL_VECTOR) {
+    *items = NL_VECTOR_OF(*seq)->items;
+    return NL_VECTOR_OF(*seq)->length;
+  }
+  for (a = seq; NL_IS_PAIR(*a); a = NL_NEXT_AT(a)) ++n;
+  if (NL_TYPE(*a) != NL_NIL) {
+    scope->last_err = err;
+    return -1;
+  }
+  *items = malloc((n + 1) * sizeof(**items));
+  n = 0;
+  NL_FOREACH(seq, a) (*items)[n++] = NL_HEAD_AT(a);
+  return n;
+}
+static int nl_par(struct nl_scope *scope, struct nl_cell cell, struct nl_cell *result, enum nl_par_mode mode, char *err) {
+  struct nl_cell fun, seq, results, *items;
+  int64_t n, i;
+  char *keep;
+  if ((n = nl_par_args(scope, cell, &fun, &seq, &items, err)) < 0) return 1;
+  *result = nl_cell_as_nil();
+  if (n == 0) {
+    if (NL_TYPE(seq) == NL_VECTOR && mode != NL_PAR_FOREACH) *result = seq;
+    return 0;
+  }
+  results = nl_cell_as_vector(n);
+  if (nl_par_run(scope, mode, fun, items, n, results)) {
+    if (NL_TYPE(seq) != NL_VECTOR) free(items);
+    return 1;
+  }
+  switch (mode) {
+  case NL_PAR_MAP:
+    if (NL_TYPE(seq) == NL_VECTOR) {
+      *result = results;
+    } else {
+      for (i = n; i-- > 0;)
+        *result = nl_cell_as_pair(NL_VECTOR_OF(results)->items[i], *result);
+    }
+    break;
+  case NL_PAR_FILTER:
+    if (NL_TYPE(seq) == NL_VECTOR) {
+      keep = malloc(n + 1);
+      for (i = 0; i < n; ++i) keep[i] = NL_TYPE(NL_VECTOR_OF(results)->items[i]) != NL_NIL;
+      *result = nl_vector_keep(items, n, keep);
+      free(keep);
+    } else {
+      for (i = n; i-- > 0;)
+        if (NL_TYPE(NL_VECTOR_OF(results)->items[i]) != NL_NIL)
+          *result = nl_cell_as_pair(items[i], *result);
+    }
+    break;
+  case NL_PAR_FOREACH:
+    break;
+  }
+  if (NL_TYPE(seq) != NL_VECTOR) free(items);
+  return 0;
+}
+NL_BUILTIN(pmap) {
+  return nl_par(scope, cell, result, NL_PAR_MAP, "illegal pmap: expected a function and a list or vector");
+}
+NL_BUILTIN(pfilter) {
+  return nl_par(scope, cell, result, NL_PAR_FILTER, "illegal pfilter: expected a function and a list or vector");
+}
+NL_BUILTIN(pforeach) {
+  return nl_par(scope, cell, result, NL_PAR_FOREACH, "illegal pfor-each: expected a function and a list or vector");
+}
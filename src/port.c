@@ -0,0 +1,302 @@
+#include "nl.h"
+#include <errno.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#define NL_PORT_BUFFER 65536
+struct nl_port nl_stdout_port = { STDOUT_FILENO, 0, 0, NULL, 0, NL_PORT_BUFFER };
+struct nl_port nl_stderr_port = { STDERR_FILENO, 0, 0, NULL, 0, 0 };
+/**
+ * Every output port, so that a port can be told apart from any other
+ * integer
+ */
+static struct nl_port *nl_output_ports[] = { &nl_stdout_port, &nl_stderr_port, NULL };
+/**
+ * Write all of the given buffers, retrying after signals and short writes
+ */
+static int nl_port_writev(int fd, struct iovec *iov, int count) {
+  ssize_t n;
+  while (count) {
+    if ((n = writev(fd, iov, count)) < 0) {
+      if (errno == EINTR) continue;
+      return 1;
+    }
+    for (; count && (size_t)n >= iov->iov_len; --count, ++iov)
+      n -= iov->iov_len;
+    if (count) {
+      iov->iov_base = (char *)iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+  return 0;
+}
+int nl_port_flush(struct nl_port *port) {
+  struct iovec iov;
+  if (port->length) {
+    iov.iov_base = port->buf;
+    iov.iov_len = port->length;
+    if (nl_port_writev(port->fd, &iov, 1)) port->failed = 1;
+    port->length = 0;
+  }
+  return port->failed;
+}
+void nl_port_write(struct nl_port *port, const void *bytes, size_t length) {
+  struct iovec iov[2];
+  if (!length) return;
+  if (port->length + length <= port->capacity) {
+    if (!port->buf) port->buf = malloc(port->capacity);
+    memcpy(port->buf + port->length, bytes, length);
+    port->length += length;
+    if (port->line && memchr(bytes, '\n', length)) nl_port_flush(port);
+    return;
+  }
+  // Too big for what is left: send what is buffered and the bytes together
+  iov[0].iov_base = port->buf;
+  iov[0].iov_len = port->length;
+  iov[1].iov_base = (void *)bytes;
+  iov[1].iov_len = length;
+  if (nl_port_writev(port->fd, iov, 2)) port->failed = 1;
+  port->length = 0;
+}
+void nl_port_putc(struct nl_port *port, int c) {
+  char ch = c;
+  if (port->buf && port->length < port->capacity && !(port->line && ch == '\n'))
+    port->buf[port->length++] = ch;
+  else
+    nl_port_write(port, &ch, 1);
+}
+void nl_port_write_int(struct nl_port *port, int64_t value) {
+  char digits[24], *p = digits + sizeof(digits);
+  uint64_t n = value < 0 ? -(uint64_t)value : (uint64_t)value;
+  do {
+    *--p = '0' + n % 10;
+  } while (n /= 10);
+  if (value < 0) *--p = '-';
+  nl_port_write(port, p, digits + sizeof(digits) - p);
+}
+void nl_port_printf(struct nl_port *port, const char *format, ...) {
+  char small[256], *text = small;
+  va_list args;
+  int n;
+  va_start(args, format);
+  n = vsnprintf(small, sizeof(small), format, args);
+  va_end(args);
+  if (n < 0) return;
+  if ((size_t)n >= sizeof(small)) {
+    text = malloc(n + 1);
+    va_start(args, format);
+    vsnprintf(text, n + 1, format, args);
+    va_end(args);
+  }
+  nl_port_write(port, text, n);
+  if (text != small) free(text);
+}
+void nl_port_set_buffer(struct nl_port *port, size_t capacity) {
+  nl_port_flush(port);
+  free(port->buf);
+  port->buf = NULL;
+  port->capacity = capacity;
+}
+void nl_port_flush_all() {
+  nl_port_flush(&nl_stdout_port);
+  nl_port_flush(&nl_stderr_port);
+}
+void nl_port_init() {
+  static int done;
+  if (done) return;
+  done = 1;
+  // Like stdio, a terminal sees each line as soon as it is finished
+  nl_stdout_port.line = isatty(STDOUT_FILENO);
+  atexit(nl_port_flush_all);
+}
+struct nl_port *nl_port_of(struct nl_cell cell) {
+  struct nl_port **port;
+  if (NL_TYPE(cell) != NL_INTEGER) return NULL;
+  for (port = nl_output_ports; *port; ++port)
+    if ((struct nl_port *)NL_INT(cell) == *port) return *port;
+  return NULL;
+}
+struct nl_port *nl_port_out(struct nl_scope *scope) {
+  struct nl_cell out;
+  struct nl_port *port;
+  nl_scope_get(scope, NL_SYM(nl_out), &out);
+  if (NL_TYPE(out) == NL_NIL) return &nl_stdout_port;
+  if (!(port = nl_port_of(out))) scope->last_err = "illegal *Out: expected a port";
+  return port;
+}
+NL_BUILTIN(flush) {
+  struct nl_port *port;
+  if (NL_IS_PAIR(cell)) {
+    if (nl_evalq(scope, NL_HEAD(cell), result)) return 1;
+    if (!(port = nl_port_of(*result))) {
+      scope->last_err = "illegal flush: expected a port";
+      return 1;
+    }
+  } else if (!(port = nl_port_out(scope))) {
+    return 1;
+  }
+  if (nl_port_flush(port)) {
+    scope->last_err = "flush: cannot write";
+    return 1;
+  }
+  *result = t;
+  return 0;
+}
+NL_BUILTIN(portbuffer) {
+  struct nl_cell size;
+  struct nl_port *port;
+  if (!NL_IS_PAIR(cell)) {
+    scope->last_err = "illegal port-buffer: expected a port";
+    return 1;
+  }
+  if (nl_evalq(scope, NL_HEAD(cell), result)) return 1;
+  if (!(port = nl_port_of(*result))) {
+    scope->last_err = "illegal port-buffer: expected a port";
+    return 1;
+  }
+  if (NL_IS_PAIR(NL_TAIL(cell))) {
+    if (nl_evalq(scope, NL_HEAD(NL_TAIL(cell)), &size)) return 1;
+    if (NL_TYPE(size) != NL_INTEGER || NL_INT(size) < 0) {
+      scope->last_err = "illegal port-buffer: size should be a non-negative integer";
+      return 1;
+    }
+    nl_port_set_buffer(port, NL_INT(size));
+  }
+  *result = nl_cell_as_int(port->capacity);
+  return 0;
+}
+/**
+ * An input port reads data from a file, a block at a time. Open ports are
+ * kept in a list, so that a port can be told apart from any other integer
+ */
+struct nl_input_port {
+  struct nl_reader reader;
+  struct nl_input_port *next;
+};
+static struct nl_input_port *nl_input_ports;
+static struct nl_input_port *nl_input_port_open(const char *path) {
+  struct nl_input_port *port;
+  FILE *in;
+  // Streamed rather than mapped, so memory use does not grow with the file
+  if (!(in = fopen(path, "r"))) return NULL;
+  port = malloc(sizeof(*port));
+  nl_reader_init(&port->reader, in);
+  port->reader.owned = 1;
+  port->next = nl_input_ports;
+  return nl_input_ports = port;
+}
+static void nl_input_port_close(struct nl_input_port *port) {
+  struct nl_input_port **p;
+  for (p = &nl_input_ports; *p; p = &(*p)->next) {
+    if (*p == port) {
+      *p = port->next;
+      nl_reader_close(&port->reader);
+      free(port);
+      return;
+    }
+  }
+}
+struct nl_input_port *nl_input_port_of(struct nl_cell cell) {
+  struct nl_input_port *port;
+  if (NL_TYPE(cell) != NL_INTEGER) return NULL;
+  for (port = nl_input_ports; port; port = port->next)
+    if ((struct nl_input_port *)NL_INT(cell) == port) return port;
+  return NULL;
+}
+int nl_input_port_read(struct nl_scope *scope, struct nl_input_port *port, struct nl_cell *result) {
+  int err = nl_read(scope, &port->reader, result);
+  if (err && err != EOF && !scope->last_err)
+    scope->last_err = "read: unexpected end of input";
+  return err;
+}
+NL_BUILTIN(openinput) {
+  struct nl_cell path;
+  struct nl_input_port *port;
+  if (!NL_IS_PAIR(cell)) {
+    scope->last_err = "illegal open-input: expected pathname";
+    return 1;
+  }
+  if (nl_evalq(scope, NL_HEAD(cell), &path)) return 1;
+  if (NL_TYPE(path) != NL_SYMBOL) {
+    scope->last_err = "illegal open-input: expected pathname";
+    return 1;
+  }
+  if (!(port = nl_input_port_open(NL_SYM(path)))) {
+    scope->last_err = "open-input: cannot open file";
+    return 1;
+  }
+  *result = nl_cell_as_int((int64_t)port);
+  return 0;
+}
+NL_BUILTIN(closeinput) {
+  struct nl_input_port *port;
+  if (!NL_IS_PAIR(cell)) {
+    scope->last_err = "illegal close-input: expected an input port";
+    return 1;
+  }
+  if (nl_evalq(scope, NL_HEAD(cell), result)) return 1;
+  if (!(port = nl_input_port_of(*result))) {
+    scope->last_err = "illegal close-input: expected an input port";
+    return 1;
+  }
+  nl_input_port_close(port);
+  *result = t;
+  return 0;
+}
+static int nl_read_port(struct nl_scope *scope, struct nl_cell cell, struct nl_cell *result, int shared) {
+  struct nl_input_port *port;
+  int err;
+  if (!NL_IS_PAIR(cell)) {
+    scope->last_err = shared ? "illegal read-shared: expected an input port" : "illegal read: expected an input port";
+    return 1;
+  }
+  if (nl_evalq(scope, NL_HEAD(cell), result)) return 1;
+  if (!(port = nl_input_port_of(*result))) {
+    scope->last_err = shared ? "illegal read-shared: expected an input port" : "illegal read: expected an input port";
+    return 1;
+  }
+  port->reader.shared = shared;
+  err = nl_input_port_read(scope, port, result);
+  port->reader.shared = 0;
+  if (err != EOF) return err;
+  // At the end of the input, the second argument (or nil)
+  if (NL_IS_PAIR(NL_TAIL(cell))) return nl_evalq(scope, NL_HEAD(NL_TAIL(cell)), result);
+  *result = nil;
+  return 0;
+}
+NL_BUILTIN(readport) {
+  return nl_read_port(scope, cell, result, 0);
+}
+NL_BUILTIN(readshared) {
+  return nl_read_port(scope, cell, result, 1);
+}
+NL_BUILTIN(foreachdatum) {
+  struct nl_cell fun, source, datum;
+  struct nl_input_port *port;
+  int err;
+  if (!NL_IS_PAIR(cell) || !NL_IS_PAIR(NL_TAIL(cell))) {
+    scope->last_err = "illegal for-each-datum: expected a function and a pathname or port";
+    return 1;
+  }
+  if (nl_evalq(scope, NL_HEAD(cell), &fun)) return 1;
+  if (nl_evalq(scope, NL_HEAD(NL_TAIL(cell)), &source)) return 1;
+  if (NL_TYPE(source) == NL_SYMBOL) {
+    if (!(port = nl_input_port_open(NL_SYM(source)))) {
+      scope->last_err = "for-each-datum: cannot open file";
+      return 1;
+    }
+  } else if (!(port = nl_input_port_of(source))) {
+    scope->last_err = "illegal for-each-datum: expected a pathname or port";
+    return 1;
+  }
+  // Only the current datum is live, so the rest of the input can be any size
+  *result = nil;
+  while (!(err = nl_input_port_read(scope, port, &datum))) {
+    if ((err = nl_invoke_values(scope, fun, 1, &datum, result))) break;
+  }
+  // A port that was passed in is left open, at wherever reading stopped
+  if (NL_TYPE(source) == NL_SYMBOL) nl_input_port_close(port);
+  return err == EOF ? 0 : err;
+}
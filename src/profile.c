@@ -0,0 +1,228 @@
+#include "nl.h"
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#define NL_PROFILE_INTERVAL_US 1000
+#define NL_PROFILE_MAX_DEPTH 65536
+/**
+ * What has been measured for one function, which is either a lambda or
+ * a native function. Time is sampled: a timer signal looks at the stack
+ * of calls in progress every interval, charging the CPU time since the
+ * last sample to the function on top as self time, and to every function
+ * on the stack as total time. The timer only ticks as often as the kernel
+ * allows, so the time is measured rather than assumed to be the interval
+ */
+struct nl_profile_entry {
+  struct nl_cell fun;
+  char *name;
+  uint64_t calls, self_allocs, total_allocs;
+  volatile uint64_t self_ns, total_ns, last_sample;
+  int64_t active;
+  struct nl_profile_entry *next;
+};
+/**
+ * A call in progress. allocs is the allocation count when it started,
+ * and children is how many allocations the calls it made have done
+ */
+struct nl_profile_frame {
+  struct nl_profile_entry *entry;
+  uint64_t allocs, children;
+};
+int nl_profiling;
+static struct nl_profile_entry *nl_profile_entries, **nl_profile_index;
+static size_t nl_profile_count, nl_profile_capacity;
+// The frames are never moved, so the signal handler can walk them at any time
+static struct nl_profile_frame *nl_profile_frames;
+static volatile int64_t nl_profile_depth;
+static volatile uint64_t nl_profile_samples, nl_profile_ns, nl_profile_last_ns;
+static uintptr_t nl_profile_key(struct nl_cell fun) {
+  return NL_IS_PAIR(fun) ? (uintptr_t)NL_PAIR_OF(fun) : (uintptr_t)NL_INT(fun);
+}
+static size_t nl_profile_slot(struct nl_profile_entry **index, size_t capacity, uintptr_t key) {
+  size_t i = (key >> 4) * 0x9e3779b97f4a7c15ULL;
+  for (i &= capacity - 1; index[i] && nl_profile_key(index[i]->fun) != key; i = (i + 1) & (capacity - 1));
+  return i;
+}
+static struct nl_profile_entry *nl_profile_entry(struct nl_cell fun) {
+  struct nl_profile_entry **old = nl_profile_index, *e;
+  size_t i, old_capacity = nl_profile_capacity;
+  if (2 * (nl_profile_count + 1) > nl_profile_capacity) {
+    nl_profile_capacity = old_capacity ? old_capacity * 2 : 256;
+    nl_profile_index = calloc(nl_profile_capacity, sizeof(*nl_profile_index));
+    for (i = 0; i < old_capacity; ++i)
+      if (old[i])
+        nl_profile_index[nl_profile_slot(nl_profile_index, nl_profile_capacity, nl_profile_key(old[i]->fun))] = old[i];
+    free(old);
+  }
+  i = nl_profile_slot(nl_profile_index, nl_profile_capacity, nl_profile_key(fun));
+  if (nl_profile_index[i]) return nl_profile_index[i];
+  e = calloc(1, sizeof(*e));
+  e->fun = fun;
+  e->next = nl_profile_entries;
+  nl_profile_entries = nl_profile_index[i] = e;
+  ++nl_profile_count;
+  return e;
+}
+void nl_profile_enter(struct nl_cell fun) {
+  struct nl_profile_frame *f;
+  struct nl_profile_entry *e = nl_profile_entry(fun);
+  ++e->calls;
+  ++e->active;
+  if (nl_profile_depth < NL_PROFILE_MAX_DEPTH) {
+    f = &nl_profile_frames[nl_profile_depth];
+    f->entry = e;
+    f->allocs = nl_gc_allocations();
+    f->children = 0;
+  }
+  // The frame must be complete before the signal handler can see it
+  __atomic_signal_fence(__ATOMIC_SEQ_CST);
+  ++nl_profile_depth;
+}
+void nl_profile_leave() {
+  struct nl_profile_frame *f;
+  uint64_t allocs;
+  if (!nl_profile_depth) return;
+  --nl_profile_depth;
+  __atomic_signal_fence(__ATOMIC_SEQ_CST);
+  if (nl_profile_depth >= NL_PROFILE_MAX_DEPTH) return;
+  f = &nl_profile_frames[nl_profile_depth];
+  allocs = nl_gc_allocations() - f->allocs;
+  f->entry->self_allocs += allocs - f->children;
+  // Recursive calls are already counted by the outermost one
+  if (!--f->entry->active) f->entry->total_allocs += allocs;
+  if (nl_profile_depth) nl_profile_frames[nl_profile_depth - 1].children += allocs;
+}
+void nl_profile_replace(struct nl_cell fun) {
+  if (!nl_profile_depth) return;
+  nl_profile_leave();
+  nl_profile_enter(fun);
+}
+static uint64_t nl_profile_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+static void nl_profile_sample(int sig) {
+  struct nl_profile_entry *e;
+  int64_t i, depth = nl_profile_depth;
+  uint64_t sample = ++nl_profile_samples, now = nl_profile_now(), ns = now - nl_profile_last_ns;
+  nl_profile_last_ns = now;
+  nl_profile_ns += ns;
+  if (depth > NL_PROFILE_MAX_DEPTH) depth = NL_PROFILE_MAX_DEPTH;
+  // A function is only charged once, however deep it recurses
+  for (i = 0; i < depth; ++i) {
+    e = nl_profile_frames[i].entry;
+    if (e->last_sample == sample) continue;
+    e->last_sample = sample;
+    e->total_ns += ns;
+  }
+  if (depth) nl_profile_frames[depth - 1].entry->self_ns += ns;
+}
+void nl_profile_roots() {
+  struct nl_profile_entry *e;
+  for (e = nl_profile_entries; e; e = e->next)
+    nl_gc_mark_cell(e->fun);
+}
+/**
+ * Start sampling, forgetting whatever was measured before. Entries can
+ * only be dropped once no call is left to finish, so until then they are
+ * just reset
+ */
+void nl_profile_start() {
+  struct nl_profile_entry *e, *next;
+  struct itimerval timer = { { 0, NL_PROFILE_INTERVAL_US }, { 0, NL_PROFILE_INTERVAL_US } };
+  struct sigaction action;
+  if (nl_profiling) return;
+  if (!nl_profile_frames) nl_profile_frames = malloc(NL_PROFILE_MAX_DEPTH * sizeof(*nl_profile_frames));
+  for (e = nl_profile_entries; e; e = next) {
+    next = e->next;
+    if (nl_profile_depth) {
+      e->calls = e->self_allocs = e->total_allocs = 0;
+      e->self_ns = e->total_ns = 0;
+    } else {
+      free(e);
+    }
+  }
+  if (!nl_profile_depth) {
+    nl_profile_entries = NULL;
+    free(nl_profile_index);
+    nl_profile_index = NULL;
+    nl_profile_count = nl_profile_capacity = 0;
+  }
+  nl_profile_samples = nl_profile_ns = 0;
+  nl_profile_last_ns = nl_profile_now();
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = nl_profile_sample;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGPROF, &action, NULL);
+  setitimer(ITIMER_PROF, &timer, NULL);
+  nl_profiling = 1;
+}
+void nl_profile_stop() {
+  struct itimerval timer = { { 0, 0 }, { 0, 0 } };
+  if (!nl_profiling) return;
+  setitimer(ITIMER_PROF, &timer, NULL);
+  nl_profiling = 0;
+}
+static void nl_profile_name(char *sym, void *data) {
+  struct nl_cell value = NL_SYMBOL_OF(sym)->value;
+  struct nl_profile_entry *e;
+  if ((!NL_IS_PAIR(value) && NL_TYPE(value) != NL_INTEGER) || !nl_profile_index) return;
+  e = nl_profile_index[nl_profile_slot(nl_profile_index, nl_profile_capacity, nl_profile_key(value))];
+  // Of several names for the same function, report the first in order
+  if (e && NL_TYPE(e->fun) == NL_TYPE(value) && (!e->name || strcmp(sym, e->name) < 0))
+    e->name = sym;
+}
+static int nl_profile_compare(const void *a, const void *b) {
+  const struct nl_profile_entry *x = *(struct nl_profile_entry **)a, *y = *(struct nl_profile_entry **)b;
+  if (x->self_ns != y->self_ns) return x->self_ns < y->self_ns ? 1 : -1;
+  if (x->total_ns != y->total_ns) return x->total_ns < y->total_ns ? 1 : -1;
+  return x->calls < y->calls ? 1 : x->calls > y->calls ? -1 : 0;
+}
+/**
+ * Print what has been measured so far, busiest functions first. Each
+ * function is named after a symbol bound to it, if there is one
+ */
+void nl_profile_report(struct nl_port *out) {
+  struct nl_profile_entry **sorted, *e;
+  size_t i, n = 0;
+  char *name;
+  sorted = malloc((nl_profile_count + 1) * sizeof(*sorted));
+  for (e = nl_profile_entries; e; e = e->next) {
+    e->name = NULL;
+    if (e->calls || e->total_ns) sorted[n++] = e;
+  }
+  nl_intern_foreach(nl_profile_name, NULL);
+  qsort(sorted, n, sizeof(*sorted), nl_profile_compare);
+  nl_port_printf(out, "%llu samples over %.1f ms\n", (unsigned long long)nl_profile_samples, nl_profile_ns / 1e6);
+  nl_port_printf(out, "%12s %10s %10s %12s %12s  %s\n", "calls", "self ms", "total ms", "self allocs", "total allocs", "name");
+  for (i = 0; i < n; ++i) {
+    e = sorted[i];
+    name = e->name || NL_IS_PAIR(e->fun) ? e->name : nl_native_name((nl_native_func)NL_INT(e->fun));
+    nl_port_printf(out, "%12llu %10.1f %10.1f %12llu %12llu  %s\n",
+            (unsigned long long)e->calls, e->self_ns / 1e6, e->total_ns / 1e6,
+            (unsigned long long)e->self_allocs, (unsigned long long)e->total_allocs,
+            name ? name : "(lambda)");
+  }
+  free(sorted);
+}
+NL_BUILTIN(profilestart) {
+  nl_profile_start();
+  *result = nl_cell_as_nil();
+  return 0;
+}
+NL_BUILTIN(profilestop) {
+  nl_profile_stop();
+  *result = nl_cell_as_nil();
+  return 0;
+}
+NL_BUILTIN(profilereport) {
+  struct nl_port *out = nl_port_out(scope);
+  if (!out) return 1;
+  nl_profile_report(out);
+  *result = nl_cell_as_nil();
+  return 0;
+}
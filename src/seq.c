@@ -0,0 +1,207 @@
+#include "nl.h"
+#include <stdlib.h>
+#include <string.h>
+static const char *nl_seq_kind_names[] = {
+  "list", "vector", "range", "unfold", "port", "map", "filter", "take", "drop",
+};
+#define NL_SEQ_KINDS (sizeof(nl_seq_kind_names) / sizeof(nl_seq_kind_names[0]))
+/**
+ * The kind symbols are interned on first use, so that they are the ones
+ * found in any image loaded before then
+ */
+static char *nl_seq_kinds[NL_SEQ_KINDS];
+static void nl_seq_intern() {
+  size_t i;
+  for (i = 0; i < NL_SEQ_KINDS; ++i)
+    nl_seq_kinds[i] = nl_intern_bytes(nl_seq_kind_names[i], strlen(nl_seq_kind_names[i]));
+}
+static int nl_seq_kind_of(struct nl_cell cell) {
+  size_t i;
+  if (!nl_seq_kinds[0]) nl_seq_intern();
+  if (NL_TYPE(cell) == NL_SYMBOL)
+    for (i = 0; i < NL_SEQ_KINDS; ++i)
+      if (NL_SYM(cell) == nl_seq_kinds[i]) return i;
+  return -1;
+}
+struct nl_cell nl_seq_make(enum nl_seq_kind kind, struct nl_cell args) {
+  struct nl_cell source;
+  if (!nl_seq_kinds[0]) nl_seq_intern();
+  source = nl_cell_as_pair(nl_cell_as_symbol(nl_seq_kinds[kind]), args);
+  return nl_cell_of_seq(NL_PAIR_OF(nl_cell_as_pair(source, nil)));
+}
+struct nl_cell nl_seq_add(struct nl_cell seq, enum nl_seq_kind kind, struct nl_cell arg) {
+  struct nl_cell result, stage, *tail, *s;
+  result = nl_cell_as_pair(NL_SEQ_OF(seq)[0], nil);
+  tail = NL_NEXT_AT(&result);
+  NL_FOREACH(&NL_SEQ_OF(seq)[1], s) {
+    nl_gc_write(tail, nl_cell_as_pair(NL_HEAD_AT(s), nil));
+    tail = NL_NEXT_AT(tail);
+  }
+  stage = nl_cell_as_pair(nl_cell_as_symbol(nl_seq_kinds[kind]), arg);
+  nl_gc_write(tail, nl_cell_as_pair(stage, nil));
+  return nl_cell_of_seq(NL_PAIR_OF(result));
+}
+int nl_seq_of(struct nl_cell cell, struct nl_cell *result) {
+  if (NL_TYPE(cell) == NL_SEQ)
+    *result = cell;
+  else if (NL_TYPE(cell) == NL_NIL || NL_IS_PAIR(cell))
+    *result = nl_seq_make(NL_SEQ_LIST, cell);
+  else if (NL_TYPE(cell) == NL_VECTOR || NL_TYPE(cell) == NL_INTS)
+    *result = nl_seq_make(NL_SEQ_VECTOR, cell);
+  else if (nl_input_port_of(cell))
+    *result = nl_seq_make(NL_SEQ_PORT, cell);
+  else
+    return 1;
+  return 0;
+}
+int nl_seq_begin(struct nl_scope *scope, struct nl_seq_iter *it, struct nl_cell seq) {
+  struct nl_cell source, args, *s;
+  int64_t i;
+  int kind;
+  it->seq = seq;
+  it->index = it->bounded = it->started = it->done = 0;
+  it->stages = NULL;
+  it->stage_count = 0;
+  if (NL_TYPE(seq) != NL_SEQ || !NL_IS_PAIR(source = NL_SEQ_OF(seq)[0]))
+    goto malformed;
+  args = NL_TAIL(source);
+  switch (it->source = nl_seq_kind_of(NL_HEAD(source))) {
+  case NL_SEQ_LIST:
+    if (NL_TYPE(args) != NL_NIL && !NL_IS_PAIR(args)) goto malformed;
+    it->items = args;
+    break;
+  case NL_SEQ_VECTOR:
+    if (NL_TYPE(args) != NL_VECTOR && NL_TYPE(args) != NL_INTS) goto malformed;
+    it->items = args;
+    break;
+  case NL_SEQ_RANGE:
+    // (range Start End Step), where an End of nil never ends
+    if (nl_list_length(args) != 3 || NL_TYPE(NL_HEAD(args)) != NL_INTEGER
+        || NL_TYPE(NL_HEAD(NL_TAIL(NL_TAIL(args)))) != NL_INTEGER)
+      goto malformed;
+    it->index = NL_INT(NL_HEAD(args));
+    it->step = NL_INT(NL_HEAD(NL_TAIL(NL_TAIL(args))));
+    if ((it->bounded = NL_TYPE(NL_HEAD(NL_TAIL(args))) == NL_INTEGER))
+      it->end = NL_INT(NL_HEAD(NL_TAIL(args)));
+    break;
+  case NL_SEQ_UNFOLD:
+    // (unfold Seed Continue Next)
+    if (nl_list_length(args) != 3) goto malformed;
+    it->items = NL_HEAD(args);
+    it->more = NL_HEAD(NL_TAIL(args));
+    it->next = NL_HEAD(NL_TAIL(NL_TAIL(args)));
+    break;
+  case NL_SEQ_PORT:
+    if (!(it->port = nl_input_port_of(args))) {
+      scope->last_err = "illegal sequence: the input port is closed";
+      return 1;
+    }
+    break;
+  default:
+    goto malformed;
+  }
+  it->stage_count = nl_list_length(NL_SEQ_OF(seq)[1]);
+  if (it->stage_count) it->stages = malloc(it->stage_count * sizeof(*it->stages));
+  i = 0;
+  NL_FOREACH(&NL_SEQ_OF(seq)[1], s) {
+    kind = NL_IS_PAIR(NL_HEAD_AT(s)) ? nl_seq_kind_of(NL_HEAD(NL_HEAD_AT(s))) : -1;
+    if (kind < NL_SEQ_MAP) goto malformed;
+    it->stages[i].kind = kind;
+    it->stages[i].arg = NL_TAIL(NL_HEAD_AT(s));
+    it->stages[i].count = 0;
+    if ((it->stages[i].kind == NL_SEQ_TAKE || it->stages[i].kind == NL_SEQ_DROP)
+        && NL_TYPE(it->stages[i].arg) != NL_INTEGER)
+      goto malformed;
+    // Nothing gets past taking none, so the source is never touched
+    if (it->stages[i].kind == NL_SEQ_TAKE && NL_INT(it->stages[i].arg) <= 0) it->done = 1;
+    ++i;
+  }
+  return 0;
+ malformed:
+  nl_seq_end(it);
+  scope->last_err = "illegal sequence";
+  return 1;
+}
+/**
+ * Store the source's next item. Returns EOF once it has run out
+ */
+static int nl_seq_pull(struct nl_scope *scope, struct nl_seq_iter *it, struct nl_cell *result) {
+  struct nl_cell seed, more;
+  switch (it->source) {
+  case NL_SEQ_LIST:
+    if (!NL_IS_PAIR(it->items)) return EOF;
+    *result = NL_HEAD(it->items);
+    it->items = NL_TAIL(it->items);
+    return 0;
+  case NL_SEQ_VECTOR:
+    if (NL_TYPE(it->items) == NL_INTS) {
+      if (it->index >= NL_INTS_OF(it->items)->length) return EOF;
+      *result = nl_cell_as_int(NL_INTS_OF(it->items)->items[it->index++]);
+    } else {
+      if (it->index >= NL_VECTOR_OF(it->items)->length) return EOF;
+      *result = NL_VECTOR_OF(it->items)->items[it->index++];
+    }
+    return 0;
+  case NL_SEQ_RANGE:
+    if (it->bounded && (it->step > 0 ? it->index >= it->end : it->index <= it->end)) return EOF;
+    *result = nl_cell_as_int(it->index);
+    it->index += it->step;
+    return 0;
+  case NL_SEQ_UNFOLD:
+    // The next seed is only asked for once the item before it is done with
+    if (it->started) {
+      if (nl_invoke_values(scope, it->next, 1, &it->items, &seed)) return 1;
+      it->items = seed;
+    }
+    it->started = 1;
+    if (nl_invoke_values(scope, it->more, 1, &it->items, &more)) return 1;
+    if (NL_TYPE(more) == NL_NIL) return EOF;
+    *result = it->items;
+    return 0;
+  case NL_SEQ_PORT:
+    return nl_input_port_read(scope, it->port, result);
+  default:
+    return EOF;
+  }
+}
+int nl_seq_next(struct nl_scope *scope, struct nl_seq_iter *it, struct nl_cell *result) {
+  struct nl_seq_stage *stage, *end = it->stages + it->stage_count;
+  struct nl_cell value;
+  int err;
+ next:
+  if (it->done) return EOF;
+  if ((err = nl_seq_pull(scope, it, result))) {
+    if (err == EOF) it->done = 1;
+    return err;
+  }
+  for (stage = it->stages; stage < end; ++stage) {
+    switch (stage->kind) {
+    case NL_SEQ_MAP:
+      if (nl_invoke_values(scope, stage->arg, 1, result, &value)) return 1;
+      *result = value;
+      break;
+    case NL_SEQ_FILTER:
+      if (nl_invoke_values(scope, stage->arg, 1, result, &value)) return 1;
+      if (NL_TYPE(value) == NL_NIL) goto next;
+      break;
+    case NL_SEQ_DROP:
+      if (stage->count < NL_INT(stage->arg)) {
+        ++stage->count;
+        goto next;
+      }
+      break;
+    case NL_SEQ_TAKE:
+      // This item still goes on through the stages after, but it is the last
+      if (++stage->count >= NL_INT(stage->arg)) it->done = 1;
+      break;
+    default:
+      break;
+    }
+  }
+  return 0;
+}
+void nl_seq_end(struct nl_seq_iter *it) {
+  free(it->stages);
+  it->stages = NULL;
+  it->stage_count = 0;
+}
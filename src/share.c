@@ -0,0 +1,141 @@
+#include "nl.h"
+#include <stdlib.h>
+#include <string.h>
+#define NL_SHARE_MIN 1024
+/**
+ * The pairs read in shared mode, in an open-addressing table keyed on
+ * the identity of each pair's head and tail, which have been shared
+ * already. The table does not keep its pairs alive: it is swept after
+ * each collection, like the compiled code cache. set-head and set-tail
+ * look a pair up here before changing it, and refuse to change one found
+ */
+struct nl_share_entry {
+  uint64_t hash;
+  struct nl_cell *pair;
+};
+static struct nl_share_entry *nl_shared;
+static size_t nl_shared_capacity, nl_shared_count;
+/**
+ * Pairs added since the last collection, which are the only ones a
+ * minor collection can free
+ */
+static struct nl_share_entry *nl_shared_young;
+static size_t nl_shared_young_count, nl_shared_young_capacity;
+/**
+ * Cells stand for themselves here, so nil has to be the same whatever
+ * its (unused) value bits hold
+ */
+static uint64_t nl_share_word(struct nl_cell cell) {
+#ifdef NL_TAGGED_CELLS
+  return cell.bits;
+#else
+  return NL_TYPE(cell) == NL_NIL ? 0 : (uint64_t)NL_INT(cell);
+#endif
+}
+static int nl_share_same(struct nl_cell a, struct nl_cell b) {
+  return NL_TYPE(a) == NL_TYPE(b) && nl_share_word(a) == nl_share_word(b);
+}
+static uint64_t nl_share_hash(struct nl_cell *pair) {
+  uint64_t hash = nl_share_word(pair[0]) * 31 + NL_TYPE(pair[0]);
+  hash = (hash ^ hash >> 29) * 0xbf58476d1ce4e5b9ULL;
+  hash += nl_share_word(pair[1]) * 31 + NL_TYPE(pair[1]);
+  hash = (hash ^ hash >> 32) * 0x94d049bb133111ebULL;
+  return hash ^ hash >> 29;
+}
+static void nl_share_insert(struct nl_share_entry entry) {
+  size_t mask = nl_shared_capacity - 1, i;
+  for (i = entry.hash & mask; nl_shared[i].pair; i = (i + 1) & mask);
+  nl_shared[i] = entry;
+  ++nl_shared_count;
+}
+static void nl_share_resize(size_t capacity) {
+  struct nl_share_entry *old = nl_shared;
+  size_t old_capacity = nl_shared_capacity, i;
+  nl_shared = calloc(capacity, sizeof(*nl_shared));
+  nl_shared_capacity = capacity;
+  nl_shared_count = 0;
+  for (i = 0; i < old_capacity; ++i)
+    if (old[i].pair) nl_share_insert(old[i]);
+  free(old);
+}
+struct nl_cell nl_share_pair(struct nl_cell pair) {
+  struct nl_share_entry entry;
+  size_t mask, i;
+  struct nl_cell *p = NL_PAIR_OF(pair);
+  if (!nl_shared) nl_share_resize(NL_SHARE_MIN);
+  entry.hash = nl_share_hash(p);
+  entry.pair = p;
+  mask = nl_shared_capacity - 1;
+  for (i = entry.hash & mask; nl_shared[i].pair; i = (i + 1) & mask) {
+    if (nl_shared[i].hash == entry.hash && nl_share_same(nl_shared[i].pair[0], p[0])
+        && nl_share_same(nl_shared[i].pair[1], p[1]))
+      return nl_cell_of_pair(nl_shared[i].pair);
+  }
+  if (4 * (nl_shared_count + 1) > 3 * nl_shared_capacity) nl_share_resize(2 * nl_shared_capacity);
+  nl_share_insert(entry);
+  if (nl_shared_young_count == nl_shared_young_capacity) {
+    nl_shared_young_capacity = nl_shared_young_capacity ? 2 * nl_shared_young_capacity : 256;
+    nl_shared_young = realloc(nl_shared_young, nl_shared_young_capacity * sizeof(*nl_shared_young));
+  }
+  nl_shared_young[nl_shared_young_count++] = entry;
+  return pair;
+}
+int nl_share_has(struct nl_cell pair) {
+  struct nl_cell *p = NL_PAIR_OF(pair);
+  uint64_t hash;
+  size_t mask, i;
+  if (!nl_shared_count) return 0;
+  hash = nl_share_hash(p);
+  mask = nl_shared_capacity - 1;
+  for (i = hash & mask; nl_shared[i].pair; i = (i + 1) & mask)
+    if (nl_shared[i].pair == p) return 1;
+  return 0;
+}
+/**
+ * Remove the given entry, moving later entries of the same run back
+ * into the hole so that they can still be found
+ */
+static void nl_share_remove(struct nl_share_entry entry) {
+  size_t mask = nl_shared_capacity - 1, i, j, home;
+  for (i = entry.hash & mask; nl_shared[i].pair != entry.pair; i = (i + 1) & mask)
+    if (!nl_shared[i].pair) return;
+  nl_shared[i].pair = NULL;
+  --nl_shared_count;
+  for (j = (i + 1) & mask; nl_shared[j].pair; j = (j + 1) & mask) {
+    home = nl_shared[j].hash & mask;
+    // The entry stays unless its home is at or before the hole
+    if (i <= j ? (i < home && home <= j) : (i < home || home <= j)) continue;
+    nl_shared[i] = nl_shared[j];
+    nl_shared[j].pair = NULL;
+    i = j;
+  }
+}
+void nl_share_sweep(int major) {
+  size_t i;
+  if (!nl_shared) return;
+  if (major) {
+    for (i = 0; i < nl_shared_capacity; ++i)
+      if (nl_shared[i].pair && !nl_gc_is_live(nl_shared[i].pair)) nl_shared[i].pair = NULL;
+    nl_share_resize(nl_shared_capacity);
+  } else {
+    for (i = 0; i < nl_shared_young_count; ++i)
+      if (!nl_gc_is_live(nl_shared_young[i].pair)) nl_share_remove(nl_shared_young[i]);
+  }
+  nl_shared_young_count = 0;
+}
+struct nl_cell nl_share_list(struct nl_cell list) {
+  struct nl_cell reversed = nil, next, tail;
+  // Turn the spine around, so that the pairs can be shared from the end
+  while (NL_IS_PAIR(list)) {
+    next = NL_TAIL(list);
+    nl_gc_write(&NL_TAIL(list), reversed);
+    reversed = list;
+    list = next;
+  }
+  for (tail = list; NL_IS_PAIR(reversed); reversed = next) {
+    next = NL_TAIL(reversed);
+    nl_gc_write(&NL_TAIL(reversed), tail);
+    tail = nl_share_pair(reversed);
+  }
+  return tail;
+}
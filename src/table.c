@@ -0,0 +1,252 @@
+#include "nl.h"
+#include <stdlib.h>
+#define NL_TABLE_MIN 8
+#define NL_TABLE_MOVE_STEP 8
+/**
+ * Entries use open addressing with linear probing. A hash of zero marks
+ * an empty entry, and one marks an entry whose key was removed; real
+ * hashes are moved out of the way of both
+ */
+#define NL_TABLE_EMPTY 0
+#define NL_TABLE_REMOVED 1
+struct nl_table_entry {
+  uint64_t hash;
+  struct nl_cell key, value;
+};
+/**
+ * The capacity is always a power of two. used counts removed entries
+ * as well as live ones, and is kept under three quarters of capacity.
+ * moved is how far the entries have been moved into the next block,
+ * once this block has been replaced
+ */
+struct nl_table_entries {
+  int64_t capacity, count, used, moved;
+  struct nl_table_entry items[];
+};
+static uint64_t nl_hash_mix(uint64_t hash) {
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+uint64_t nl_cell_hash(struct nl_cell cell) {
+  uint64_t hash = NL_PAIR;
+  int64_t i;
+  // Walk down the tails, only recursing into the heads
+  while (NL_IS_PAIR(cell)) {
+    hash = nl_hash_mix(hash * 31 + nl_cell_hash(NL_HEAD(cell)));
+    cell = NL_TAIL(cell);
+  }
+  switch (NL_TYPE(cell)) {
+  case NL_NIL:
+    return nl_hash_mix(hash);
+  case NL_INTEGER:
+    return nl_hash_mix(hash * 31 + NL_INT(cell));
+  case NL_SYMBOL:
+    // Symbols are interned, so their hash is already known
+    return nl_hash_mix(hash * 31 + NL_SYMBOL_OF(NL_SYM(cell))->hash);
+  case NL_VECTOR:
+    hash = hash * 31 + NL_VECTOR;
+    for (i = 0; i < NL_VECTOR_OF(cell)->length; ++i)
+      hash = nl_hash_mix(hash * 31 + nl_cell_hash(NL_VECTOR_OF(cell)->items[i]));
+    return nl_hash_mix(hash);
+  case NL_INTS:
+    hash = hash * 31 + NL_INTS;
+    for (i = 0; i < NL_INTS_OF(cell)->length; ++i)
+      hash = nl_hash_mix(hash * 31 + NL_INTS_OF(cell)->items[i]);
+    return nl_hash_mix(hash);
+  case NL_SEQ:
+    return nl_hash_mix(hash * 31 + (uintptr_t)NL_SEQ_OF(cell));
+  default:
+    return nl_hash_mix(hash * 31 + (uintptr_t)NL_TABLE_OF(cell));
+  }
+}
+static uint64_t nl_table_hash(struct nl_cell key) {
+  uint64_t hash = nl_cell_hash(key);
+  return hash <= NL_TABLE_REMOVED ? hash + 2 : hash;
+}
+static struct nl_table_entries *nl_table_entries_alloc(int64_t capacity) {
+  struct nl_table_entries *entries = calloc(1, sizeof(*entries) + capacity * sizeof(struct nl_table_entry));
+  entries->capacity = capacity;
+  return entries;
+}
+/**
+ * Find the entry for the given key, or NULL if it is not in the block
+ */
+static struct nl_table_entry *nl_table_find(struct nl_table_entries *entries, uint64_t hash, struct nl_cell key) {
+  struct nl_table_entry *e;
+  int64_t i;
+  if (!entries) return NULL;
+  for (i = hash & (entries->capacity - 1);; i = (i + 1) & (entries->capacity - 1)) {
+    e = &entries->items[i];
+    if (e->hash == NL_TABLE_EMPTY) return NULL;
+    if (e->hash == hash && nl_cell_equal(e->key, key)) return e;
+  }
+}
+/**
+ * Add an entry for a key which is known not to be in the block
+ */
+static void nl_table_insert(struct nl_table_entries *entries, uint64_t hash, struct nl_cell key, struct nl_cell value) {
+  struct nl_table_entry *e;
+  int64_t i;
+  for (i = hash & (entries->capacity - 1);
+       entries->items[i].hash > NL_TABLE_REMOVED;
+       i = (i + 1) & (entries->capacity - 1));
+  e = &entries->items[i];
+  if (e->hash == NL_TABLE_EMPTY) ++entries->used;
+  ++entries->count;
+  e->hash = hash;
+  // The entries are outside the heap, so every store is remembered
+  nl_gc_write(&e->key, key);
+  nl_gc_write(&e->value, value);
+}
+static void nl_table_delete(struct nl_table_entries *entries, struct nl_table_entry *e) {
+  e->hash = NL_TABLE_REMOVED;
+  e->key = e->value = nl_cell_as_nil();
+  --entries->count;
+}
+static int64_t nl_table_capacity(int64_t count) {
+  int64_t capacity = NL_TABLE_MIN;
+  while (capacity < 2 * count) capacity *= 2;
+  return capacity;
+}
+static int nl_table_full(struct nl_table_entries *entries) {
+  return 4 * (entries->used + 1) > 3 * entries->capacity;
+}
+static void nl_table_copy(struct nl_table_entries *to, struct nl_table_entries *from) {
+  int64_t i;
+  if (!from) return;
+  for (i = 0; i < from->capacity; ++i)
+    if (from->items[i].hash > NL_TABLE_REMOVED)
+      nl_table_insert(to, from->items[i].hash, from->items[i].key, from->items[i].value);
+  nl_gc_free_later(from);
+}
+/**
+ * Move every entry into a new block at once, with room for one more
+ */
+static void nl_table_rehash(struct nl_table *table) {
+  struct nl_table_entries *entries = nl_table_entries_alloc(nl_table_capacity(nl_table_count(table) + 1));
+  nl_table_copy(entries, table->old);
+  nl_table_copy(entries, table->entries);
+  table->entries = entries;
+  table->old = NULL;
+}
+/**
+ * Move the next few entries of the old block into the new one, dropping
+ * the old block once it is empty. If the new block fills up first, the
+ * rest are moved all at once
+ */
+static void nl_table_move(struct nl_table *table, int64_t step) {
+  struct nl_table_entries *old = table->old;
+  struct nl_table_entry *e;
+  if (!old) return;
+  for (; step > 0 && old->moved < old->capacity; --step, ++old->moved) {
+    e = &old->items[old->moved];
+    if (e->hash <= NL_TABLE_REMOVED) continue;
+    if (nl_table_full(table->entries)) {
+      nl_table_rehash(table);
+      return;
+    }
+    nl_table_insert(table->entries, e->hash, e->key, e->value);
+    nl_table_delete(old, e);
+  }
+  if (old->moved == old->capacity) {
+    nl_gc_free_later(old);
+    table->old = NULL;
+  }
+}
+/**
+ * Make room for one more entry. The full block becomes the old one,
+ * to be moved into a block twice the size of the table a bit at a time
+ */
+static void nl_table_grow(struct nl_table *table) {
+  if (!table->entries) {
+    table->entries = nl_table_entries_alloc(NL_TABLE_MIN);
+  } else if (!nl_table_full(table->entries)) {
+    return;
+  } else if (table->old) {
+    nl_table_rehash(table);
+  } else {
+    table->old = table->entries;
+    table->old->moved = 0;
+    table->entries = nl_table_entries_alloc(nl_table_capacity(nl_table_count(table) + 1));
+  }
+}
+int nl_table_get(struct nl_table *table, struct nl_cell key, struct nl_cell *value) {
+  uint64_t hash = nl_table_hash(key);
+  struct nl_table_entry *e;
+  if (!(e = nl_table_find(table->entries, hash, key))
+      && !(e = nl_table_find(table->old, hash, key)))
+    return 0;
+  *value = e->value;
+  return 1;
+}
+void nl_table_put(struct nl_table *table, struct nl_cell key, struct nl_cell value) {
+  uint64_t hash = nl_table_hash(key);
+  struct nl_table_entry *e;
+  if ((e = nl_table_find(table->entries, hash, key))) {
+    nl_gc_write(&e->value, value);
+    return;
+  }
+  if ((e = nl_table_find(table->old, hash, key))) nl_table_delete(table->old, e);
+  nl_table_grow(table);
+  nl_table_insert(table->entries, hash, key, value);
+  nl_table_move(table, NL_TABLE_MOVE_STEP);
+}
+int nl_table_remove(struct nl_table *table, struct nl_cell key) {
+  uint64_t hash = nl_table_hash(key);
+  struct nl_table_entry *e;
+  if ((e = nl_table_find(table->entries, hash, key))) {
+    nl_table_delete(table->entries, e);
+  } else if ((e = nl_table_find(table->old, hash, key))) {
+    nl_table_delete(table->old, e);
+  } else {
+    return 0;
+  }
+  nl_table_move(table, NL_TABLE_MOVE_STEP);
+  return 1;
+}
+int64_t nl_table_count(struct nl_table *table) {
+  return (table->entries ? table->entries->count : 0)
+    + (table->old ? table->old->count : 0);
+}
+static void nl_table_entries_foreach(struct nl_table_entries *entries, void (*f)(struct nl_cell, struct nl_cell, void *), void *data) {
+  int64_t i;
+  if (!entries) return;
+  for (i = 0; i < entries->capacity; ++i)
+    if (entries->items[i].hash > NL_TABLE_REMOVED)
+      f(entries->items[i].key, entries->items[i].value, data);
+}
+void nl_table_foreach(struct nl_table *table, void (*f)(struct nl_cell, struct nl_cell, void *), void *data) {
+  nl_table_entries_foreach(table->old, f, data);
+  nl_table_entries_foreach(table->entries, f, data);
+}
+static void nl_table_mark_entry(struct nl_cell key, struct nl_cell value, void *data) {
+  nl_gc_mark_cell(key);
+  nl_gc_mark_cell(value);
+}
+void nl_table_mark(struct nl_table *table) {
+  nl_table_foreach(table, nl_table_mark_entry, NULL);
+}
+static void nl_table_entries_cells(struct nl_table_entries *entries, void (*f)(struct nl_cell *, void *), void *data) {
+  int64_t i;
+  if (!entries) return;
+  for (i = 0; i < entries->capacity; ++i)
+    if (entries->items[i].hash > NL_TABLE_REMOVED) {
+      f(&entries->items[i].key, data);
+      f(&entries->items[i].value, data);
+    }
+}
+void nl_table_cells(struct nl_table *table, void (*f)(struct nl_cell *, void *), void *data) {
+  nl_table_entries_cells(table->old, f, data);
+  nl_table_entries_cells(table->entries, f, data);
+}
+void nl_table_free(struct nl_table *table) {
+  free(table->entries);
+  free(table->old);
+  table->entries = table->old = NULL;
+}
+size_t nl_table_bytes(struct nl_table *table) {
+  return (table->entries ? sizeof(*table->entries) + table->entries->capacity * sizeof(struct nl_table_entry) : 0)
+    + (table->old ? sizeof(*table->old) + table->old->capacity * sizeof(struct nl_table_entry) : 0);
+}
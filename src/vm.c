@@ -0,0 +1,935 @@
+#include "nl.h"
+#include <stdlib.h>
+#include <string.h>
+#define NL_VM_STACK_MIN 16
+#define NL_VM_MAX_ARGS 64
+#define NL_VM_NEXT goto *(pc++)->op
+#define NL_VM_COMPARE(a, b) (NL_TYPE(a) == NL_INTEGER && NL_TYPE(b) == NL_INTEGER \
+                             ? (NL_INT(a) > NL_INT(b)) - (NL_INT(a) < NL_INT(b)) \
+                             : nl_compare((a), (b)))
+enum nl_opcode {
+  NL_OP_CONST,
+  NL_OP_INT,
+  NL_OP_LOAD,
+  NL_OP_STORE,
+  NL_OP_POP,
+  NL_OP_RETURN,
+  NL_OP_JUMP_NIL,
+  NL_OP_JUMP_NOT_NIL,
+  NL_OP_GUARD,
+  NL_OP_GUARD_PAIR,
+  NL_OP_JUMP,
+  NL_OP_EVAL,
+  NL_OP_TAIL_EVAL,
+  NL_OP_EVAL_TOP,
+  NL_OP_TAIL_EVAL_TOP,
+  NL_OP_CALL,
+  NL_OP_TAIL_CALL,
+  NL_OP_ARGCHECK,
+  NL_OP_APPLY,
+  NL_OP_TAIL_APPLY,
+  NL_OP_CHECK_INT,
+  NL_OP_ADD,
+  NL_OP_SUB,
+  NL_OP_MUL,
+  NL_OP_DIV,
+  NL_OP_LT,
+  NL_OP_LTE,
+  NL_OP_GT,
+  NL_OP_GTE,
+  NL_OP_EQUAL,
+  NL_OP_NOT,
+  NL_OP_TYPEP,
+  NL_OP_HEAD,
+  NL_OP_TAIL,
+  NL_OP_PAIR,
+  NL_OP_COUNT
+};
+/**
+ * Code is direct-threaded: each instruction is the address of the label
+ * implementing it, followed by its operands
+ */
+union nl_word {
+  const void *op;
+  int64_t n;
+  char *sym;
+  char *msg;
+  struct nl_cell *cell;
+  struct nl_code *code;
+  uint64_t version;
+};
+/**
+ * Compiled lambdas keep the lambda they were compiled from, and the
+ * epoch they were compiled in; code from an earlier epoch is stale.
+ *
+ * Code is counted as active while it runs, or between a CALL and its
+ * APPLY; active code is never freed, and keeps its lambda alive
+ */
+struct nl_code {
+  struct nl_cell lambda;
+  uint64_t epoch;
+  int64_t nparams, max_stack, depth, size, allocated, active;
+  char **params;
+  union nl_word *words;
+  struct nl_code *next_retired;
+};
+static const void **nl_vm_ops;
+static struct nl_cell nl_vm_t;
+static uint64_t nl_vm_epoch;
+/**
+ * Each call site caches the lambda it called last and that lambda's code.
+ * The version changes whenever any code may have been freed or gone
+ * stale, which empties every cache at once
+ */
+static uint64_t nl_vm_cache_version = 1;
+/**
+ * Compiled code is cached in an open-addressing table keyed by the
+ * address of the lambda's pair. The table does not keep lambdas alive:
+ * code for a lambda which is collected is dropped from the table, and
+ * freed once it is no longer active. Code which is dropped or replaced
+ * while active is retired until it is not
+ */
+static struct nl_code **nl_code_table;
+static size_t nl_code_count, nl_code_capacity;
+static struct nl_code *nl_code_retired;
+static size_t nl_code_slot(struct nl_code **table, size_t capacity, struct nl_cell *pair) {
+  size_t i = ((uintptr_t)pair >> 4) * 11400714819323198485ULL >> 32;
+  for (i &= capacity - 1;
+       table[i] && NL_PAIR_OF(table[i]->lambda) != pair;
+       i = (i + 1) & (capacity - 1));
+  return i;
+}
+static void nl_code_free(struct nl_code *code) {
+  free(code->params);
+  free(code->words);
+  free(code);
+}
+static void nl_code_retire(struct nl_code *code) {
+  ++nl_vm_cache_version;
+  if (!code->active) {
+    nl_code_free(code);
+    return;
+  }
+  code->next_retired = nl_code_retired;
+  nl_code_retired = code;
+}
+static void nl_code_table_put(struct nl_code *code) {
+  struct nl_code **old = nl_code_table;
+  size_t i, old_capacity = nl_code_capacity;
+  if (2 * (nl_code_count + 1) > nl_code_capacity) {
+    nl_code_capacity = old_capacity ? old_capacity * 2 : 256;
+    nl_code_table = calloc(nl_code_capacity, sizeof(*nl_code_table));
+    for (i = 0; i < old_capacity; ++i)
+      if (old[i])
+        nl_code_table[nl_code_slot(nl_code_table, nl_code_capacity, NL_PAIR_OF(old[i]->lambda))] = old[i];
+    free(old);
+  }
+  i = nl_code_slot(nl_code_table, nl_code_capacity, NL_PAIR_OF(code->lambda));
+  if (!nl_code_table[i]) ++nl_code_count;
+  else nl_code_retire(nl_code_table[i]);
+  nl_code_table[i] = code;
+}
+void nl_vm_invalidate() {
+  ++nl_vm_epoch;
+  ++nl_vm_cache_version;
+}
+void nl_vm_roots() {
+  struct nl_code *code;
+  size_t i;
+  for (i = 0; i < nl_code_capacity; ++i)
+    if (nl_code_table[i] && nl_code_table[i]->active)
+      nl_gc_mark_cell(nl_code_table[i]->lambda);
+  for (code = nl_code_retired; code; code = code->next_retired)
+    if (code->active)
+      nl_gc_mark_cell(code->lambda);
+}
+void nl_vm_sweep() {
+  struct nl_code **old = nl_code_table, *code, **retired;
+  size_t i;
+  if (!old) return;
+  nl_code_table = calloc(nl_code_capacity, sizeof(*nl_code_table));
+  nl_code_count = 0;
+  for (i = 0; i < nl_code_capacity; ++i) {
+    if (!(code = old[i])) continue;
+    if (code->epoch == nl_vm_epoch && nl_gc_is_live(NL_PAIR_OF(code->lambda))) {
+      nl_code_table[nl_code_slot(nl_code_table, nl_code_capacity, NL_PAIR_OF(code->lambda))] = code;
+      ++nl_code_count;
+    } else {
+      nl_code_retire(code);
+    }
+  }
+  free(old);
+  for (retired = &nl_code_retired; (code = *retired) != NULL;) {
+    if (code->active) {
+      retired = &code->next_retired;
+    } else {
+      *retired = code->next_retired;
+      nl_code_free(code);
+    }
+  }
+}
+static int64_t nl_emit(struct nl_code *code, union nl_word word) {
+  if (code->size == code->allocated) {
+    code->allocated *= 2;
+    code->words = realloc(code->words, code->allocated * sizeof(*code->words));
+  }
+  code->words[code->size] = word;
+  return code->size++;
+}
+static void nl_emit_op(struct nl_code *code, enum nl_opcode op, int64_t stack_effect) {
+  union nl_word w;
+  w.op = nl_vm_ops[op];
+  code->depth += stack_effect;
+  if (code->depth > code->max_stack) code->max_stack = code->depth;
+  nl_emit(code, w);
+}
+static int64_t nl_emit_n(struct nl_code *code, int64_t n) {
+  union nl_word w;
+  w.n = n;
+  return nl_emit(code, w);
+}
+static void nl_emit_cell(struct nl_code *code, struct nl_cell *cell) {
+  union nl_word w;
+  w.cell = cell;
+  nl_emit(code, w);
+}
+static void nl_emit_sym(struct nl_code *code, char *sym) {
+  union nl_word w;
+  w.sym = sym;
+  nl_emit(code, w);
+}
+static void nl_emit_msg(struct nl_code *code, char *msg) {
+  union nl_word w;
+  w.msg = msg;
+  nl_emit(code, w);
+}
+static void nl_compile_form(struct nl_code *, struct nl_cell *, int);
+/**
+ * Count the arguments in a call form, returning -1 if the argument list
+ * is not a proper list or is too long to be compiled
+ */
+static int64_t nl_compile_argc(struct nl_cell args) {
+  struct nl_cell *a;
+  int64_t n = 0;
+  NL_FOREACH(&args, a) ++n;
+  if (NL_TYPE(*a) != NL_NIL || n > NL_VM_MAX_ARGS) return -1;
+  return n;
+}
+/**
+ * Compile each argument in turn, following each one with the given
+ * instruction, which combines it with the value below it on the stack
+ */
+static void nl_compile_fold(struct nl_code *code, struct nl_cell args, enum nl_opcode op, char *msg) {
+  struct nl_cell *a;
+  NL_FOREACH(&args, a) {
+    nl_compile_form(code, &NL_HEAD_AT(a), 0);
+    nl_emit_op(code, op, -1);
+    nl_emit_msg(code, msg);
+  }
+}
+/**
+ * Compile and/or: every argument but the last jumps to the end, leaving
+ * its value as the result, if it is nil (for and) or non-nil (for or)
+ */
+static void nl_compile_and_or(struct nl_code *code, struct nl_cell args, enum nl_opcode op, int tail) {
+  int64_t jumps[NL_VM_MAX_ARGS], n = 0;
+  struct nl_cell *a;
+  NL_FOREACH(&args, a) {
+    nl_compile_form(code, &NL_HEAD_AT(a), tail && !NL_IS_PAIR(NL_TAIL_AT(a)));
+    if (!NL_IS_PAIR(NL_TAIL_AT(a))) break;
+    nl_emit_op(code, op, -1);
+    jumps[n++] = nl_emit_n(code, 0);
+  }
+  while (n--) code->words[jumps[n]].n = code->size;
+}
+/**
+ * Compile a body of forms, a proper list, leaving the value of the last
+ * one, or nil if there are none
+ */
+static void nl_compile_body(struct nl_code *code, struct nl_cell *forms, int tail) {
+  struct nl_cell *f;
+  if (!NL_IS_PAIR(*forms)) {
+    nl_emit_op(code, NL_OP_CONST, 1);
+    nl_emit_cell(code, forms);
+    return;
+  }
+  NL_FOREACH(forms, f) {
+    nl_compile_form(code, &NL_HEAD_AT(f), tail && !NL_IS_PAIR(NL_TAIL_AT(f)));
+    if (!NL_IS_PAIR(NL_TAIL_AT(f))) break;
+    nl_emit_op(code, NL_OP_POP, -1);
+  }
+}
+/**
+ * Compile if, cond, while and guard as jumps. A test that fails leaves its nil
+ * on the stack where it jumps to, which is popped before the next form,
+ * or kept as the value of the whole form
+ */
+static int nl_compile_control(struct nl_code *code, struct nl_cell *form, char *name, int64_t argc, int tail) {
+  struct nl_cell args = NL_TAIL_AT(form), *a, clause;
+  int64_t jumps[NL_VM_MAX_ARGS], n = 0, other, end, top;
+  if (!strcmp(name, "nl_progn")) {
+    nl_compile_body(code, &NL_TAIL_AT(form), tail);
+    return 1;
+  }
+  if (!strcmp(name, "nl_if")) {
+    if (argc != 2 && argc != 3) return 0;
+    nl_compile_form(code, &NL_HEAD(args), 0);
+    nl_emit_op(code, NL_OP_JUMP_NIL, -1);
+    other = nl_emit_n(code, 0);
+    nl_compile_form(code, &NL_HEAD(NL_TAIL(args)), tail);
+    if (argc == 3) {
+      nl_emit_op(code, NL_OP_JUMP, 0);
+      end = nl_emit_n(code, 0);
+      code->words[other].n = code->size;
+      nl_emit_op(code, NL_OP_POP, -1);
+      nl_compile_form(code, &NL_HEAD(NL_TAIL(NL_TAIL(args))), tail);
+      other = end;
+    }
+    code->words[other].n = code->size;
+    return 1;
+  }
+  if (!strcmp(name, "nl_guard")) {
+    if (argc != 4 || NL_TYPE(NL_HEAD(args)) != NL_SYMBOL) return 0;
+    a = NL_NEXT(args);
+    clause = NL_SYMBOL_OF(NL_SYM(NL_HEAD(args)))->value;
+    // A guard on a native is decided now, and checked again as it runs
+    if (NL_TYPE(NL_HEAD_AT(a)) == NL_SYMBOL) {
+      if (NL_TYPE(clause) != NL_INTEGER || !nl_native_name((nl_native_func)NL_INT(clause))
+          || strcmp(nl_native_name((nl_native_func)NL_INT(clause)), NL_SYM(NL_HEAD_AT(a)))) {
+        nl_compile_form(code, &NL_HEAD(NL_TAIL(NL_TAIL_AT(a))), tail);
+        return 1;
+      }
+      nl_emit_op(code, NL_OP_GUARD, 0);
+      nl_emit_sym(code, NL_SYM(NL_HEAD(args)));
+      nl_emit_n(code, NL_INT(clause));
+    } else {
+      nl_emit_op(code, NL_OP_GUARD_PAIR, 0);
+      nl_emit_sym(code, NL_SYM(NL_HEAD(args)));
+      nl_emit_cell(code, &NL_HEAD_AT(a));
+    }
+    other = nl_emit_n(code, 0);
+    nl_compile_form(code, &NL_HEAD(NL_TAIL_AT(a)), tail);
+    nl_emit_op(code, NL_OP_JUMP, 0);
+    end = nl_emit_n(code, 0);
+    code->words[other].n = code->size;
+    --code->depth;
+    nl_compile_form(code, &NL_HEAD(NL_TAIL(NL_TAIL_AT(a))), tail);
+    code->words[end].n = code->size;
+    return 1;
+  }
+  if (!strcmp(name, "nl_cond")) {
+    if (argc == 0) return 0;
+    NL_FOREACH(&args, a)
+      if (!NL_IS_PAIR(NL_HEAD_AT(a)) || nl_compile_argc(NL_HEAD_AT(a)) < 0) return 0;
+    NL_FOREACH(&args, a) {
+      clause = NL_HEAD_AT(a);
+      nl_compile_form(code, &NL_HEAD(clause), 0);
+      // A clause with only a test gives the value of the test
+      if (!NL_IS_PAIR(NL_TAIL(clause))) {
+        nl_emit_op(code, NL_OP_JUMP_NOT_NIL, -1);
+        jumps[n++] = nl_emit_n(code, 0);
+        continue;
+      }
+      nl_emit_op(code, NL_OP_JUMP_NIL, -1);
+      other = nl_emit_n(code, 0);
+      nl_compile_body(code, &NL_TAIL(clause), tail);
+      nl_emit_op(code, NL_OP_JUMP, 0);
+      jumps[n++] = nl_emit_n(code, 0);
+      code->words[other].n = code->size;
+      nl_emit_op(code, NL_OP_POP, -1);
+    }
+    // No clause passed: a points at the nil which ends them
+    nl_emit_op(code, NL_OP_CONST, 1);
+    nl_emit_cell(code, a);
+    while (n--) code->words[jumps[n]].n = code->size;
+    return 1;
+  }
+  if (!strcmp(name, "nl_while")) {
+    if (argc == 0) return 0;
+    top = code->size;
+    nl_compile_form(code, &NL_HEAD(args), 0);
+    nl_emit_op(code, NL_OP_JUMP_NIL, -1);
+    end = nl_emit_n(code, 0);
+    NL_FOREACH(&NL_TAIL(args), a) {
+      nl_compile_form(code, &NL_HEAD_AT(a), 0);
+      nl_emit_op(code, NL_OP_POP, -1);
+    }
+    nl_emit_op(code, NL_OP_JUMP, 0);
+    nl_emit_n(code, top);
+    code->words[end].n = code->size;
+    ++code->depth;
+    return 1;
+  }
+  return 0;
+}
+/**
+ * Compile a call to a well-known native function inline. Returns zero
+ * if the call has a shape that is better left to the native function
+ */
+static int nl_compile_native(struct nl_code *code, struct nl_cell *form, char *name, int tail) {
+  static const struct {
+    const char *name;
+    enum nl_opcode op;
+    int64_t type;
+  } unary[] = {
+    { "nl_not", NL_OP_NOT, 0 },
+    { "nl_is_nil", NL_OP_NOT, 0 },
+    { "nl_is_integer", NL_OP_TYPEP, NL_INTEGER },
+    { "nl_is_symbol", NL_OP_TYPEP, NL_SYMBOL },
+    { "nl_is_pair", NL_OP_TYPEP, NL_PAIR },
+    { "nl_head", NL_OP_HEAD, 0 },
+    { "nl_tail", NL_OP_TAIL, 0 },
+  }, binary[] = {
+    { "nl_lt", NL_OP_LT, 0 },
+    { "nl_lte", NL_OP_LTE, 0 },
+    { "nl_gt", NL_OP_GT, 0 },
+    { "nl_gte", NL_OP_GTE, 0 },
+    { "nl_equal", NL_OP_EQUAL, 0 },
+    { "nl_pair", NL_OP_PAIR, 0 },
+  };
+  struct nl_cell args = NL_TAIL_AT(form);
+  int64_t argc = nl_compile_argc(args);
+  size_t i;
+  if (!strcmp(name, "nl_quote")) {
+    nl_emit_op(code, NL_OP_CONST, 1);
+    nl_emit_cell(code, &NL_TAIL_AT(form));
+    return 1;
+  }
+  if (argc < 0) return 0;
+  for (i = 0; i < sizeof(unary) / sizeof(*unary); ++i) {
+    if (argc != 1 || strcmp(name, unary[i].name)) continue;
+    nl_compile_form(code, &NL_HEAD(args), 0);
+    nl_emit_op(code, unary[i].op, 0);
+    if (unary[i].op == NL_OP_TYPEP) nl_emit_n(code, unary[i].type);
+    return 1;
+  }
+  for (i = 0; i < sizeof(binary) / sizeof(*binary); ++i) {
+    if (argc != 2 || strcmp(name, binary[i].name)) continue;
+    nl_compile_form(code, &NL_HEAD(args), 0);
+    nl_compile_form(code, &NL_HEAD(NL_TAIL(args)), 0);
+    nl_emit_op(code, binary[i].op, -1);
+    return 1;
+  }
+  if (!strcmp(name, "nl_and") || !strcmp(name, "nl_or")) {
+    if (argc == 0) return 0;
+    nl_compile_and_or(code, args, name[3] == 'a' ? NL_OP_JUMP_NIL : NL_OP_JUMP_NOT_NIL, tail);
+    return 1;
+  }
+  if (!strcmp(name, "nl_add") || !strcmp(name, "nl_sub")) {
+    if (argc == 1 && name[3] == 's') return 0;
+    if (argc == 0) {
+      nl_emit_op(code, NL_OP_INT, 1);
+      nl_emit_n(code, 0);
+      return 1;
+    }
+    nl_compile_form(code, &NL_HEAD(args), 0);
+    nl_emit_op(code, NL_OP_CHECK_INT, 0);
+    if (name[3] == 'a') {
+      nl_emit_msg(code, "illegal add: non-integer arg");
+      nl_compile_fold(code, NL_TAIL(args), NL_OP_ADD, "illegal add: non-integer arg");
+    } else {
+      nl_emit_msg(code, "illegal sub: non-integer arg");
+      nl_compile_fold(code, NL_TAIL(args), NL_OP_SUB, "illegal sub: non-integer arg");
+    }
+    return 1;
+  }
+  if (!strcmp(name, "nl_mul")) {
+    nl_emit_op(code, NL_OP_INT, 1);
+    nl_emit_n(code, 1);
+    nl_compile_fold(code, args, NL_OP_MUL, "illegal mul: non-integer arg");
+    return 1;
+  }
+  if (!strcmp(name, "nl_div")) {
+    if (argc == 1) return 0;
+    if (argc == 0) {
+      nl_emit_op(code, NL_OP_INT, 1);
+      nl_emit_n(code, 1);
+      return 1;
+    }
+    nl_compile_form(code, &NL_HEAD(args), 0);
+    nl_compile_fold(code, NL_TAIL(args), NL_OP_DIV, "illegal div: non-integer arg");
+    return 1;
+  }
+  if (!strcmp(name, "nl_setq")) {
+    if (argc != 2 || NL_TYPE(NL_HEAD(args)) != NL_SYMBOL) return 0;
+    nl_compile_form(code, &NL_HEAD(NL_TAIL(args)), 0);
+    nl_emit_op(code, NL_OP_STORE, 0);
+    nl_emit_sym(code, NL_SYM(NL_HEAD(args)));
+    return 1;
+  }
+  if (!strcmp(name, "nl_eval")) {
+    if (argc != 1) return 0;
+    nl_compile_form(code, &NL_HEAD(args), 0);
+    nl_emit_op(code, tail ? NL_OP_TAIL_EVAL_TOP : NL_OP_EVAL_TOP, 0);
+    return 1;
+  }
+  return nl_compile_control(code, form, name, argc, tail);
+}
+/**
+ * Compile a call to whatever the head symbol is bound to when the call
+ * runs. Arguments are compiled inline, but only evaluated if the callee
+ * turns out to be a compiled lambda, and only up to its parameter count,
+ * so the apply finds the callee by its slot rather than by the count.
+ *
+ * The call is followed by its cache: the pair of the lambda called last,
+ * its code, and the cache version they were found in. Since the current
+ * value of a symbol is always in the symbol, rebinding or shadowing it
+ * needs no invalidation; the cache simply stops matching
+ */
+static void nl_compile_call(struct nl_code *code, struct nl_cell *form, int64_t argc, int tail) {
+  int64_t checks[NL_VM_MAX_ARGS], apply, end, slot = code->depth, i = 0;
+  struct nl_cell *a;
+  nl_emit_op(code, tail ? NL_OP_TAIL_CALL : NL_OP_CALL, 1);
+  nl_emit_cell(code, form);
+  apply = nl_emit_n(code, 0);
+  end = nl_emit_n(code, 0);
+  nl_emit_cell(code, NULL);
+  nl_emit_n(code, 0);
+  nl_emit_n(code, 0);
+  NL_FOREACH(&NL_TAIL_AT(form), a) {
+    nl_compile_form(code, &NL_HEAD_AT(a), 0);
+    if (i + 1 == argc) break;
+    nl_emit_op(code, NL_OP_ARGCHECK, 0);
+    nl_emit_n(code, i + 1);
+    checks[i++] = nl_emit_n(code, 0);
+  }
+  code->words[apply].n = code->size;
+  while (i--) code->words[checks[i]].n = code->size;
+  nl_emit_op(code, tail ? NL_OP_TAIL_APPLY : NL_OP_APPLY, -argc);
+  nl_emit_n(code, argc);
+  nl_emit_n(code, slot);
+  code->words[end].n = code->size;
+}
+static void nl_compile_form(struct nl_code *code, struct nl_cell *form, int tail) {
+  struct nl_cell head;
+  int64_t guard, jump, depth;
+  char *name;
+  switch (NL_TYPE(*form)) {
+  case NL_SYMBOL:
+    nl_emit_op(code, NL_OP_LOAD, 1);
+    nl_emit_sym(code, NL_SYM(*form));
+    return;
+  case NL_PAIR:
+    break;
+  default:
+    nl_emit_op(code, NL_OP_CONST, 1);
+    nl_emit_cell(code, form);
+    return;
+  }
+  // The guards the optimizer leaves are checks already, and are not
+  // checked in turn
+  if (nl_is_guard(*form) && nl_compile_control(code, form, "nl_guard", 4, tail)) return;
+  if (NL_TYPE(NL_HEAD_AT(form)) != NL_SYMBOL) goto eval;
+  head = NL_SYMBOL_OF(NL_SYM(NL_HEAD_AT(form)))->value;
+  if (NL_TYPE(head) == NL_INTEGER
+      && (name = nl_native_name((nl_native_func)NL_INT(head))) != NULL) {
+    nl_emit_op(code, NL_OP_GUARD, 0);
+    nl_emit_sym(code, NL_SYM(NL_HEAD_AT(form)));
+    nl_emit_n(code, NL_INT(head));
+    guard = nl_emit_n(code, 0);
+    depth = code->depth;
+    if (nl_compile_native(code, form, name, tail)) {
+      nl_emit_op(code, NL_OP_JUMP, 0);
+      jump = nl_emit_n(code, 0);
+      code->words[guard].n = code->size;
+      code->depth = depth;
+      nl_emit_op(code, tail ? NL_OP_TAIL_EVAL : NL_OP_EVAL, 1);
+      nl_emit_cell(code, form);
+      code->words[jump].n = code->size;
+      return;
+    }
+    code->size = guard - 3;
+  }
+  if (nl_compile_argc(NL_TAIL_AT(form)) >= 0) {
+    nl_compile_call(code, form, nl_compile_argc(NL_TAIL_AT(form)), tail);
+    return;
+  }
+ eval:
+  nl_emit_op(code, tail ? NL_OP_TAIL_EVAL : NL_OP_EVAL, 1);
+  nl_emit_cell(code, form);
+}
+/**
+ * Compile a lambda whose parameters are a proper list of symbols (or nil),
+ * and whose body is not empty
+ */
+static struct nl_code *nl_compile_lambda(struct nl_cell lambda) {
+  struct nl_code *code;
+  struct nl_cell *p;
+  int64_t n = 0;
+  if (NL_TYPE(NL_HEAD(lambda)) != NL_NIL && !NL_IS_PAIR(NL_HEAD(lambda))) return NULL;
+  if (!NL_IS_PAIR(NL_TAIL(lambda))) return NULL;
+  NL_FOREACH(&NL_HEAD(lambda), p) {
+    if (NL_TYPE(NL_HEAD_AT(p)) != NL_SYMBOL) return NULL;
+    ++n;
+  }
+  if (NL_TYPE(*p) != NL_NIL) return NULL;
+  code = calloc(1, sizeof(*code));
+  code->lambda = lambda;
+  code->epoch = nl_vm_epoch;
+  code->nparams = n;
+  code->params = malloc((n + 1) * sizeof(*code->params));
+  n = 0;
+  NL_FOREACH(&NL_HEAD(lambda), p) code->params[n++] = NL_SYM(NL_HEAD_AT(p));
+  code->allocated = 32;
+  code->words = malloc(code->allocated * sizeof(*code->words));
+  NL_FOREACH(&NL_TAIL(lambda), p) {
+    if (!NL_IS_PAIR(NL_TAIL_AT(p))) break;
+    nl_compile_form(code, &NL_HEAD_AT(p), 0);
+    nl_emit_op(code, NL_OP_POP, -1);
+  }
+  nl_compile_form(code, &NL_HEAD_AT(p), 1);
+  nl_emit_op(code, NL_OP_RETURN, -1);
+  return code;
+}
+struct nl_code *nl_vm_compile(struct nl_cell lambda) {
+  struct nl_code *code;
+  size_t i;
+  if (!NL_IS_PAIR(lambda) || NL_TYPE(NL_HEAD(lambda)) == NL_SYMBOL) return NULL;
+  if (nl_code_table) {
+    i = nl_code_slot(nl_code_table, nl_code_capacity, NL_PAIR_OF(lambda));
+    code = nl_code_table[i];
+    if (code && code->epoch == nl_vm_epoch) return code->words ? code : NULL;
+  }
+  if (!nl_vm_ops) {
+    nl_vm_exec(NULL, NULL, NULL);
+    nl_vm_t = nl_cell_as_symbol(nl_intern_bytes("t", 1));
+  }
+  code = nl_compile_lambda(lambda);
+  if (!code) {
+    code = calloc(1, sizeof(*code));
+    code->lambda = lambda;
+    code->epoch = nl_vm_epoch;
+  }
+  nl_code_table_put(code);
+  return code->words ? code : NULL;
+}
+/**
+ * Rebind the callee's parameters in the current scope for a tail call,
+ * missing arguments being bound to nil. The arguments are copied first,
+ * since they live on the stack which the callee is about to reuse
+ */
+static void nl_vm_rebind(struct nl_scope *scope, struct nl_code *callee, struct nl_cell *stack_args, int64_t argc) {
+  struct nl_cell args[argc + 1];
+  int64_t i;
+  memcpy(args, stack_args, argc * sizeof(*args));
+  for (i = 0; i < callee->nparams; ++i)
+    nl_scope_bind(scope, callee->params[i], i < argc ? args[i] : nl_cell_as_nil());
+}
+/**
+ * The values shadowed by the callee's parameters are saved on the C stack,
+ * rather than allocated
+ */
+int nl_vm_call(struct nl_scope *scope, struct nl_code *callee, int64_t argc, struct nl_cell *args, struct nl_cell *result) {
+  struct nl_scope_symbols saved[callee->nparams + 1];
+  struct nl_scope call_scope;
+  struct nl_symbol *sym;
+  int64_t i;
+  int err, profiled;
+  nl_scope_init(&call_scope);
+  call_scope.parent_scope = scope;
+  for (i = 0; i < callee->nparams; ++i) {
+    sym = NL_SYMBOL_OF(callee->params[i]);
+    saved[i].name = callee->params[i];
+    saved[i].value = sym->value;
+    saved[i].next = call_scope.symbols;
+    call_scope.symbols = &saved[i];
+    nl_gc_write(&sym->value, i < argc ? args[i] : nl_cell_as_nil());
+  }
+  if ((profiled = nl_profiling)) nl_profile_enter(callee->lambda);
+  err = nl_vm_exec(&call_scope, callee, result);
+  if (err == NL_TAILCALL) err = nl_evalq(&call_scope, *result, result);
+  if (profiled) nl_profile_leave();
+  if (err && call_scope.last_err) scope->last_err = call_scope.last_err;
+  nl_scope_unwind(&call_scope);
+  return err;
+}
+/**
+ * Run compiled code, leaving the code that finished running (after any
+ * tail calls) in *running
+ */
+static int nl_vm_run(struct nl_scope *scope, struct nl_code **running, struct nl_cell *result) {
+  static const void *ops[NL_OP_COUNT] = {
+    [NL_OP_CONST] = &&op_const,
+    [NL_OP_INT] = &&op_int,
+    [NL_OP_LOAD] = &&op_load,
+    [NL_OP_STORE] = &&op_store,
+    [NL_OP_POP] = &&op_pop,
+    [NL_OP_RETURN] = &&op_return,
+    [NL_OP_JUMP_NIL] = &&op_jump_nil,
+    [NL_OP_JUMP_NOT_NIL] = &&op_jump_not_nil,
+    [NL_OP_GUARD] = &&op_guard,
+    [NL_OP_GUARD_PAIR] = &&op_guard_pair,
+    [NL_OP_JUMP] = &&op_jump,
+    [NL_OP_EVAL] = &&op_eval,
+    [NL_OP_TAIL_EVAL] = &&op_tail_eval,
+    [NL_OP_EVAL_TOP] = &&op_eval_top,
+    [NL_OP_TAIL_EVAL_TOP] = &&op_tail_eval_top,
+    [NL_OP_CALL] = &&op_call,
+    [NL_OP_TAIL_CALL] = &&op_tail_call,
+    [NL_OP_ARGCHECK] = &&op_argcheck,
+    [NL_OP_APPLY] = &&op_apply,
+    [NL_OP_TAIL_APPLY] = &&op_tail_apply,
+    [NL_OP_CHECK_INT] = &&op_check_int,
+    [NL_OP_ADD] = &&op_add,
+    [NL_OP_SUB] = &&op_sub,
+    [NL_OP_MUL] = &&op_mul,
+    [NL_OP_DIV] = &&op_div,
+    [NL_OP_LT] = &&op_lt,
+    [NL_OP_LTE] = &&op_lte,
+    [NL_OP_GT] = &&op_gt,
+    [NL_OP_GTE] = &&op_gte,
+    [NL_OP_EQUAL] = &&op_equal,
+    [NL_OP_NOT] = &&op_not,
+    [NL_OP_TYPEP] = &&op_typep,
+    [NL_OP_HEAD] = &&op_head,
+    [NL_OP_TAIL] = &&op_tail,
+    [NL_OP_PAIR] = &&op_pair,
+  };
+  struct nl_code *code = running ? *running : NULL;
+  int64_t stack_size = code && code->max_stack > NL_VM_STACK_MIN ? code->max_stack : NL_VM_STACK_MIN, argc;
+  struct nl_cell stack[stack_size], *sp = stack, head, r, *form;
+  union nl_word *words, *pc;
+  struct nl_code *callee;
+  int tail, err, profiled, chain;
+  if (!code) {
+    nl_vm_ops = ops;
+    return 0;
+  }
+  words = pc = code->words;
+  NL_VM_NEXT;
+ op_const:
+  *sp++ = *(pc++)->cell;
+  NL_VM_NEXT;
+ op_int:
+  *sp++ = nl_cell_as_int((pc++)->n);
+  NL_VM_NEXT;
+ op_load:
+  *sp++ = NL_SYMBOL_OF((pc++)->sym)->value;
+  NL_VM_NEXT;
+ op_store:
+  nl_gc_write(&NL_SYMBOL_OF((pc++)->sym)->value, sp[-1]);
+  NL_VM_NEXT;
+ op_pop:
+  --sp;
+  NL_VM_NEXT;
+ op_return:
+  *result = sp[-1];
+  return 0;
+ op_jump_nil:
+  if (NL_TYPE(sp[-1]) == NL_NIL) {
+    pc = words + pc->n;
+    NL_VM_NEXT;
+  }
+  --sp;
+  ++pc;
+  NL_VM_NEXT;
+ op_jump_not_nil:
+  if (NL_TYPE(sp[-1]) != NL_NIL) {
+    pc = words + pc->n;
+    NL_VM_NEXT;
+  }
+  --sp;
+  ++pc;
+  NL_VM_NEXT;
+ op_guard:
+  head = NL_SYMBOL_OF(pc[0].sym)->value;
+  if (NL_TYPE(head) == NL_INTEGER && NL_INT(head) == pc[1].n)
+    pc += 3;
+  else
+    pc = words + pc[2].n;
+  NL_VM_NEXT;
+ op_guard_pair:
+  head = NL_SYMBOL_OF(pc[0].sym)->value;
+  if (NL_IS_PAIR(head) && NL_PAIR_OF(head) == NL_PAIR_OF(*pc[1].cell))
+    pc += 3;
+  else
+    pc = words + pc[2].n;
+  NL_VM_NEXT;
+ op_jump:
+  pc = words + pc->n;
+  NL_VM_NEXT;
+ op_eval:
+  if (nl_evalq(scope, *(pc++)->cell, sp)) return 1;
+  ++sp;
+  NL_VM_NEXT;
+ op_tail_eval:
+  *result = *pc->cell;
+  return NL_TAILCALL;
+ op_eval_top:
+  if (nl_evalq(scope, sp[-1], &sp[-1])) return 1;
+  NL_VM_NEXT;
+ op_tail_eval_top:
+  *result = sp[-1];
+  return NL_TAILCALL;
+ op_call:
+  tail = 0;
+  goto call;
+ op_tail_call:
+  tail = 1;
+ call:
+  form = pc[0].cell;
+  head = NL_SYMBOL_OF(NL_SYM(NL_HEAD_AT(form)))->value;
+  // Symbols bound to symbols are followed as nl_invoke does
+  for (chain = 0; NL_TYPE(head) == NL_SYMBOL; ++chain) {
+    if (chain == NL_CHAIN_MAX) {
+      scope->last_err = "illegal call: too many symbols bound to symbols";
+      return 1;
+    }
+    head = NL_SYMBOL_OF(NL_SYM(head))->value;
+  }
+  switch (NL_TYPE(head)) {
+  case NL_INTEGER:
+    if ((profiled = nl_profiling)) nl_profile_enter(head);
+    err = ((nl_native_func)NL_INT(head))(scope, NL_TAIL_AT(form), &r);
+    if (profiled) nl_profile_leave();
+    if (err == NL_TAILCALL) {
+      if (tail) {
+        *result = r;
+        return NL_TAILCALL;
+      }
+      if (nl_evalq(scope, r, &r)) return 1;
+    } else if (err) {
+      return 1;
+    }
+    *sp++ = r;
+    pc = words + pc[2].n;
+    NL_VM_NEXT;
+  case NL_NIL:
+    scope->last_err = "illegal call: cannot invoke nil";
+    return 1;
+  default:
+    break;
+  }
+  if (NL_IS_PAIR(head) && NL_PAIR_OF(head) == pc[3].cell && pc[5].version == nl_vm_cache_version) {
+    callee = pc[4].code;
+  } else if ((callee = nl_vm_compile(head)) != NULL) {
+    pc[3].cell = NL_PAIR_OF(head);
+    pc[4].code = callee;
+    pc[5].version = nl_vm_cache_version;
+  } else {
+    if (tail) {
+      *result = *form;
+      return NL_TAILCALL;
+    }
+    if (nl_invoke(scope, head, NL_TAIL_AT(form), &r)) return 1;
+    *sp++ = r;
+    pc = words + pc[2].n;
+    NL_VM_NEXT;
+  }
+  ++callee->active;
+  *sp++ = nl_cell_as_int((int64_t)callee);
+  pc = callee->nparams ? pc + 6 : words + pc[1].n;
+  NL_VM_NEXT;
+ op_argcheck:
+  callee = (struct nl_code *)NL_INT(sp[-pc[0].n - 1]);
+  pc = pc[0].n < callee->nparams ? pc + 2 : words + pc[1].n;
+  NL_VM_NEXT;
+ op_apply:
+  sp = stack + pc[1].n;
+  callee = (struct nl_code *)NL_INT(*sp);
+  argc = pc[0].n < callee->nparams ? pc[0].n : callee->nparams;
+  err = nl_vm_call(scope, callee, argc, sp + 1, sp);
+  --callee->active;
+  if (err) return 1;
+  ++sp;
+  pc += 2;
+  NL_VM_NEXT;
+ op_tail_apply:
+  callee = (struct nl_code *)NL_INT(stack[pc[1].n]);
+  argc = pc[0].n < callee->nparams ? pc[0].n : callee->nparams;
+  if (callee->max_stack > stack_size) goto op_apply;
+  nl_vm_rebind(scope, callee, stack + pc[1].n + 1, argc);
+  if (nl_profiling) nl_profile_replace(callee->lambda);
+  --(*running)->active;
+  *running = callee;
+  words = pc = callee->words;
+  sp = stack;
+  NL_VM_NEXT;
+ op_check_int:
+  if (NL_TYPE(sp[-1]) != NL_INTEGER) {
+    scope->last_err = pc->msg;
+    return 1;
+  }
+  ++pc;
+  NL_VM_NEXT;
+ op_add:
+  if (NL_TYPE(sp[-1]) != NL_INTEGER) {
+    scope->last_err = pc->msg;
+    return 1;
+  }
+  --sp;
+  sp[-1] = nl_cell_as_int(NL_INT(sp[-1]) + NL_INT(*sp));
+  ++pc;
+  NL_VM_NEXT;
+ op_sub:
+  if (NL_TYPE(sp[-1]) != NL_INTEGER) {
+    scope->last_err = pc->msg;
+    return 1;
+  }
+  --sp;
+  sp[-1] = nl_cell_as_int(NL_INT(sp[-1]) - NL_INT(*sp));
+  ++pc;
+  NL_VM_NEXT;
+ op_mul:
+  if (NL_TYPE(sp[-1]) != NL_INTEGER) {
+    scope->last_err = pc->msg;
+    return 1;
+  }
+  --sp;
+  sp[-1] = nl_cell_as_int(NL_INT(sp[-1]) * NL_INT(*sp));
+  ++pc;
+  NL_VM_NEXT;
+ op_div:
+  if (NL_TYPE(sp[-1]) != NL_INTEGER) {
+    scope->last_err = pc->msg;
+    return 1;
+  }
+  --sp;
+  sp[-1] = nl_cell_as_int(NL_INT(sp[-1]) / NL_INT(*sp));
+  ++pc;
+  NL_VM_NEXT;
+ op_lt:
+  --sp;
+  sp[-1] = NL_VM_COMPARE(sp[-1], *sp) == -1 ? nl_vm_t : nl_cell_as_nil();
+  NL_VM_NEXT;
+ op_lte:
+  --sp;
+  sp[-1] = NL_VM_COMPARE(sp[-1], *sp) != 1 ? nl_vm_t : nl_cell_as_nil();
+  NL_VM_NEXT;
+ op_gt:
+  --sp;
+  sp[-1] = NL_VM_COMPARE(sp[-1], *sp) == 1 ? nl_vm_t : nl_cell_as_nil();
+  NL_VM_NEXT;
+ op_gte:
+  --sp;
+  sp[-1] = NL_VM_COMPARE(sp[-1], *sp) != -1 ? nl_vm_t : nl_cell_as_nil();
+  NL_VM_NEXT;
+ op_equal:
+  --sp;
+  sp[-1] = nl_cell_equal(sp[-1], *sp) ? nl_vm_t : nl_cell_as_nil();
+  NL_VM_NEXT;
+ op_not:
+  sp[-1] = NL_TYPE(sp[-1]) == NL_NIL ? nl_vm_t : nl_cell_as_nil();
+  NL_VM_NEXT;
+ op_typep:
+  sp[-1] = NL_TYPE(sp[-1]) == (pc++)->n ? nl_vm_t : nl_cell_as_nil();
+  NL_VM_NEXT;
+ op_head:
+  if (NL_IS_PAIR(sp[-1])) sp[-1] = NL_HEAD(sp[-1]);
+  NL_VM_NEXT;
+ op_tail:
+  sp[-1] = NL_IS_PAIR(sp[-1]) ? NL_TAIL(sp[-1]) : nl_cell_as_nil();
+  NL_VM_NEXT;
+ op_pair:
+  --sp;
+  sp[-1] = nl_cell_as_pair(sp[-1], *sp);
+  NL_VM_NEXT;
+}
+int nl_vm_exec(struct nl_scope *scope, struct nl_code *code, struct nl_cell *result) {
+  int err;
+  if (!code) return nl_vm_run(NULL, NULL, NULL);
+  ++code->active;
+  err = nl_vm_run(scope, &code, result);
+  --code->active;
+  return err;
+}
@@ -0,0 +1,28 @@
+# Higher-order builtins call natives, lambdas and functions named by
+# symbols with values which are already evaluated
+(load 'test/check.nl)
+(defq sq (X) (* X X))
+(check (map sq '(1 2 3)) '(1 4 9))
+(check (map 'sq '(1 2 3)) '(1 4 9))
+(check (map '((X) (+ X 1)) '(1 2)) '(2 3))
+(check (map head '((1 2) (3 4))) '(1 3))
+(check (filter '((X) (> X 1)) '(1 2 3)) '(2 3))
+(check (fold + 0 '(1 2 3 4)) 10)
+(check (fold '((X Acc) (pair X Acc)) () '(1 2 3)) '(3 2 1))
+(check (apply + '(1 2 3)) 6)
+(check (apply list '((+ 1 2) b)) '(3 ()))
+(setq Seen ())
+(for-each '((X) (setq Seen (pair X Seen))) '(1 2 3))
+(check Seen '(3 2 1))
+# The arguments are already values, so a fexpr sees them quoted
+(defq args Args Args)
+(check (map args '(x)) '(((quote . x))))
+# A symbol bound to a symbol is looked up again, for as long as that goes
+(setq f 'sq)
+(check (f 3) 9)
+(check (map f '(2)) '(4))
+(setq a 'b)(setq b 'c)(setq c +)
+(check (a 1 2) 3)
+(check (map a '(1 2)) '(1 2))
+(defq chained (X) (a X 1))
+(check (chained 2) 3)
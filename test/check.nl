@@ -0,0 +1,16 @@
+# Loaded by each test: (check Form Want) evaluates both, and writes the
+# form and what it gave when the two are not =, so a passing test prints
+# nothing at all
+(load 'src/core.nl)
+(defq check Check
+  (let ((Got (eval (head Check)))
+        (Want (eval (head (tail Check)))))
+    (or (= Got Want)
+        (progn
+          (write-bytes '"FAIL ")
+          (write (head Check))
+          (write-bytes '" got ")
+          (write Got)
+          (write-bytes '" want ")
+          (write Want)
+          (newline)))))
@@ -0,0 +1,19 @@
+# Compiled ahead of time by test/run.sh with bin/nlc, and loaded both
+# compiled and as it is: results gives the same either way
+(defq fib (N) (if (< N 2) N (+ (fib (- N 1)) (fib (- N 2)))))
+(defq sign (N) (cond ((< N 0) 'negative) ((= N 0) 'zero) ('t 'positive)))
+(defq total (N) (let ((Total 0)) (while (> N 0) (setq Total (+ Total N) N (- N 1))) Total))
+(defq count-down (N Acc) (if (= N 0) Acc (count-down (- N 1) (pair N Acc))))
+(defq square (X) (* X X))
+(defq squares (Items) (map square Items))
+(defq folded () (+ 1 (* 2 3) (if (< 1 2) 10 20)))
+(defq shapes (X) (list (head X) (tail X) (pair? X) (nil? X) (integer? X) (symbol? X) (not X)))
+(defq quoted Args Args)
+(defq either (A B) (or (and A B) (and (not A) 'neither)))
+(defq divide (A B) (/ A B))
+# The inlined square sits inside a form left to the interpreter
+(defq boxed (X) (vector-ref (list->vector (list (square X))) 0))
+(defq results ()
+  (list (fib 15) (map sign '(-2 0 3)) (total 1000) (count-down 5 ()) (squares '(1 2 3))
+        (folded) (shapes '(a . b)) (shapes 5) (quoted x (y z)) (either 1 2) (either () 1)
+        (divide 17 5) (divide -17 5) (<= 1 1) (>= 1 2) (= '(1 2) (list 1 2)) (boxed 4)))
@@ -0,0 +1,73 @@
+# The special forms, each checked at the top level, where the evaluator
+# runs them, and inside a lambda, where they are compiled inline
+(load 'test/check.nl)
+(setq Log ())
+(defq note (X) (progn (setq Log (pair X Log)) X))
+# if evaluates only the branch it takes, and a missing one is nil
+(check (if 't 1 2) 1)
+(check (if () 1 2) 2)
+(check (if () 1) ())
+(check (if 0 'yes 'no) 'yes)
+(setq Log ())
+(check (if (note 't) (note 'then) (note 'else)) 'then)
+(check Log '(then t))
+(defq f-if (X) (if X (note 'then) (note 'else)))
+(setq Log ())
+(check (f-if ()) 'else)
+(check Log '(else))
+(defq f-if-missing (X) (if X 1))
+(check (f-if-missing ()) ())
+# cond stops at the first clause which passes, and a clause with no
+# forms gives its test
+(check (cond (() 1) ('t 2) ('t 3)) 2)
+(check (cond (() 1)) ())
+(check (cond ((+ 1 2))) 3)
+(check (cond ('t 1 2 3)) 3)
+(setq Log ())
+(check (cond ((note ()) (note 'a)) ((note 'b) (note 'c)) ((note 'd) (note 'e))) 'c)
+(check Log '(c b ()))
+(defq f-cond (X)
+  (cond ((< X 0) 'negative)
+        ((= X 0) 'zero)
+        (X)))
+(check (f-cond -5) 'negative)
+(check (f-cond 0) 'zero)
+(check (f-cond 7) 7)
+# progn evaluates in order and gives the last
+(setq Log ())
+(check (progn (note 1) (note 2) (note 3)) 3)
+(check Log '(3 2 1))
+(check (progn) ())
+(defq f-progn (X) (progn (note X) (+ X 1)))
+(check (f-progn 4) 5)
+# while runs its body until the test fails, and gives nil
+(setq I 0)
+(setq Sum 0)
+(check (while (< I 5) (setq Sum (+ Sum I)) (setq I (+ I 1))) ())
+(check Sum 10)
+(check (while () (note 'never)) ())
+(defq f-while (N)
+  (let ((Acc ()))
+    (while (> N 0)
+      (setq Acc (pair N Acc))
+      (setq N (- N 1)))
+    Acc))
+(check (f-while 3) '(1 2 3))
+(check (f-while 0) ())
+# let evaluates every value before binding any, and restores the names
+# it bound afterwards
+(setq A 'outer)
+(setq B 'outer)
+(check (let ((A 1) (B A)) (list A B)) '(1 outer))
+(check (list A B) '(outer outer))
+(check (let (C) C) ())
+(check (let ((A 1)) (setq A 2) A) 2)
+(check A 'outer)
+(defq f-let (X) (let ((X (+ X 1)) (Y X)) (list X Y)))
+(check (f-let 1) '(2 1))
+# Bindings are dynamic, so a called function sees the let
+(defq see-a () A)
+(check (let ((A 'inner)) (see-a)) 'inner)
+(check (see-a) 'outer)
+(defq f-dynamic () (let ((A 'compiled)) (see-a)))
+(check (f-dynamic) 'compiled)
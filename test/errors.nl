@@ -0,0 +1,40 @@
+# Each line runs on its own, after loading core.nl, and must fail with
+# the error that follows it in test/errors.out
+(setq a 'a)(map a '(1))
+(setq a 'a)(a 1)
+(setq a 'a)(defq f () (a 1))(f)
+(map (make-vector 1) '(1))
+(defq f () ((make-table) 2))(f)
+(vector-ref (make-vector 2) 2)
+(vector-ref (make-vector 2) -1)
+(vector-set (make-vector 2) 5 'x)
+(vector-ref '(1 2) 0)
+(list->vector '(1 . 2))
+(pmap '((X) (make-table)) '(1 2))
+(pmap '((X) (if (= X 1) (vector-ref (make-vector 0) 0) (> X 900) (vector-set (make-vector 0) 0 0) X)) (seq->list (seq-range 0 1000)))
+(pfilter 'nosuchfunction '(1 2))
+(pmap head 5)
+(flush 42)
+(port-buffer 42 10)
+(port-buffer 'a)
+(setq *Out 42)(print 1)
+(setq *Out 42)(write-bytes 'a)
+(setq *Out 'a)(write 1)
+(setq *Out 42)(setq *In 7)(setq *Err 9)(head)
+(read 42)
+(open-input 'no/such/file)
+(for-each-datum '((X) X) 'no/such/file)
+(read (open-input 'test/unclosed.txt))
+(for-each-datum '((X) X) 'test/unclosed.txt)
+(list 1 (2
+(length (seq-range 0 3))
+(seq->list '#seq((nosuchsource 1)))
+(seq->list '#seq((vector 1 2 3)))
+(ints-length '#ints(1 a))
+(table-count '#table(1))
+(print '#nosuch(1 2))
+(write '#seq(1))
+(seq 5)
+# Lists read in shared mode cannot be changed
+(set-head (read-shared (open-input 'test/share.txt)) 'x)
+(set-tail (tail (read-shared (open-input 'test/share.txt))) ())
@@ -0,0 +1,37 @@
+# Stores of young values into old pairs, vectors, tables and symbols,
+# with plenty of allocation in between. test/run.sh runs every test
+# with NL_GC_VERIFY set as well, which checks each such store was seen
+(load 'test/check.nl)
+(defq iota (N Acc) (if (= N 0) Acc (iota (- N 1) (pair N Acc))))
+(defq churn (N) (while (> N 0) (list N N N) (setq N (- N 1))))
+(setq P (list 1 2 3))
+(setq V (make-vector 3))
+(setq T (make-table))
+(gc)
+(set-head P (list 'a 'b))
+(set-tail (tail P) (list 'c 'd))
+(vector-set V 0 (list 'e))
+(vector-set V 2 (list->vector (list 'f)))
+(table-put T (list 'k) (list 'v))
+(table-put T 'ints (list->ints '(1 2 3)))
+(setq G (list 'g))
+(churn 5000)
+(check P '((a b) 2 c d))
+(check (vector->list V) '((e) () #(f)))
+(check (table-get T '(k)) '(v))
+(check (ints->list (table-get T 'ints)) '(1 2 3))
+(check G '(g))
+# Lists built by linking each new pair onto the last
+(setq L (iota 20000 ()))
+(setq M (map '((X) (+ X 1)) L))
+(check (length (filter '((X) (> X 10001)) M)) 10000)
+(check (fold + 0 M) 200030000)
+(check (length (list 1 (list 2 3) (iota 100 ()) 4)) 4)
+# Bindings which shadow old values with young ones
+(defq nest (N) (let ((X (list N))) (if (= N 0) X (pair (head X) (nest (- N 1))))))
+(check (nest 5) '(5 4 3 2 1 0))
+(check (length (nest 2000)) 2001)
+(gc)
+(churn 5000)
+(check P '((a b) 2 c d))
+(check (length (gc-stats)) 3)
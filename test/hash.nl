@@ -0,0 +1,36 @@
+# hash agrees with =: values which are = hash the same, however they
+# were made, and hashes are non-negative integers
+(load 'test/check.nl)
+(defq same (A B) (list (= A B) (= (hash A) (hash B))))
+(defq hashes? (Items) (fold '((Ok X) (and Ok (integer? (hash X)) (>= (hash X) 0))) 't Items))
+(check (same 0 0) '(t t))
+(check (same -1 (- 0 1)) '(t t))
+(check (same 4611686018427387903 (+ 4611686018427387902 1)) '(t t))
+(check (same 'abc (head '(abc))) '(t t))
+(check (same () (tail '(1))) '(t t))
+(check (same '(1 2 3) (list 1 2 (+ 1 2))) '(t t))
+(check (same '(1 (2 (3 . 4)) a) (list 1 (list 2 (pair 3 4)) 'a)) '(t t))
+(check (same (list->vector '(1 (2) b)) (list->vector (list 1 (list 2) 'b))) '(t t))
+(check (same (list->vector ()) (make-vector 0)) '(t t))
+(check (same (list->ints '(5 -6 7)) (list->ints (list 5 (- 0 6) 7))) '(t t))
+(check (same (list (list->vector '(1)) (list->ints '(2))) (list (list->vector '(1)) (list->ints '(2)))) '(t t))
+(check (hashes? (list 0 -5 'a () '(1 . 2) (list->vector '(1)) (list->ints '(1)) (make-table) (seq '(1)))) 't)
+# Values which are not = hash apart, for these at least
+(check (same '(1 2) '(2 1)) '(() ()))
+(check (same '(1 2) (list->vector '(1 2))) '(() ()))
+(check (same (list->vector '(1 2)) (list->ints '(1 2))) '(() ()))
+(check (same '(1 2) '(1 . 2)) '(() ()))
+(check (same '((1) 2) '(1 (2))) '(() ()))
+(check (same 'a 'b) '(() ()))
+# Tables and sequences are = only to themselves, and hash by identity
+(setq T (make-table))
+(check (same T T) '(t t))
+(setq S (seq '(1 2)))
+(check (same S S) '(t t))
+# Long and deep lists, each made twice
+(defq long (N) (let ((L ())) (while (> N 0) (setq L (pair N L) N (- N 1))) L))
+(defq deep (N) (let ((L ())) (while (> N 0) (setq L (list L N) N (- N 1))) L))
+(check (same (long 10000) (long 10000)) '(t t))
+(check (same (deep 1000) (deep 1000)) '(t t))
+(check (same (long 10000) (long 9999)) '(() ()))
+(check (same (deep 1000) (deep 999)) '(() ()))
@@ -0,0 +1,42 @@
+# Int array kernels against the same sums done on lists, at every length
+# up to a few times the widest vector, so each tail is covered;
+# test/run.sh runs this under each NL_INTS_KERNELS set
+(load 'test/check.nl)
+(defq zip (F A B)
+  (if (nil? A) () (pair (F (head A) (head B)) (zip F (tail A) (tail B)))))
+(defq prefix (L Acc)
+  (if (nil? L) () (pair (+ Acc (head L)) (prefix (tail L) (+ Acc (head L))))))
+(defq bool (X) (if X 1 0))
+(defq sum (L) (fold + 0 L))
+(defq least (L) (fold '((X Acc) (if (< X Acc) X Acc)) (head L) L))
+(defq most (L) (fold '((X Acc) (if (> X Acc) X Acc)) (head L) L))
+(defq numbers (N Seed)
+  (seq->list (seq-map '((I) (- (* (+ I Seed) 7919) (* 1000 (/ (* (+ I Seed) 7919) 1000)) 500))
+                      (seq-range 0 N))))
+(defq test-length (N)
+  (let ((A (numbers N 1))
+        (B (numbers N 2)))
+    (let ((IA (list->ints A))
+          (IB (list->ints B)))
+      (check (ints->list (ints-add IA IB)) (zip + A B))
+      (check (ints->list (ints-sub IA IB)) (zip - A B))
+      (check (ints->list (ints-mul IA IB)) (zip * A B))
+      (check (ints->list (ints-add IA 3)) (map '((X) (+ X 3)) A))
+      (check (ints->list (ints-mul IA -2)) (map '((X) (* X -2)) A))
+      (check (ints->list (ints= IA IB)) (zip '((X Y) (bool (= X Y))) A B))
+      (check (ints->list (ints< IA IB)) (zip '((X Y) (bool (< X Y))) A B))
+      (check (ints->list (ints> IA 0)) (map '((X) (bool (> X 0))) A))
+      (check (ints-sum IA) (sum A))
+      (check (ints-dot IA IB) (sum (zip * A B)))
+      (check (ints->list (ints-prefix-sum IA)) (prefix A 0))
+      (if A (progn (check (ints-min IA) (least A))
+                   (check (ints-max IA) (most A)))))))
+(for-each test-length (seq->list (seq-range 0 40)))
+(test-length 1000)
+# Equal items give 1 for ints=, and the extremes sit at either end
+(check (ints->list (ints= (list->ints '(5 5 5 5 5)) 5)) '(1 1 1 1 1))
+(check (ints-min (list->ints '(-9 1 2 3 4 5 6 7 8))) -9)
+(check (ints-max (list->ints '(1 2 3 4 5 6 7 8 9))) 9)
+# An int array is written as #ints(...), which reads back as one
+(check (ints->list '#ints(4 -5 6)) '(4 -5 6))
+(check (ints-length '#ints()) 0)
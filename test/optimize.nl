@@ -0,0 +1,57 @@
+# Inlined calls and folded natives give what the calls would once what
+# they call is bound to something else
+(load 'test/check.nl)
+(defq h (X) (+ X 1))
+(defq g (Y) (h Y))
+(check (g 1) 2)
+(defq h (X) (* X 100))
+(check (g 1) 100)
+(check (let ((h '((X) (- 0 X)))) (g 1)) -1)
+(check (g 1) 100)
+(defq dyn () 5)
+(defq usez () (dyn))
+(check (usez) 5)
+(defq dyn () 7)
+(check (usez) 7)
+# Called enough times to run compiled
+(defq loop (N) (let ((I 0) (S 0)) (while (< I N) (setq S (+ S (g I))) (setq I (+ I 1))) S))
+(check (loop 10) 4500)
+(defq h (X) X)
+(check (loop 10) 45)
+# A helper inlined into one inlined in turn, rebound in a way that can
+# see the parameter of the one it was inlined into
+(defq square (X) (* X X))
+(defq step (N) (+ N (- (square 3) 8)))
+(defq steps (K) (let ((N 0) (Ns ())) (while (> K 0) (setq N (step N) Ns (pair N Ns) K (- K 1))) Ns))
+(check (steps 3) '(3 2 1))
+(defq square (X) (+ N 2))
+(check (steps 3) '(-42 -18 -6))
+(defq folded () (+ 1 (* 2 3) (if (< 1 2) 10 20)))
+(check (folded) 17)
+(setq Plus +)
+(setq Times *)
+(setq Less <)
+(setq + -)
+(check (folded) -15)
+(setq * Plus)
+(check (folded) -14)
+(setq < >)
+(check (folded) -24)
+(setq + Plus)
+(setq * Times)
+(setq < Less)
+(check (folded) 17)
+# A guard's head is the native itself, so binding guard changes nothing
+(defq day () (* 60 60 24))
+(defq guard (A B C D) 'oops)
+(check (day) 86400)
+(setq guard 5)
+(check (day) 86400)
+(check (g 4) 4)
+# The same lambdas give the same with the optimizer off
+(defq inlined (A B) (list (g A) (usez) (folded) (+ A (* B 2) (- 10 3))))
+(setq Optimized (inlined 4 5))
+(optimize nil)
+(defq inlined (A B) (list (g A) (usez) (folded) (+ A (* B 2) (- 10 3))))
+(check (inlined 4 5) Optimized)
+(check Optimized '(4 7 17 21))
@@ -0,0 +1,19 @@
+# Parallel builtins give their results in the order of the items, however
+# the chunks were shared out among the workers
+(load 'test/check.nl)
+(defq sq (X) (* X X))
+(setq L (seq->list (seq-range 0 1000)))
+(check (pmap sq L) (map sq L))
+(check (pmap sq (list->vector L)) (list->vector (map sq L)))
+(check (pfilter '((X) (< X 10)) L) '(0 1 2 3 4 5 6 7 8 9))
+(check (pfilter '((X) (> X 994)) (list->vector L)) (list->vector '(995 996 997 998 999)))
+(check (pmap sq ()) ())
+(check (pmap sq '(3)) '(9))
+(check (pmap '((X) (list X (list->vector (list X)))) '(1 2)) (list (list 1 (list->vector '(1))) (list 2 (list->vector '(2)))))
+(check (pmap '((X) (list->ints (list X X))) '(4)) (list (list->ints '(4 4))))
+# A worker changes only its own copy of the heap
+(setq Count 0)
+(setq V (make-vector 1 0))
+(pfor-each '((X) (setq Count (+ Count 1)) (vector-set V 0 X)) L)
+(check Count 0)
+(check (vector-ref V 0) 0)
@@ -0,0 +1,12 @@
+# Ports: only the ports themselves are accepted where one is expected,
+# and a library which cannot be opened binds nothing
+(load 'test/check.nl)
+(check (flush) 't)
+(check (flush *Err) 't)
+(check (port-buffer *Err) 0)
+(check (port-buffer *Out 128) 128)
+(check (port-buffer *Out) 128)
+(check (load-native 'no-such-library.so (nl_add . plus)) ())
+(check plus ())
+(check (load-native 'core.o (nl_add . plus)) 't)
+(check (plus 1 2) 3)
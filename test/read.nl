@@ -0,0 +1,32 @@
+# Input ports: read gives each datum unevaluated, then the end value
+# for as long as it is asked; for-each-datum reads the rest
+(load 'test/check.nl)
+(setq P (open-input 'test/read.txt))
+(check (read P) '(a b (c . d)))
+(check (read P) 42)
+(check (read P 'end) 'sym)
+(check (vector->list (read P)) '(1 2))
+(check (read P) ())
+(check (read P 'end) 'end)
+(check (read P 'end) 'end)
+(check (close-input P) 't)
+# A port passed to for-each-datum is left where reading stopped
+(setq P (open-input 'test/read.txt))
+(read P)
+(setq Seen ())
+(for-each-datum '((X) (setq Seen (pair X Seen))) P)
+(check (length Seen) 3)
+(check (head (tail Seen)) 'sym)
+(check (head (tail (tail Seen))) 42)
+(check (read P 'end) 'end)
+(close-input P)
+(setq Count 0)
+(for-each-datum '((X) (setq Count (+ Count 1))) 'test/read.txt)
+(check Count 4)
+# An empty file has nothing in it but its end
+(setq P (open-input '/dev/null))
+(check (read P 'end) 'end)
+(close-input P)
+(check (for-each-datum '((X) X) '/dev/null) ())
+(check (seq->list (seq (open-input 'test/read.txt))) (seq->list (seq (open-input 'test/read.txt))))
+(check (length (seq->list (seq (open-input 'test/read.txt)))) 4)
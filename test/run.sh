@@ -0,0 +1,87 @@
+#!/bin/sh
+# Run the tests under test/ on each interpreter given, from the top of
+# the repository: ./build.sh test builds both cell layouts and runs this
+failed=0
+fail() {
+  echo "FAIL $*"
+  failed=1
+}
+for nl in "$@"; do
+  # A test passes if it runs to the end of its input printing nothing,
+  # again with the collector checking its write barrier, and again with
+  # the optimizer off, which must not change what anything gives
+  for test in test/*.nl; do
+    case "$test" in test/check.nl|test/errors.nl|test/compiled.nl) continue ;; esac
+    for mode in "" NL_GC_VERIFY=on --no-optimize; do
+      case "$mode" in
+        --*) "$nl" $mode < "$test" > bin/test.out 2>&1 ;;
+        *) env $mode "$nl" < "$test" > bin/test.out 2>&1 ;;
+      esac
+      if [ $? != 0 ] || [ -s bin/test.out ]; then
+        fail "$mode $nl $test"
+        cat bin/test.out
+      fi
+    done
+  done
+  # Every set of int array kernels gives what the others do
+  for kernels in avx2 sse4.2 scalar; do
+    if ! env NL_INTS_KERNELS=$kernels "$nl" < test/ints.nl > bin/test.out 2>&1 || [ -s bin/test.out ]; then
+      fail "NL_INTS_KERNELS=$kernels $nl test/ints.nl"
+      cat bin/test.out
+    fi
+  done
+  # Each line of test/errors.nl is a program of its own, which fails
+  # with the error test/errors.out gives after it
+  grep -v -e '^#' -e '^$' test/errors.nl | while IFS= read -r line; do
+    echo "$line"
+    printf "(load 'src/core.nl)\n%s\n" "$line" | "$nl" 2>&1 && echo "exit 0" || echo "exit $?"
+  done > bin/test-errors.out
+  diff -u test/errors.out bin/test-errors.out || fail "$nl test/errors.nl"
+  # Lambdas compiled by bin/nlc give what they give interpreted, and
+  # again once what they call is bound to something else. The library
+  # is built for the cell layout the interpreter's name says it has
+  case "$nl" in *tagged*) layout=--tagged ;; *) layout= ;; esac
+  then="(write (results))(defq square (X) (+ X 100))(setq + -)(write (results))"
+  if bin/nlc $layout -o bin/test-compiled-native test/compiled.nl; then
+    printf "(load 'src/core.nl)(load 'test/compiled.nl)%s" "$then" | "$nl" > bin/test-interpreted.out 2>&1
+    printf "(load 'src/core.nl)(load 'bin/test-compiled-native.nl)(write (integer? results))%s" "$then" \
+      | "$nl" > bin/test.out 2>&1
+    [ "$(cat bin/test.out)" = "t$(cat bin/test-interpreted.out)" ] \
+      || fail "$nl nlc: $(cat bin/test.out), not t$(cat bin/test-interpreted.out)"
+    # Without its library, the loader falls back on the forms themselves
+    sed 's/test-compiled-native\.so/no-such-native.so/' bin/test-compiled-native.nl > bin/test-fallback.nl
+    printf "(load 'src/core.nl)(load 'bin/test-fallback.nl)(write (integer? results))%s" "$then" \
+      | "$nl" > bin/test.out 2>&1
+    [ "$(cat bin/test.out)" = "nil$(cat bin/test-interpreted.out)" ] \
+      || fail "$nl nlc fallback: $(cat bin/test.out), not nil$(cat bin/test-interpreted.out)"
+  else
+    fail "$nl nlc: test/compiled.nl did not compile"
+  fi
+  # An image is refused if it is truncated, or its counts or offsets
+  # point outside it
+  printf "(load 'src/core.nl)(setq V (list->vector '(1 (a))))(setq S (seq-map head (seq '((1) (2)))))(defq sq2 (X) (* X X))(defq nine () (sq2 3))(dump-image 'bin/test.img)" | "$nl"
+  printf "(write V)(write (seq->list S))(write (nine))(defq sq2 (X) X)(write (nine))" | "$nl" --image bin/test.img > bin/test.out 2>&1
+  [ "$(cat bin/test.out)" = "#(1 (a))(1 2)93" ] || fail "$nl image: $(cat bin/test.out)"
+  cell_size=$(od -An -t u8 -j 16 -N 8 bin/test.img | tr -d ' ')
+  npairs=$(od -An -t u8 -j 24 -N 8 bin/test.img | tr -d ' ')
+  # The count of pairs, and the name of the first symbol
+  for corrupt in "head -c 100" "head -c -1" "poke 24" "poke $((64 + 2 * npairs * cell_size))"; do
+    case "$corrupt" in
+      poke*) cp bin/test.img bin/test-bad.img
+             printf '\377\377\377\377\377\377\377\177' \
+               | dd of=bin/test-bad.img bs=1 seek="${corrupt#poke }" conv=notrunc 2>/dev/null ;;
+      *) $corrupt bin/test.img > bin/test-bad.img ;;
+    esac
+    "$nl" --image bin/test-bad.img < /dev/null > bin/test.out 2>&1
+    [ $? = 1 ] && grep -q "ERROR image: corrupt image" bin/test.out || fail "$nl image after $corrupt"
+  done
+done
+# hash gives the same in every run and in either cell layout
+for nl in "$@"; do
+  printf "(load 'src/core.nl)(write (map hash (list 0 -7 'abc () '(1 (2 . 3) x) (list->vector '(1 a)) (list->ints '(4 -5)))))" \
+    | "$nl" > bin/test-hash.out 2>&1
+  [ -z "$hashes" ] && hashes=$(cat bin/test-hash.out)
+  [ "$(cat bin/test-hash.out)" = "$hashes" ] || fail "$nl hash: $(cat bin/test-hash.out), not $hashes"
+done
+[ "$failed" = 0 ] && echo "all tests passed"
+exit "$failed"
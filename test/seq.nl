@@ -0,0 +1,40 @@
+# Sequences: stages fuse, so each item goes through all of them before
+# the next is pulled, and a sequence is a type of its own
+(load 'test/check.nl)
+(defq sq (X) (* X X))
+(defq odd (X) (not (= X (* 2 (/ X 2)))))
+(check (seq->list (seq-range 0 5)) '(0 1 2 3 4))
+(check (seq->list (seq-range 5 0 -2)) '(5 3 1))
+(check (seq->list (seq-take 3 (seq-range 0 ()))) '(0 1 2))
+(check (seq->list (seq-drop 2 (seq '(a b c d)))) '(c d))
+(check (seq->list (seq-map sq (seq (list->vector '(1 2 3))))) '(1 4 9))
+(check (seq->list (seq (list->ints '(4 5)))) '(4 5))
+(check (seq->list (seq-unfold 1 '((X) (< X 100)) '((X) (* X 3)))) '(1 3 9 27 81))
+(check (fold + 0 (seq-map sq (seq-filter odd (seq-range 0 10)))) 165)
+(check (seq->list (seq-take 0 (seq-range 0 ()))) ())
+# Fused: the map sees only what the filter lets through, one at a time,
+# and nothing past the last item taken is pulled
+(setq Seen ())
+(defq note (X) (progn (setq Seen (pair X Seen)) X))
+(check (seq->list (seq-take 2 (seq-map note (seq-filter odd (seq-range 0 ()))))) '(1 3))
+(check Seen '(3 1))
+(setq Seen ())
+(for-each '((X) (setq Seen (pair (list 'use X) Seen)))
+          (seq-map note (seq-range 0 2)))
+(check Seen '((use 1) 1 (use 0) 0))
+# Adding a stage leaves the sequence it was added to as it was
+(setq S (seq-range 0 3))
+(setq T (seq-map sq S))
+(check (seq->list S) '(0 1 2))
+(check (seq->list T) '(0 1 4))
+(check (seq->list T) '(0 1 4))
+# A type of its own, equal only to itself, which reads back as written
+(check (seq? S) 't)
+(check (seq? '(1)) ())
+(check (pair? S) ())
+(check (= S S) 't)
+(check (= S (seq-range 0 3)) ())
+(check (seq? '#seq((range 0 3 1))) 't)
+(check (seq->list '#seq((range 0 3 1) (map . sq))) '(0 1 4))
+(check (seq->list (seq S)) '(0 1 2))
+(check (map seq->list (pmap '((N) (seq-take N (seq-range 0 ()))) '(1 2))) '((0) (0 1)))
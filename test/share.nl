@@ -0,0 +1,23 @@
+# Lists read in shared mode read as plain ones do, and are the same
+# lists wherever they repeat, so set-head and set-tail refuse them
+# (test/errors.nl), but not other lists, even equal ones
+(load 'test/check.nl)
+(setq P (open-input 'test/share.txt))
+(setq A (read-shared P))
+(setq B (read-shared P))
+(check (read-shared P 'end) 'end)
+(close-input P)
+(check A '(record 1 (tags x y)))
+(check B '(record 2 (tags x y)))
+(check (= (tail (tail A)) (tail (tail B))) 't)
+(setq P (open-input 'test/share.txt))
+(setq C (read P))
+(close-input P)
+(set-head (head (tail (tail C))) 'labels)
+(set-tail (tail C) ())
+(check C '(record 1))
+(check A '(record 1 (tags x y)))
+(setq D (list 'tags 'x 'y))
+(set-head D 'labels)
+(check D '(labels x y))
+(check B '(record 2 (tags x y)))
@@ -0,0 +1,56 @@
+# Tables: keys are found by =, so equal lists, vectors and int arrays
+# made separately find the same entry
+(load 'test/check.nl)
+(setq T (make-table))
+(check (table-count T) 0)
+(check (table-get T 'a) ())
+(check (table-get T 'a 'none) 'none)
+(check (table-put T 'a 1) 1)
+(check (table-get T 'a) 1)
+(check (table-put T 'a 2) 2)
+(check (table-get T 'a) 2)
+(check (table-count T) 1)
+(table-put T 5 'five)
+(check (table-get T 5) 'five)
+(check (table-get T 6) ())
+(table-put T (list 1 (list 2 3)) 'list)
+(check (table-get T '(1 (2 3))) 'list)
+(check (table-get T '(1 (2 4))) ())
+(table-put T (list->vector '(x y)) 'vector)
+(check (table-get T (list->vector '(x y))) 'vector)
+(check (table-get T '(x y)) ())
+(table-put T (list->ints '(1 2 3)) 'ints)
+(check (table-get T (list->ints '(1 2 3))) 'ints)
+(check (table-get T (list->vector '(1 2 3))) ())
+(check (table-count T) 5)
+(check (table-remove T '(1 (2 3))) 't)
+(check (table-remove T '(1 (2 3))) ())
+(check (table-get T '(1 (2 3))) ())
+(check (table-count T) 4)
+# A table is a key by identity
+(setq K (make-table))
+(table-put T K 'table)
+(check (table-get T K) 'table)
+(check (table-get T (make-table)) ())
+# An alist fills a new table, and table->list gives the pairs back
+(setq A (make-table '((a . 1) (b . 2))))
+(check (table-count A) 2)
+(check (table-get A 'b) 2)
+(check (fold '((P Acc) (+ (tail P) Acc)) 0 (table->list A)) 3)
+(setq Sum 0)
+(table-for-each '((K V) (setq Sum (+ Sum V))) A)
+(check Sum 3)
+# Many keys, removed again, leave the others in place
+(setq B (make-table))
+(fold '((X Acc) (table-put B (list X) X)) () (seq-range 0 1000))
+(check (table-count B) 1000)
+(fold '((X Acc) (table-remove B (list X))) () (seq-range 0 1000 2))
+(check (table-count B) 500)
+(check (table-get B '(1)) 1)
+(check (table-get B '(998)) ())
+(check (table-get B '(999)) 999)
+# A table is written as #table and its entries, which reads back as one
+(setq C '#table((a . 1) ((b) . 2)))
+(check (table-count C) 2)
+(check (table-get C '(b)) 2)
+(check (table-count '#table()) 0)
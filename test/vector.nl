@@ -0,0 +1,32 @@
+# Vectors: making, indexing, converting, and the higher-order builtins
+# which accept them
+(load 'test/check.nl)
+(setq V (make-vector 3 'x))
+(check (vector-length V) 3)
+(check (vector-ref V 2) 'x)
+(check (vector-length (make-vector 0)) 0)
+(check (vector-ref (make-vector 2) 1) ())
+(check (vector-set V 1 'b) 'b)
+(check (vector-ref V 1) 'b)
+(check (vector->list V) '(x b x))
+(check (list->vector '(1 (2) 3)) (list->vector '(1 (2) 3)))
+(check (vector->list (list->vector ())) ())
+(check (vector? V) 't)
+(check (vector? '(1)) ())
+# Vectors are equal item by item, and ordered by their length first
+(check (= (list->vector '(1 2)) (list->vector '(1 2))) 't)
+(check (= (list->vector '(1 2)) (list->vector '(1 3))) ())
+(check (< (list->vector '(9)) (list->vector '(1 1))) 't)
+# Filtering keeps the order, and gives a new vector
+(setq W (list->vector '(1 2 3 4 5 6)))
+(check (vector->list (filter '((X) (> X 3)) W)) '(4 5 6))
+(check (vector->list (filter '((X) (= X (* 2 (/ X 2)))) W)) '(2 4 6))
+(check (vector-length (filter '((X) ()) W)) 0)
+(check (vector->list W) '(1 2 3 4 5 6))
+(check (vector->list (map '((X) (* X X)) (list->vector '(1 2 3)))) '(1 4 9))
+(check (fold + 0 W) 21)
+# A vector made while others are young still holds what was stored in it
+(setq Old (make-vector 1))
+(vector-set Old 0 (list 1 2))
+(fold '((X Acc) (pair X Acc)) () (make-vector 1000 'y))
+(check (vector-ref Old 0) '(1 2))
@@ -0,0 +1,25 @@
+# Calls between compiled lambdas, with the optimizer off so that none of
+# them is inlined away
+(load 'test/check.nl)
+(optimize nil)
+(defq f (X) X)
+(defq g () (f 1 2 3))
+(check (g) 1)
+(defq none () 'none)
+(defq g0 () (none 1 2))
+(check (g0) 'none)
+(defq f2 (X Y) (list X Y))
+(defq missing () (f2 1))
+(check (missing) '(1 ()))
+(defq nested (N) (pair (f (+ N 1) (f 2) 3) (f2 N (f N 7) 8)))
+(check (nested 1) '(2 1 1))
+(defq quoted Args Args)
+(defq g1 () (quoted 1 (+ 1 1)))
+(check (g1) '(1 (+ 1 1)))
+# Tail calls, to itself and to others, with extra arguments
+(defq count (N Acc) (if (= N 0) Acc (count (- N 1) (+ Acc 1) 'extra)))
+(check (count 100000 0) 100000)
+(defq tail1 (N) (f N 'extra 'more))
+(check (tail1 5) 5)
+(defq deep (N) (if (= N 0) 'done (progn (f 1 2 3) (deep (- N 1) 'x))))
+(check (deep 1000) 'done)